@@ -1,12 +1,44 @@
 #include "fullmetal-3d.h"
+#include "fullmetal-config.h"
 #include "fullmetal.h"
+#include "fullmetal-platform.h"
 #include <fstream>
 #include <cassert>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+
+#ifdef FM_SSE
+#include <xmmintrin.h>
+#endif
 
 fm::PolyFace::Indexes::Indexes() : vertexIndex(-1), normalIndex(-1), texCoordIndex(-1) { }
 
 fm::PolyFace::PolyFace() : indices() { }
 
+fm::ObjModel::ObjModel() : buffer(nullptr), compact(nullptr) { }
+
+fm::ObjModel::~ObjModel()
+{
+	delete buffer;
+	delete compact;
+}
+
+size_t fm::ObjModel::triangleCount() const
+{
+	if (compact != nullptr)
+		return compact->indexCount() / 3;
+
+	if (buffer != nullptr)
+		return buffer->indices.size() / 3;
+
+	return polyFaces.size();
+}
+
 fm::ObjModel * fm::ObjModelLoader::load(std::string fp)
 {
 	// try to open stream, if bad - assert out
@@ -17,7 +49,6 @@ fm::ObjModel * fm::ObjModelLoader::load(std::string fp)
 	// create a model, begin the readLine procedure to parse it
 	ObjModel* model = new ObjModel();
 	model->filepath = fp;
-	model->switchedUvs = false;
 
 	std::string data;
 	while (std::getline(stream, data))
@@ -110,12 +141,1792 @@ fm::ObjModel* fm::loadObjModel(std::string filepath)
 	return model;
 }
 
-void fm::switchModelUvs(ObjModel * model)
+// COMPACT MESH IMPLEMENTATION
+fm::CompactMesh::CompactMesh() : boundsMin(), boundsSize() { }
+
+size_t fm::CompactMesh::indexCount() const
+{
+	return indices16.empty() ? indices32.size() : indices16.size();
+}
+
+unsigned int fm::CompactMesh::index(size_t i) const
+{
+	return indices16.empty() ? indices32[i] : indices16[i];
+}
+
+void fm::CompactMesh::decodeVertex(unsigned int index, MeshVertex & vertex) const
+{
+	const CompactVertex& compact = vertices[index];
+
+	for (int axis = 0; axis < 3; ++axis)
+		vertex.position[axis] = boundsMin[axis] + (compact.position[axis] / 65535.0f) * boundsSize[axis];
+
+	decodeOctahedral(compact.normal[0] / 32767.0f, compact.normal[1] / 32767.0f, vertex.normal);
+
+	vertex.uv[0] = halfToFloat(compact.uv[0]);
+	vertex.uv[1] = halfToFloat(compact.uv[1]);
+}
+
+size_t fm::CompactMesh::memorySize() const
+{
+	return vertices.size() * sizeof(CompactVertex) 
+		+ indices16.size() * sizeof(unsigned short) 
+		+ indices32.size() * sizeof(unsigned int);
+}
+
+fm::CompactError::CompactError() : position(0.0f), normalDegrees(0.0f), uv(0.0f) { }
+
+// Hashes & compares mesh vertices by their bits, used for welding
+struct MeshVertexHash {
+	size_t operator()(const fm::MeshVertex& vertex) const {
+		return (size_t)fm::hashBytes(&vertex, sizeof(fm::MeshVertex));
+	}
+};
+
+struct MeshVertexEqual {
+	bool operator()(const fm::MeshVertex& a, const fm::MeshVertex& b) const {
+		return memcmp(&a, &b, sizeof(fm::MeshVertex)) == 0;
+	}
+};
+
+void fm::weldObjModel(ObjModel * model, MeshBuffer & buffer)
+{
+	size_t cornerCount = model->polyFaces.size() * 3;
+
+	std::unordered_map<MeshVertex, unsigned int, MeshVertexHash, MeshVertexEqual> welded;
+	welded.reserve(cornerCount);
+
+	buffer.vertices.clear();
+	buffer.indices.clear();
+	buffer.indices.reserve(cornerCount);
+
+	for (auto& face : model->polyFaces) {
+		for (auto& index : face.indices) {
+			// indexes in obj models start at 1, not 0, so remove 1
+			Vector3& position = model->vertices[index.vertexIndex - 1];
+			Vector3& normal = model->vertexNormals[index.normalIndex - 1];
+			Vector3& texCoord = model->textureCoords[index.texCoordIndex - 1];
+
+			// zero the padding-free struct first, so equal values hash the same
+			MeshVertex vertex;
+			memset(&vertex, 0, sizeof(vertex));
+			vertex.position[0] = position.x; vertex.position[1] = position.y; vertex.position[2] = position.z;
+			vertex.normal[0] = normal.x; vertex.normal[1] = normal.y; vertex.normal[2] = normal.z;
+			vertex.uv[0] = texCoord.x; vertex.uv[1] = texCoord.y;
+
+			auto found = welded.find(vertex);
+			if (found != welded.end()) {
+				buffer.indices.push_back(found->second);
+				continue;
+			}
+
+			unsigned int newIndex = (unsigned int)buffer.vertices.size();
+			buffer.vertices.push_back(vertex);
+			welded[vertex] = newIndex;
+			buffer.indices.push_back(newIndex);
+		}
+	}
+}
+
+// Forsyth vertex score, from the position in the cache & the triangles left using it
+static float vertexCacheScore(int cachePosition, unsigned int liveTriangles, int cacheSize)
+{
+	// no triangles left, never pick it
+	if (liveTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		// the last triangle's vertices get a fixed score so we don't favour them too much
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+	}
+
+	// boost vertices with few triangles left, so we finish them off
+	return score + 2.0f * powf((float)liveTriangles, -0.5f);
+}
+
+void fm::optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+	const int cacheSize = 32;
+	size_t faceCount = indices.size() / 3;
+	if (faceCount == 0) return;
+
+	// build the vertex -> triangle adjacency as one flat array
+	std::vector<unsigned int> liveTriangles(vertexCount, 0);
+	for (auto index : indices)
+		++liveTriangles[index];
+
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] = offsets[v] + liveTriangles[v];
+
+	std::vector<unsigned int> adjacency(indices.size());
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t f = 0; f < faceCount; ++f) {
+		for (int k = 0; k < 3; ++k)
+			adjacency[fill[indices[f * 3 + k]]++] = (unsigned int)f;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertexScore[v] = vertexCacheScore(-1, liveTriangles[v], cacheSize);
+
+	std::vector<char> emitted(faceCount, 0);
+	std::vector<unsigned int> result;
+	result.reserve(indices.size());
+
+	unsigned int cache[cacheSize + 3];
+	int cacheCount = 0;
+	size_t cursor = 0;
+	long long best = 0;
+
+	while (result.size() < indices.size()) {
+		// nothing in the cache has triangles left, take the next one in input order
+		if (best < 0) {
+			while (cursor < faceCount && emitted[cursor])
+				++cursor;
+			if (cursor == faceCount)
+				break;
+			best = (long long)cursor;
+		}
+
+		const unsigned int* triangle = &indices[(size_t)best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+		emitted[(size_t)best] = 1;
+
+		// the new cache is the triangle, followed by the old cache without it
+		unsigned int newCache[cacheSize + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; ++k)
+			newCache[newCount++] = triangle[k];
+
+		for (int i = 0; i < cacheCount; ++i) {
+			unsigned int v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				newCache[newCount++] = v;
+		}
+
+		// remove the triangle from the live lists of its vertices
+		for (int k = 0; k < 3; ++k) {
+			unsigned int v = triangle[k];
+			unsigned int* list = &adjacency[offsets[v]];
+			unsigned int count = liveTriangles[v];
+
+			for (unsigned int i = 0; i < count; ++i) {
+				if (list[i] == (unsigned int)best) {
+					list[i] = list[count - 1];
+					break;
+				}
+			}
+			--liveTriangles[v];
+		}
+
+		// update the vertex scores, anything past the cache size was evicted
+		for (int i = 0; i < newCount; ++i) {
+			unsigned int v = newCache[i];
+			cachePosition[v] = i < cacheSize ? i : -1;
+			vertexScore[v] = vertexCacheScore(cachePosition[v], liveTriangles[v], cacheSize);
+		}
+
+		cacheCount = newCount < cacheSize ? newCount : cacheSize;
+		memcpy(cache, newCache, cacheCount * sizeof(unsigned int));
+
+		// rescore the triangles touching the cache, the best one goes next
+		best = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < newCount; ++i) {
+			unsigned int v = newCache[i];
+			const unsigned int* list = &adjacency[offsets[v]];
+
+			for (unsigned int t = 0; t < liveTriangles[v]; ++t) {
+				unsigned int f = list[t];
+				float score = vertexScore[indices[f * 3]] + vertexScore[indices[f * 3 + 1]] + vertexScore[indices[f * 3 + 2]];
+
+				if (score > bestScore) {
+					bestScore = score;
+					best = f;
+				}
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+void fm::optimizeVertexFetch(MeshBuffer & buffer)
+{
+	const unsigned int unused = 0xffffffff;
+	std::vector<unsigned int> remap(buffer.vertices.size(), unused);
+	std::vector<MeshVertex> vertices;
+	vertices.reserve(buffer.vertices.size());
+
+	// give each vertex a new index the first time it's used
+	for (auto& index : buffer.indices) {
+		if (remap[index] == unused) {
+			remap[index] = (unsigned int)vertices.size();
+			vertices.push_back(buffer.vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	buffer.vertices.swap(vertices);
+}
+
+float fm::computeAcmr(const std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize)
+{
+	if (indices.size() < 3)
+		return 0.0f;
+
+	// a vertex is in the FIFO if fewer than cacheSize misses happened since it was added
+	// (addedAt is the miss that added it, 0 if it never was)
+	std::vector<unsigned int> addedAt(vertexCount, 0);
+	unsigned int misses = 0;
+
+	for (auto index : indices) {
+		if (addedAt[index] == 0 || misses - addedAt[index] >= (unsigned int)cacheSize) {
+			++misses;
+			addedAt[index] = misses;
+		}
+	}
+
+	return (float)misses / (indices.size() / 3);
+}
+
+fm::MeshProcessReport fm::processObjModel(ObjModel * model)
+{
+	assert(model != nullptr);
+	MeshProcessReport report;
+
+	// already processed, nothing to do
+	if (model->buffer != nullptr || model->compact != nullptr)
+		return report;
+
+	Timer timer;
+	MeshBuffer* buffer = new MeshBuffer();
+
+	weldObjModel(model, *buffer);
+	report.cornerCount = model->polyFaces.size() * 3;
+	report.vertexCount = buffer->vertices.size();
+	report.acmrBefore = computeAcmr(buffer->indices, buffer->vertices.size());
+
+	optimizeVertexCache(buffer->indices, buffer->vertices.size());
+	optimizeVertexFetch(*buffer);
+	report.acmrAfter = computeAcmr(buffer->indices, buffer->vertices.size());
+
+	if (!buffer->vertices.empty())
+		model->bounds = computeBounds(buffer->vertices[0].position, buffer->vertices.size(), sizeof(MeshVertex));
+
+	// release the obj data, swap with empty vectors so the memory is freed
+	model->buffer = buffer;
+	std::vector<Vector3>().swap(model->vertices);
+	std::vector<Vector3>().swap(model->vertexNormals);
+	std::vector<Vector3>().swap(model->textureCoords);
+	std::vector<PolyFace>().swap(model->polyFaces);
+
+	report.milliseconds = timer.elapsedMs();
+	return report;
+}
+
+fm::MeshProcessReport::MeshProcessReport() 
+	: cornerCount(0), vertexCount(0), acmrBefore(0.0f), acmrAfter(0.0f), milliseconds(0.0) { }
+
+// LOD IMPLEMENTATION
+fm::MeshLod::MeshLod() : ratio(1.0f), error(0.0f), indices() { }
+
+int fm::ObjModel::selectLod(float maxError) const
+{
+	// the errors only grow along the chain, so take the last one that's good enough
+	for (int i = (int)lods.size() - 1; i >= 0; --i) {
+		if (lods[i].error <= maxError)
+			return i;
+	}
+
+	return -1;
+}
+
+// Hashes & compares positions by their bits, used to find the vertices split by seams
+struct PositionKey {
+	float position[3];
+
+	bool operator==(const PositionKey& other) const {
+		return memcmp(position, other.position, sizeof(position)) == 0;
+	}
+};
+
+struct PositionKeyHash {
+	size_t operator()(const PositionKey& key) const {
+		return (size_t)fm::hashBytes(key.position, sizeof(key.position));
+	}
+};
+
+// The sum of the squared distances to a set of planes (Garland & Heckbert), weighted by triangle area
+struct Quadric {
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, weight;
+};
+
+static void addPlaneQuadric(Quadric& q, double a, double b, double c, double d, double weight)
+{
+	q.a2 += weight * a * a; q.ab += weight * a * b; q.ac += weight * a * c; q.ad += weight * a * d;
+	q.b2 += weight * b * b; q.bc += weight * b * c; q.bd += weight * b * d;
+	q.c2 += weight * c * c; q.cd += weight * c * d;
+	q.d2 += weight * d * d;
+	q.weight += weight;
+}
+
+static void addQuadric(Quadric& q, const Quadric& other)
+{
+	q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+	q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+	q.c2 += other.c2; q.cd += other.cd;
+	q.d2 += other.d2;
+	q.weight += other.weight;
+}
+
+static double evaluateQuadric(const Quadric& q, const float* position)
+{
+	double x = position[0], y = position[1], z = position[2];
+
+	// (x, y, z, 1) * Q * (x, y, z, 1)
+	return q.a2 * x * x + q.b2 * y * y + q.c2 * z * z
+		+ 2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z)
+		+ 2.0 * (q.ad * x + q.bd * y + q.cd * z) + q.d2;
+}
+
+static void triangleNormal(const float* p0, const float* p1, const float* p2, double* normal)
+{
+	double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// Checks if moving 'from' onto 'to' would turn any of the triangles around 'from' over (or too far).
+// 'remap' holds the collapses already made in this pass, so their effect is included
+static bool collapseFlipsTriangle(const std::vector<fm::MeshVertex>& vertices, const std::vector<unsigned int>& indices,
+	const std::vector<unsigned int>& remap, const unsigned int* triangles, unsigned int triangleCount, 
+	unsigned int from, unsigned int to)
+{
+	for (unsigned int t = 0; t < triangleCount; ++t) {
+		const unsigned int* triangle = &indices[triangles[t] * 3];
+		unsigned int current[3] = { remap[triangle[0]], remap[triangle[1]], remap[triangle[2]] };
+
+		// triangles using both vertices disappear with the collapse, as do ones that already have
+		if (current[0] == to || current[1] == to || current[2] == to)
+			continue;
+		if (current[0] == current[1] || current[1] == current[2] || current[0] == current[2])
+			continue;
+
+		const float* before[3];
+		const float* after[3];
+		for (int k = 0; k < 3; ++k) {
+			before[k] = vertices[current[k]].position;
+			after[k] = current[k] == from ? vertices[to].position : before[k];
+		}
+
+		double normalBefore[3], normalAfter[3];
+		triangleNormal(before[0], before[1], before[2], normalBefore);
+		triangleNormal(after[0], after[1], after[2], normalAfter);
+
+		// rotating a triangle by more than ~75 degrees also counts, that's how slivers form
+		double dot = normalBefore[0] * normalAfter[0] + normalBefore[1] * normalAfter[1] + normalBefore[2] * normalAfter[2];
+		double lengths = sqrt(normalBefore[0] * normalBefore[0] + normalBefore[1] * normalBefore[1] + normalBefore[2] * normalBefore[2])
+			* sqrt(normalAfter[0] * normalAfter[0] + normalAfter[1] * normalAfter[1] + normalAfter[2] * normalAfter[2]);
+		if (dot <= 0.25 * lengths)
+			return true;
+	}
+
+	return false;
+}
+
+// An edge collapse that moves one vertex onto another
+struct EdgeCollapse {
+	double cost;
+	float error;
+	unsigned int from;
+	unsigned int to;
+};
+
+// Cheapest first, ties broken by the vertices so the order never depends on the sort
+static bool sortEdgeCollapse(const EdgeCollapse& a, const EdgeCollapse& b)
+{
+	if (a.cost != b.cost) return a.cost < b.cost;
+	if (a.from != b.from) return a.from < b.from;
+	return a.to < b.to;
+}
+
+float fm::simplifyMesh(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices,
+	size_t targetIndexCount, std::vector<unsigned int>& result)
+{
+	size_t vertexCount = vertices.size();
+	result = indices;
+
+	if (result.size() <= targetIndexCount)
+		return 0.0f;
+
+	// vertices with the same position are the same point split by a uv or normal seam
+	std::vector<unsigned int> positionIds(vertexCount);
+	std::vector<unsigned int> wedgeCounts;
+	{
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash> positions;
+		positions.reserve(vertexCount);
+
+		for (size_t v = 0; v < vertexCount; ++v) {
+			PositionKey key;
+			memcpy(key.position, vertices[v].position, sizeof(key.position));
+
+			auto found = positions.find(key);
+			if (found == positions.end()) {
+				found = positions.insert(std::make_pair(key, (unsigned int)wedgeCounts.size())).first;
+				wedgeCounts.push_back(0);
+			}
+
+			positionIds[v] = found->second;
+			++wedgeCounts[found->second];
+		}
+	}
+
+	size_t positionCount = wedgeCounts.size();
+	std::vector<char> lockedPositions(positionCount, 0);
+
+	for (size_t p = 0; p < positionCount; ++p) {
+		if (wedgeCounts[p] > 1)
+			lockedPositions[p] = 1;
+	}
+
+	// an edge that isn't used exactly once in each direction is on an open border (or isn't manifold)
+	std::unordered_map<unsigned long long, unsigned int> edgeCounts;
+	edgeCounts.reserve(result.size());
+
+	for (size_t i = 0; i < result.size(); i += 3) {
+		for (int k = 0; k < 3; ++k) {
+			unsigned long long a = positionIds[result[i + k]], b = positionIds[result[i + (k + 1) % 3]];
+			++edgeCounts[(a << 32) | b];
+		}
+	}
+
+	for (size_t i = 0; i < result.size(); i += 3) {
+		for (int k = 0; k < 3; ++k) {
+			unsigned long long a = positionIds[result[i + k]], b = positionIds[result[i + (k + 1) % 3]];
+			auto reverse = edgeCounts.find((b << 32) | a);
+
+			if (edgeCounts[(a << 32) | b] != 1 || reverse == edgeCounts.end() || reverse->second != 1) {
+				lockedPositions[(size_t)a] = 1;
+				lockedPositions[(size_t)b] = 1;
+			}
+		}
+	}
+
+	// every position starts with the planes of the triangles around it
+	std::vector<Quadric> quadrics(positionCount, Quadric());
+	for (size_t i = 0; i < result.size(); i += 3) {
+		const float* p0 = vertices[result[i]].position;
+		const float* p1 = vertices[result[i + 1]].position;
+		const float* p2 = vertices[result[i + 2]].position;
+
+		double normal[3];
+		triangleNormal(p0, p1, p2, normal);
+		double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length <= 0.0)
+			continue;
+
+		for (int axis = 0; axis < 3; ++axis)
+			normal[axis] /= length;
+
+		double d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+		for (int k = 0; k < 3; ++k)
+			addPlaneQuadric(quadrics[positionIds[result[i + k]]], normal[0], normal[1], normal[2], d, length * 0.5);
+	}
+
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<char> collapseLocked(vertexCount);
+	std::vector<unsigned int> offsets(vertexCount + 1);
+	std::vector<unsigned int> adjacency;
+	std::vector<EdgeCollapse> collapses;
+	float maxError = 0.0f;
+
+	// each pass collapses the cheapest edges it can without touching the same vertex twice
+	while (result.size() > targetIndexCount) {
+		size_t triangleCount = result.size() / 3;
+
+		// vertex -> triangle adjacency of the current triangles
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (auto index : result)
+			++offsets[index + 1];
+		for (size_t v = 0; v < vertexCount; ++v)
+			offsets[v + 1] += offsets[v];
+
+		adjacency.resize(result.size());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t) {
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[result[t * 3 + k]]++] = (unsigned int)t;
+		}
+
+		// find the cost of moving each end of each edge onto the other
+		collapses.clear();
+		for (size_t t = 0; t < triangleCount; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				unsigned int ends[2] = { result[t * 3 + k], result[t * 3 + (k + 1) % 3] };
+
+				for (int e = 0; e < 2; ++e) {
+					unsigned int from = ends[e], to = ends[1 - e];
+					if (lockedPositions[positionIds[from]])
+						continue;
+
+					Quadric quadric = quadrics[positionIds[from]];
+					addQuadric(quadric, quadrics[positionIds[to]]);
+
+					double cost = evaluateQuadric(quadric, vertices[to].position);
+					if (cost < 0.0) cost = 0.0;
+
+					EdgeCollapse collapse;
+					collapse.cost = cost;
+					collapse.error = quadric.weight > 0.0 ? (float)sqrt(cost / quadric.weight) : 0.0f;
+					collapse.from = from;
+					collapse.to = to;
+					collapses.push_back(collapse);
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), sortEdgeCollapse);
+
+		for (size_t v = 0; v < vertexCount; ++v) {
+			remap[v] = (unsigned int)v;
+			collapseLocked[v] = 0;
+		}
+
+		size_t trianglesToRemove = triangleCount - targetIndexCount / 3;
+		size_t trianglesRemoved = 0;
+		size_t performed = 0;
+
+		for (auto& collapse : collapses) {
+			if (trianglesRemoved >= trianglesToRemove)
+				break;
+
+			if (collapseLocked[collapse.from] || collapseLocked[collapse.to])
+				continue;
+
+			if (collapseFlipsTriangle(vertices, result, remap, &adjacency[offsets[collapse.from]],
+				offsets[collapse.from + 1] - offsets[collapse.from], collapse.from, collapse.to))
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			collapseLocked[collapse.from] = 1;
+			collapseLocked[collapse.to] = 1;
+
+			// the triangles on the edge disappear
+			for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1]; ++a) {
+				const unsigned int* triangle = &result[adjacency[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					++trianglesRemoved;
+			}
+
+			addQuadric(quadrics[positionIds[collapse.to]], quadrics[positionIds[collapse.from]]);
+			maxError = fmaxf(maxError, collapse.error);
+			++performed;
+		}
+
+		// nothing left that can be collapsed
+		if (performed == 0)
+			break;
+
+		// move the collapsed vertices & drop the triangles that became degenerate
+		size_t written = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+
+			result[written++] = a;
+			result[written++] = b;
+			result[written++] = c;
+		}
+
+		result.resize(written);
+	}
+
+	return maxError;
+}
+
+// Gets the full precision vertices & indices of a model, decoding them into 'decoded' if it's compact
+static const fm::MeshBuffer* fullPrecisionBuffer(fm::ObjModel* model, fm::MeshBuffer& decoded)
+{
+	if (model->buffer == nullptr && model->compact == nullptr)
+		fm::processObjModel(model);
+
+	if (model->buffer != nullptr)
+		return model->buffer;
+
+	fm::CompactMesh* compact = model->compact;
+	decoded.vertices.resize(compact->vertices.size());
+	for (size_t i = 0; i < compact->vertices.size(); ++i)
+		compact->decodeVertex((unsigned int)i, decoded.vertices[i]);
+
+	decoded.indices.resize(compact->indexCount());
+	for (size_t i = 0; i < compact->indexCount(); ++i)
+		decoded.indices[i] = compact->index(i);
+
+	return &decoded;
+}
+
+void fm::generateLods(ObjModel * model, const std::vector<float>& ratios)
+{
+	assert(model != nullptr);
+
+	// the simplifier works on full precision vertices
+	MeshBuffer decoded;
+	const MeshBuffer* buffer = fullPrecisionBuffer(model, decoded);
+
+	// most detailed first, so each level can be simplified from the last
+	std::vector<float> sorted(ratios);
+	std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+
+	model->lods.clear();
+	size_t triangleCount = buffer->indices.size() / 3;
+	float error = 0.0f;
+
+	for (float ratio : sorted) {
+		if (ratio >= 1.0f || ratio <= 0.0f)
+			continue;
+
+		const std::vector<unsigned int>& source = model->lods.empty() ? buffer->indices : model->lods.back().indices;
+
+		MeshLod lod;
+		lod.ratio = ratio;
+
+		// the errors add up, since each level only measures against the last
+		error += simplifyMesh(buffer->vertices, source, (size_t)(triangleCount * ratio) * 3, lod.indices);
+		lod.error = error;
+
+		optimizeVertexCache(lod.indices, buffer->vertices.size());
+		model->lods.push_back(std::move(lod));
+	}
+}
+
+void fm::generateLods(const std::vector<ObjModel*>& models, const std::vector<float>& ratios)
+{
+	// every model is simplified on its own, so they can all run at once
+	parallelFor(models.size(), [&](size_t i) {
+		generateLods(models[i], ratios);
+	});
+}
+
+// BOUNDS IMPLEMENTATION
+fm::MeshBounds::MeshBounds() : boxMin(), boxMax(), center(), radius(0.0f) { }
+
+// Gets the position at 'index' of a strided array
+static inline const float* positionAt(const float* positions, size_t stride, size_t index)
+{
+	return reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(positions) + index * stride);
+}
+
+// Splits very large arrays into blocks for the worker threads, small ones are one block
+static size_t boundsBlockCount(size_t count)
+{
+	const size_t blockSize = 65536;
+	if (count < blockSize * 4)
+		return 1;
+
+	return (count + blockSize - 1) / blockSize;
+}
+
+// Min & max of the positions in [begin, end)
+static void boxRange(const float* positions, size_t stride, size_t count, size_t begin, size_t end, 
+	float* boxMin, float* boxMax)
+{
+	for (int axis = 0; axis < 3; ++axis) {
+		boxMin[axis] = FLT_MAX;
+		boxMax[axis] = -FLT_MAX;
+	}
+
+	size_t i = begin;
+
+#ifdef FM_SSE
+	// each load takes a position plus the float after it (ignored), so the
+	// last position of the array is left to the scalar loop to not read past the end
+	size_t simdEnd = end < count ? end : count - 1;
+	if (i < simdEnd) {
+		__m128 minimum = _mm_loadu_ps(positionAt(positions, stride, i));
+		__m128 maximum = minimum;
+
+		for (; i < simdEnd; ++i) {
+			__m128 position = _mm_loadu_ps(positionAt(positions, stride, i));
+			minimum = _mm_min_ps(minimum, position);
+			maximum = _mm_max_ps(maximum, position);
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, minimum);
+		memcpy(boxMin, lanes, sizeof(float) * 3);
+		_mm_storeu_ps(lanes, maximum);
+		memcpy(boxMax, lanes, sizeof(float) * 3);
+	}
+#endif
+
+	for (; i < end; ++i) {
+		const float* position = positionAt(positions, stride, i);
+		for (int axis = 0; axis < 3; ++axis) {
+			boxMin[axis] = fminf(boxMin[axis], position[axis]);
+			boxMax[axis] = fmaxf(boxMax[axis], position[axis]);
+		}
+	}
+}
+
+// The largest squared distance from 'center' to the positions in [begin, end)
+static float maxDistanceRange(const float* positions, size_t stride, size_t count, size_t begin, size_t end,
+	const float* center)
+{
+	float result = 0.0f;
+	if (count == 0)
+		return result;
+
+	size_t i = begin;
+
+#ifdef FM_SSE
+	// four positions at a time, transposed so each register holds one axis
+	size_t simdEnd = end < count ? end : count - 1;
+	__m128 centerX = _mm_set1_ps(center[0]);
+	__m128 centerY = _mm_set1_ps(center[1]);
+	__m128 centerZ = _mm_set1_ps(center[2]);
+	__m128 maximum = _mm_setzero_ps();
+
+	for (; i + 4 <= simdEnd; i += 4) {
+		__m128 x = _mm_loadu_ps(positionAt(positions, stride, i));
+		__m128 y = _mm_loadu_ps(positionAt(positions, stride, i + 1));
+		__m128 z = _mm_loadu_ps(positionAt(positions, stride, i + 2));
+		__m128 w = _mm_loadu_ps(positionAt(positions, stride, i + 3));
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128 dx = _mm_sub_ps(x, centerX);
+		__m128 dy = _mm_sub_ps(y, centerY);
+		__m128 dz = _mm_sub_ps(z, centerZ);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		maximum = _mm_max_ps(maximum, distance);
+	}
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, maximum);
+	result = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#endif
+
+	for (; i < end; ++i) {
+		const float* position = positionAt(positions, stride, i);
+		float dx = position[0] - center[0], dy = position[1] - center[1], dz = position[2] - center[2];
+		result = fmaxf(result, dx * dx + dy * dy + dz * dz);
+	}
+
+	return result;
+}
+
+// The largest distance from 'center' to any of the positions, across the worker threads for large arrays
+static float maxDistance(const float* positions, size_t stride, size_t count, const float* center)
 {
-	model->switchedUvs = !model->switchedUvs;
+	size_t blockCount = boundsBlockCount(count);
+	size_t blockSize = (count + blockCount - 1) / blockCount;
+	std::vector<float> results(blockCount, 0.0f);
+
+	fm::parallelFor(blockCount, [&](size_t block) {
+		size_t begin = block * blockSize;
+		size_t end = begin + blockSize < count ? begin + blockSize : count;
+		results[block] = maxDistanceRange(positions, stride, count, begin, end, center);
+	});
+
+	float result = 0.0f;
+	for (auto value : results)
+		result = fmaxf(result, value);
+
+	return sqrtf(result);
+}
+
+fm::MeshBounds fm::computeBounds(const float * positions, size_t count, size_t stride)
+{
+	MeshBounds bounds;
+	if (count == 0)
+		return bounds;
+
+	// the box, each block is reduced on its own then the blocks are combined
+	size_t blockCount = boundsBlockCount(count);
+	size_t blockSize = (count + blockCount - 1) / blockCount;
+	std::vector<float> blockMin(blockCount * 3), blockMax(blockCount * 3);
+
+	parallelFor(blockCount, [&](size_t block) {
+		size_t begin = block * blockSize;
+		size_t end = begin + blockSize < count ? begin + blockSize : count;
+		boxRange(positions, stride, count, begin, end, &blockMin[block * 3], &blockMax[block * 3]);
+	});
+
+	for (int axis = 0; axis < 3; ++axis) {
+		bounds.boxMin[axis] = blockMin[axis];
+		bounds.boxMax[axis] = blockMax[axis];
+	}
+
+	for (size_t block = 1; block < blockCount; ++block) {
+		for (int axis = 0; axis < 3; ++axis) {
+			bounds.boxMin[axis] = fminf(bounds.boxMin[axis], blockMin[block * 3 + axis]);
+			bounds.boxMax[axis] = fmaxf(bounds.boxMax[axis], blockMax[block * 3 + axis]);
+		}
+	}
+
+	// the sphere around the box centre
+	float boxCenter[3];
+	for (int axis = 0; axis < 3; ++axis)
+		boxCenter[axis] = (bounds.boxMin[axis] + bounds.boxMax[axis]) * 0.5f;
+	float boxRadius = maxDistance(positions, stride, count, boxCenter);
+
+	// Ritter's sphere starts from the points at each end of the longest side of the box..
+	int longest = 0;
+	for (int axis = 1; axis < 3; ++axis) {
+		if (bounds.boxMax[axis] - bounds.boxMin[axis] > bounds.boxMax[longest] - bounds.boxMin[longest])
+			longest = axis;
+	}
+
+	const float* low = positions;
+	const float* high = positions;
+	for (size_t i = 0; i < count; ++i) {
+		const float* position = positionAt(positions, stride, i);
+		if (position[longest] == bounds.boxMin[longest]) low = position;
+		if (position[longest] == bounds.boxMax[longest]) high = position;
+	}
+
+	float ritterCenter[3];
+	for (int axis = 0; axis < 3; ++axis)
+		ritterCenter[axis] = (low[axis] + high[axis]) * 0.5f;
+
+	float dx = high[0] - low[0], dy = high[1] - low[1], dz = high[2] - low[2];
+	float ritterRadius = sqrtf(dx * dx + dy * dy + dz * dz) * 0.5f;
+
+	// ..and grows to take in every point outside of it
+	for (size_t i = 0; i < count; ++i) {
+		const float* position = positionAt(positions, stride, i);
+		float offset[3] = { position[0] - ritterCenter[0], position[1] - ritterCenter[1], position[2] - ritterCenter[2] };
+		float distance = sqrtf(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+
+		if (distance > ritterRadius) {
+			float newRadius = (ritterRadius + distance) * 0.5f;
+			for (int axis = 0; axis < 3; ++axis)
+				ritterCenter[axis] += offset[axis] * (newRadius - ritterRadius) / distance;
+			ritterRadius = newRadius;
+		}
+	}
+
+	// growing is done in float, so measure the real radius around the centre it found
+	ritterRadius = maxDistance(positions, stride, count, ritterCenter);
+
+	const float* center = ritterRadius < boxRadius ? ritterCenter : boxCenter;
+	memcpy(bounds.center, center, sizeof(bounds.center));
+	bounds.radius = ritterRadius < boxRadius ? ritterRadius : boxRadius;
+
+	return bounds;
+}
+
+// STREAMING OBJ IMPLEMENTATION
+fm::ObjStreamOptions::ObjStreamOptions() : windowBytes(4 << 20), memoryBudget(64 << 20) { }
+
+fm::ObjStreamReport::ObjStreamReport() : bytesRead(0), vertexCount(0), indexCount(0), bounds(), 
+	peakMemory(0), longLine(0), milliseconds(0.0), megabytesPerSecond(0.0) { }
+
+// Appends to a file through a fixed size buffer
+class BufferedFileWriter {
+private:
+	std::ofstream _stream;
+	std::vector<char> _buffer;
+	size_t _used;
+
+public:
+	BufferedFileWriter(const std::string& fp, size_t bufferSize) 
+		: _stream(fp.c_str(), std::ios::binary | std::ios::trunc), _buffer(bufferSize), _used(0) { }
+
+	bool good() {
+		return _stream.good();
+	}
+
+	void write(const void* data, size_t size) {
+		if (_used + size > _buffer.size())
+			flush();
+
+		memcpy(&_buffer[_used], data, size);
+		_used += size;
+	}
+
+	void flush() {
+		_stream.write(_buffer.data(), _used);
+		_stream.flush();
+		_used = 0;
+	}
+
+	size_t memory() {
+		return _buffer.size();
+	}
+};
+
+// Positions, normals or uvs kept on disk while streaming, read back through a few cached pages
+class AttributeFile {
+public:
+	static const size_t PAGE_ATTRIBUTES = 4096;
+	static const size_t PAGE_BYTES = PAGE_ATTRIBUTES * sizeof(float) * 3;
+
+private:
+	struct Page {
+		size_t page;
+		unsigned long long lastUsed;
+		std::vector<float> values;
+	};
+
+	std::string _path;
+	std::ofstream _output;
+	std::ifstream _input;
+	std::vector<float> _tail;
+	std::vector<Page> _pages;
+	size_t _maxPages;
+	size_t _count;
+	unsigned long long _clock;
+
+public:
+	AttributeFile(const std::string& path, size_t maxPages) 
+		: _path(path), _output(path.c_str(), std::ios::binary | std::ios::trunc), _maxPages(maxPages), _count(0), _clock(0) {
+		_tail.reserve(PAGE_ATTRIBUTES * 3);
+	}
+
+	~AttributeFile() {
+		_output.close();
+		_input.close();
+		std::remove(_path.c_str());
+	}
+
+	size_t count() {
+		return _count;
+	}
+
+	void append(float x, float y, float z) {
+		_tail.push_back(x);
+		_tail.push_back(y);
+		_tail.push_back(z);
+		++_count;
+
+		// whole pages go to disk, the page being filled stays in memory
+		if (_tail.size() == PAGE_ATTRIBUTES * 3) {
+			_output.write(reinterpret_cast<const char*>(_tail.data()), PAGE_BYTES);
+			_output.flush();
+			_tail.clear();
+		}
+	}
+
+	// Gets the attribute at 'index', which starts at 0
+	const float* get(size_t index) {
+		assert(index < _count);
+		size_t page = index / PAGE_ATTRIBUTES;
+		size_t offset = (index % PAGE_ATTRIBUTES) * 3;
+
+		if (page == _count / PAGE_ATTRIBUTES)
+			return &_tail[offset];
+
+		++_clock;
+		for (auto& cached : _pages) {
+			if (cached.page == page) {
+				cached.lastUsed = _clock;
+				return &cached.values[offset];
+			}
+		}
+
+		// not cached, load it over the least recently used page
+		Page* target = nullptr;
+		if (_pages.size() < _maxPages) {
+			_pages.push_back(Page());
+			target = &_pages.back();
+			target->values.resize(PAGE_ATTRIBUTES * 3);
+		}
+		else {
+			target = &_pages[0];
+			for (auto& cached : _pages) {
+				if (cached.lastUsed < target->lastUsed)
+					target = &cached;
+			}
+		}
+
+		if (!_input.is_open())
+			_input.open(_path.c_str(), std::ios::binary);
+
+		_input.clear();
+		_input.seekg((std::streamoff)(page * PAGE_BYTES));
+		_input.read(reinterpret_cast<char*>(target->values.data()), PAGE_BYTES);
+
+		target->page = page;
+		target->lastUsed = _clock;
+		return &target->values[offset];
+	}
+
+	size_t memory() {
+		return (_tail.capacity() + _pages.size() * PAGE_ATTRIBUTES * 3) * sizeof(float);
+	}
+};
+
+// An entry of the streaming weld table, position is 0 (obj indexes start at 1) when empty
+struct WeldEntry {
+	int position;
+	int texCoord;
+	int normal;
+	unsigned int index;
+};
+
+// Turns an obj index (1 based, or negative & relative to the end) into a 0 based one
+static size_t resolveObjIndex(int index, size_t count)
+{
+	size_t resolved = index < 0 ? count + index : (size_t)(index - 1);
+	assert(resolved < count);
+	return resolved;
+}
+
+bool fm::ObjModelLoader::stream(const std::string & fp, const std::string & outputPrefix, 
+	const ObjStreamOptions & options, ObjStreamReport & report)
+{
+	Timer timer;
+	report = ObjStreamReport();
+
+	std::ifstream input(fp.c_str(), std::ios::binary);
+	if (!input.good())
+		return false;
+
+	// what's left after the window & write buffers goes half to the pages and half to the weld table
+	const size_t writeBufferBytes = 1 << 20;
+	assert(options.memoryBudget > options.windowBytes + writeBufferBytes * 2);
+	size_t remaining = options.memoryBudget - options.windowBytes - writeBufferBytes * 2;
+
+	size_t pagesPerFile = remaining / 2 / 3 / AttributeFile::PAGE_BYTES;
+	if (pagesPerFile < 1)
+		pagesPerFile = 1;
+
+	// a power of two so the hash can be masked, cleared when half full
+	size_t weldCapacity = 16;
+	while (weldCapacity * 2 * sizeof(WeldEntry) <= remaining / 2)
+		weldCapacity *= 2;
+
+	AttributeFile positions(outputPrefix + ".v", pagesPerFile);
+	AttributeFile normals(outputPrefix + ".vn", pagesPerFile);
+	AttributeFile texCoords(outputPrefix + ".vt", pagesPerFile);
+	BufferedFileWriter vertexWriter(outputPrefix + ".vertices", writeBufferBytes);
+	BufferedFileWriter indexWriter(outputPrefix + ".indices", writeBufferBytes);
+
+	if (!vertexWriter.good() || !indexWriter.good())
+		return false;
+
+	std::vector<WeldEntry> weld(weldCapacity);
+	size_t weldCount = 0;
+
+	// the box & a Ritter sphere are grown as vertices are written
+	MeshBounds& bounds = report.bounds;
+	float ritterCenter[3] = { 0.0f, 0.0f, 0.0f };
+	float ritterRadius = 0.0f;
+
+	std::vector<char> window(options.windowBytes);
+	std::string line;
+	size_t carried = 0;
+	unsigned long long lineNumber = 0;
+
+	while (true) {
+		input.read(window.data() + carried, window.size() - carried);
+		size_t read = (size_t)input.gcount();
+		size_t filled = carried + read;
+		bool finished = !input;
+		report.bytesRead += read;
+
+		size_t start = 0;
+		while (start < filled) {
+			const char* end = static_cast<const char*>(memchr(&window[start], '\n', filled - start));
+
+			// a partial line, wait for the rest of it unless the file ended
+			if (end == nullptr && !finished)
+				break;
+
+			size_t length = end != nullptr ? end - &window[start] : filled - start;
+			line.assign(&window[start], length);
+			start += length + 1;
+			++lineNumber;
+
+			if (line.size() < 3)
+				continue;
+
+			switch (getParam(line)) {
+				case OBJ_PARAM::VERTEX: {
+					float x, y, z;
+					int matches = sscanf_s(line.data(), "v %f %f %f", &x, &y, &z);
+					assert(matches == 3);
+					positions.append(x, y, z);
+				}
+				break;
+
+				case OBJ_PARAM::VERTEX_NORMAL: {
+					float x, y, z;
+					int matches = sscanf_s(line.data(), "vn %f %f %f", &x, &y, &z);
+					assert(matches == 3);
+					normals.append(x, y, z);
+				}
+				break;
+
+				case OBJ_PARAM::TEX_COORD: {
+					float x, y;
+					int matches = sscanf_s(line.data(), "vt %f %f", &x, &y);
+					assert(matches == 2);
+					texCoords.append(x, y, 0.0f);
+				}
+				break;
+
+				case OBJ_PARAM::POLY_FACE: {
+					int corners[3][3];
+					int matches = sscanf_s(line.data(), "f %d/%d/%d %d/%d/%d %d/%d/%d",
+						&corners[0][0], &corners[0][1], &corners[0][2],
+						&corners[1][0], &corners[1][1], &corners[1][2],
+						&corners[2][0], &corners[2][1], &corners[2][2]);
+					assert(matches == 9);
+
+					for (auto& corner : corners) {
+						// store the resolved (1 based) indexes, so relative & absolute ones weld together
+						WeldEntry key;
+						key.position = (int)resolveObjIndex(corner[0], positions.count()) + 1;
+						key.texCoord = (int)resolveObjIndex(corner[1], texCoords.count()) + 1;
+						key.normal = (int)resolveObjIndex(corner[2], normals.count()) + 1;
+
+						size_t mask = weldCapacity - 1;
+						size_t slot = (size_t)hashBytes(&key, sizeof(int) * 3) & mask;
+						while (weld[slot].position != 0 && (weld[slot].position != key.position
+							|| weld[slot].texCoord != key.texCoord || weld[slot].normal != key.normal))
+							slot = (slot + 1) & mask;
+
+						if (weld[slot].position == 0) {
+							// the table is full, forget what was welded so far
+							if (weldCount >= weldCapacity / 2) {
+								memset(weld.data(), 0, weld.size() * sizeof(WeldEntry));
+								weldCount = 0;
+								slot = (size_t)hashBytes(&key, sizeof(int) * 3) & mask;
+							}
+
+							MeshVertex vertex;
+							memcpy(vertex.position, positions.get(key.position - 1), sizeof(vertex.position));
+							memcpy(vertex.normal, normals.get(key.normal - 1), sizeof(vertex.normal));
+							memcpy(vertex.uv, texCoords.get(key.texCoord - 1), sizeof(vertex.uv));
+							vertexWriter.write(&vertex, sizeof(vertex));
+
+							key.index = (unsigned int)report.vertexCount++;
+							weld[slot] = key;
+							++weldCount;
+
+							// grow the bounds
+							for (int axis = 0; axis < 3; ++axis) {
+								bool first = report.vertexCount == 1;
+								bounds.boxMin[axis] = first ? vertex.position[axis] : fminf(bounds.boxMin[axis], vertex.position[axis]);
+								bounds.boxMax[axis] = first ? vertex.position[axis] : fmaxf(bounds.boxMax[axis], vertex.position[axis]);
+							}
+
+							if (report.vertexCount == 1)
+								memcpy(ritterCenter, vertex.position, sizeof(ritterCenter));
+
+							float offset[3] = { vertex.position[0] - ritterCenter[0], vertex.position[1] - ritterCenter[1], 
+								vertex.position[2] - ritterCenter[2] };
+							float distance = sqrtf(offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+							if (distance > ritterRadius) {
+								float newRadius = (ritterRadius + distance) * 0.5f;
+								for (int axis = 0; axis < 3; ++axis)
+									ritterCenter[axis] += offset[axis] * (newRadius - ritterRadius) / distance;
+								ritterRadius = newRadius;
+							}
+						}
+
+						indexWriter.write(&weld[slot].index, sizeof(unsigned int));
+						++report.indexCount;
+					}
+				}
+				break;
+
+				default:
+					break;
+			}
+		}
+
+		size_t memory = window.size() + line.capacity() + vertexWriter.memory() + indexWriter.memory()
+			+ positions.memory() + normals.memory() + texCoords.memory() + weld.size() * sizeof(WeldEntry);
+		if (memory > report.peakMemory)
+			report.peakMemory = memory;
+
+		if (finished)
+			break;
+
+		// move the partial line to the front, a line that fills the whole window would never end
+		carried = filled - start;
+		if (carried >= window.size()) {
+			report.longLine = lineNumber + 1;
+			return false;
+		}
+
+		memmove(window.data(), window.data() + start, carried);
+	}
+
+	vertexWriter.flush();
+	indexWriter.flush();
+
+	// the window & weld table aren't needed anymore, the read back below takes their place in the budget
+	std::vector<char>().swap(window);
+	std::vector<WeldEntry>().swap(weld);
+
+	// read the vertices back a window at a time to find the real radius around each centre
+	float boxCenter[3];
+	for (int axis = 0; axis < 3; ++axis)
+		boxCenter[axis] = (bounds.boxMin[axis] + bounds.boxMax[axis]) * 0.5f;
+
+	std::ifstream vertexInput((outputPrefix + ".vertices").c_str(), std::ios::binary);
+	std::vector<MeshVertex> vertices(options.windowBytes / sizeof(MeshVertex));
+	float boxRadius = 0.0f;
+	ritterRadius = 0.0f;
+
+	size_t memory = vertices.size() * sizeof(MeshVertex) + line.capacity() + vertexWriter.memory() + indexWriter.memory()
+		+ positions.memory() + normals.memory() + texCoords.memory();
+	if (memory > report.peakMemory)
+		report.peakMemory = memory;
+
+	while (vertexInput) {
+		vertexInput.read(reinterpret_cast<char*>(vertices.data()), vertices.size() * sizeof(MeshVertex));
+		size_t count = (size_t)vertexInput.gcount() / sizeof(MeshVertex);
+
+		// the last read finds nothing when the file ends on a window (or there are no vertices at all)
+		if (count == 0)
+			break;
+
+		boxRadius = fmaxf(boxRadius, maxDistanceRange(vertices[0].position, sizeof(MeshVertex), count, 0, count, boxCenter));
+		ritterRadius = fmaxf(ritterRadius, maxDistanceRange(vertices[0].position, sizeof(MeshVertex), count, 0, count, ritterCenter));
+	}
+
+	bool useRitter = ritterRadius < boxRadius;
+	memcpy(bounds.center, useRitter ? ritterCenter : boxCenter, sizeof(bounds.center));
+	bounds.radius = sqrtf(useRitter ? ritterRadius : boxRadius);
+
+	report.milliseconds = timer.elapsedMs();
+	if (report.milliseconds > 0.0)
+		report.megabytesPerSecond = (report.bytesRead / (1024.0 * 1024.0)) / (report.milliseconds / 1000.0);
+
+	return true;
+}
+
+// MESHLET IMPLEMENTATION
+fm::Meshlet::Meshlet() : indexOffset(0), indexCount(0), center(), radius(0.0f), coneAxis(), coneCutoff(1.0f) { }
+
+void fm::MeshletCullData::build(const std::vector<Meshlet>& meshlets)
+{
+	// padding never gets culled, the results for it are ignored anyway
+	size_t padded = (meshlets.size() + 3) / 4 * 4;
+	std::vector<float>* arrays[8] = { &centerX, &centerY, &centerZ, &radius, &axisX, &axisY, &axisZ, &cutoff };
+	for (auto array : arrays)
+		array->assign(padded, 0.0f);
+
+	for (size_t i = meshlets.size(); i < padded; ++i)
+		cutoff[i] = 1.0f;
+
+	for (size_t i = 0; i < meshlets.size(); ++i) {
+		const Meshlet& meshlet = meshlets[i];
+		centerX[i] = meshlet.center[0];
+		centerY[i] = meshlet.center[1];
+		centerZ[i] = meshlet.center[2];
+		radius[i] = meshlet.radius;
+		axisX[i] = meshlet.coneAxis[0];
+		axisY[i] = meshlet.coneAxis[1];
+		axisZ[i] = meshlet.coneAxis[2];
+		cutoff[i] = meshlet.coneCutoff;
+	}
+}
+
+fm::CullCamera::CullCamera() : planes(), position() { }
+
+fm::CullCamera fm::CullCamera::fromMatrices(const float * modelView, const float * projection)
+{
+	CullCamera camera;
+
+	// clip = projection * modelView, both column major
+	float clip[16];
+	for (int column = 0; column < 4; ++column) {
+		for (int row = 0; row < 4; ++row) {
+			float sum = 0.0f;
+			for (int k = 0; k < 4; ++k)
+				sum += projection[k * 4 + row] * modelView[column * 4 + k];
+			clip[column * 4 + row] = sum;
+		}
+	}
+
+	// the planes are the last row plus or minus each of the other rows (Gribb & Hartmann)
+	for (int plane = 0; plane < 6; ++plane) {
+		int row = plane / 2;
+		float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+
+		for (int column = 0; column < 4; ++column)
+			camera.planes[plane][column] = clip[column * 4 + 3] + sign * clip[column * 4 + row];
+
+		float* p = camera.planes[plane];
+		float length = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+		if (length > 0.0f) {
+			for (int k = 0; k < 4; ++k)
+				p[k] /= length;
+		}
+	}
+
+	// the camera is where the model view maps to the eye space origin, -inverse(R) * t
+	const float* m = modelView;
+	float r[3][3] = {
+		{ m[0], m[4], m[8] },
+		{ m[1], m[5], m[9] },
+		{ m[2], m[6], m[10] }
+	};
+	float t[3] = { m[12], m[13], m[14] };
+
+	float inverse[3][3];
+	inverse[0][0] = r[1][1] * r[2][2] - r[1][2] * r[2][1];
+	inverse[0][1] = r[0][2] * r[2][1] - r[0][1] * r[2][2];
+	inverse[0][2] = r[0][1] * r[1][2] - r[0][2] * r[1][1];
+	inverse[1][0] = r[1][2] * r[2][0] - r[1][0] * r[2][2];
+	inverse[1][1] = r[0][0] * r[2][2] - r[0][2] * r[2][0];
+	inverse[1][2] = r[0][2] * r[1][0] - r[0][0] * r[1][2];
+	inverse[2][0] = r[1][0] * r[2][1] - r[1][1] * r[2][0];
+	inverse[2][1] = r[0][1] * r[2][0] - r[0][0] * r[2][1];
+	inverse[2][2] = r[0][0] * r[1][1] - r[0][1] * r[1][0];
+
+	float determinant = r[0][0] * inverse[0][0] + r[0][1] * inverse[1][0] + r[0][2] * inverse[2][0];
+	if (determinant != 0.0f) {
+		for (int row = 0; row < 3; ++row) {
+			camera.position[row] = -(inverse[row][0] * t[0] + inverse[row][1] * t[1] + inverse[row][2] * t[2]) / determinant;
+		}
+	}
+
+	return camera;
+}
+
+// Fills in the bounds of a meshlet from its triangles, 'positions' & 'normals' are scratch space reused between meshlets
+static void computeMeshletBounds(const std::vector<fm::MeshVertex>& vertices, const unsigned int* indices, fm::Meshlet& meshlet,
+	std::vector<float>& positions, std::vector<float>& normals)
+{
+	// the same sphere the whole model gets, from the corner positions
+	positions.resize(meshlet.indexCount * 3);
+	for (unsigned int i = 0; i < meshlet.indexCount; ++i)
+		memcpy(&positions[i * 3], vertices[indices[i]].position, sizeof(float) * 3);
+
+	fm::MeshBounds bounds = fm::computeBounds(positions.data(), meshlet.indexCount, sizeof(float) * 3);
+	memcpy(meshlet.center, bounds.center, sizeof(meshlet.center));
+	meshlet.radius = bounds.radius;
+
+	// the cone axis is the average of the triangle normals
+	normals.clear();
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+
+	for (unsigned int i = 0; i < meshlet.indexCount; i += 3) {
+		double normal[3];
+		triangleNormal(vertices[indices[i]].position, vertices[indices[i + 1]].position, 
+			vertices[indices[i + 2]].position, normal);
+
+		double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length <= 0.0)
+			continue;
+
+		for (int k = 0; k < 3; ++k) {
+			normals.push_back((float)(normal[k] / length));
+			axis[k] += normals.back();
+		}
+	}
+
+	float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	meshlet.coneCutoff = 1.0f;
+	if (axisLength <= 0.0f)
+		return;
+
+	for (int k = 0; k < 3; ++k)
+		meshlet.coneAxis[k] = axis[k] / axisLength;
+
+	// the widest angle between a triangle & the axis, past 90 degrees the cone can't cull anything
+	float minDot = 1.0f;
+	for (size_t i = 0; i < normals.size(); i += 3) {
+		float dot = normals[i] * meshlet.coneAxis[0] + normals[i + 1] * meshlet.coneAxis[1] + normals[i + 2] * meshlet.coneAxis[2];
+		minDot = fminf(minDot, dot);
+	}
+
+	if (minDot > 0.0f)
+		meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+void fm::buildMeshlets(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices,
+	std::vector<Meshlet>& meshlets)
+{
+	meshlets.clear();
+
+	// 'usedBy' marks the vertices already in the meshlet being built
+	std::vector<unsigned int> usedBy(vertices.size(), 0xffffffff);
+	unsigned int meshletId = 0;
+	unsigned int vertexCount = 0;
+	Meshlet meshlet;
+
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		unsigned int newVertices = 0;
+		for (int k = 0; k < 3; ++k) {
+			if (usedBy[indices[i + k]] != meshletId)
+				++newVertices;
+		}
+
+		// full, start the next one
+		if (vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.indexCount / 3 >= MESHLET_MAX_TRIANGLES) {
+			meshlets.push_back(meshlet);
+
+			meshlet = Meshlet();
+			meshlet.indexOffset = (unsigned int)i;
+			vertexCount = 0;
+			++meshletId;
+		}
+
+		for (int k = 0; k < 3; ++k) {
+			if (usedBy[indices[i + k]] != meshletId) {
+				usedBy[indices[i + k]] = meshletId;
+				++vertexCount;
+			}
+		}
+
+		meshlet.indexCount += 3;
+	}
+
+	if (meshlet.indexCount > 0)
+		meshlets.push_back(meshlet);
+
+	// the bounds of each meshlet are independent, so blocks of them are computed across the worker threads
+	const size_t blockSize = 256;
+	size_t meshletCount = meshlets.size();
+	size_t blockCount = (meshletCount + blockSize - 1) / blockSize;
+
+	parallelFor(blockCount, [&](size_t block) {
+		size_t begin = block * blockSize;
+		size_t end = begin + blockSize < meshletCount ? begin + blockSize : meshletCount;
+
+		std::vector<float> positions, normals;
+		for (size_t i = begin; i < end; ++i)
+			computeMeshletBounds(vertices, &indices[meshlets[i].indexOffset], meshlets[i], positions, normals);
+	});
+}
+
+void fm::buildMeshlets(ObjModel * model)
+{
+	assert(model != nullptr);
+
+	MeshBuffer decoded;
+	const MeshBuffer* buffer = fullPrecisionBuffer(model, decoded);
+
+	buildMeshlets(buffer->vertices, buffer->indices, model->meshlets);
+	model->meshletCullData.build(model->meshlets);
+}
+
+// Culls the meshlets in [begin, end) one at a time
+static size_t cullMeshletRange(const fm::MeshletCullData& data, size_t begin, size_t end, 
+	const fm::CullCamera& camera, unsigned char* visible)
+{
+	size_t visibleCount = 0;
+
+	for (size_t i = begin; i < end; ++i) {
+		bool culled = false;
+
+		for (int p = 0; p < 6; ++p) {
+			const float* plane = camera.planes[p];
+			float distance = plane[0] * data.centerX[i] + plane[1] * data.centerY[i] + plane[2] * data.centerZ[i] + plane[3];
+			culled = culled || distance < -data.radius[i];
+		}
+
+		float dx = data.centerX[i] - camera.position[0];
+		float dy = data.centerY[i] - camera.position[1];
+		float dz = data.centerZ[i] - camera.position[2];
+		float dot = dx * data.axisX[i] + dy * data.axisY[i] + dz * data.axisZ[i];
+		culled = culled || dot >= data.cutoff[i] * sqrtf(dx * dx + dy * dy + dz * dz) + data.radius[i];
+
+		visible[i] = culled ? 0 : 1;
+		visibleCount += visible[i];
+	}
+
+	return visibleCount;
+}
+
+#ifdef FM_SSE
+// Culls the meshlets in [begin, end) four at a time, begin must be a multiple of 4
+static size_t cullMeshletRangeSse(const fm::MeshletCullData& data, size_t begin, size_t end, 
+	const fm::CullCamera& camera, unsigned char* visible)
+{
+	size_t visibleCount = 0;
+	__m128 cameraX = _mm_set1_ps(camera.position[0]);
+	__m128 cameraY = _mm_set1_ps(camera.position[1]);
+	__m128 cameraZ = _mm_set1_ps(camera.position[2]);
+
+	for (size_t i = begin; i < end; i += 4) {
+		__m128 centerX = _mm_loadu_ps(&data.centerX[i]);
+		__m128 centerY = _mm_loadu_ps(&data.centerY[i]);
+		__m128 centerZ = _mm_loadu_ps(&data.centerZ[i]);
+		__m128 radius = _mm_loadu_ps(&data.radius[i]);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+		__m128 culled = _mm_setzero_ps();
+
+		for (int p = 0; p < 6; ++p) {
+			const float* plane = camera.planes[p];
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), centerX), _mm_mul_ps(_mm_set1_ps(plane[1]), centerY)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), centerZ), _mm_set1_ps(plane[3])));
+			culled = _mm_or_ps(culled, _mm_cmplt_ps(distance, negativeRadius));
+		}
+
+		__m128 dx = _mm_sub_ps(centerX, cameraX);
+		__m128 dy = _mm_sub_ps(centerY, cameraY);
+		__m128 dz = _mm_sub_ps(centerZ, cameraZ);
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&data.axisX[i])), 
+			_mm_mul_ps(dy, _mm_loadu_ps(&data.axisY[i]))), _mm_mul_ps(dz, _mm_loadu_ps(&data.axisZ[i])));
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&data.cutoff[i]), distance), radius);
+		culled = _mm_or_ps(culled, _mm_cmpge_ps(dot, limit));
+
+		int mask = _mm_movemask_ps(culled);
+		for (size_t k = 0; k < 4 && i + k < end; ++k) {
+			visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+			visibleCount += visible[i + k];
+		}
+	}
+
+	return visibleCount;
+}
+#endif
+
+size_t fm::cullMeshletsScalar(const MeshletCullData & data, size_t meshletCount, const CullCamera & camera, 
+	std::vector<unsigned char>& visible)
+{
+	visible.resize(meshletCount);
+	return cullMeshletRange(data, 0, meshletCount, camera, visible.data());
+}
+
+size_t fm::cullMeshlets(const MeshletCullData & data, size_t meshletCount, const CullCamera & camera,
+	std::vector<unsigned char>& visible, bool parallel)
+{
+	visible.resize(meshletCount);
+
+#ifdef FM_SSE
+	auto cullRange = cullMeshletRangeSse;
+#else
+	auto cullRange = cullMeshletRange;
+#endif
+
+	// starting threads costs more than culling a few thousand meshlets
+	const size_t blockSize = 4096;
+	if (!parallel || meshletCount <= blockSize * 2)
+		return cullRange(data, 0, meshletCount, camera, visible.data());
+
+	size_t blockCount = (meshletCount + blockSize - 1) / blockSize;
+	std::atomic<size_t> visibleCount(0);
+
+	parallelFor(blockCount, [&](size_t block) {
+		size_t begin = block * blockSize;
+		size_t end = begin + blockSize < meshletCount ? begin + blockSize : meshletCount;
+		visibleCount += cullRange(data, begin, end, camera, visible.data());
+	});
+
+	return visibleCount;
+}
+
+fm::CompactError fm::compactObjModel(ObjModel * model)
+{
+	assert(model != nullptr);
+	if (model->compact != nullptr)
+		return CompactError();
+
+	// compact the welded buffer, so we get the cache friendly order too
+	if (model->buffer == nullptr)
+		processObjModel(model);
+
+	MeshBuffer& buffer = *model->buffer;
+	CompactMesh* mesh = new CompactMesh();
+
+	// positions are stored relative to the bounds
+	for (int axis = 0; axis < 3; ++axis) {
+		mesh->boundsMin[axis] = model->bounds.boxMin[axis];
+		mesh->boundsSize[axis] = model->bounds.boxMax[axis] - model->bounds.boxMin[axis];
+	}
+
+	// quantise every vertex
+	mesh->vertices.resize(buffer.vertices.size());
+	for (size_t i = 0; i < buffer.vertices.size(); ++i) {
+		MeshVertex& vertex = buffer.vertices[i];
+		CompactVertex& compact = mesh->vertices[i];
+
+		for (int axis = 0; axis < 3; ++axis) {
+			float size = mesh->boundsSize[axis];
+			float t = size > 0.0f ? (vertex.position[axis] - mesh->boundsMin[axis]) / size : 0.0f;
+			compact.position[axis] = (unsigned short)(t * 65535.0f + 0.5f);
+		}
+
+		float octX, octY;
+		encodeOctahedral(vertex.normal, octX, octY);
+		compact.normal[0] = (short)roundf(octX * 32767.0f);
+		compact.normal[1] = (short)roundf(octY * 32767.0f);
+
+		compact.uv[0] = floatToHalf(vertex.uv[0]);
+		compact.uv[1] = floatToHalf(vertex.uv[1]);
+	}
+
+	// use the smallest index type that fits
+	if (buffer.vertices.size() <= 65536)
+		mesh->indices16.assign(buffer.indices.begin(), buffer.indices.end());
+	else
+		mesh->indices32 = buffer.indices;
+
+	CompactError error = measureCompactError(buffer, *mesh);
+
+	// the compact mesh replaces the full precision buffer
+	model->compact = mesh;
+	delete model->buffer;
+	model->buffer = nullptr;
+
+	return error;
+}
+
+fm::CompactError fm::measureCompactError(const MeshBuffer & buffer, const CompactMesh & mesh)
+{
+	CompactError error;
+
+	float largestSide = fmaxf(mesh.boundsSize[0], fmaxf(mesh.boundsSize[1], mesh.boundsSize[2]));
+	if (largestSide <= 0.0f)
+		largestSide = 1.0f;
+
+	MeshVertex decoded;
+	for (size_t i = 0; i < buffer.vertices.size(); ++i) {
+		const MeshVertex& vertex = buffer.vertices[i];
+		mesh.decodeVertex((unsigned int)i, decoded);
+
+		for (int axis = 0; axis < 3; ++axis)
+			error.position = fmaxf(error.position, fabsf(vertex.position[axis] - decoded.position[axis]) / largestSide);
+
+		// obj normals aren't always unit length
+		float length = sqrtf(vertex.normal[0] * vertex.normal[0] + vertex.normal[1] * vertex.normal[1] 
+			+ vertex.normal[2] * vertex.normal[2]);
+		if (length > 0.0f) {
+			float dot = (vertex.normal[0] * decoded.normal[0] + vertex.normal[1] * decoded.normal[1] 
+				+ vertex.normal[2] * decoded.normal[2]) / length;
+			dot = fmaxf(-1.0f, fminf(1.0f, dot));
+			error.normalDegrees = fmaxf(error.normalDegrees, acosf(dot) * 57.29578f);
+		}
+
+		error.uv = fmaxf(error.uv, fabsf(vertex.uv[0] - decoded.uv[0]));
+		error.uv = fmaxf(error.uv, fabsf(vertex.uv[1] - decoded.uv[1]));
+	}
+
+	return error;
+}
+
+unsigned short fm::floatToHalf(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	unsigned int sign = (bits >> 16) & 0x8000;
+	unsigned int rawExponent = (bits >> 23) & 0xff;
+	unsigned int mantissa = bits & 0x7fffff;
+	int exponent = (int)rawExponent - 127 + 15;
+
+	// infinity & nan
+	if (rawExponent == 0xff)
+		return (unsigned short)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+
+	// too large, becomes infinity
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7c00);
+
+	// too small for a normal half, becomes subnormal or zero
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return (unsigned short)sign;
+
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			++half;
+
+		return (unsigned short)(sign | half);
+	}
+
+	// round to nearest, a carry moves into the exponent which is still correct
+	unsigned int half = sign | ((unsigned int)exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		++half;
+
+	return (unsigned short)half;
+}
+
+float fm::halfToFloat(unsigned short half)
+{
+	unsigned int sign = (unsigned int)(half & 0x8000) << 16;
+	int exponent = (half >> 10) & 0x1f;
+	unsigned int mantissa = half & 0x3ff;
+	unsigned int bits;
+
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		}
+		else {
+			// subnormal, normalise it
+			exponent = 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				--exponent;
+			}
+			mantissa &= 0x3ff;
+			bits = sign | ((unsigned int)(exponent + 127 - 15) << 23) | (mantissa << 13);
+		}
+	}
+	else if (exponent == 31) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((unsigned int)(exponent + 127 - 15) << 23) | (mantissa << 13);
+	}
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+void fm::encodeOctahedral(const float * normal, float & x, float & y)
+{
+	// project onto the octahedron |x| + |y| + |z| = 1
+	float l1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	if (l1 == 0.0f) {
+		x = y = 0.0f;
+		return;
+	}
+
+	x = normal[0] / l1;
+	y = normal[1] / l1;
+
+	// fold the lower half over the diagonals
+	if (normal[2] < 0.0f) {
+		float foldX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldX;
+		y = foldY;
+	}
+}
+
+void fm::decodeOctahedral(float x, float y, float * normal)
+{
+	normal[0] = x;
+	normal[1] = y;
+	normal[2] = 1.0f - fabsf(x) - fabsf(y);
+
+	// unfold the lower half
+	if (normal[2] < 0.0f) {
+		normal[0] = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		normal[1] = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+	}
 
-	for (auto& uv : model->textureCoords) {
-		uv.x = 1.0f - uv.x;
-		uv.y = 1.0f - uv.y;
+	float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	if (length > 0.0f) {
+		normal[0] /= length;
+		normal[1] /= length;
+		normal[2] /= length;
 	}
 }
@@ -26,20 +26,281 @@ namespace fm {
 		Indexes indices[3];
 	};
 
+	/*
+	 * A single vertex with every attribute, made by merging the
+	 * position, normal and uv indexes of an obj face corner.
+	 */
+	struct MeshVertex {
+		float position[3];
+		float normal[3];
+		float uv[2];
+	};
+
+	/*
+	 * An indexed triangle mesh with a single vertex buffer.
+	 * Built from the separately indexed obj data by processObjModel().
+	 */
+	struct MeshBuffer {
+		std::vector<MeshVertex> vertices;
+		std::vector<unsigned int> indices;
+	};
+
+	/*
+	 * What processObjModel() did to a model.
+	 */
+	struct MeshProcessReport {
+		MeshProcessReport();
+
+		/* The number of face corners, what was sent before processing. */
+		size_t cornerCount;
+
+		/* The number of unique vertices after welding. */
+		size_t vertexCount;
+
+		/* Average cache miss ratio (transformed vertices per triangle) before & after reordering. */
+		float acmrBefore;
+		float acmrAfter;
+
+		/* How long the processing took. */
+		double milliseconds;
+	};
+
+	/*
+	 * A quantised vertex of a CompactMesh, 14 bytes instead of 32.
+	 */
+	struct CompactVertex {
+		/* Position within the bounds of the mesh, 0 is the min & 65535 is the max. */
+		unsigned short position[3];
+
+		/* Octahedral encoded normal, -32767 to 32767. */
+		short normal[2];
+
+		/* Half float uvs. */
+		unsigned short uv[2];
+	};
+
+	/*
+	 * Compact indexed version of an ObjModel, uses about half the memory.
+	 * Indices are 16 bit when the mesh has at most 65536 vertices, 32 bit otherwise.
+	 * Vertices are decoded when they are drawn, see decodeVertex().
+	 */
+	struct CompactMesh {
+		CompactMesh();
+
+		/* The minimum corner of the mesh bounds. */
+		float boundsMin[3];
+
+		/* The size of the mesh bounds on each axis. */
+		float boundsSize[3];
+
+		std::vector<CompactVertex> vertices;
+		std::vector<unsigned short> indices16;
+		std::vector<unsigned int> indices32;
+
+		/* The number of indices, 3 per triangle. */
+		size_t indexCount() const;
+
+		/* Gets the index at i, from whichever index buffer is used. */
+		unsigned int index(size_t i) const;
+
+		/* Decodes a vertex back to full precision. */
+		void decodeVertex(unsigned int index, MeshVertex& vertex) const;
+
+		/* The number of bytes used by the vertices & indices. */
+		size_t memorySize() const;
+	};
+
+	/*
+	 * The largest errors between an ObjModel and its CompactMesh.
+	 */
+	struct CompactError {
+		CompactError();
+
+		/* Largest position error, as a fraction of the largest side of the mesh bounds. */
+		float position;
+
+		/* Largest angle between the original and decoded normals, in degrees. */
+		float normalDegrees;
+
+		/* Largest absolute uv error. */
+		float uv;
+	};
+
+	/*
+	 * A simplified version of a model, generated by generateLods().
+	 * Uses the vertices of the full detail model, only the triangles are different.
+	 */
+	struct MeshLod {
+		MeshLod();
+
+		/* The fraction of the full detail triangles it was generated for. */
+		float ratio;
+
+		/* Roughly how far (in model units) the simplified surface is from the full detail one. */
+		float error;
+
+		std::vector<unsigned int> indices;
+	};
+
+	/*
+	 * An axis aligned box and a bounding sphere, in model space.
+	 */
+	struct MeshBounds {
+		MeshBounds();
+
+		float boxMin[3];
+		float boxMax[3];
+
+		float center[3];
+		float radius;
+	};
+
+	/* The most vertices & triangles in one meshlet. */
+	const unsigned int MESHLET_MAX_VERTICES = 64;
+	const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+	/*
+	 * A small cluster of a model's triangles, built by buildMeshlets().
+	 * Has its own bounds, so the parts of a large model that can't be seen are skipped.
+	 */
+	struct Meshlet {
+		Meshlet();
+
+		/* The range of the full detail indices the meshlet draws. */
+		unsigned int indexOffset;
+		unsigned int indexCount;
+
+		/* Bounding sphere, in model space. */
+		float center[3];
+		float radius;
+
+		/*
+		 * Normal cone, every triangle faces within the cone around the axis.
+		 * The meshlet is facing away when dot(center - camera, axis) >= cutoff * |center - camera| + radius.
+		 * A cutoff of 1 means the triangles face too many ways to ever be culled like this.
+		 */
+		float coneAxis[3];
+		float coneCutoff;
+	};
+
+	/*
+	 * The bounds of a model's meshlets in separate arrays, so they can be culled 4 at a time.
+	 * Each array is padded to a multiple of 4.
+	 */
+	struct MeshletCullData {
+		std::vector<float> centerX, centerY, centerZ, radius;
+		std::vector<float> axisX, axisY, axisZ, cutoff;
+
+		/* Fills the arrays from the meshlets. */
+		void build(const std::vector<Meshlet>& meshlets);
+	};
+
+	/*
+	 * A camera in the local space of a model, what the meshlets are culled against.
+	 */
+	struct CullCamera {
+		CullCamera();
+
+		/* Frustum planes (a, b, c, d) with unit normals, inside is a*x + b*y + c*z + d >= 0. */
+		float planes[6][4];
+
+		/* Position of the camera. */
+		float position[3];
+
+		/* Builds the camera from OpenGL (column major) model view & projection matrices. */
+		static CullCamera fromMatrices(const float* modelView, const float* projection);
+	};
+
 	/*
 	 * 3D model data parsed from a .obj file.
 	 */
 	struct ObjModel {
 	public:
+		ObjModel();
+		~ObjModel();
+
 		// Editor & IO data
 		std::string filepath;
-		bool switchedUvs;
 
 		// Imported draw data
 		std::vector<Vector3> vertices;
 		std::vector<Vector3> vertexNormals;
 		std::vector<Vector3> textureCoords;
 		std::vector<PolyFace> polyFaces;
+
+		/*
+		 * The welded & reordered version of the model, nullptr unless processObjModel() was called.
+		 * When set, the obj draw data above has been released.
+		 */
+		MeshBuffer* buffer;
+
+		/*
+		 * The compact version of the model, nullptr unless compactObjModel() was called.
+		 * When set, the full precision draw data above (and the buffer) has been released.
+		 */
+		CompactMesh* compact;
+
+		/* The bounds of the model, computed when it's processed. */
+		MeshBounds bounds;
+
+		/*
+		 * Simplified versions of the model, from the most to least detailed.
+		 * Empty unless generateLods() was called.
+		 */
+		std::vector<MeshLod> lods;
+
+		/*
+		 * The full detail triangles split into clusters, and their bounds for culling.
+		 * Empty unless buildMeshlets() was called.
+		 */
+		std::vector<Meshlet> meshlets;
+		MeshletCullData meshletCullData;
+
+		/* The number of triangles in the model, full precision or compact. */
+		size_t triangleCount() const;
+
+		/*
+		 * Picks the least detailed lod whose error is below 'maxError', in model units.
+		 * Returns -1 if the full detail model should be drawn.
+		 */
+		int selectLod(float maxError) const;
+	};
+
+	/*
+	 * Options for streaming very large obj files, see ObjModelLoader::stream.
+	 */
+	struct ObjStreamOptions {
+		ObjStreamOptions();
+
+		/* Bytes of the file read & parsed at a time. 4MB by default. */
+		size_t windowBytes;
+
+		/*
+		 * The most memory the loader holds at once, 64MB by default. Split between the window,
+		 * the write buffers, the pages of attributes read back from disk and the weld table.
+		 */
+		size_t memoryBudget;
+	};
+
+	/*
+	 * What ObjModelLoader::stream did.
+	 */
+	struct ObjStreamReport {
+		ObjStreamReport();
+
+		unsigned long long bytesRead;
+		size_t vertexCount;
+		size_t indexCount;
+		MeshBounds bounds;
+
+		/* The most memory held by the loader at once, in bytes. */
+		size_t peakMemory;
+
+		/* The line (1 based) that didn't fit in the window, which stops the stream. 0 if there wasn't one. */
+		unsigned long long longLine;
+
+		double milliseconds;
+		double megabytesPerSecond;
 	};
 
 	/*
@@ -58,6 +319,19 @@ namespace fm {
 
 		ObjModel* load(std::string fp);
 
+		/*
+		 * Streaming mode for obj files too big to load in one go.
+		 * Parses the file a window at a time and welds the face corners as it goes, writing
+		 * the vertices (MeshVertex) to outputPrefix + ".vertices" and the indices (unsigned int) to 
+		 * outputPrefix + ".indices". The positions, normals & uvs are kept on disk as well and
+		 * read back through a small page cache. Memory stays under options.memoryBudget, the weld
+		 * table is cleared when it fills up, so a few vertices may be written twice.
+		 * Faces may only use attributes defined above them. Returns false if the file can't be read,
+		 * or has a line longer than the window (see ObjStreamReport::longLine).
+		 */
+		bool stream(const std::string& fp, const std::string& outputPrefix, 
+			const ObjStreamOptions& options, ObjStreamReport& report);
+
 	private:
 		void readLine(std::string& line, ObjModel* model);
 		OBJ_PARAM getParam(std::string& line);
@@ -70,9 +344,116 @@ namespace fm {
 	ObjModel* loadObjModel(std::string filepath);
 
 	/*
-	 * Switches the UVs on a obj model. 
-	 * Inverses the switch flag on the obj model.
-	 * Use this if you don't want to rotatate textures to match uv coords.
+	 * The mesh processing stage run after loading an obj.
+	 * Welds identical (position, normal, uv) face corners into a MeshBuffer,
+	 * reorders the triangles for the post-transform vertex cache and then
+	 * reorders the vertices in the order they are used. Runs in linear time.
+	 * Also computes the bounds of the model.
+	 * Releases the obj draw data of the model.
+	 */
+	MeshProcessReport processObjModel(ObjModel* model);
+
+	/*
+	 * Welds the face corners of an obj model into a single indexed vertex buffer.
+	 */
+	void weldObjModel(ObjModel* model, MeshBuffer& buffer);
+
+	/*
+	 * Reorders triangles so vertices are reused while they're still in the
+	 * post-transform cache (Forsyth's linear-speed algorithm).
+	 */
+	void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+
+	/*
+	 * Reorders vertices in the order they are first used by the indices,
+	 * so the vertex fetches walk through memory. Drops unused vertices.
+	 */
+	void optimizeVertexFetch(MeshBuffer& buffer);
+
+	/*
+	 * Simulates a FIFO post-transform cache of 'cacheSize' vertices.
+	 * Returns the average number of cache misses per triangle, 3.0 is the worst & 0.5 is about the best.
+	 */
+	float computeAcmr(const std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize = 16);
+
+	/*
+	 * Simplifies the triangles in 'indices' down to about 'targetIndexCount' indices,
+	 * collapsing the edges with the lowest quadric error first. Vertices are only ever moved
+	 * onto their neighbours, so the result uses the same vertex buffer. Vertices on uv/normal
+	 * seams and open borders are never moved, so seams & the outline of open meshes are kept.
+	 * The result is deterministic. Returns the error of the simplified mesh in model units.
+	 */
+	float simplifyMesh(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices,
+		size_t targetIndexCount, std::vector<unsigned int>& result);
+
+	/*
+	 * Generates model->lods, one for each ratio of the full detail triangles (e.g. 0.5, 0.25, 0.1).
+	 * Each level is simplified from the one before it. Processes the model first if needed.
+	 */
+	void generateLods(ObjModel* model, const std::vector<float>& ratios);
+
+	/*
+	 * Generates the lods of many models, spread across the worker threads.
+	 */
+	void generateLods(const std::vector<ObjModel*>& models, const std::vector<float>& ratios);
+
+	/*
+	 * Computes the bounds of 'count' positions (3 floats each), 'stride' bytes apart.
+	 * The box comes from a SIMD min/max reduction, split across the worker threads for very
+	 * large arrays. The sphere is the tighter of Ritter's sphere and the sphere around the box centre.
+	 */
+	MeshBounds computeBounds(const float* positions, size_t count, size_t stride);
+
+	/*
+	 * Splits triangles into meshlets of up to MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES
+	 * triangles, in the order they are given. Run it on cache optimised indices, which keep
+	 * neighbouring triangles together, so the meshlets come out small and flat.
+	 */
+	void buildMeshlets(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices,
+		std::vector<Meshlet>& meshlets);
+
+	/*
+	 * Builds model->meshlets & model->meshletCullData from the full detail triangles.
+	 * Processes the model first if needed.
+	 */
+	void buildMeshlets(ObjModel* model);
+
+	/*
+	 * Marks each meshlet visible (1) or culled (0), by the frustum & its normal cone.
+	 * Uses SSE when FM_SSE is defined, and splits very large models across the worker threads unless not 'parallel'.
+	 * Returns the number of visible meshlets.
+	 */
+	size_t cullMeshlets(const MeshletCullData& data, size_t meshletCount, const CullCamera& camera,
+		std::vector<unsigned char>& visible, bool parallel = true);
+
+	/*
+	 * Same as cullMeshlets, but one meshlet at a time on the calling thread.
+	 */
+	size_t cullMeshletsScalar(const MeshletCullData& data, size_t meshletCount, const CullCamera& camera,
+		std::vector<unsigned char>& visible);
+
+	/*
+	 * Builds the CompactMesh of a model and releases the full precision draw data.
+	 * The model is processed with processObjModel() first if it hasn't been already.
+	 * Returns the errors introduced by the quantisation.
+	 */
+	CompactError compactObjModel(ObjModel* model);
+
+	/*
+	 * Measures the errors between every vertex of a full precision buffer and
+	 * the same vertex decoded from 'mesh'. Used to check the compact format.
+	 */
+	CompactError measureCompactError(const MeshBuffer& buffer, const CompactMesh& mesh);
+
+	/*
+	 * Converts a float to a 16 bit half float, and back.
+	 */
+	unsigned short floatToHalf(float value);
+	float halfToFloat(unsigned short half);
+
+	/*
+	 * Octahedral normal encoding, maps a unit normal to two values in -1 to 1 and back.
 	 */
-	void switchModelUvs(ObjModel* model);
+	void encodeOctahedral(const float* normal, float& x, float& y);
+	void decodeOctahedral(float x, float y, float* normal);
 }
\ No newline at end of file
@@ -0,0 +1,827 @@
+#include "fullmetal-bench.h"
+#include "fullmetal-platform.h"
+#include "fullmetal-compress.h"
+#include "fullmetal-textures.h"
+#include "fullmetal-3d.h"
+#include "fullmetal-gltf.h"
+#include "fullmetal-io.h"
+#include "fullmetal-streaming.h"
+#include "fullmetal-types.h"
+#include "fullmetal.h"
+
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <typeindex>
+#include <cassert>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <cstring>
+
+#include <gl/GL.h>
+#include "../SOIL.h"
+
+void fm::bench::textureCache(const std::vector<std::string>& paths, TextureCache& cache)
+{
+	std::vector<GLuint> textures;
+
+	// cold, what AssetManager does without a cache
+	Timer timer;
+	for (auto& path : paths) {
+		textures.push_back(SOIL_load_OGL_texture(path.c_str(), SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID,
+			SOIL_FLAG_MIPMAPS | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT));
+	}
+	Stats::global->set("texcache.cold_ms", timer.elapsedMs());
+
+	// build the cache entries, in parallel across the textures
+	timer.reset();
+	cache.buildAll(paths);
+	Stats::global->set("texcache.build_ms", timer.elapsedMs());
+
+	// warm, look up the entry & upload the compressed mip chain directly
+	timer.reset();
+	for (auto& path : paths) {
+		std::string cachedPath;
+		if (cache.find(path, cachedPath)) {
+			textures.push_back(SOIL_load_OGL_texture(cachedPath.c_str(), SOIL_LOAD_AUTO, 
+				SOIL_CREATE_NEW_ID, SOIL_FLAG_DDS_LOAD_DIRECT));
+		}
+	}
+	Stats::global->set("texcache.warm_ms", timer.elapsedMs());
+
+	glDeleteTextures((GLsizei)textures.size(), textures.data());
+}
+
+// Builds column major look at & perspective matrices, like gluLookAt & gluPerspective
+static void benchCamera(const float* eye, const float* target, float* modelView, float* projection)
+{
+	float forward[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	float length = sqrtf(forward[0] * forward[0] + forward[1] * forward[1] + forward[2] * forward[2]);
+	for (int k = 0; k < 3; ++k)
+		forward[k] /= length;
+
+	// up is +y, the cameras circle around it
+	float side[3] = { -forward[2], 0.0f, forward[0] };
+	length = sqrtf(side[0] * side[0] + side[2] * side[2]);
+	for (int k = 0; k < 3; ++k)
+		side[k] /= length;
+
+	float up[3] = { side[1] * forward[2] - side[2] * forward[1], side[2] * forward[0] - side[0] * forward[2],
+		side[0] * forward[1] - side[1] * forward[0] };
+
+	float rows[3][3] = {
+		{ side[0], side[1], side[2] },
+		{ up[0], up[1], up[2] },
+		{ -forward[0], -forward[1], -forward[2] }
+	};
+
+	for (int i = 0; i < 16; ++i)
+		modelView[i] = projection[i] = 0.0f;
+
+	for (int row = 0; row < 3; ++row) {
+		for (int column = 0; column < 3; ++column)
+			modelView[column * 4 + row] = rows[row][column];
+		modelView[12 + row] = -(rows[row][0] * eye[0] + rows[row][1] * eye[1] + rows[row][2] * eye[2]);
+	}
+	modelView[15] = 1.0f;
+
+	// 60 degree field of view, square, near 0.1 & far 1000
+	float f = 1.0f / tanf(30.0f * 3.14159265f / 180.0f);
+	float zNear = 0.1f, zFar = 1000.0f;
+	projection[0] = f;
+	projection[5] = f;
+	projection[10] = (zFar + zNear) / (zNear - zFar);
+	projection[11] = -1.0f;
+	projection[14] = 2.0f * zFar * zNear / (zNear - zFar);
+}
+
+void fm::bench::meshletCulling(ObjModel * model, int iterations)
+{
+	assert(model != nullptr && !model->meshlets.empty());
+	size_t meshletCount = model->meshlets.size();
+
+	// circle around the middle of the meshlets, close enough that some are off screen
+	float center[3] = { 0.0f, 0.0f, 0.0f };
+	for (auto& meshlet : model->meshlets) {
+		for (int k = 0; k < 3; ++k)
+			center[k] += meshlet.center[k] / meshletCount;
+	}
+
+	float extent = 0.0f;
+	for (auto& meshlet : model->meshlets) {
+		float dx = meshlet.center[0] - center[0], dy = meshlet.center[1] - center[1], dz = meshlet.center[2] - center[2];
+		extent = fmaxf(extent, sqrtf(dx * dx + dy * dy + dz * dz) + meshlet.radius);
+	}
+
+	std::vector<CullCamera> cameras;
+	for (int i = 0; i < iterations; ++i) {
+		float angle = 6.2831853f * i / iterations;
+		float eye[3] = { center[0] + cosf(angle) * extent * 1.5f, center[1] + extent * 0.25f, center[2] + sinf(angle) * extent * 1.5f };
+		float target[3] = { center[0] + cosf(angle * 3.0f) * extent * 0.5f, center[1], center[2] };
+
+		float modelView[16], projection[16];
+		benchCamera(eye, target, modelView, projection);
+		cameras.push_back(CullCamera::fromMatrices(modelView, projection));
+	}
+
+	std::vector<unsigned char> visible;
+	size_t visibleTotal = 0;
+
+	Timer timer;
+	for (auto& camera : cameras)
+		visibleTotal += cullMeshletsScalar(model->meshletCullData, meshletCount, camera, visible);
+	double scalarMs = timer.elapsedMs();
+
+	timer.reset();
+	for (auto& camera : cameras)
+		cullMeshlets(model->meshletCullData, meshletCount, camera, visible);
+	double simdMs = timer.elapsedMs();
+
+	Stats::global->set("meshlets.count", (double)meshletCount);
+	Stats::global->set("meshlets.visible_ratio", (double)visibleTotal / (meshletCount * cameras.size()));
+	Stats::global->set("meshlets.scalar_us", scalarMs * 1000.0 / cameras.size());
+	Stats::global->set("meshlets.simd_us", simdMs * 1000.0 / cameras.size());
+}
+
+void fm::bench::modelLoading(const std::string& objPath, const std::string& glbPath, int iterations)
+{
+#ifdef FM_IO
+	assert(iterations > 0);
+
+	// obj, everything the AssetManager does before the model can be drawn
+	Timer timer;
+	for (int i = 0; i < iterations; ++i) {
+		ObjModel* model = loadObjModel(objPath);
+		processObjModel(model);
+		delete model;
+	}
+	double objMs = timer.elapsedMs() / iterations;
+
+	// glb, already indexed so it's only mapped & copied
+	size_t vertexCount = 0;
+	timer.reset();
+	for (int i = 0; i < iterations; ++i) {
+		ObjModel* model = loadGlbModel(glbPath);
+		assert(model != nullptr);
+		vertexCount = model->buffer->vertices.size();
+		delete model;
+	}
+	double glbMs = timer.elapsedMs() / iterations;
+
+	Stats::global->set("load.obj_ms", objMs);
+	Stats::global->set("load.glb_ms", glbMs);
+	Stats::global->set("load.speedup", glbMs > 0.0 ? objMs / glbMs : 0.0);
+	Stats::global->set("load.glb_vertices", (double)vertexCount);
+#endif
+}
+
+void fm::bench::objStreamEdges(const std::string& directory)
+{
+	ObjModelLoader loader;
+	ObjStreamOptions options;
+
+	// no faces, so no vertices are ever written
+	std::string noFacesPath = directory + "/bench_no_faces.obj";
+	std::string noFaces = "v 0 0 0\nv 1 0 0\nv 0 1 0\n";
+	writeFileBytes(noFacesPath, noFaces.data(), noFaces.size());
+
+	ObjStreamReport noFacesReport;
+	bool noFacesOk = loader.stream(noFacesPath, directory + "/bench_no_faces", options, noFacesReport)
+		&& noFacesReport.vertexCount == 0 && noFacesReport.indexCount == 0;
+
+	// two windows of vertices exactly, every corner its own vertex
+	const size_t windowVertices = 48;
+	options.windowBytes = windowVertices * sizeof(MeshVertex);
+
+	std::string exactPath = directory + "/bench_exact_window.obj";
+	size_t vertexCount = windowVertices * 2;
+	std::string exact = "vt 0 0\nvn 0 0 1\n";
+	for (size_t i = 0; i < vertexCount; ++i)
+		exact += "v " + std::to_string(i) + " " + std::to_string(i % 3) + " 0\n";
+	for (size_t i = 1; i <= vertexCount; i += 3)
+		exact += "f " + std::to_string(i) + "/1/1 " + std::to_string(i + 1) + "/1/1 " + std::to_string(i + 2) + "/1/1\n";
+	writeFileBytes(exactPath, exact.data(), exact.size());
+
+	ObjStreamReport exactReport;
+	bool exactOk = loader.stream(exactPath, directory + "/bench_exact_window", options, exactReport)
+		&& exactReport.vertexCount == vertexCount && exactReport.indexCount == vertexCount
+		&& fileSize(directory + "/bench_exact_window.vertices") == vertexCount * sizeof(MeshVertex)
+		&& exactReport.bounds.boxMax[0] == (float)(vertexCount - 1) && exactReport.bounds.radius > 0.0f;
+
+	// a line that doesn't fit in the window stops the stream, rather than reading nothing forever
+	std::string longPath = directory + "/bench_long_line.obj";
+	std::string longLine = "v 0 0 0\nv " + std::string(options.windowBytes, '1') + " 0 0\n";
+	writeFileBytes(longPath, longLine.data(), longLine.size());
+
+	ObjStreamReport longReport;
+	bool longOk = !loader.stream(longPath, directory + "/bench_long_line", options, longReport) && longReport.longLine == 2;
+
+	Stats::global->set("objstream.no_faces_ok", noFacesOk ? 1.0 : 0.0);
+	Stats::global->set("objstream.exact_window_ok", exactOk ? 1.0 : 0.0);
+	Stats::global->set("objstream.long_line_ok", longOk ? 1.0 : 0.0);
+}
+
+#ifdef FM_IO
+// Builds a scene of 'nodeCount' cubes, spheres & lights, in groups of ten under a cube so the hierarchy is written too
+static fm::SceneNodeGraph* buildBenchScene(int nodeCount)
+{
+	using namespace fm;
+
+	SceneNodeGraph* graph = new SceneNodeGraph();
+	std::vector<SceneNode*> roots;
+	for (int i = 0; i < nodeCount; i += 10) {
+		SceneNode* parent = new CubeNode(Color(1.0f, 0.5f, 0.25f, 1.0f));
+		parent->transform.position = Vector3((float)i, 0.0f, 0.0f);
+		parent->name = "Group " + std::to_string(i / 10);
+
+		for (int k = 1; k < 10 && i + k < nodeCount; ++k) {
+			SceneNode* child;
+			if (k % 3 == 0) {
+				SphereNode* sphere = new SphereNode(Color(0.25f, 0.5f, 1.0f, 1.0f));
+				sphere->material.specularEnabled = true;
+				child = sphere;
+			}
+			else if (k == 5) {
+				child = new SpotLightNode();
+			}
+			else {
+				child = new CubeNode(Color(0.5f, 0.5f, 0.5f, 1.0f));
+			}
+
+			child->transform.position = Vector3((float)k, (float)(k * 2), 0.5f);
+			child->transform.angle = (float)k * 10.0f;
+			parent->addChild(child);
+		}
+
+		roots.push_back(parent);
+	}
+	graph->addNodes(roots);
+	return graph;
+}
+#endif
+
+void fm::bench::sceneFormats(NodeTypeTable* typeTable, const std::string& directory, int nodeCount)
+{
+#ifdef FM_IO
+	assert(typeTable != nullptr && nodeCount > 0);
+
+	SceneNodeGraph* graph = buildBenchScene(nodeCount);
+
+	std::string jsonPath = directory + "/bench_scene.json";
+	std::string binaryPath = directory + "/bench_scene.fmscene";
+
+	Timer timer;
+	io::writeSceneGraph(jsonPath, graph, typeTable);
+	double jsonWriteMs = timer.elapsedMs();
+
+	std::string compactPath = directory + "/bench_scene_compact.json";
+	timer.reset();
+	io::writeSceneGraph(compactPath, graph, typeTable, true);
+	double compactWriteMs = timer.elapsedMs();
+
+	timer.reset();
+	SceneNodeGraph* jsonGraph = io::readSceneGraph(jsonPath, typeTable);
+	double jsonReadMs = timer.elapsedMs();
+
+	timer.reset();
+	SceneNodeGraph* parallelGraph = io::readSceneGraphParallel(jsonPath, typeTable);
+	double parallelReadMs = timer.elapsedMs();
+
+	// it must be the same graph, in the same order
+	std::vector<unsigned char> serialBytes, parallelBytes;
+	io::writeSceneGraphBinary(serialBytes, jsonGraph, typeTable);
+	if (parallelGraph != nullptr)
+		io::writeSceneGraphBinary(parallelBytes, parallelGraph, typeTable);
+
+	delete parallelGraph;
+
+	// the whole document parsed first, then the nodes read from it
+	timer.reset();
+	nlohmann::json document = io::readJson(jsonPath);
+	SceneNodeGraph* domGraph = io::readSceneGraph(document, typeTable);
+	document = nlohmann::json();
+	double domReadMs = timer.elapsedMs();
+	delete domGraph;
+
+	timer.reset();
+	io::writeSceneGraph(binaryPath, graph, typeTable);
+	double binaryWriteMs = timer.elapsedMs();
+
+	timer.reset();
+	SceneNodeGraph* binaryGraph = io::readSceneGraph(binaryPath, typeTable);
+	double binaryReadMs = timer.elapsedMs();
+
+	// the scene read back must write exactly the same bytes
+	std::vector<unsigned char> written, rewritten;
+	readFileBytes(binaryPath, written);
+	if (binaryGraph != nullptr)
+		io::writeSceneGraphBinary(rewritten, binaryGraph, typeTable);
+
+	Stats::global->set("scene.json_write_ms", jsonWriteMs);
+	Stats::global->set("scene.json_read_ms", jsonReadMs);
+	Stats::global->set("scene.json_dom_read_ms", domReadMs);
+	Stats::global->set("scene.json_parallel_read_ms", parallelReadMs);
+	Stats::global->set("scene.parallel_speedup", parallelReadMs > 0.0 ? jsonReadMs / parallelReadMs : 0.0);
+	Stats::global->set("scene.parallel_same", serialBytes == parallelBytes ? 1.0 : 0.0);
+	Stats::global->set("scene.json_compact_write_ms", compactWriteMs);
+	Stats::global->set("scene.json_compact_bytes", (double)fileSize(compactPath));
+	Stats::global->set("scene.stream_speedup", jsonReadMs > 0.0 ? domReadMs / jsonReadMs : 0.0);
+	Stats::global->set("scene.binary_write_ms", binaryWriteMs);
+	Stats::global->set("scene.binary_read_ms", binaryReadMs);
+	Stats::global->set("scene.json_bytes", (double)fileSize(jsonPath));
+	Stats::global->set("scene.binary_bytes", (double)fileSize(binaryPath));
+	Stats::global->set("scene.read_speedup", binaryReadMs > 0.0 ? jsonReadMs / binaryReadMs : 0.0);
+	Stats::global->set("scene.write_speedup", binaryWriteMs > 0.0 ? jsonWriteMs / binaryWriteMs : 0.0);
+	Stats::global->set("scene.roundtrip", !written.empty() && written == rewritten ? 1.0 : 0.0);
+
+	delete graph;
+	delete jsonGraph;
+	delete binaryGraph;
+#endif
+}
+
+void fm::bench::prefabInstances(NodeTypeTable* typeTable, const std::string& directory, int instanceCount)
+{
+#ifdef FM_IO
+	assert(typeTable != nullptr && instanceCount > 0);
+
+	// the prop, a cube with nine children
+	SceneNode* prop = new CubeNode(Color(1.0f, 0.5f, 0.25f, 1.0f));
+	prop->name = "Prop";
+	for (int k = 1; k < 10; ++k) {
+		SceneNode* child = k % 3 == 0 ? (SceneNode*)new SphereNode(Color(0.25f, 0.5f, 1.0f, 1.0f)) : new CubeNode(Color(0.5f, 0.5f, 0.5f, 1.0f));
+		child->transform.position = Vector3((float)k, (float)(k * 2), 0.5f);
+		prop->addChild(child);
+	}
+
+	SceneNodeGraph propGraph;
+	propGraph.addNode(prop);
+	std::string propPath = directory + "/bench_prop.json";
+	io::writeSceneGraph(propPath, &propGraph, typeTable);
+
+	// the same level twice, with deep copies of the prop and with instances of it (every hundredth overridden)
+	SceneNodeGraph cloned, instanced;
+	std::vector<SceneNode*> clones, instances;
+	SceneNodeGraph* source = io::PrefabLibrary::global->get(propPath);
+
+	for (int i = 0; i < instanceCount; ++i) {
+		Vector3 position((float)(i % 100) * 4.0f, 0.0f, (float)(i / 100) * 4.0f);
+
+		SceneNode* clone = prop->clone();
+		clone->transform.position = position;
+		clones.push_back(clone);
+
+		PrefabNode* instance = new PrefabNode();
+		instance->prefab = propPath;
+		instance->transform.position = position;
+		instance->setSource(source);
+
+		if (i % 100 == 0) {
+			CubeNode* red = new CubeNode(Color(1.0f, 0.0f, 0.0f, 1.0f));
+			red->transform.position = Vector3(1.0f, 2.0f, 0.5f);
+			instance->addOverride({ 0, 0 }, red);
+		}
+
+		instances.push_back(instance);
+	}
+
+	cloned.addNodes(clones);
+	instanced.addNodes(instances);
+
+	std::string clonedPath = directory + "/bench_cloned.json";
+	std::string instancedPath = directory + "/bench_instanced.json";
+	io::writeSceneGraph(clonedPath, &cloned, typeTable);
+	io::writeSceneGraph(instancedPath, &instanced, typeTable);
+
+	Timer timer;
+	SceneNodeGraph* clonedRead = io::readSceneGraph(clonedPath, typeTable);
+	double clonedReadMs = timer.elapsedMs();
+
+	timer.reset();
+	SceneNodeGraph* instancedRead = io::readSceneGraph(instancedPath, typeTable);
+	double instancedReadMs = timer.elapsedMs();
+
+	// the nodes held in memory, an instance only holds a copy of the prop when it's overridden
+	int instancedNodes = instancedRead->nodeCount() + source->nodeCount();
+	for (auto node : instancedRead->getNodes()) {
+		PrefabNode* instance = dynamic_cast<PrefabNode*>(node);
+		if (instance != nullptr && !instance->overrides.empty())
+			instancedNodes += source->nodeCount();
+	}
+
+	Stats::global->set("prefab.cloned_bytes", (double)fileSize(clonedPath));
+	Stats::global->set("prefab.instanced_bytes", (double)fileSize(instancedPath));
+	Stats::global->set("prefab.cloned_read_ms", clonedReadMs);
+	Stats::global->set("prefab.instanced_read_ms", instancedReadMs);
+	Stats::global->set("prefab.read_speedup", instancedReadMs > 0.0 ? clonedReadMs / instancedReadMs : 0.0);
+	Stats::global->set("prefab.cloned_nodes", (double)clonedRead->nodeCount());
+	Stats::global->set("prefab.instanced_nodes", (double)instancedNodes);
+
+	delete clonedRead;
+	delete instancedRead;
+#endif
+}
+
+void fm::bench::lazyScene(NodeTypeTable* typeTable, const std::string& directory, int subtreeCount)
+{
+#ifdef FM_IO
+	assert(typeTable != nullptr && subtreeCount > 0);
+
+	// a square grid of props, each a cube with nine children, 10 apart
+	int side = (int)ceil(sqrt((double)subtreeCount));
+	SceneNodeGraph world;
+	std::vector<SceneNode*> props;
+
+	for (int i = 0; i < subtreeCount; ++i) {
+		SceneNode* prop = new CubeNode(Color(1.0f, 0.5f, 0.25f, 1.0f));
+		prop->transform.position = Vector3((float)(i % side) * 10.0f, 0.0f, (float)(i / side) * 10.0f);
+
+		for (int k = 1; k < 10; ++k) {
+			SceneNode* child = new SphereNode(Color(0.25f, 0.5f, 1.0f, 1.0f));
+			child->transform.position = Vector3((float)k * 0.5f, 1.0f, 0.0f);
+			prop->addChild(child);
+		}
+
+		props.push_back(prop);
+	}
+
+	world.addNodes(props);
+	std::string path = directory + "/bench_lazy.fmscene";
+	io::writeSceneGraph(path, &world, typeTable);
+
+	Timer timer;
+	SceneNodeGraph* full = io::readSceneGraph(path, typeTable);
+	double fullReadMs = timer.elapsedMs();
+	int fullNodes = full->nodeCount();
+	delete full;
+
+	timer.reset();
+	io::LazyScene lazy(path, typeTable, 30.0f, 0.0);
+	SceneNodeGraph* graph = lazy.open();
+	double openMs = timer.elapsedMs();
+
+	// a flight along the diagonal, every subtree left behind is unloaded straight away
+	int residentNodes = 0;
+	double maxUpdateMs = 0.0;
+	for (int step = 0; step <= 200; ++step) {
+		float along = (float)step / 200.0f * (float)side * 10.0f;
+
+		timer.reset();
+		lazy.update(Vector3(along, 2.0f, along));
+		maxUpdateMs = std::max(maxUpdateMs, timer.elapsedMs());
+		residentNodes = std::max(residentNodes, graph->nodeCount());
+	}
+
+	Stats::global->set("lazy.full_read_ms", fullReadMs);
+	Stats::global->set("lazy.open_ms", openMs);
+	Stats::global->set("lazy.open_speedup", openMs > 0.0 ? fullReadMs / openMs : 0.0);
+	Stats::global->set("lazy.full_nodes", (double)fullNodes);
+	Stats::global->set("lazy.resident_nodes", (double)residentNodes);
+	Stats::global->set("lazy.max_update_ms", maxUpdateMs);
+
+	delete graph;
+#endif
+}
+
+void fm::bench::worldStreaming(NodeTypeTable* typeTable, const std::string& directory, int propCount, float speed)
+{
+#ifdef FM_IO
+	assert(typeTable != nullptr && propCount > 0 && speed > 0.0f);
+
+	// the props 10 apart on a square grid, in cells of 50
+	int side = (int)ceil(sqrt((double)propCount));
+	SceneNodeGraph world;
+	std::vector<SceneNode*> props;
+
+	for (int i = 0; i < propCount; ++i) {
+		SceneNode* prop = new CubeNode(Color(1.0f, 0.5f, 0.25f, 1.0f));
+		prop->transform.position = Vector3((float)(i % side) * 10.0f, 0.0f, (float)(i / side) * 10.0f);
+
+		for (int k = 1; k < 10; ++k) {
+			SceneNode* child = new SphereNode(Color(0.25f, 0.5f, 1.0f, 1.0f));
+			child->transform.position = Vector3((float)k * 0.5f, 1.0f, 0.0f);
+			prop->addChild(child);
+		}
+
+		props.push_back(prop);
+	}
+
+	world.addNodes(props);
+	std::string scenePath = directory + "/bench_world.fmscene";
+	std::string worldPath = directory + "/bench_world.fmworld";
+	io::writeSceneGraph(scenePath, &world, typeTable);
+	io::writeWorld(worldPath, &world, typeTable, 50.0f);
+
+	Timer timer;
+	SceneNodeGraph* full = io::readSceneGraph(scenePath, typeTable);
+	double fullReadMs = timer.elapsedMs();
+	delete full;
+
+	// a flight along the diagonal at 60 frames a second, the frames wait out the rest of their 16.7ms
+	SceneNodeGraph streamed;
+	io::WorldStreamer streamer(typeTable, 100.0f, 150.0f);
+	if (!streamer.open(worldPath))
+		return;
+
+	Camera camera(1280, 720);
+	camera.setPosition(Vector3(0.0f, 5.0f, 0.0f));
+
+	const double frameMs = 1000.0 / 60.0;
+	float length = (float)side * 10.0f;
+	int frames = (int)(length * 1.41421356f / speed * 60.0f) + 1;
+	float step = length / (float)frames;
+	std::vector<double> frameTimes;
+	size_t peakResident = 0;
+
+	for (int frame = 0; frame <= frames; ++frame) {
+		timer.reset();
+		streamer.update(&streamed, camera.getPosition());
+		double updateMs = timer.elapsedMs();
+
+		frameTimes.push_back(updateMs);
+		peakResident = std::max(peakResident, streamer.residentCount());
+		camera.move(Vector3(step, 0.0f, step));
+
+		if (updateMs < frameMs)
+			std::this_thread::sleep_for(std::chrono::microseconds((long long)((frameMs - updateMs) * 1000.0)));
+	}
+
+	std::sort(frameTimes.begin(), frameTimes.end());
+	int hitches = 0;
+	for (auto time : frameTimes)
+		hitches += time > frameMs ? 1 : 0;
+
+	Stats::global->set("stream.frame_p50_ms", frameTimes[frameTimes.size() / 2]);
+	Stats::global->set("stream.frame_p99_ms", frameTimes[(frameTimes.size() * 99) / 100]);
+	Stats::global->set("stream.frame_max_ms", frameTimes.back());
+	Stats::global->set("stream.hitches", (double)hitches);
+	Stats::global->set("stream.full_read_ms", fullReadMs);
+	Stats::global->set("stream.peak_resident", (double)peakResident);
+	Stats::global->set("stream.world_bytes", (double)fileSize(worldPath));
+#endif
+}
+
+void fm::bench::nodeReading(NodeTypeTable* typeTable, int nodeCount)
+{
+#ifdef FM_IO
+	assert(typeTable != nullptr && nodeCount > 0);
+
+	// one of each type in turn, the types that need no assets
+	std::vector<SceneNode*> nodes;
+	for (int i = 0; i < nodeCount; ++i) {
+		SceneNode* node;
+		switch (i % 7) {
+		case 0: node = new CubeNode(Color(1.0f, 0.5f, 0.25f, 1.0f)); break;
+		case 1: node = new SphereNode(Color(0.25f, 0.5f, 1.0f, 1.0f)); break;
+		case 2: node = new PlaneNode(Color(0.5f, 0.5f, 0.5f, 1.0f), 1, 8, 8); break;
+		case 3: node = new CylinderNode(); break;
+		case 4: node = new AmbientLightNode(); break;
+		case 5: node = new DirectionalLightNode(); break;
+		default: node = new SpotLightNode(); break;
+		}
+
+		node->transform.position = Vector3((float)i, 1.0f, 2.0f);
+		nodes.push_back(node);
+	}
+
+	// each node's json, and each node's binary values on their own
+	std::vector<nlohmann::json> jsons(nodes.size());
+	std::vector<std::string> ids(nodes.size());
+	std::vector<unsigned char> values;
+	std::vector<size_t> offsets;
+	ByteWriter writer(values);
+
+	Timer timer;
+	for (size_t i = 0; i < nodes.size(); ++i)
+		typeTable->writeNode(jsons[i], nodes[i]);
+	double jsonWriteNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	timer.reset();
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		offsets.push_back(values.size());
+		typeTable->writeNodeBinary(writer, nodes[i]);
+	}
+	double binaryWriteNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	offsets.push_back(values.size());
+	for (size_t i = 0; i < nodes.size(); ++i)
+		ids[i] = typeTable->getId(nodes[i]);
+
+	std::vector<unsigned char> scene;
+	io::writeNodesBinary(scene, nodes, typeTable, true);
+
+	for (auto node : nodes)
+		delete node;
+
+	// the nodes are deleted outside of the timings
+	std::vector<SceneNode*> read(nodes.size(), nullptr);
+
+	timer.reset();
+	for (size_t i = 0; i < jsons.size(); ++i)
+		read[i] = typeTable->readNode(jsons[i]);
+	double jsonNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	for (auto node : read)
+		delete node;
+
+	timer.reset();
+	for (size_t i = 0; i < ids.size(); ++i) {
+		ByteReader reader(values.data() + offsets[i], offsets[i + 1] - offsets[i]);
+		read[i] = typeTable->readNodeBinary(ids[i], reader);
+	}
+	double binaryNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	for (auto node : read)
+		delete node;
+
+	read.clear();
+	timer.reset();
+	io::readNodesBinary(scene.data(), scene.size(), typeTable, read);
+	double sceneNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	for (auto node : read)
+		delete node;
+
+	Stats::global->set("nodes.json_read_ns", jsonNs);
+	Stats::global->set("nodes.binary_read_ns", binaryNs);
+	Stats::global->set("nodes.binary_scene_read_ns", sceneNs);
+	Stats::global->set("nodes.json_write_ns", jsonWriteNs);
+	Stats::global->set("nodes.binary_write_ns", binaryWriteNs);
+#endif
+}
+
+void fm::bench::typeDispatch(NodeTypeTable* typeTable, int nodeCount)
+{
+	assert(typeTable != nullptr && nodeCount > 0);
+
+	// one of each type in turn, made here rather than by the table so their ids aren't known yet
+	std::vector<SceneNode*> nodes;
+	for (int i = 0; i < nodeCount; ++i) {
+		SceneNode* node;
+		switch (i % 7) {
+		case 0: node = new CubeNode(); break;
+		case 1: node = new SphereNode(); break;
+		case 2: node = new PlaneNode(); break;
+		case 3: node = new CylinderNode(); break;
+		case 4: node = new AmbientLightNode(); break;
+		case 5: node = new DirectionalLightNode(); break;
+		default: node = new SpotLightNode(); break;
+		}
+
+		nodes.push_back(node);
+	}
+
+	// the first lookup of each node finds its id & keeps it on the node
+	unsigned int sum = 0;
+	Timer timer;
+	for (auto node : nodes)
+		sum += typeTable->typeId(node);
+	double flatFirstNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	timer.reset();
+	for (auto node : nodes)
+		sum += typeTable->typeId(node);
+	double flatNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	// what the table used to do for every node it wrote or introspected
+	std::map<std::type_index, unsigned int> byType;
+	for (int i = 0; i < 7 && i < nodeCount; ++i)
+		byType[std::type_index(typeid(*nodes[i]))] = typeTable->typeId(nodes[i]);
+
+	timer.reset();
+	for (auto node : nodes) {
+		auto found = byType.find(std::type_index(typeid(*node)));
+		sum += found != byType.end() ? found->second : 0;
+	}
+	double mapNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	std::vector<unsigned int> counts;
+	timer.reset();
+	typeTable->countTypes(nodes, counts);
+	double countNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+	std::vector<std::vector<SceneNode*>> groups;
+	timer.reset();
+	typeTable->groupByType(nodes, groups);
+	double groupNs = timer.elapsedMs() * 1e6 / (double)nodeCount;
+
+#ifdef FM_IO
+	std::vector<unsigned char> bytes;
+	timer.reset();
+	io::writeNodesBinary(bytes, nodes, typeTable, true);
+	Stats::global->set("dispatch.binary_write_ns", timer.elapsedMs() * 1e6 / (double)nodeCount);
+#endif
+
+	for (auto node : nodes)
+		delete node;
+
+	unsigned int types = 0;
+	for (size_t type = 1; type < counts.size(); ++type)
+		types += counts[type] > 0 ? 1 : 0;
+
+	Stats::global->set("dispatch.types", (double)types);
+	Stats::global->set("dispatch.map_ns", mapNs);
+	Stats::global->set("dispatch.flat_first_ns", flatFirstNs);
+	Stats::global->set("dispatch.flat_ns", flatNs);
+	Stats::global->set("dispatch.count_ns", countNs);
+	Stats::global->set("dispatch.group_ns", groupNs);
+	// reported so the lookups aren't optimised away
+	Stats::global->set("dispatch.lookup_sink", (double)sum);
+}
+
+static double megabytesPerSecond(size_t bytes, double ms)
+{
+	return ms > 0.0 ? (bytes / (1024.0 * 1024.0)) / (ms / 1000.0) : 0.0;
+}
+
+void fm::bench::sceneCompression(NodeTypeTable* typeTable, const std::string& directory, int nodeCount)
+{
+#ifdef FM_IO
+	assert(typeTable != nullptr && nodeCount > 0);
+
+	SceneNodeGraph* graph = buildBenchScene(nodeCount);
+
+	// the scene in both formats, in memory so only the codec is timed
+	std::ostringstream jsonStream;
+	io::writeSceneGraphStream(jsonStream, graph, typeTable);
+	std::string json = jsonStream.str();
+
+	std::vector<unsigned char> binary;
+	io::writeSceneGraphBinary(binary, graph, typeTable);
+
+	const char* formats[] = { "json", "binary" };
+	const unsigned char* data[] = { reinterpret_cast<const unsigned char*>(json.data()), binary.data() };
+	size_t sizes[] = { json.size(), binary.size() };
+	bool same = true;
+
+	for (int f = 0; f < 2; ++f) {
+		std::string prefix = std::string("compress.") + formats[f];
+
+		// on one thread, then across the worker threads
+		std::vector<unsigned char> serial, compressed;
+		Timer timer;
+		compressBytes(data[f], sizes[f], serial, 1 << 20, false);
+		double compressSerialMs = timer.elapsedMs();
+
+		timer.reset();
+		compressBytes(data[f], sizes[f], compressed);
+		double compressMs = timer.elapsedMs();
+
+		std::vector<unsigned char> serialOut, out;
+		timer.reset();
+		bool read = decompressBytes(compressed.data(), compressed.size(), serialOut, false);
+		double decompressSerialMs = timer.elapsedMs();
+
+		timer.reset();
+		read = decompressBytes(compressed.data(), compressed.size(), out) && read;
+		double decompressMs = timer.elapsedMs();
+
+		same = same && read && serial == compressed && out == serialOut && out.size() == sizes[f] &&
+			memcmp(out.data(), data[f], sizes[f]) == 0;
+
+		Stats::global->set(prefix + "_bytes", (double)sizes[f]);
+		Stats::global->set(prefix + "_ratio", compressed.empty() ? 0.0 : (double)sizes[f] / compressed.size());
+		Stats::global->set(prefix + "_compress_mbps", megabytesPerSecond(sizes[f], compressMs));
+		Stats::global->set(prefix + "_compress_serial_mbps", megabytesPerSecond(sizes[f], compressSerialMs));
+		Stats::global->set(prefix + "_decompress_mbps", megabytesPerSecond(sizes[f], decompressMs));
+		Stats::global->set(prefix + "_decompress_serial_mbps", megabytesPerSecond(sizes[f], decompressSerialMs));
+	}
+
+	// the scene saved & read back through the files, compressed & not
+	std::string plainPath = directory + "/bench_compress.json";
+	std::string compressedPath = directory + "/bench_compress_lz.json";
+
+	Timer timer;
+	io::writeSceneGraph(plainPath, graph, typeTable);
+	double plainWriteMs = timer.elapsedMs();
+
+	timer.reset();
+	io::writeSceneGraph(compressedPath, graph, typeTable, false, true);
+	double writeMs = timer.elapsedMs();
+
+	timer.reset();
+	SceneNodeGraph* plainGraph = io::readSceneGraph(plainPath, typeTable);
+	double plainReadMs = timer.elapsedMs();
+	delete plainGraph;
+
+	timer.reset();
+	SceneNodeGraph* readGraph = io::readSceneGraph(compressedPath, typeTable);
+	double readMs = timer.elapsedMs();
+
+	// it must be the same graph
+	std::vector<unsigned char> rewritten;
+	if (readGraph != nullptr)
+		io::writeSceneGraphBinary(rewritten, readGraph, typeTable);
+
+	delete readGraph;
+	delete graph;
+
+	Stats::global->set("compress.file_bytes", (double)fileSize(compressedPath));
+	Stats::global->set("compress.plain_write_ms", plainWriteMs);
+	Stats::global->set("compress.write_ms", writeMs);
+	Stats::global->set("compress.plain_read_ms", plainReadMs);
+	Stats::global->set("compress.read_ms", readMs);
+	Stats::global->set("compress.roundtrip", same && rewritten == binary ? 1.0 : 0.0);
+#endif
+}
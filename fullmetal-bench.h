@@ -0,0 +1,126 @@
+/*
+ * Benchmarks for the loaders and serialisers of fullmetal.
+ * These are meant to be called from a running program (most need
+ * an OpenGL context), every result is written into fm::Stats::global
+ * so it can be read in code or shown with fm::gui::drawStats().
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace fm {
+	class TextureCache;
+	class NodeTypeTable;
+	struct ObjModel;
+
+	namespace bench {
+		/*
+		 * Loads the textures the old way (decode, mipmap & compress at runtime),
+		 * builds their texture cache entries in parallel, then loads them again from the cache.
+		 * Reports "texcache.cold_ms", "texcache.build_ms" and "texcache.warm_ms".
+		 */
+		void textureCache(const std::vector<std::string>& paths, TextureCache& cache);
+
+		/*
+		 * Culls the meshlets of a model from cameras circling around it, first one meshlet at a time
+		 * and then with cullMeshlets (SSE & threads). The model needs meshlets, see buildMeshlets.
+		 * Reports "meshlets.count", "meshlets.visible_ratio", "meshlets.scalar_us" and "meshlets.simd_us",
+		 * the times are per cull. Doesn't need OpenGL.
+		 */
+		void meshletCulling(ObjModel* model, int iterations = 100);
+
+		/*
+		 * Loads the same model from an .obj (parse & process, see processObjModel) and from a .glb,
+		 * 'iterations' times each, so the two mesh sources can be compared. Bypasses the AssetManager & mesh cache.
+		 * Reports "load.obj_ms", "load.glb_ms" (per load), "load.speedup" and "load.glb_vertices".
+		 * Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void modelLoading(const std::string& objPath, const std::string& glbPath, int iterations = 5);
+
+		/*
+		 * Streams three small objs into 'directory' with ObjModelLoader::stream: one with no faces, one whose vertices
+		 * fill the window they're read back with exactly, so the last read of the vertices finds nothing, and one
+		 * with a line longer than the window. Reports "objstream.no_faces_ok", "objstream.exact_window_ok" &
+		 * "objstream.long_line_ok", 1 if the stream did what it should have, 0 if not. Doesn't need OpenGL.
+		 */
+		void objStreamEdges(const std::string& directory);
+
+		/*
+		 * Builds a scene of 'nodeCount' cubes, spheres & lights (in groups of ten under a parent), then writes
+		 * & reads it as json and in the binary scene format (see fm::io::writeSceneGraph), into 'directory'.
+		 * Reports "scene.json_write_ms", "scene.json_read_ms", "scene.binary_write_ms", "scene.binary_read_ms",
+		 * "scene.json_bytes", "scene.binary_bytes", "scene.read_speedup", "scene.write_speedup" and
+		 * "scene.roundtrip" (1 if the binary scene read back writes the same bytes, 0 if not).
+		 * The json is also read the old way, parsing the whole document before reading the nodes from it,
+		 * reported as "scene.json_dom_read_ms" and "scene.stream_speedup" against the streamed read.
+		 * The json is written compact too, reported as "scene.json_compact_write_ms" and "scene.json_compact_bytes".
+		 * It's read with readSceneGraphParallel too, reported as "scene.json_parallel_read_ms", "scene.parallel_speedup"
+		 * and "scene.parallel_same" (1 if it built the same graph as the serial read, 0 if not).
+		 * Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void sceneFormats(NodeTypeTable* typeTable, const std::string& directory, int nodeCount = 500000);
+
+		/*
+		 * Builds a prop of ten nodes, saves it as a prefab into 'directory', then writes & reads a level with
+		 * 'instanceCount' copies of it twice: deep copies (see cloneNode) and instances of the prefab (see PrefabNode),
+		 * every hundredth instance overriding one of the prop's nodes.
+		 * Reports "prefab.cloned_bytes", "prefab.instanced_bytes", "prefab.cloned_read_ms", "prefab.instanced_read_ms",
+		 * "prefab.read_speedup", "prefab.cloned_nodes" and "prefab.instanced_nodes" (the nodes held in memory).
+		 * Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void prefabInstances(NodeTypeTable* typeTable, const std::string& directory, int instanceCount = 10000);
+
+		/*
+		 * Builds a world of 'subtreeCount' props of ten nodes on a grid, saves it as a binary scene into 'directory',
+		 * then reads it whole and opens it as a lazy scene (see fm::io::LazyScene), flying the camera across it.
+		 * Reports "lazy.full_read_ms", "lazy.open_ms", "lazy.open_speedup", "lazy.full_nodes",
+		 * "lazy.resident_nodes" (the most nodes held during the flight) and "lazy.max_update_ms" (the slowest update).
+		 * Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void lazyScene(NodeTypeTable* typeTable, const std::string& directory, int subtreeCount = 10000);
+
+		/*
+		 * Builds a world of 'propCount' props of ten nodes on a grid, writes it as a world of cells into 'directory'
+		 * (see fm::io::writeWorld), then flies a camera across it at 'speed' units a second, 60 frames a second,
+		 * streaming the cells around it (see fm::io::WorldStreamer). A frame is the time spent in the streamer's update.
+		 * Reports "stream.frame_p50_ms", "stream.frame_p99_ms", "stream.frame_max_ms", "stream.hitches" (frames over
+		 * 16.7ms), "stream.full_read_ms" (the whole world read at once, for comparison), "stream.peak_resident" (cells)
+		 * and "stream.world_bytes". Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void worldStreaming(NodeTypeTable* typeTable, const std::string& directory, int propCount = 40000, float speed = 400.0f);
+
+		/*
+		 * Reads 'nodeCount' nodes of the default shape & light types one at a time through the type table,
+		 * from json (see NodeTypeTable::readNode) and from the binary scene format, to measure the cost of each node.
+		 * Reports "nodes.json_read_ns" & "nodes.binary_read_ns" (per node, the json already parsed) and
+		 * "nodes.binary_scene_read_ns" (per node, read as one binary scene with readNodesBinary).
+		 * Writing them is timed as well, "nodes.json_write_ns" & "nodes.binary_write_ns".
+		 * Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void nodeReading(NodeTypeTable* typeTable, int nodeCount = 200000);
+
+		/*
+		 * Dispatches 'nodeCount' nodes of the default shape & light types by their type, to measure the flat type ids
+		 * (see NodeTypeTable::typeId) against the typeid & map lookup the table used to do.
+		 * Reports "dispatch.map_ns" (the map lookup), "dispatch.flat_first_ns" (the first lookup of each node, which
+		 * stores its id), "dispatch.flat_ns", "dispatch.count_ns" (countTypes) & "dispatch.group_ns" (groupByType),
+		 * per node. With the IO, "dispatch.binary_write_ns" is the whole graph written as a binary scene, per node.
+		 * Doesn't need OpenGL.
+		 */
+		void typeDispatch(NodeTypeTable* typeTable, int nodeCount = 200000);
+
+		/*
+		 * Builds a scene of 'nodeCount' nodes like sceneFormats, then compresses & decompresses its json and its
+		 * binary scene in memory (see fm::compressBytes), on one thread and across the worker threads.
+		 * Reports, for "compress.json_*" & "compress.binary_*": "_bytes" (uncompressed), "_ratio",
+		 * "_compress_mbps", "_compress_serial_mbps", "_decompress_mbps" and "_decompress_serial_mbps" (MB/s of the
+		 * uncompressed data). The json scene is also saved into 'directory' & read back compressed and not, reported as
+		 * "compress.file_bytes", "compress.write_ms", "compress.read_ms", "compress.plain_write_ms" & "compress.plain_read_ms".
+		 * "compress.roundtrip" is 1 if everything decompressed to the same bytes & the same graph, 0 if not.
+		 * Needs the IO (json) to be turned on. Doesn't need OpenGL.
+		 */
+		void sceneCompression(NodeTypeTable* typeTable, const std::string& directory, int nodeCount = 500000);
+	}
+}
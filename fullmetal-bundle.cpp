@@ -0,0 +1,374 @@
+#include "fullmetal-bundle.h"
+
+#ifdef FM_IO
+#include "fullmetal-3d.h"
+#include "fullmetal-gltf.h"
+#include "fullmetal-meshcache.h"
+#include "fullmetal-textures.h"
+#include "fullmetal-filebrowser.h"
+#include "fullmetal-compress.h"
+#include "json.hpp"
+#endif
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <cctype>
+#include <algorithm>
+
+// BUNDLE FORMAT CONSTANTS
+namespace {
+	const unsigned int BUNDLE_MAGIC = 0x4e424d46; // "FMBN"
+	const unsigned int BUNDLE_VERSION = 1;
+
+	// magic, version, entry count, reserved, toc offset & toc size
+	const size_t BUNDLE_HEADER_SIZE = 32;
+
+	// entries start on this alignment, so the mesh arrays can be used in place
+	const size_t BUNDLE_ALIGNMENT = 16;
+
+	// the name of the scene entry, there is only ever one
+	const char* BUNDLE_SCENE_NAME = "scene";
+
+	// the name of the world entry, if there is one
+	const char* BUNDLE_WORLD_NAME = "world";
+}
+
+// BUNDLE IMPLEMENTATION
+fm::BundleEntry::BundleEntry() : type(0), offset(0), size(0) { }
+
+std::string fm::bundleEntryName(const std::string& path)
+{
+	std::string name = path;
+	std::replace(name.begin(), name.end(), '\\', '/');
+
+	// "./Assets/a.obj" and "Assets/a.obj" are the same asset
+	while (name.compare(0, 2, "./") == 0)
+		name.erase(0, 2);
+
+	return name;
+}
+
+bool fm::Bundle::open(const std::string& fp)
+{
+	close();
+
+	if (!_file.open(fp))
+		return false;
+
+	ByteReader reader(_file.data(), _file.size());
+	unsigned int magic = reader.readValue<unsigned int>();
+	unsigned int version = reader.readValue<unsigned int>();
+	unsigned int entryCount = reader.readValue<unsigned int>();
+	reader.skip(sizeof(unsigned int));
+	unsigned long long tocOffset = reader.readValue<unsigned long long>();
+	unsigned long long tocSize = reader.readValue<unsigned long long>();
+
+	if (reader.failed() || magic != BUNDLE_MAGIC || version != BUNDLE_VERSION
+		|| tocOffset > _file.size() || tocSize > _file.size() - tocOffset) {
+		close();
+		return false;
+	}
+
+	ByteReader toc(_file.data() + tocOffset, (size_t)tocSize);
+	for (unsigned int i = 0; i < entryCount; ++i) {
+		BundleEntry entry;
+		entry.type = toc.readValue<unsigned int>();
+		toc.skip(sizeof(unsigned int));
+		entry.offset = toc.readValue<unsigned long long>();
+		entry.size = toc.readValue<unsigned long long>();
+		std::string name = toc.readString();
+
+		// every entry must be inside of the file
+		if (toc.failed() || entry.offset > _file.size() || entry.size > _file.size() - entry.offset) {
+			close();
+			return false;
+		}
+
+		_entries[name] = entry;
+	}
+
+	return true;
+}
+
+void fm::Bundle::close()
+{
+	_file.close();
+	_entries.clear();
+}
+
+bool fm::Bundle::find(const std::string& path, BundleEntryType type, const unsigned char*& data, size_t& size) const
+{
+	auto found = _entries.find(type == BUNDLE_SCENE ? std::string(BUNDLE_SCENE_NAME) : bundleEntryName(path));
+	if (found == _entries.end() || found->second.type != (unsigned int)type)
+		return false;
+
+	data = _file.data() + found->second.offset;
+	size = (size_t)found->second.size;
+	return true;
+}
+
+bool fm::Bundle::findScene(const unsigned char*& data, size_t& size) const
+{
+	return find(BUNDLE_SCENE_NAME, BUNDLE_SCENE, data, size);
+}
+
+bool fm::Bundle::findWorld(const unsigned char*& data, size_t& size) const
+{
+	return find(BUNDLE_WORLD_NAME, BUNDLE_WORLD, data, size);
+}
+
+const std::map<std::string, fm::BundleEntry>& fm::Bundle::entries() const
+{
+	return _entries;
+}
+
+#ifdef FM_IO
+// BUNDLE BUILDER IMPLEMENTATION
+fm::BundleBuildOptions::BundleBuildOptions() : lodRatios(), buildMeshlets(false), worldPath(), compressScene(false) { }
+
+fm::BundleBuildReport::BundleBuildReport() : meshCount(0), textureCount(0), failed(), bundleBytes(0), milliseconds(0.0) { }
+
+namespace {
+	// An entry waiting to be written into the bundle
+	struct PendingEntry {
+		std::string name;
+		std::string sourcePath;
+		fm::BundleEntryType type;
+		std::vector<unsigned char> bytes;
+		bool built;
+	};
+}
+
+// Gets the lower case extension of a path, including the '.'
+static std::string lowerExtension(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension;
+}
+
+static bool isImagePath(const std::string& path)
+{
+	std::string extension = lowerExtension(path);
+	return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".bmp" || extension == ".tga";
+}
+
+static bool isModelPath(const std::string& path)
+{
+	std::string extension = lowerExtension(path);
+	return extension == ".obj" || extension == ".glb";
+}
+
+// Finds the model filepaths (see fm::io::writeObjModel) & material textures a scene refers to
+static void collectSceneAssets(const nlohmann::json& j, std::vector<std::string>& models, std::vector<std::string>& textures)
+{
+	if (j.is_object()) {
+		auto model = j.find("model");
+		if (model != j.end() && model->is_object()) {
+			auto filepath = model->find("filepath");
+			if (filepath != model->end() && filepath->is_string())
+				models.push_back(filepath->get<std::string>());
+		}
+
+		auto texture = j.find("texture");
+		if (texture != j.end() && texture->is_string())
+			textures.push_back(texture->get<std::string>());
+	}
+
+	if (j.is_object() || j.is_array()) {
+		for (auto& child : j)
+			collectSceneAssets(child, models, textures);
+	}
+}
+
+static void collectDirectoryAssets(const std::vector<fm::DirectoryBrowseResult::Item*>& items,
+	std::vector<std::string>& models, std::vector<std::string>& textures)
+{
+	for (auto item : items) {
+		if (item->type == fm::DirectoryBrowseResult::Item::FOLDER)
+			collectDirectoryAssets(item->children, models, textures);
+		else if (isModelPath(item->fullpath))
+			models.push_back(item->fullpath);
+		else if (isImagePath(item->fullpath))
+			textures.push_back(item->fullpath);
+	}
+}
+
+// Loads & processes a model the same way the AssetManager does, into the binary mesh format
+static bool buildMeshEntry(const std::string& fp, const fm::BundleBuildOptions& options, std::vector<unsigned char>& bytes)
+{
+	if (!fm::fileExists(fp))
+		return false;
+
+	fm::ObjModel* model = fm::isGlbPath(fp) ? fm::loadGlbModel(fp) : fm::loadObjModel(fp);
+	if (model == nullptr)
+		return false;
+
+	fm::processObjModel(model);
+
+	if (!options.lodRatios.empty())
+		fm::generateLods(model, options.lodRatios);
+
+	if (options.buildMeshlets)
+		fm::buildMeshlets(model);
+
+	fm::writeMeshBinary(model, bytes);
+	delete model;
+	return true;
+}
+
+bool fm::buildBundle(const std::string& scenePath, const std::string& assetsDirectory, const std::string& bundlePath,
+	const BundleBuildOptions& options, BundleBuildReport* report)
+{
+	Timer timer;
+	BundleBuildReport result;
+
+	// the scene may have been saved compressed
+	std::vector<unsigned char> sceneBytes;
+	if (!readFileDecompressed(scenePath, sceneBytes))
+		return false;
+
+	nlohmann::json scene;
+	try {
+		scene = nlohmann::json::parse(std::string(sceneBytes.begin(), sceneBytes.end()));
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+
+	// the assets the scene refers to, then everything else in the assets directory
+	std::vector<std::string> models, textures;
+	collectSceneAssets(scene, models, textures);
+
+	if (!assetsDirectory.empty()) {
+		DirectoryBrowseResult* browse = browseDirectory(assetsDirectory);
+		if (browse != nullptr) {
+			collectDirectoryAssets(browse->items, models, textures);
+			delete browse;
+		}
+	}
+
+	// each asset once, even if it's used by many nodes
+	std::vector<PendingEntry> entries(1);
+	entries[0].name = BUNDLE_SCENE_NAME;
+	entries[0].type = BUNDLE_SCENE;
+	entries[0].built = true;
+
+	if (options.compressScene)
+		compressBytes(sceneBytes.data(), sceneBytes.size(), entries[0].bytes);
+	else
+		entries[0].bytes.swap(sceneBytes);
+
+	std::set<std::string> names;
+	for (size_t i = 0; i < models.size() + textures.size(); ++i) {
+		bool isModel = i < models.size();
+		const std::string& path = isModel ? models[i] : textures[i - models.size()];
+
+		if (!names.insert(bundleEntryName(path)).second)
+			continue;
+
+		PendingEntry entry;
+		entry.name = bundleEntryName(path);
+		entry.sourcePath = path;
+		entry.type = isModel ? BUNDLE_MESH : BUNDLE_TEXTURE;
+		entry.built = false;
+		entries.push_back(entry);
+	}
+
+	// process the models & compress the textures in parallel
+	parallelFor(entries.size() - 1, [&](size_t i) {
+		PendingEntry& entry = entries[i + 1];
+
+		if (entry.type == BUNDLE_MESH)
+			entry.built = buildMeshEntry(entry.sourcePath, options, entry.bytes);
+		else
+			entry.built = fileExists(entry.sourcePath) && compressTextureToDDS(entry.sourcePath, entry.bytes);
+	});
+
+	// the world is already built, it's stored as it is
+	if (!options.worldPath.empty()) {
+		PendingEntry world;
+		world.name = BUNDLE_WORLD_NAME;
+		world.sourcePath = options.worldPath;
+		world.type = BUNDLE_WORLD;
+		world.built = readFileBytes(options.worldPath, world.bytes);
+		entries.push_back(world);
+	}
+
+	// write into a temporary file, moved over the bundle once it's complete
+	std::string temporaryPath = bundlePath + ".tmp";
+	std::vector<unsigned char> toc;
+	ByteWriter tocWriter(toc);
+	unsigned int entryCount = 0;
+	unsigned long long offset = BUNDLE_HEADER_SIZE;
+	bool written;
+
+	{
+		std::ofstream output(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!output.good())
+			return false;
+
+		// the header is written last, once the toc offset is known
+		static const char padding[BUNDLE_HEADER_SIZE] = { 0 };
+		output.write(padding, BUNDLE_HEADER_SIZE);
+
+		for (auto& entry : entries) {
+			if (!entry.built) {
+				result.failed.push_back(entry.sourcePath);
+				continue;
+			}
+
+			size_t pad = (BUNDLE_ALIGNMENT - offset % BUNDLE_ALIGNMENT) % BUNDLE_ALIGNMENT;
+			output.write(padding, pad);
+			offset += pad;
+
+			output.write(reinterpret_cast<const char*>(entry.bytes.data()), entry.bytes.size());
+
+			tocWriter.writeValue((unsigned int)entry.type);
+			tocWriter.writeValue((unsigned int)0);
+			tocWriter.writeValue(offset);
+			tocWriter.writeValue((unsigned long long)entry.bytes.size());
+			tocWriter.writeString(entry.name);
+			++entryCount;
+
+			offset += entry.bytes.size();
+			result.meshCount += entry.type == BUNDLE_MESH ? 1 : 0;
+			result.textureCount += entry.type == BUNDLE_TEXTURE ? 1 : 0;
+
+			// release it as soon as it's written
+			std::vector<unsigned char>().swap(entry.bytes);
+		}
+
+		unsigned long long tocOffset = offset;
+		output.write(reinterpret_cast<const char*>(toc.data()), toc.size());
+
+		std::vector<unsigned char> header;
+		ByteWriter headerWriter(header);
+		headerWriter.writeValue(BUNDLE_MAGIC);
+		headerWriter.writeValue(BUNDLE_VERSION);
+		headerWriter.writeValue(entryCount);
+		headerWriter.writeValue((unsigned int)0);
+		headerWriter.writeValue(tocOffset);
+		headerWriter.writeValue((unsigned long long)toc.size());
+
+		output.seekp(0);
+		output.write(reinterpret_cast<const char*>(header.data()), header.size());
+		written = output.good();
+		result.bundleBytes = tocOffset + toc.size();
+	}
+
+	if (!written || !replaceFile(temporaryPath, bundlePath)) {
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	result.milliseconds = timer.elapsedMs();
+	if (report != nullptr)
+		*report = result;
+
+	return true;
+}
+#endif
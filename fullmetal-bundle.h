@@ -0,0 +1,131 @@
+/*
+ * The scene bundle, a single file holding a scene's json, its processed meshes (in the binary mesh format),
+ * its precompressed textures (as .dds) and optionally its streamed world, found through a table of contents.
+ * A bundle is memory mapped once and its assets are read in place, by offset, when they are first used,
+ * so a level loads from one file instead of a json plus one file per asset.
+ */
+
+#pragma once
+#include "fullmetal-config.h"
+#include "fullmetal-platform.h"
+
+#include <string>
+#include <vector>
+#include <map>
+
+namespace fm {
+	/*
+	 * What a bundle entry holds.
+	 */
+	enum BundleEntryType {
+		BUNDLE_SCENE = 1,
+		BUNDLE_MESH = 2,
+		BUNDLE_TEXTURE = 3,
+		BUNDLE_WORLD = 4
+	};
+
+	/*
+	 * Where an entry is inside of the bundle file.
+	 */
+	struct BundleEntry {
+		BundleEntry();
+
+		unsigned int type;
+		unsigned long long offset;
+		unsigned long long size;
+	};
+
+	/*
+	 * Gets the name an asset path has inside of a bundle.
+	 * Separators are turned into '/', so paths written on any platform match.
+	 */
+	std::string bundleEntryName(const std::string& path);
+
+	/*
+	 * A memory mapped bundle file.
+	 * Entries are named by the path of the asset they were built from, see bundleEntryName.
+	 */
+	class Bundle {
+	private:
+		MappedFile _file;
+		std::map<std::string, BundleEntry> _entries;
+
+	public:
+		/*
+		 * Maps the bundle & reads its table of contents, closing any bundle opened before.
+		 * Returns false if the file isn't a valid bundle.
+		 */
+		bool open(const std::string& fp);
+
+		/* Unmaps the bundle, data found in it is invalid after this. */
+		void close();
+
+		/*
+		 * Finds an entry of the given type by the path of its asset.
+		 * Returns true and points 'data' into the mapped file if it exists.
+		 */
+		bool find(const std::string& path, BundleEntryType type, const unsigned char*& data, size_t& size) const;
+
+		/*
+		 * Finds the scene of the bundle, its json.
+		 * Returns false if the bundle has no scene.
+		 */
+		bool findScene(const unsigned char*& data, size_t& size) const;
+
+		/*
+		 * Finds the streamed world of the bundle, its cells (see fm::io::WorldStreamer).
+		 * Returns false if the bundle has no world.
+		 */
+		bool findWorld(const unsigned char*& data, size_t& size) const;
+
+		/* Every entry in the bundle, by name. */
+		const std::map<std::string, BundleEntry>& entries() const;
+	};
+
+#ifdef FM_IO
+	/*
+	 * Options for buildBundle.
+	 */
+	struct BundleBuildOptions {
+		BundleBuildOptions();
+
+		/* The lods generated for every mesh, see generateLods. Empty (the default) for none. */
+		std::vector<float> lodRatios;
+
+		/* If true, every mesh is split into meshlets, see buildMeshlets. Off by default. */
+		bool buildMeshlets;
+
+		/* A world file (see fm::io::writeWorld) to store in the bundle with the scene, "" (the default) for none. */
+		std::string worldPath;
+
+		/* If true, the scene's json is stored compressed (see compressBytes), it's detected when it's read. Off by default. */
+		bool compressScene;
+	};
+
+	/*
+	 * What buildBundle did.
+	 */
+	struct BundleBuildReport {
+		BundleBuildReport();
+
+		size_t meshCount;
+		size_t textureCount;
+
+		/* Assets that are referenced (or in the assets directory) but could not be loaded. */
+		std::vector<std::string> failed;
+
+		unsigned long long bundleBytes;
+		double milliseconds;
+	};
+
+	/*
+	 * Builds a bundle offline from a scene json (see fm::io::writeSceneGraph) and an assets directory.
+	 * The bundle holds the scene, every model & texture the scene refers to and every
+	 * model & texture inside of 'assetsDirectory' (pass "" to only bundle what the scene uses).
+	 * Models are processed (see processObjModel) and textures compressed in parallel.
+	 * Returns false if the scene could not be read or the bundle could not be written.
+	 */
+	bool buildBundle(const std::string& scenePath, const std::string& assetsDirectory, const std::string& bundlePath,
+		const BundleBuildOptions& options = BundleBuildOptions(), BundleBuildReport* report = nullptr);
+#endif
+}
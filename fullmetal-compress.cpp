@@ -0,0 +1,550 @@
+#include "fullmetal-compress.h"
+#include "fullmetal-platform.h"
+
+#include <fstream>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <cassert>
+
+// COMPRESSED DATA CONSTANTS
+namespace {
+	const unsigned int COMPRESSED_MAGIC = 0x5a4c4d46; // "FMLZ"
+	const unsigned int COMPRESSED_VERSION = 1;
+	const size_t COMPRESSED_HEADER_SIZE = 12;
+
+	// set in a block's stored size when it didn't compress, so it's stored as it is
+	const unsigned int BLOCK_STORED = 0x80000000;
+
+	// matches are at least 4 bytes, at most 64k back
+	const size_t MIN_MATCH = 4;
+	const size_t MAX_OFFSET = 65535;
+
+	// the last bytes of a block are always literals, so finding a match never reads past the end
+	const size_t END_LITERALS = 8;
+
+	const int HASH_BITS = 16;
+
+	// a block as it's stored, found before the blocks are decompressed
+	struct StoredBlock {
+		const unsigned char* data;
+		size_t storedSize;
+		size_t rawSize;
+		size_t offset;
+		bool stored;
+	};
+}
+
+static inline unsigned int read32(const unsigned char* p)
+{
+	unsigned int value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline unsigned long long read64(const unsigned char* p)
+{
+	unsigned long long value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline unsigned int hashSequence(unsigned int sequence)
+{
+	return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// The most a block of 'size' bytes can take compressed, a run of literals has a length byte every 255 bytes
+static size_t compressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+static void forEachBlock(size_t count, bool parallel, const std::function<void(size_t)>& func)
+{
+	if (parallel) {
+		fm::parallelFor(count, func);
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		func(i);
+}
+
+// BLOCK CODEC
+// Each sequence is a token (the literal length in the high 4 bits, the match length - 4 in the low 4 bits),
+// the literals, then the match's offset back (16 bits) - lengths of 15 carry on in bytes, 255 at a time.
+// The last sequence of a block is only literals.
+static unsigned char* writeLength(unsigned char* op, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*op++ = 255;
+
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+static unsigned char* writeSequence(unsigned char* op, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+	unsigned char* token = op++;
+	*token = (unsigned char)(std::min(literalLength, (size_t)15) << 4);
+	if (literalLength >= 15)
+		op = writeLength(op, literalLength - 15);
+
+	memcpy(op, literals, literalLength);
+	op += literalLength;
+
+	if (matchLength == 0)
+		return op;
+
+	*op++ = (unsigned char)(offset & 0xff);
+	*op++ = (unsigned char)(offset >> 8);
+
+	size_t code = matchLength - MIN_MATCH;
+	*token |= (unsigned char)std::min(code, (size_t)15);
+	if (code >= 15)
+		op = writeLength(op, code - 15);
+
+	return op;
+}
+
+// Counts the bytes that match from 'a' and 'b', 'a' is ahead so it's the one checked against 'end'
+static size_t countMatch(const unsigned char* a, const unsigned char* b, const unsigned char* end)
+{
+	const unsigned char* start = a;
+	while (a + 8 <= end && read64(a) == read64(b)) {
+		a += 8;
+		b += 8;
+	}
+
+	while (a < end && *a == *b) {
+		++a;
+		++b;
+	}
+
+	return a - start;
+}
+
+// Compresses a block into 'dst', which must hold compressBound(size). Returns the compressed size
+static size_t compressBlock(const unsigned char* src, size_t size, unsigned char* dst)
+{
+	unsigned char* op = dst;
+	size_t anchor = 0;
+
+	if (size > END_LITERALS + MIN_MATCH) {
+		// where each hashed sequence was last seen, the table is reused by each thread
+		thread_local std::vector<unsigned int> table;
+		table.assign((size_t)1 << HASH_BITS, 0);
+
+		const size_t matchEnd = size - END_LITERALS;
+		const size_t limit = matchEnd - MIN_MATCH;
+		size_t ip = 0;
+
+		while (ip <= limit) {
+			unsigned int sequence = read32(src + ip);
+			unsigned int& slot = table[hashSequence(sequence)];
+			size_t ref = slot;
+			slot = (unsigned int)ip;
+
+			if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != sequence) {
+				// step further the longer nothing has matched, so data that doesn't compress is skipped quickly
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			// the literals before the match may match too
+			while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+				--ip;
+				--ref;
+			}
+
+			size_t length = MIN_MATCH + countMatch(src + ip + MIN_MATCH, src + ref + MIN_MATCH, src + matchEnd);
+			op = writeSequence(op, src + anchor, ip - anchor, ip - ref, length);
+			ip += length;
+			anchor = ip;
+
+			// the positions inside the match aren't hashed, just the one near its end
+			if (ip - 2 <= limit)
+				table[hashSequence(read32(src + ip - 2))] = (unsigned int)(ip - 2);
+		}
+	}
+
+	op = writeSequence(op, src + anchor, size - anchor, 0, 0);
+	return op - dst;
+}
+
+static bool readLength(const unsigned char*& ip, const unsigned char* end, size_t& length)
+{
+	unsigned char byte;
+	do {
+		if (ip == end)
+			return false;
+
+		byte = *ip++;
+		length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+// Decompresses a block of exactly 'rawSize' bytes into 'dst'. Returns false if it's invalid
+static bool decompressBlock(const unsigned char* src, size_t size, unsigned char* dst, size_t rawSize)
+{
+	const unsigned char* ip = src;
+	const unsigned char* end = src + size;
+	unsigned char* op = dst;
+	unsigned char* outEnd = dst + rawSize;
+
+	while (ip < end) {
+		unsigned int token = *ip++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == 15 && !readLength(ip, end, literalLength))
+			return false;
+
+		if ((size_t)(end - ip) < literalLength || (size_t)(outEnd - op) < literalLength)
+			return false;
+
+		memcpy(op, ip, literalLength);
+		op += literalLength;
+		ip += literalLength;
+
+		// the last sequence is only literals
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return false;
+
+		size_t offset = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+
+		size_t length = token & 15;
+		if (length == 15 && !readLength(ip, end, length))
+			return false;
+
+		length += MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(op - dst) || (size_t)(outEnd - op) < length)
+			return false;
+
+		// a match can overlap what it writes, a run of one byte is a match one back
+		const unsigned char* match = op - offset;
+		if (offset >= length) {
+			memcpy(op, match, length);
+		}
+		else if (offset >= 8) {
+			size_t i = 0;
+			for (; i + 8 <= length; i += 8)
+				memcpy(op + i, match + i, 8);
+			for (; i < length; ++i)
+				op[i] = match[i];
+		}
+		else {
+			for (size_t i = 0; i < length; ++i)
+				op[i] = match[i];
+		}
+
+		op += length;
+	}
+
+	return op == outEnd;
+}
+
+// Compresses the data a block at a time, appending the blocks (each with its raw & stored size) to 'out'
+static void compressBlocks(const unsigned char* data, size_t size, size_t blockSize, bool parallel, std::vector<unsigned char>& out)
+{
+	size_t count = (size + blockSize - 1) / blockSize;
+	std::vector<std::vector<unsigned char>> blocks(count);
+
+	forEachBlock(count, parallel, [&](size_t i) {
+		const unsigned char* raw = data + i * blockSize;
+		size_t rawSize = std::min(blockSize, size - i * blockSize);
+		std::vector<unsigned char>& block = blocks[i];
+		block.resize(8 + compressBound(rawSize));
+
+		unsigned int header[2];
+		size_t storedSize = compressBlock(raw, rawSize, block.data() + 8);
+		if (storedSize >= rawSize) {
+			memcpy(block.data() + 8, raw, rawSize);
+			storedSize = rawSize;
+			header[1] = (unsigned int)rawSize | BLOCK_STORED;
+		}
+		else {
+			header[1] = (unsigned int)storedSize;
+		}
+
+		header[0] = (unsigned int)rawSize;
+		memcpy(block.data(), header, sizeof(header));
+		block.resize(8 + storedSize);
+	});
+
+	for (auto& block : blocks)
+		out.insert(out.end(), block.begin(), block.end());
+}
+
+// Reads the raw & stored size of a block, false if they aren't valid. A raw size of 0 ends the data
+static bool readBlockHeader(const unsigned int* header, size_t blockSize, StoredBlock& block)
+{
+	block.rawSize = header[0];
+	block.stored = (header[1] & BLOCK_STORED) != 0;
+	block.storedSize = header[1] & ~BLOCK_STORED;
+
+	if (block.rawSize == 0)
+		return block.storedSize == 0 && !block.stored;
+
+	return block.rawSize <= blockSize && (!block.stored || block.storedSize == block.rawSize);
+}
+
+static bool decompressBlocks(const std::vector<StoredBlock>& blocks, unsigned char* out, bool parallel)
+{
+	std::atomic<bool> failed(false);
+
+	forEachBlock(blocks.size(), parallel, [&](size_t i) {
+		const StoredBlock& block = blocks[i];
+		if (block.stored)
+			memcpy(out + block.offset, block.data, block.rawSize);
+		else if (!decompressBlock(block.data, block.storedSize, out + block.offset, block.rawSize))
+			failed = true;
+	});
+
+	return !failed;
+}
+
+static void writeCompressedHeader(std::vector<unsigned char>& out, size_t blockSize)
+{
+	fm::ByteWriter w(out);
+	w.writeValue(COMPRESSED_MAGIC);
+	w.writeValue(COMPRESSED_VERSION);
+	w.writeValue((unsigned int)blockSize);
+}
+
+// COMPRESSION IMPLEMENTATION
+void fm::compressBytes(const void* data, size_t size, std::vector<unsigned char>& out, size_t blockSize, bool parallel)
+{
+	assert(blockSize > 0 && blockSize < BLOCK_STORED);
+
+	writeCompressedHeader(out, blockSize);
+	compressBlocks(static_cast<const unsigned char*>(data), size, blockSize, parallel, out);
+
+	// a block of no bytes ends the data
+	ByteWriter w(out);
+	w.writeValue(0u);
+	w.writeValue(0u);
+}
+
+bool fm::decompressBytes(const void* data, size_t size, std::vector<unsigned char>& out, bool parallel)
+{
+	ByteReader r(static_cast<const unsigned char*>(data), size);
+	unsigned int magic = r.readValue<unsigned int>();
+	unsigned int version = r.readValue<unsigned int>();
+	unsigned int blockSize = r.readValue<unsigned int>();
+
+	if (r.failed() || magic != COMPRESSED_MAGIC || version != COMPRESSED_VERSION)
+		return false;
+
+	// find every block first, so they can be decompressed at once
+	std::vector<StoredBlock> blocks;
+	size_t total = 0;
+
+	for (;;) {
+		unsigned int header[2];
+		StoredBlock block;
+		if (!r.read(header, sizeof(header)) || !readBlockHeader(header, blockSize, block))
+			return false;
+
+		if (block.rawSize == 0)
+			break;
+
+		block.data = r.current();
+		block.offset = total;
+		if (!r.skip(block.storedSize))
+			return false;
+
+		blocks.push_back(block);
+		total += block.rawSize;
+	}
+
+	if (r.remaining() != 0)
+		return false;
+
+	size_t start = out.size();
+	out.resize(start + total);
+
+	if (!decompressBlocks(blocks, out.data() + start, parallel)) {
+		out.resize(start);
+		return false;
+	}
+
+	return true;
+}
+
+bool fm::isCompressed(const void* data, size_t size)
+{
+	if (size < COMPRESSED_HEADER_SIZE)
+		return false;
+
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	return read32(bytes) == COMPRESSED_MAGIC && read32(bytes + 4) == COMPRESSED_VERSION;
+}
+
+bool fm::isCompressedFile(const std::string& fp)
+{
+	std::ifstream stream(fp.c_str(), std::ios::binary);
+	unsigned char header[COMPRESSED_HEADER_SIZE];
+	if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)))
+		return false;
+
+	return isCompressed(header, sizeof(header));
+}
+
+bool fm::readFileDecompressed(const std::string& fp, std::vector<unsigned char>& bytes)
+{
+	if (!readFileBytes(fp, bytes))
+		return false;
+
+	if (!isCompressed(bytes.data(), bytes.size()))
+		return true;
+
+	std::vector<unsigned char> decompressed;
+	if (!decompressBytes(bytes.data(), bytes.size(), decompressed)) {
+		bytes.clear();
+		return false;
+	}
+
+	bytes.swap(decompressed);
+	return true;
+}
+
+// COMPRESSED OUTPUT BUFFER IMPLEMENTATION
+fm::CompressedOutputBuffer::CompressedOutputBuffer(std::ostream& output, size_t blockSize, bool parallel)
+	: _output(output), _blockSize(blockSize), _parallel(parallel), _finished(false)
+{
+	assert(blockSize > 0 && blockSize < BLOCK_STORED);
+
+	// a block for each thread, compressed together
+	_pending.resize(blockSize * (parallel ? workerThreadCount() : 1));
+	setp(_pending.data(), _pending.data() + _pending.size());
+
+	writeCompressedHeader(_compressed, blockSize);
+	_output.write(reinterpret_cast<const char*>(_compressed.data()), _compressed.size());
+}
+
+fm::CompressedOutputBuffer::~CompressedOutputBuffer()
+{
+	finish();
+}
+
+bool fm::CompressedOutputBuffer::writePending()
+{
+	size_t used = pptr() - pbase();
+	if (used > 0) {
+		_compressed.clear();
+		compressBlocks(reinterpret_cast<const unsigned char*>(pbase()), used, _blockSize, _parallel, _compressed);
+		_output.write(reinterpret_cast<const char*>(_compressed.data()), _compressed.size());
+		setp(_pending.data(), _pending.data() + _pending.size());
+	}
+
+	return _output.good();
+}
+
+fm::CompressedOutputBuffer::int_type fm::CompressedOutputBuffer::overflow(int_type c)
+{
+	if (_finished || !writePending())
+		return traits_type::eof();
+
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+bool fm::CompressedOutputBuffer::finish()
+{
+	if (_finished)
+		return _output.good();
+
+	writePending();
+	_finished = true;
+
+	unsigned int end[2] = { 0, 0 };
+	_output.write(reinterpret_cast<const char*>(end), sizeof(end));
+	_output.flush();
+	return _output.good();
+}
+
+// COMPRESSED INPUT BUFFER IMPLEMENTATION
+fm::CompressedInputBuffer::CompressedInputBuffer(std::istream& input, bool parallel)
+	: _input(input), _parallel(parallel), _blockSize(0), _ended(false), _failed(false)
+{
+	unsigned int header[3];
+	if (!_input.read(reinterpret_cast<char*>(header), sizeof(header)) || !isCompressed(header, sizeof(header))) {
+		_failed = true;
+		return;
+	}
+
+	_blockSize = header[2];
+}
+
+fm::CompressedInputBuffer::int_type fm::CompressedInputBuffer::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+
+	if (_ended || _failed)
+		return traits_type::eof();
+
+	// read a block for each thread, then decompress them together
+	size_t batch = _parallel ? workerThreadCount() : 1;
+	std::vector<StoredBlock> blocks;
+	std::vector<size_t> positions;
+	size_t total = 0;
+	_stored.clear();
+
+	while (blocks.size() < batch) {
+		unsigned int header[2];
+		StoredBlock block;
+		if (!_input.read(reinterpret_cast<char*>(header), sizeof(header)) || !readBlockHeader(header, _blockSize, block)) {
+			_failed = true;
+			return traits_type::eof();
+		}
+
+		if (block.rawSize == 0) {
+			_ended = true;
+			break;
+		}
+
+		positions.push_back(_stored.size());
+		_stored.resize(_stored.size() + block.storedSize);
+		if (!_input.read(reinterpret_cast<char*>(_stored.data() + positions.back()), block.storedSize)) {
+			_failed = true;
+			return traits_type::eof();
+		}
+
+		block.offset = total;
+		blocks.push_back(block);
+		total += block.rawSize;
+	}
+
+	// the stored data has stopped moving now
+	for (size_t i = 0; i < blocks.size(); ++i)
+		blocks[i].data = _stored.data() + positions[i];
+
+	_buffer.resize(total);
+	if (!decompressBlocks(blocks, reinterpret_cast<unsigned char*>(_buffer.data()), _parallel)) {
+		_failed = true;
+		return traits_type::eof();
+	}
+
+	if (total == 0)
+		return traits_type::eof();
+
+	setg(_buffer.data(), _buffer.data(), _buffer.data() + total);
+	return traits_type::to_int_type(*gptr());
+}
+
+bool fm::CompressedInputBuffer::failed() const
+{
+	return _failed;
+}
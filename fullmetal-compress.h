@@ -0,0 +1,106 @@
+/*
+ * Block compression for the stored scenes and bundles.
+ * A small LZ77 codec in the style of LZ4 (byte aligned, no entropy coding), so it decompresses at close to memory speed.
+ * The data is split into blocks compressed on their own, so they're compressed & decompressed in parallel
+ * across the worker threads (see parallelFor). Compressed data starts with a magic, the readers detect it on their own.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+
+namespace fm {
+	/*
+	 * Compresses a block of bytes, appending the compressed data to 'out'.
+	 * The data is split into blocks of 'blockSize' bytes, compressed across the worker threads unless not 'parallel'.
+	 * Blocks that don't get any smaller are stored as they are.
+	 */
+	void compressBytes(const void* data, size_t size, std::vector<unsigned char>& out,
+		size_t blockSize = 1 << 20, bool parallel = true);
+
+	/*
+	 * Decompresses data written by compressBytes (or a CompressedOutputBuffer), appending it to 'out'.
+	 * The blocks are decompressed across the worker threads unless not 'parallel'.
+	 * Returns false (and appends nothing) if the data is invalid.
+	 */
+	bool decompressBytes(const void* data, size_t size, std::vector<unsigned char>& out, bool parallel = true);
+
+	/*
+	 * True if the data starts like compressed data, see compressBytes.
+	 */
+	bool isCompressed(const void* data, size_t size);
+
+	/*
+	 * True if the file starts like compressed data, see compressBytes.
+	 */
+	bool isCompressedFile(const std::string& fp);
+
+	/*
+	 * Reads an entire file into the given buffer like readFileBytes, decompressing it if it's compressed.
+	 * Returns false if the file could not be opened, or is compressed but invalid.
+	 */
+	bool readFileDecompressed(const std::string& fp, std::vector<unsigned char>& bytes);
+
+	/*
+	 * A stream buffer that compresses what's written through it into another stream, in the format of compressBytes.
+	 * A block for each of the worker threads is held, and compressed together once they're full.
+	 * Call finish() once everything is written, the destructor does if it hasn't been.
+	 */
+	class CompressedOutputBuffer : public std::streambuf {
+	private:
+		std::ostream& _output;
+		size_t _blockSize;
+		bool _parallel;
+		std::vector<char> _pending;
+		std::vector<unsigned char> _compressed;
+		bool _finished;
+
+		CompressedOutputBuffer(const CompressedOutputBuffer&) = delete;
+		CompressedOutputBuffer& operator=(const CompressedOutputBuffer&) = delete;
+
+		bool writePending();
+
+	protected:
+		int_type overflow(int_type c) override;
+
+	public:
+		CompressedOutputBuffer(std::ostream& output, size_t blockSize = 1 << 20, bool parallel = true);
+		~CompressedOutputBuffer();
+
+		/* Compresses what's left & ends the data. Returns false if the stream failed. */
+		bool finish();
+	};
+
+	/*
+	 * A stream buffer that decompresses the data of another stream as it's read, see compressBytes.
+	 * The blocks are read a batch at a time, one for each of the worker threads, and decompressed together.
+	 * Only a batch is ever held, so the whole data is never in memory.
+	 */
+	class CompressedInputBuffer : public std::streambuf {
+	private:
+		std::istream& _input;
+		bool _parallel;
+		size_t _blockSize;
+		std::vector<char> _buffer;
+		std::vector<unsigned char> _stored;
+		bool _ended;
+		bool _failed;
+
+		CompressedInputBuffer(const CompressedInputBuffer&) = delete;
+		CompressedInputBuffer& operator=(const CompressedInputBuffer&) = delete;
+
+	protected:
+		int_type underflow() override;
+
+	public:
+		/* Reads the start of the compressed data, failed() is true if the stream isn't compressed. */
+		CompressedInputBuffer(std::istream& input, bool parallel = true);
+
+		/* True if the data was invalid or ended early. */
+		bool failed() const;
+	};
+}
@@ -11,3 +11,9 @@
 // Defines if the node IO is turned on or not.
 // 1 for on, 0 for off
 #define FM_IO 1
+
+// Defines if SSE is used by the culling & bounds code, when the compiler targets it.
+// Comment this out to force the scalar versions
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define FM_SSE 1
+#endif
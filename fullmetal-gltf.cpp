@@ -0,0 +1,539 @@
+#include "fullmetal-gltf.h"
+
+#ifdef FM_IO
+
+#include "fullmetal-3d.h"
+
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+
+// GLB FORMAT CONSTANTS
+namespace {
+	const unsigned int GLB_MAGIC = 0x46546c67; // "glTF"
+	const unsigned int GLB_VERSION = 2;
+	const unsigned int GLB_CHUNK_JSON = 0x4e4f534a; // "JSON"
+	const unsigned int GLB_CHUNK_BIN = 0x004e4942; // "BIN\0"
+
+	// accessor component types, the GL enums
+	const int GLB_BYTE = 5120;
+	const int GLB_UNSIGNED_BYTE = 5121;
+	const int GLB_SHORT = 5122;
+	const int GLB_UNSIGNED_SHORT = 5123;
+	const int GLB_UNSIGNED_INT = 5125;
+	const int GLB_FLOAT = 5126;
+
+	const int GLB_MODE_TRIANGLES = 4;
+
+	// nodes deeper than this are ignored, a valid file never gets close
+	const int GLB_MAX_NODE_DEPTH = 64;
+}
+
+// GLB ACCESSOR IMPLEMENTATION
+fm::GlbAccessor::GlbAccessor() : data(nullptr), count(0), stride(0), componentType(0), components(0), normalized(false) { }
+
+float fm::GlbAccessor::readFloat(size_t index, int component) const
+{
+	assert(index < count && component < components);
+	const unsigned char* element = data + index * stride;
+
+	// components may not be aligned in a mapped file, so they are copied out
+	switch (componentType) {
+		case GLB_FLOAT: {
+			float value;
+			memcpy(&value, element + component * sizeof(float), sizeof(value));
+			return value;
+		}
+
+		case GLB_BYTE: {
+			signed char value = (signed char)element[component];
+			return normalized ? std::max(value / 127.0f, -1.0f) : (float)value;
+		}
+
+		case GLB_UNSIGNED_BYTE: {
+			unsigned char value = element[component];
+			return normalized ? value / 255.0f : (float)value;
+		}
+
+		case GLB_SHORT: {
+			short value;
+			memcpy(&value, element + component * sizeof(short), sizeof(value));
+			return normalized ? std::max(value / 32767.0f, -1.0f) : (float)value;
+		}
+
+		case GLB_UNSIGNED_SHORT: {
+			unsigned short value;
+			memcpy(&value, element + component * sizeof(unsigned short), sizeof(value));
+			return normalized ? value / 65535.0f : (float)value;
+		}
+
+		case GLB_UNSIGNED_INT: {
+			unsigned int value;
+			memcpy(&value, element + component * sizeof(unsigned int), sizeof(value));
+			return (float)value;
+		}
+
+		default:
+			return 0.0f;
+	}
+}
+
+void fm::GlbAccessor::readFloats(size_t index, float * values, int count) const
+{
+	assert(count <= components);
+
+	if (componentType == GLB_FLOAT) {
+		memcpy(values, data + index * stride, count * sizeof(float));
+		return;
+	}
+
+	for (int component = 0; component < count; ++component)
+		values[component] = readFloat(index, component);
+}
+
+unsigned int fm::GlbAccessor::readIndex(size_t index) const
+{
+	assert(index < count);
+	const unsigned char* element = data + index * stride;
+
+	switch (componentType) {
+		case GLB_UNSIGNED_BYTE:
+			return element[0];
+
+		case GLB_UNSIGNED_SHORT: {
+			unsigned short value;
+			memcpy(&value, element, sizeof(value));
+			return value;
+		}
+
+		case GLB_UNSIGNED_INT: {
+			unsigned int value;
+			memcpy(&value, element, sizeof(value));
+			return value;
+		}
+
+		default:
+			return 0;
+	}
+}
+
+// GLB FILE IMPLEMENTATION
+fm::GlbFile::GlbFile() : _file(), _document(), _binary(nullptr), _binarySize(0) { }
+
+bool fm::GlbFile::open(const std::string & fp)
+{
+	_binary = nullptr;
+	_binarySize = 0;
+
+	if (!_file.open(fp))
+		return false;
+
+	// header, then the json chunk
+	ByteReader reader(_file.data(), _file.size());
+	unsigned int magic = reader.readValue<unsigned int>();
+	unsigned int version = reader.readValue<unsigned int>();
+	unsigned int length = reader.readValue<unsigned int>();
+	if (reader.failed() || magic != GLB_MAGIC || version != GLB_VERSION || length > _file.size())
+		return false;
+
+	unsigned int jsonLength = reader.readValue<unsigned int>();
+	unsigned int jsonType = reader.readValue<unsigned int>();
+	const unsigned char* jsonData = reader.current();
+	reader.skip(jsonLength);
+	if (reader.failed() || jsonType != GLB_CHUNK_JSON)
+		return false;
+
+	// the json is small next to the binary chunk, so it's the only part that is parsed
+	try {
+		_document = nlohmann::json::parse(std::string(reinterpret_cast<const char*>(jsonData), jsonLength));
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+
+	// the binary chunk is optional, it's used in place
+	if (reader.remaining() >= sizeof(unsigned int) * 2) {
+		unsigned int binaryLength = reader.readValue<unsigned int>();
+		unsigned int binaryType = reader.readValue<unsigned int>();
+
+		if (binaryType == GLB_CHUNK_BIN && binaryLength <= reader.remaining()) {
+			_binary = reader.current();
+			_binarySize = binaryLength;
+		}
+	}
+
+	return _document.is_object();
+}
+
+const nlohmann::json & fm::GlbFile::document() const
+{
+	return _document;
+}
+
+bool fm::GlbFile::accessor(size_t index, GlbAccessor & view) const
+{
+	auto accessors = _document.find("accessors");
+	if (accessors == _document.end() || index >= accessors->size())
+		return false;
+
+	const nlohmann::json& accessor = (*accessors)[index];
+
+	// sparse & zero filled (no buffer view) accessors would need copying, and exporters don't use them for meshes
+	if (accessor.find("sparse") != accessor.end() || accessor.find("bufferView") == accessor.end())
+		return false;
+
+	size_t viewIndex = accessor["bufferView"].get<size_t>();
+	const nlohmann::json& bufferViews = _document.at("bufferViews");
+	if (viewIndex >= bufferViews.size())
+		return false;
+
+	// only the first buffer can be the binary chunk, external buffers aren't supported
+	const nlohmann::json& bufferView = bufferViews[viewIndex];
+	const nlohmann::json& buffer = _document.at("buffers").at(0);
+	if (bufferView.value("buffer", 0) != 0 || buffer.find("uri") != buffer.end() || _binary == nullptr)
+		return false;
+
+	view.componentType = accessor.at("componentType").get<int>();
+	view.normalized = accessor.value("normalized", false);
+	view.count = accessor.at("count").get<size_t>();
+
+	std::string type = accessor.at("type").get<std::string>();
+	if (type == "SCALAR") view.components = 1;
+	else if (type == "VEC2") view.components = 2;
+	else if (type == "VEC3") view.components = 3;
+	else if (type == "VEC4" || type == "MAT2") view.components = 4;
+	else if (type == "MAT3") view.components = 9;
+	else if (type == "MAT4") view.components = 16;
+	else return false;
+
+	size_t componentSize = 0;
+	switch (view.componentType) {
+		case GLB_BYTE: case GLB_UNSIGNED_BYTE: componentSize = 1; break;
+		case GLB_SHORT: case GLB_UNSIGNED_SHORT: componentSize = 2; break;
+		case GLB_UNSIGNED_INT: case GLB_FLOAT: componentSize = 4; break;
+		default: return false;
+	}
+
+	size_t elementSize = componentSize * view.components;
+	view.stride = bufferView.value("byteStride", (size_t)0);
+	if (view.stride == 0)
+		view.stride = elementSize;
+
+	// the view must be inside the binary chunk, and the accessor inside the view
+	size_t viewOffset = bufferView.value("byteOffset", (size_t)0);
+	size_t viewLength = bufferView.at("byteLength").get<size_t>();
+	size_t accessorOffset = accessor.value("byteOffset", (size_t)0);
+	if (viewOffset > _binarySize || viewLength > _binarySize - viewOffset || view.stride < elementSize)
+		return false;
+
+	if (view.count > 0 && (accessorOffset > viewLength || (view.count - 1) > (viewLength - accessorOffset) / view.stride
+		|| accessorOffset + (view.count - 1) * view.stride + elementSize > viewLength))
+		return false;
+
+	view.data = _binary + viewOffset + accessorOffset;
+	return true;
+}
+
+// GLB MODEL LOADER IMPLEMENTATION
+namespace {
+	// A mesh placed in the scene by a node
+	struct GlbInstance {
+		size_t mesh;
+		float matrix[16];
+	};
+}
+
+// out = a * b, column major
+static void multiplyMatrices(const float* a, const float* b, float* out)
+{
+	for (int column = 0; column < 4; ++column) {
+		for (int row = 0; row < 4; ++row) {
+			float sum = 0.0f;
+			for (int k = 0; k < 4; ++k)
+				sum += a[k * 4 + row] * b[column * 4 + k];
+			out[column * 4 + row] = sum;
+		}
+	}
+}
+
+// Gets the local matrix of a node, from its matrix or its translation, rotation & scale
+static void readNodeMatrix(const nlohmann::json& node, float* matrix)
+{
+	auto found = node.find("matrix");
+	if (found != node.end() && found->size() == 16) {
+		for (int i = 0; i < 16; ++i)
+			matrix[i] = (*found)[i].get<float>();
+		return;
+	}
+
+	float translation[3] = { 0.0f, 0.0f, 0.0f };
+	float rotation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	float scale[3] = { 1.0f, 1.0f, 1.0f };
+
+	if ((found = node.find("translation")) != node.end() && found->size() == 3)
+		for (int i = 0; i < 3; ++i) translation[i] = (*found)[i].get<float>();
+
+	if ((found = node.find("rotation")) != node.end() && found->size() == 4)
+		for (int i = 0; i < 4; ++i) rotation[i] = (*found)[i].get<float>();
+
+	if ((found = node.find("scale")) != node.end() && found->size() == 3)
+		for (int i = 0; i < 3; ++i) scale[i] = (*found)[i].get<float>();
+
+	// T * R * S, the rotation is a quaternion (x, y, z, w)
+	float x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+	float rows[3][3] = {
+		{ 1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y - z * w), 2.0f * (x * z + y * w) },
+		{ 2.0f * (x * y + z * w), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z - x * w) },
+		{ 2.0f * (x * z - y * w), 2.0f * (y * z + x * w), 1.0f - 2.0f * (x * x + y * y) }
+	};
+
+	for (int column = 0; column < 3; ++column) {
+		for (int row = 0; row < 3; ++row)
+			matrix[column * 4 + row] = rows[row][column] * scale[column];
+		matrix[column * 4 + 3] = 0.0f;
+	}
+
+	matrix[12] = translation[0];
+	matrix[13] = translation[1];
+	matrix[14] = translation[2];
+	matrix[15] = 1.0f;
+}
+
+// Walks a node & its children, collecting the meshes they place
+static void collectInstances(const nlohmann::json& nodes, size_t index, const float* parent, int depth,
+	std::vector<GlbInstance>& instances)
+{
+	if (index >= nodes.size() || depth > GLB_MAX_NODE_DEPTH)
+		return;
+
+	const nlohmann::json& node = nodes[index];
+	float local[16];
+	GlbInstance instance;
+	readNodeMatrix(node, local);
+	multiplyMatrices(parent, local, instance.matrix);
+
+	auto mesh = node.find("mesh");
+	if (mesh != node.end()) {
+		instance.mesh = mesh->get<size_t>();
+		instances.push_back(instance);
+	}
+
+	auto children = node.find("children");
+	if (children != node.end()) {
+		for (auto& child : *children)
+			collectInstances(nodes, child.get<size_t>(), instance.matrix, depth + 1, instances);
+	}
+}
+
+// Appends a triangle primitive to the buffer, transformed by the matrix of its instance
+static bool appendPrimitive(const fm::GlbFile& file, const nlohmann::json& primitive, const GlbInstance& instance,
+	fm::MeshBuffer& buffer)
+{
+	if (primitive.value("mode", GLB_MODE_TRIANGLES) != GLB_MODE_TRIANGLES)
+		return true;
+
+	const nlohmann::json& attributes = primitive.at("attributes");
+	auto positionAttribute = attributes.find("POSITION");
+	auto normalAttribute = attributes.find("NORMAL");
+	auto uvAttribute = attributes.find("TEXCOORD_0");
+
+	fm::GlbAccessor positions, normals, uvs, indices;
+	if (positionAttribute == attributes.end() || !file.accessor(positionAttribute->get<size_t>(), positions)
+		|| positions.components != 3)
+		return false;
+
+	bool hasNormals = normalAttribute != attributes.end();
+	if (hasNormals && (!file.accessor(normalAttribute->get<size_t>(), normals) || normals.components != 3
+		|| normals.count != positions.count))
+		return false;
+
+	bool hasUvs = uvAttribute != attributes.end();
+	if (hasUvs && (!file.accessor(uvAttribute->get<size_t>(), uvs) || uvs.components != 2 || uvs.count != positions.count))
+		return false;
+
+	auto indexAccessor = primitive.find("indices");
+	bool hasIndices = indexAccessor != primitive.end();
+	if (hasIndices && (!file.accessor(indexAccessor->get<size_t>(), indices) || indices.components != 1))
+		return false;
+
+	// normals are transformed by the cofactor matrix, which handles non uniform scale
+	const float* m = instance.matrix;
+	float cofactor[9] = {
+		m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+		m[9] * m[2] - m[10] * m[1], m[10] * m[0] - m[8] * m[2], m[8] * m[1] - m[9] * m[0],
+		m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4]
+	};
+	float determinant = m[0] * cofactor[0] + m[1] * cofactor[1] + m[2] * cofactor[2];
+	float normalSign = determinant < 0.0f ? -1.0f : 1.0f;
+
+	size_t base = buffer.vertices.size();
+	buffer.vertices.resize(base + positions.count);
+
+	for (size_t i = 0; i < positions.count; ++i) {
+		fm::MeshVertex& vertex = buffer.vertices[base + i];
+		float position[3], normal[3] = { 0.0f, 0.0f, 0.0f }, uv[2] = { 0.0f, 0.0f };
+		positions.readFloats(i, position, 3);
+
+		for (int row = 0; row < 3; ++row)
+			vertex.position[row] = m[row] * position[0] + m[4 + row] * position[1] + m[8 + row] * position[2] + m[12 + row];
+
+		if (hasNormals) {
+			normals.readFloats(i, normal, 3);
+			float length = 0.0f;
+			for (int row = 0; row < 3; ++row) {
+				vertex.normal[row] = normalSign * (cofactor[row * 3] * normal[0] + cofactor[row * 3 + 1] * normal[1]
+					+ cofactor[row * 3 + 2] * normal[2]);
+				length += vertex.normal[row] * vertex.normal[row];
+			}
+
+			length = length > 0.0f ? 1.0f / sqrtf(length) : 0.0f;
+			for (int row = 0; row < 3; ++row)
+				vertex.normal[row] *= length;
+		}
+		else {
+			memset(vertex.normal, 0, sizeof(vertex.normal));
+		}
+
+		// gltf uvs start at the top of the image, obj (and gl) ones at the bottom
+		if (hasUvs)
+			uvs.readFloats(i, uv, 2);
+		vertex.uv[0] = uv[0];
+		vertex.uv[1] = 1.0f - uv[1];
+	}
+
+	size_t indexCount = hasIndices ? indices.count : positions.count;
+	size_t firstIndex = buffer.indices.size();
+	buffer.indices.resize(firstIndex + indexCount - indexCount % 3);
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		unsigned int corners[3];
+		for (int corner = 0; corner < 3; ++corner) {
+			corners[corner] = hasIndices ? indices.readIndex(i + corner) : (unsigned int)(i + corner);
+			if (corners[corner] >= positions.count)
+				return false;
+		}
+
+		// a mirroring transform turns the triangles inside out, so flip their winding back
+		if (determinant < 0.0f)
+			std::swap(corners[1], corners[2]);
+
+		for (int corner = 0; corner < 3; ++corner)
+			buffer.indices[firstIndex + i + corner] = (unsigned int)base + corners[corner];
+	}
+
+	// no normals in the file, use area weighted face normals
+	if (!hasNormals) {
+		for (size_t i = firstIndex; i < buffer.indices.size(); i += 3) {
+			fm::MeshVertex* corners[3] = { &buffer.vertices[buffer.indices[i]], &buffer.vertices[buffer.indices[i + 1]],
+				&buffer.vertices[buffer.indices[i + 2]] };
+
+			float edge1[3], edge2[3];
+			for (int k = 0; k < 3; ++k) {
+				edge1[k] = corners[1]->position[k] - corners[0]->position[k];
+				edge2[k] = corners[2]->position[k] - corners[0]->position[k];
+			}
+
+			float face[3] = { edge1[1] * edge2[2] - edge1[2] * edge2[1], edge1[2] * edge2[0] - edge1[0] * edge2[2],
+				edge1[0] * edge2[1] - edge1[1] * edge2[0] };
+
+			for (auto corner : corners)
+				for (int k = 0; k < 3; ++k)
+					corner->normal[k] += face[k];
+		}
+
+		for (size_t i = base; i < buffer.vertices.size(); ++i) {
+			float* normal = buffer.vertices[i].normal;
+			float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (length > 0.0f)
+				for (int k = 0; k < 3; ++k)
+					normal[k] /= length;
+		}
+	}
+
+	return true;
+}
+
+fm::ObjModel * fm::GlbModelLoader::load(const std::string & fp)
+{
+	GlbFile file;
+	if (!file.open(fp))
+		return nullptr;
+
+	const nlohmann::json& document = file.document();
+	MeshBuffer* buffer = new MeshBuffer();
+	bool loaded = true;
+
+	// the json comes from the file, so any missing or mistyped value fails the load
+	try {
+		const nlohmann::json& meshes = document.at("meshes");
+		std::vector<GlbInstance> instances;
+
+		static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+		auto scenes = document.find("scenes");
+		auto nodes = document.find("nodes");
+
+		if (scenes != document.end() && nodes != document.end() && !scenes->empty()) {
+			size_t sceneIndex = std::min(document.value("scene", (size_t)0), scenes->size() - 1);
+			const nlohmann::json& scene = (*scenes)[sceneIndex];
+
+			auto roots = scene.find("nodes");
+			if (roots != scene.end()) {
+				for (auto& root : *roots)
+					collectInstances(*nodes, root.get<size_t>(), identity, 0, instances);
+			}
+		}
+		else {
+			// no scene, so every mesh once, untransformed
+			for (size_t mesh = 0; mesh < meshes.size(); ++mesh) {
+				GlbInstance instance;
+				instance.mesh = mesh;
+				memcpy(instance.matrix, identity, sizeof(identity));
+				instances.push_back(instance);
+			}
+		}
+
+		for (auto& instance : instances) {
+			if (instance.mesh >= meshes.size()) {
+				loaded = false;
+				break;
+			}
+
+			for (auto& primitive : meshes[instance.mesh].at("primitives"))
+				loaded = loaded && appendPrimitive(file, primitive, instance, *buffer);
+		}
+	}
+	catch (const std::exception&) {
+		loaded = false;
+	}
+
+	if (!loaded || buffer->indices.empty()) {
+		delete buffer;
+		return nullptr;
+	}
+
+	ObjModel* model = new ObjModel();
+	model->filepath = fp;
+	model->buffer = buffer;
+	model->bounds = computeBounds(buffer->vertices[0].position, buffer->vertices.size(), sizeof(MeshVertex));
+	return model;
+}
+
+fm::ObjModel * fm::loadGlbModel(const std::string & filepath)
+{
+	GlbModelLoader glbLoader;
+	return glbLoader.load(filepath);
+}
+
+bool fm::isGlbPath(const std::string & filepath)
+{
+	if (filepath.size() < 4)
+		return false;
+
+	std::string extension = filepath.substr(filepath.size() - 4);
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	return extension == ".glb";
+}
+
+#endif // END
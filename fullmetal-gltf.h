@@ -0,0 +1,105 @@
+/*
+ * The glTF 2.0 binary (.glb) loader.
+ * A .glb is a small json description followed by a binary chunk holding the vertex & index arrays,
+ * so loading one is mapping the file and reading those arrays in place, nothing is tokenised.
+ */
+
+#pragma once
+#include "fullmetal-config.h"
+
+#ifdef FM_IO
+
+#include "fullmetal-platform.h"
+#include "json.hpp"
+#include <string>
+
+namespace fm {
+	struct ObjModel;
+
+	/*
+	 * A typed view of a glTF accessor, pointing straight into the binary chunk of a GlbFile.
+	 * Only valid while the GlbFile it came from is open.
+	 */
+	struct GlbAccessor {
+		GlbAccessor();
+
+		/* The first element. */
+		const unsigned char* data;
+
+		/* The number of elements. */
+		size_t count;
+
+		/* The bytes between the start of each element. */
+		size_t stride;
+
+		/* The GL type of each component, e.g. 5126 for GL_FLOAT. */
+		int componentType;
+
+		/* The components per element, 1 for SCALAR up to 16 for MAT4. */
+		int components;
+
+		/* If integer components map to 0-1 (or -1-1) when read as floats. */
+		bool normalized;
+
+		/* Reads a component of an element as a float, converting integer types. */
+		float readFloat(size_t index, int component) const;
+
+		/* Reads 'count' components of an element as floats, copying float data directly. */
+		void readFloats(size_t index, float* values, int count) const;
+
+		/* Reads an element of an unsigned integer scalar accessor, as used for indices. */
+		unsigned int readIndex(size_t index) const;
+	};
+
+	/*
+	 * A memory mapped .glb file, with its json parsed and its binary chunk left in place.
+	 */
+	class GlbFile {
+	private:
+		MappedFile _file;
+		nlohmann::json _document;
+		const unsigned char* _binary;
+		size_t _binarySize;
+
+	public:
+		GlbFile();
+
+		/*
+		 * Maps and validates the file, then parses the json chunk.
+		 * Returns false if it isn't a glTF 2.0 binary file.
+		 */
+		bool open(const std::string& fp);
+
+		/* The parsed json chunk. */
+		const nlohmann::json& document() const;
+
+		/*
+		 * Gets a view of an accessor.
+		 * Returns false if the accessor is invalid, sparse, or stored outside of the binary chunk.
+		 */
+		bool accessor(size_t index, GlbAccessor& view) const;
+	};
+
+	/*
+	 * Utility for loading a .glb file into an ObjModel.
+	 * Every triangle primitive of the default scene is merged into the model's MeshBuffer,
+	 * transformed by its node, so the model draws through the same path as a processed obj.
+	 */
+	class GlbModelLoader {
+	public:
+		ObjModel* load(const std::string& fp);
+	};
+
+	/*
+	 * Loads a .glb model.
+	 * Returns nullptr on failure to load.
+	 */
+	ObjModel* loadGlbModel(const std::string& filepath);
+
+	/*
+	 * Checks if a filepath has the .glb extension.
+	 */
+	bool isGlbPath(const std::string& filepath);
+}
+
+#endif
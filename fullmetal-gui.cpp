@@ -9,9 +9,11 @@
 #include "fullmetal-types.h"
 #include "fullmetal-filebrowser.h"
 #include "fullmetal-3d.h"
+#include "fullmetal-platform.h"
 
 #ifdef FM_IO
 #include "fullmetal-io.h"
+#include "fullmetal-journal.h"
 #endif
 
 #include "glut.h"
@@ -31,7 +33,7 @@ fm::ObjModel** _importObjModelRef = nullptr;
 static fm::gui::DirectoryGuiView* objDirectory = nullptr;
 static fm::gui::DirectoryGuiView* txrDirectory = nullptr;
 
-fm::gui::GraphRenderConfig::GraphRenderConfig() : window_toggled(true), selected_node(nullptr) { }
+fm::gui::GraphRenderConfig::GraphRenderConfig() : window_toggled(true), selected_node(nullptr), autosave(nullptr), journal(nullptr), lazy_scene(nullptr), compress(false) { }
 
 void fm::gui::updateNodeGraphGui(SceneNodeGraph* nodeGraph, GraphRenderConfig* config, NodeTypeTable* typeTable)
 {
@@ -54,19 +56,58 @@ void fm::gui::drawNormalState(SceneNodeGraph * nodeGraph, GraphRenderConfig * co
 #ifdef FM_IO
 		// Allow writing of the scene graph
 		if (ImGui::Button("Save##tree")) {
-			fm::io::writeSceneGraph(config->filepath, nodeGraph, typeTable);
+			// every subtree of a lazy scene must be loaded to be written
+			if (config->lazy_scene != nullptr)
+				config->lazy_scene->loadAll();
+
+			if (config->journal != nullptr)
+				config->journal->compact(nodeGraph);
+			else
+				fm::io::writeSceneGraph(config->filepath, nodeGraph, typeTable, false, config->compress);
 		}
 
+		ImGui::SameLine();
+		ImGui::Checkbox("Compress##tree", &config->compress);
+
 		ImGui::SameLine();
 
 		// Show the filepath that we're using..
 		ImGui::Text(config->filepath.c_str());
+
+		// Switches to the next journal once a save has been written
+		if (config->journal != nullptr)
+			config->journal->update();
+
+		// Snapshots the graph when it's due, the file is written in the background
+		// (not while a lazy scene has unloaded subtrees, the snapshot would only have their stubs)
+		if (config->autosave != nullptr) {
+			bool partial = config->lazy_scene != nullptr && config->lazy_scene->loadedCount() < config->lazy_scene->subtreeCount();
+			if (!partial)
+				config->autosave->update(nodeGraph, typeTable);
+
+			std::string autosaveText = config->autosave->saving() ? "Autosaving..." : "Autosaves: " + std::to_string(config->autosave->count());
+			ImGui::Text(autosaveText.c_str());
+		}
+
 		ImGui::Separator();
 #endif
 
 		// Displays the number of nodes inside the scene
 		ImGui::LabelText("Scene Node Count", std::to_string(nodeGraph->nodeCount()).c_str());
 
+		// and the number of each type, counted only while it's open
+		if (typeTable != nullptr && ImGui::TreeNode("Node Types")) {
+			std::vector<unsigned int> counts;
+			typeTable->countTypes(nodeGraph->getNodes(), counts);
+
+			for (unsigned int type = 1; type < counts.size(); ++type) {
+				if (counts[type] > 0)
+					ImGui::LabelText(typeTable->getIdOfType(type).c_str(), std::to_string(counts[type]).c_str());
+			}
+
+			ImGui::TreePop();
+		}
+
 		// if we're provided with a type table, show the add option
 		if (typeTable != nullptr) {
 			drawAddNodeOptions(nodeGraph, config, typeTable);
@@ -79,10 +120,34 @@ void fm::gui::drawNormalState(SceneNodeGraph * nodeGraph, GraphRenderConfig * co
 			ImGui::EndChild();
 		}
 
+#ifdef FM_IO
+		// the selected node's subtree stays loaded while it's being edited
+		if (config->lazy_scene != nullptr && config->selected_node != nullptr)
+			config->lazy_scene->need(config->selected_node);
+#endif
+
 		// Show the clicked node, if any
 		if (config->selected_node != nullptr) {
 			if (ImGui::BeginChild("Selected Node##tree", ImVec2{}, true)) {
+#ifdef FM_IO
+				// the node's values before they're edited, so an edited lazy subtree is kept loaded
+				std::vector<unsigned char> before, after;
+				if (config->lazy_scene != nullptr)
+					io::writeNodesBinary(before, { config->selected_node }, typeTable, false);
+#endif
+
 				typeTable->introspect(config->selected_node);
+#ifdef FM_IO
+				// records the values that were just edited, if any
+				if (config->journal != nullptr)
+					config->journal->inspect(nodeGraph, config->selected_node);
+
+				if (config->lazy_scene != nullptr) {
+					io::writeNodesBinary(after, { config->selected_node }, typeTable, false);
+					if (after != before)
+						config->lazy_scene->changed(config->selected_node);
+				}
+#endif
 				ImGui::EndChild();
 			}
 		}
@@ -145,7 +210,8 @@ void fm::gui::drawAddNodeOptions(SceneNodeGraph* nodeGraph, GraphRenderConfig* g
 
 	// draw an 'create' button, this one adds the node to the scene
 	if (ImGui::Button("Create scene node")) {
-		nodeGraph->addNode(typeTable->createNodeFromId(id));
+		auto node = nodeGraph->addNode(typeTable->createNodeFromId(id));
+		recordNodeAdded(graphConfig, nodeGraph, node);
 	}
 
 	// if we have a selected node already, allow child node creation,
@@ -155,7 +221,9 @@ void fm::gui::drawAddNodeOptions(SceneNodeGraph* nodeGraph, GraphRenderConfig* g
 		// CREATE CHILD NODE
 		ImGui::SameLine();
 		if (ImGui::Button("Create child")) {
-			graphConfig->selected_node->addChild(typeTable->createNodeFromId(id));
+			auto child = typeTable->createNodeFromId(id);
+			graphConfig->selected_node->addChild(child);
+			recordNodeAdded(graphConfig, nodeGraph, child);
 		}
 
 		// DELETE NODE
@@ -167,16 +235,39 @@ void fm::gui::drawAddNodeOptions(SceneNodeGraph* nodeGraph, GraphRenderConfig* g
 		// CLONE NODE
 		ImGui::SameLine();
 		if (ImGui::Button("Clone")) {
-			cloneNode(nodeGraph, graphConfig->selected_node);
+			auto clone = cloneNode(nodeGraph, graphConfig->selected_node);
+			recordNodeAdded(graphConfig, nodeGraph, clone);
 		}
 	}
 }
 
+void fm::gui::recordNodeAdded(GraphRenderConfig * graphConfig, SceneNodeGraph * nodeGraph, SceneNode * node)
+{
+#ifdef FM_IO
+	if (graphConfig->journal != nullptr)
+		graphConfig->journal->nodeAdded(nodeGraph, node);
+
+	if (graphConfig->lazy_scene != nullptr)
+		graphConfig->lazy_scene->changed(node);
+#endif
+}
+
 void fm::gui::deleteNodeFromGraph(fm::gui::GraphRenderConfig * graphConfig, fm::SceneNodeGraph * nodeGraph)
 {
 	// get the parent of the selected node..
 	auto node_parent = graphConfig->selected_node->getParent();
 
+#ifdef FM_IO
+	// the node's path is recorded while it's still in the graph
+	if (graphConfig->journal != nullptr)
+		graphConfig->journal->nodeRemoving(nodeGraph, graphConfig->selected_node);
+
+	if (graphConfig->lazy_scene != nullptr) {
+		graphConfig->lazy_scene->changed(graphConfig->selected_node);
+		graphConfig->lazy_scene->nodeRemoving(graphConfig->selected_node);
+	}
+#endif
+
 	// if no parent, it's a top level node
 	// so we need to remove it from the graph itself
 	if (node_parent == nullptr) {
@@ -250,6 +341,12 @@ fm::SceneNode* fm::gui::drawNodeSelect(SceneNode * node, GraphRenderConfig* conf
 {
 	int childNodeCount = node->childNodes.size();
 
+#ifdef FM_IO
+	// a stub of a lazy scene can be opened, which loads its children
+	if (config->lazy_scene != nullptr && childNodeCount == 0)
+		childNodeCount = config->lazy_scene->stubChildCount(node);
+#endif
+
 	std::string& name = node->name;
 	std::string id = name + "##scenenode" + std::to_string(node->getUniqueId());
 	
@@ -286,6 +383,12 @@ fm::SceneNode* fm::gui::drawNodeSelect(SceneNode * node, GraphRenderConfig* conf
 	}
 
 	if (nodeOpen && childNodeCount > 0) {
+#ifdef FM_IO
+		// expanded subtrees are loaded, and kept loaded
+		if (config->lazy_scene != nullptr)
+			config->lazy_scene->need(node);
+#endif
+
 		// render all children, poll for a node selection
 		// if we select a node, test we haven't found a clicked one yet already
 		for (auto child : node->childNodes) {
@@ -382,6 +485,26 @@ void fm::gui::introspectMaterial(Material & material)
 			delete material.texture;
 			material.texture = nullptr;
 		}
+
+		// introspect the uv transform, it only changes this material
+		ImGui::PushID("Mat UV Transform");
+		UvTransform& uv = material.uvTransform;
+		float offset[2] = { uv.offsetU, uv.offsetV };
+		float scale[2] = { uv.scaleU, uv.scaleV };
+
+		ImGui::Checkbox("Flipped UVs", &uv.flip);
+		if (ImGui::InputFloat2("UV Offset", offset)) {
+			uv.offsetU = offset[0];
+			uv.offsetV = offset[1];
+		}
+
+		if (ImGui::InputFloat2("UV Scale", scale)) {
+			uv.scaleU = scale[0];
+			uv.scaleV = scale[1];
+		}
+
+		ImGui::InputFloat("UV Rotation", &uv.rotation);
+		ImGui::PopID();
 	}
 
 	ImGui::Checkbox("Double Sided", &material.doubleSided);
@@ -421,9 +544,13 @@ void fm::gui::introspectMaterial(Material & material)
 
 void fm::gui::startGui(int width, int height)
 {
-	// Obj directory can import .obj files.
+	// Obj directory can import .obj files, and .glb files when the IO (json) is on.
 	objDirectory = new fm::gui::DirectoryGuiView("Assets");
+#ifdef FM_IO
+	objDirectory->setAllowedFiletypes(std::vector<std::string> { ".obj", ".glb" });
+#else
 	objDirectory->setAllowedFiletypes(std::vector<std::string> { ".obj" });
+#endif
 	objDirectory->setSelectCallback(importObjFileCallback);
 
 	// Txr directory can import .png and .jpg files.
@@ -582,6 +709,8 @@ void fm::gui::onRenderDrawLists(ImDrawData* drawData)
 	glPopAttrib();
 #endif
 
+	// we bound the font & other gui textures, so applyTexture() has to rebind
+	resetTextureBinding();
 }
 
 void fm::gui::onKeyDown(char key)
@@ -633,6 +762,19 @@ void fm::gui::debugInput(Input * input, float dt)
 	}
 }
 
+void fm::gui::drawStats()
+{
+	if (ImGui::Begin("Stats")) {
+		// the values are copied, so workers can keep writing while we draw
+		for (auto& value : Stats::global->values()) {
+			std::string str = std::to_string(value.second);
+			ImGui::LabelText(value.first.c_str(), str.c_str());
+		}
+
+		ImGui::End();
+	}
+}
+
 void fm::gui::endGui()
 {
 	ImGui::Shutdown();
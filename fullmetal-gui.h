@@ -25,6 +25,12 @@ namespace fm {
 	struct Texture;
 	struct ObjModel;
 
+	namespace io {
+		class Autosave;
+		class Journal;
+		class LazyScene;
+	}
+
 	namespace gui {
 		/*
 		 * Config for the graph render method.
@@ -50,6 +56,29 @@ namespace fm {
 			 */
 			std::function<void(SceneNode*)> on_node_doubleclicked;
 
+			/*
+			 * Autosaves the graph while it's being edited, if set (needs the IO to be turned on).
+			 * Skipped while the lazy scene has subtrees that aren't loaded.
+			 */
+			io::Autosave* autosave;
+
+			/*
+			 * Records the edits made in the gui into the scene's journal, if set (needs the IO to be turned on).
+			 * Saving then folds the journal into the scene file in the background.
+			 */
+			io::Journal* journal;
+
+			/*
+			 * The lazy scene the graph was opened from, if any (needs the IO to be turned on).
+			 * Its stubs can be expanded in the tree, and the expanded & selected subtrees are kept loaded.
+			 */
+			io::LazyScene* lazy_scene;
+
+			/*
+			 * If the scene is saved compressed (needs the IO to be turned on), see fm::io::writeSceneGraph.
+			 */
+			bool compress;
+
 			GraphRenderConfig();
 		};
 
@@ -96,6 +125,11 @@ namespace fm {
 		 */
 		void drawAddNodeOptions(SceneNodeGraph* nodeGraph, GraphRenderConfig* graphConfig, NodeTypeTable* _nodeTypeTable);
 
+		/*
+		 * Records a node that was added in the gui into the journal, if there is one.
+		 */
+		void recordNodeAdded(GraphRenderConfig* graphConfig, SceneNodeGraph* nodeGraph, SceneNode* node);
+
 		/*
 		 * Deletes a node from the graph.
 		 */
@@ -189,6 +223,11 @@ namespace fm {
 		 */
 		void debugInput(Input* input, float dt);
 
+		/*
+		 * Draws a window with the named values from fm::Stats (load timings, benchmarks).
+		 */
+		void drawStats();
+
 		/*
 		 * Cleans up anything left by starting the gui.
 		 */
@@ -9,7 +9,7 @@
 
 // EDITOR CAMERA CONTROLLER
 fm::EditorCameraController::EditorCameraController(Camera * camera, Input * input) :
-	camera(camera), _input(input), _mLastX(0), _mLastY(0), showDebugGui(true), _movementOffset() { }
+	camera(camera), _input(input), _mLastX(0), _mLastY(0), showDebugGui(true), _movementOffset(), speed(5.0f) { }
 
 void fm::EditorCameraController::useKeyControl(float dt)
 {
@@ -153,6 +153,9 @@ void fm::EditorCameraController::debugGui(float dt)
 		float farPlane = camera->getFarPlane();
 		ImGui::DragFloat("far plane", &farPlane);
 
+		// fly faster to try out streaming
+		ImGui::DragFloat("speed", &speed, 1.0f, 0.0f, 1000.0f);
+
 		ImGui::Unindent();
 
 		// directions..
@@ -193,7 +196,7 @@ void fm::EditorCameraController::update(Camera * camera, float dt)
 	if (!_movementOffset.isZero()) {
 		// normalise, apply speed & time, offset camera position
 		_movementOffset.normalise();
-		_movementOffset = _movementOffset * 5 * dt;
+		_movementOffset = _movementOffset * speed * dt;
 		camera->move(_movementOffset);
 		
 		// reset offset
@@ -40,6 +40,11 @@ namespace fm
 	public:
 		bool showDebugGui;
 
+		/*
+		 * How fast the camera flies, in units per second. 5 by default.
+		 */
+		float speed;
+
 		EditorCameraController(Camera* camera, Input* input);
 
 		/*
@@ -11,178 +11,136 @@
 #include "fullmetal-gui.h"
 #include "fullmetal-3d.h"
 #include "fullmetal-helpers.h"
+#include "fullmetal-reflect.h"
 #include "imgui/imgui.h"
 
-void fm::gui::introspectSceneNode(SceneNode * sceneNode)
+#include <cctype>
+
+// Makes a label from the name of a field, "quadSize" is "Quad Size"
+static std::string fieldLabel(const char* name)
 {
-	ImGui::Text("Node");
-	ImGui::Indent();
-	ImGui::Checkbox("Enabled", &sceneNode->enabled);
-	fm::gui::guiString(sceneNode->name, "Name");
-	ImGui::Unindent();
+	std::string label;
+	for (const char* c = name; *c != '\0'; ++c) {
+		if (c == name)
+			label += (char)toupper(*c);
+		else if (isupper(*c))
+			label += std::string(" ") + *c;
+		else
+			label += *c;
+	}
 
-	introspectTransform(sceneNode->transform);
+	return label;
 }
 
-void fm::gui::introspectShapeNode(ShapeNode * sceneNode)
+bool fm::gui::introspectField(const char * name, bool & value)
 {
-	introspectSceneNode(sceneNode);
-	fm::gui::introspectMaterial(sceneNode->material);
+	return ImGui::Checkbox(fieldLabel(name).c_str(), &value);
 }
 
-void fm::gui::introspectLightNode(LightNode * lightNode)
+bool fm::gui::introspectField(const char * name, int & value)
 {
-	introspectSceneNode(lightNode);
-
-	ImGui::PushID("LightNode Color");
-	fm::gui::introspectColor(lightNode->color);
-	ImGui::PopID();
+	return ImGui::InputInt(fieldLabel(name).c_str(), &value);
 }
 
-void fm::gui::introspectCubeNode(CubeNode * cubeNode)
+bool fm::gui::introspectField(const char * name, int & value, int min, int max)
 {
-	introspectShapeNode(cubeNode);
+	if (!ImGui::InputInt(fieldLabel(name).c_str(), &value))
+		return false;
+
+	clamp(value, min, max);
+	return true;
 }
 
-void fm::gui::introspectSphereNode(SphereNode * sphereNode)
+bool fm::gui::introspectField(const char * name, float & value)
 {
-	introspectShapeNode(sphereNode);
-
-	ImGui::Text("Sphere");
-	ImGui::Indent();
-
-	int& slices = sphereNode->getSlices();
-	int& stacks = sphereNode->getStacks();
-
-	if (ImGui::InputInt("Slices", &slices)) {
-		clamp(slices, 1, 100);
-	}
-
-	if (ImGui::InputInt("Stacks", &stacks)) {
-		clamp(stacks, 1, 100);
-	}
-
-	ImGui::Unindent();
+	return ImGui::InputFloat(fieldLabel(name).c_str(), &value);
 }
 
-void fm::gui::introspectPlaneNode(PlaneNode * planeNode)
+bool fm::gui::introspectField(const char * name, std::string & value)
 {
-	introspectShapeNode(planeNode);
-
-	ImGui::Text("Plane Settings");
-	ImGui::Indent();
-
-	int w = planeNode->width();
-	int h = planeNode->height();
-	int qSize = planeNode->quadLength();
-	bool rebuild = false;
-
-	// allow for resizing of the plane, amount of quads, etc.
-	if (ImGui::InputInt("Quad Length", &qSize, 1)) {
-		rebuild = true;
-
-		if (qSize < 0.1f)
-			qSize = 0.1f;
-	}
-
-	if (ImGui::InputInt("Width", &w, 1)) {
-		rebuild = true;
-
-		if (w < 1)
-			w = 1;
-	}
-
-	if (ImGui::InputInt("Height", &h, 1)) {
-		rebuild = true;
-
-		if (h < 1)
-			h = 1;
-	}
-
-	// check if we need to rebuild our quads
-	if (rebuild)
-		planeNode->buildQuads(qSize, w, h);
-
-	ImGui::Unindent();
+	std::string previous = value;
+	fm::gui::guiString(value, fieldLabel(name));
+	return value != previous;
 }
 
-void fm::gui::introspectAmbientLightNode(AmbientLightNode * ambientNode)
+bool fm::gui::introspectField(const char * name, Vector3 & value)
 {
-	introspectLightNode(ambientNode);
-	fm::gui::introspectColor(ambientNode->diffuse, "Diffuse Color");
+	fm::gui::introspectVector3(value, fieldLabel(name));
+	return false;
 }
 
-void fm::gui::introspectDirectionalLightNode(DirectionalLightNode * lightNode)
+bool fm::gui::introspectField(const char * name, Color & value)
 {
-	introspectLightNode(lightNode);
+	// the label is the id of its widgets, so a node's colors need different names
+	ImGui::PushID(name);
+	fm::gui::introspectColor(value, fieldLabel(name));
+	ImGui::PopID();
+	return false;
 }
 
-void fm::gui::introspectSpotLightNode(SpotLightNode * spotLight)
+bool fm::gui::introspectField(const char * /*name*/, Transform & value)
 {
-	introspectLightNode(spotLight);
-
-	fm::gui::introspectColor(spotLight->diffuse, "Diffuse Color");
-
-	// begin spot light properties..
-	ImGui::Text("Spot Light Settings");
-	ImGui::Indent();
-
-	fm::gui::introspectVector3(spotLight->direction, "direction");
-	ImGui::InputFloat("Cutoff", &spotLight->cutoff);
-	ImGui::InputFloat("Exponent", &spotLight->exponent);
-
-	ImGui::Unindent();
+	fm::gui::introspectTransform(value);
+	return false;
 }
 
-void fm::gui::introspectMeshNode(MeshNode * meshNode)
+bool fm::gui::introspectField(const char * /*name*/, Material & value)
 {
-	introspectSceneNode(meshNode);
-	fm::gui::introspectMaterial(meshNode->material);
-
-	ImGui::Text("Mesh Node Properties");
-	ImGui::Indent();
+	fm::gui::introspectMaterial(value);
+	return false;
+}
 
-	ObjModel* model = meshNode->model;
-	
+bool fm::gui::introspectField(const char * /*name*/, ObjModel *& value)
+{
 	// if model loaded, show the amount of faces imported.
-	if (model != nullptr) {
+	if (value != nullptr) {
 		// display amount of poly faces
-		ImGui::LabelText("Polygons", std::to_string(model->polyFaces.size()).c_str());
-
-		// copy param, ref gets switched in switch() anyway
-		bool switched = model->switchedUvs;
-		if (ImGui::Checkbox("Flipped UVs", &switched)) {
-			switchModelUvs(model);
-		}
+		ImGui::LabelText("Polygons", std::to_string(value->triangleCount()).c_str());
+		ImGui::LabelText("Radius", std::to_string(value->bounds.radius).c_str());
 	}
 	else {
 		// allow importing of models
 		if (ImGui::Button("Import Model")) {
-			beginImportObj(&meshNode->model);
+			beginImportObj(&value);
 		}
 	}
 
-	ImGui::Unindent();
+	return false;
 }
 
-void fm::gui::introspectCylinderNode(CylinderNode * node)
+void fm::gui::beginFieldGroup(const char * name, bool & indented)
 {
-	// introspect bases..
-	introspectShapeNode(node);
+	endFieldGroup(indented);
 
-	ImGui::Text("Cylinder Node Properties");
+	ImGui::Text(name);
 	ImGui::Indent();
+	indented = true;
+}
 
-	// allow input & change of number of segments
-	int segments = node->numSegments();
+void fm::gui::endFieldGroup(bool & indented)
+{
+	if (indented)
+		ImGui::Unindent();
 
-	// wait for input..
-	if (ImGui::InputInt("Num Segments", &segments)) {
-		// clamp between 20 & 120
-		clamp(segments, 20, 120);
+	indented = false;
+}
 
-		// rebuild the node according to the segment change
-		node->build(segments);
+void fm::gui::introspectPrefabNode(PrefabNode * node)
+{
+	// the prefab's own nodes are shared, so only the instance is edited here
+	introspectFields<SceneNode>(*node);
+
+	ImGui::Text("Prefab Node Properties");
+	ImGui::Indent();
+
+	ImGui::LabelText("Prefab", node->prefab.c_str());
+
+	if (node->source() != nullptr) {
+		ImGui::LabelText("Prefab Roots", std::to_string(node->nodes().size()).c_str());
+		ImGui::LabelText("Overrides", std::to_string(node->overrides.size()).c_str());
+	}
+	else {
+		ImGui::Text("The prefab could not be found.");
 	}
 
 	ImGui::Unindent();
@@ -6,18 +6,7 @@
 
 namespace fm
 {
-	class SceneNode;
-	class ShapeNode;
-	class LightNode;
-
-	class CubeNode;
-	class SphereNode;
-	class PlaneNode;
-	class AmbientLightNode;
-	class DirectionalLightNode;
-	class SpotLightNode;
-	class MeshNode;
-	class CylinderNode;
+	class PrefabNode;
 
 	class Transform;
 	class Vector3;
@@ -25,27 +14,7 @@ namespace fm
 
 	namespace gui
 	{
-		void introspectSceneNode(SceneNode* sceneNode);
-
-		void introspectShapeNode(ShapeNode* sceneNode);
-
-		void introspectLightNode(LightNode* lightNode);
-
-		void introspectCubeNode(CubeNode* cubeNode);
-
-		void introspectSphereNode(SphereNode* sphereNode);
-
-		void introspectPlaneNode(PlaneNode* planeNode);
-
-		void introspectAmbientLightNode(AmbientLightNode* ambientNode);
-
-		void introspectDirectionalLightNode(DirectionalLightNode* lightNode);
-
-		void introspectSpotLightNode(SpotLightNode* spotLight);
-
-		void introspectMeshNode(MeshNode* meshNode);
-
-		void introspectCylinderNode(CylinderNode* node);
+		void introspectPrefabNode(PrefabNode* node);
 	}
 }
 
@@ -4,14 +4,86 @@
 
 #include "fullmetal.h"
 #include "fullmetal-types.h"
+#include "fullmetal-reflect.h"
 #include "fullmetal-3d.h"
+#include "fullmetal-bundle.h"
+#include "fullmetal-platform.h"
+#include "fullmetal-compress.h"
 #include "json.hpp"
 
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <typeindex>
+#include <atomic>
+#include <set>
+#include <memory>
+#include <cmath>
+#include <cfloat>
+
+// BINARY SCENE FORMAT CONSTANTS
+namespace {
+	const unsigned int SCENE_MAGIC = 0x43534d46; // "FMSC"
+	const unsigned int SCENE_VERSION = 1;
+
+	// the bits of the material flags
+	const unsigned char MATERIAL_SPECULAR = 1;
+	const unsigned char MATERIAL_SHININESS = 2;
+	const unsigned char MATERIAL_TEXTURE = 4;
+	const unsigned char MATERIAL_UV_TRANSFORM = 8;
+
+	// the id given to node types the type table can't write
+	const unsigned int UNREGISTERED_TYPE = 0xffffffff;
+
+	// The asset loads of the nodes read on a loader thread, run afterwards on the calling thread (see readSceneGraphParallel)
+	typedef fm::io::DeferredAssets DeferredLoads;
+
+	// set while a loader thread is reading nodes
+	thread_local DeferredLoads* deferredLoads = nullptr;
+}
+
+// Creates the texture of a material. On a loader thread its data is loaded later, that needs the OpenGL context
+static fm::Texture* readTexture(const std::string& filepath)
+{
+	if (deferredLoads == nullptr)
+		return new fm::Texture(filepath);
+
+	fm::Texture* texture = new fm::Texture();
+	deferredLoads->textures.push_back(std::make_pair(texture, filepath));
+	return texture;
+}
+
+// Gets the model of a mesh node. On a loader thread it's given later, see loadDeferredModels & loadDeferredAssets
+static void readModel(fm::ObjModel** model, const std::string& filepath)
+{
+	if (deferredLoads == nullptr)
+		*model = fm::AssetManager::global->getObjModel(filepath);
+	else
+		deferredLoads->models.push_back(std::make_pair(model, filepath));
+}
 
-void fm::io::writeJson(std::string & file, nlohmann::json & j)
+// Gets the prefab of an instance. On a loader thread the prefab may not have its assets yet, so the
+// instance's copy is made again once it has them
+static void readPrefab(fm::PrefabNode& node)
+{
+	node.setSource(fm::io::PrefabLibrary::global->get(node.prefab));
+
+	if (deferredLoads != nullptr)
+		deferredLoads->prefabs.push_back(&node);
+}
+
+void fm::io::writeJson(std::string & file, nlohmann::json & j, bool compress)
 {
 	// write the json with 4 spaces/tab indentation for neat reading
+	if (compress) {
+		std::string text = j.dump(4) + "\n";
+		std::vector<unsigned char> bytes;
+		compressBytes(text.data(), text.size(), bytes);
+		writeFileBytes(file, bytes.data(), bytes.size());
+		return;
+	}
+
 	std::ofstream stream(file.c_str());
 	stream << j.dump(4) << std::endl;
 	stream.close();
@@ -20,55 +92,1455 @@ void fm::io::writeJson(std::string & file, nlohmann::json & j)
 nlohmann::json fm::io::readJson(std::string & file)
 {
 	std::ifstream stream;
-	stream.open(file.c_str());
+	stream.open(file.c_str(), std::ios::binary);
 	assert(stream.good());
 
-	std::string data, line;
-	while (std::getline(stream, line))
-		data += (line + "\n");
-	
-	stream.close();
-	nlohmann::json json = json::parse(data.c_str());
+	// parse straight from the file, without reading it into a string first
+	if (isCompressedFile(file)) {
+		CompressedInputBuffer buffer(stream);
+		std::istream decompressed(&buffer);
+		nlohmann::json json = json::parse(decompressed);
+		assert(!buffer.failed());
+		return json;
+	}
+
+	nlohmann::json json = json::parse(stream);
 	return json;
 }
 
 fm::SceneNodeGraph* fm::io::readSceneGraph(std::string file, NodeTypeTable* typeTable)
+{
+	if (isBinaryScenePath(file)) {
+		MappedFile mapped;
+		if (!mapped.open(file))
+			return nullptr;
+
+		if (!isCompressed(mapped.data(), mapped.size()))
+			return readSceneGraphBinary(mapped.data(), mapped.size(), typeTable);
+
+		std::vector<unsigned char> bytes;
+		if (!decompressBytes(mapped.data(), mapped.size(), bytes))
+			return nullptr;
+
+		return readSceneGraphBinary(bytes.data(), bytes.size(), typeTable);
+	}
+
+	// build the graph while the json file is parsed
+	std::ifstream stream(file.c_str(), std::ios::binary);
+	assert(stream.good());
+
+	if (!isCompressedFile(file))
+		return readSceneGraphStream(stream, typeTable);
+
+	// decompressed a batch of blocks at a time, as the parser gets to them
+	CompressedInputBuffer buffer(stream);
+	std::istream decompressed(&buffer);
+	SceneNodeGraph* graph = readSceneGraphStream(decompressed, typeTable);
+
+	if (graph != nullptr && buffer.failed()) {
+		delete graph;
+		return nullptr;
+	}
+
+	return graph;
+}
+
+namespace {
+	// Builds the scene nodes from the events of nlohmann's sax parser, see readSceneGraphStream.
+	// Only the values of the nodes being read are held as json, each node is built as soon as its object ends
+	class SceneSaxReader {
+	private:
+		enum ContainerType {
+			CONTAINER_IGNORED,	// anything outside of a node, e.g. the root object
+			CONTAINER_NODES,	// the root's "nodes" or a node's "children"
+			CONTAINER_NODE,		// a node's object
+			CONTAINER_VALUE		// an object or array inside of a node
+		};
+
+		struct Container {
+			ContainerType type;
+			nlohmann::json* value;
+		};
+
+		// a node whose object hasn't ended yet
+		struct PendingNode {
+			nlohmann::json values;
+			std::vector<fm::SceneNode*> children;
+		};
+
+		fm::NodeTypeTable* _typeTable;
+		std::vector<Container> _containers;
+		std::vector<PendingNode> _pending;
+		std::vector<fm::SceneNode*> _roots;
+		std::string _key;
+		bool _failed;
+
+		// Gets where the next value goes, nullptr if it's outside of a node
+		nlohmann::json* slot() {
+			if (_containers.empty())
+				return nullptr;
+
+			Container& top = _containers.back();
+			if (top.type == CONTAINER_NODE)
+				return &_pending.back().values[_key];
+
+			if (top.type != CONTAINER_VALUE)
+				return nullptr;
+
+			if (top.value->is_array()) {
+				top.value->push_back(nullptr);
+				return &top.value->back();
+			}
+
+			return &(*top.value)[_key];
+		}
+
+		template<typename T>
+		bool value(const T& v) {
+			nlohmann::json* json = slot();
+			if (json != nullptr)
+				*json = v;
+
+			return true;
+		}
+
+		bool start(bool object) {
+			ContainerType parent = _containers.empty() ? CONTAINER_IGNORED : _containers.back().type;
+			Container container = { CONTAINER_IGNORED, nullptr };
+
+			if (object && parent == CONTAINER_NODES) {
+				container.type = CONTAINER_NODE;
+				_pending.push_back(PendingNode());
+			}
+			else if (!object && ((parent == CONTAINER_IGNORED && _containers.size() == 1 && _key == "nodes")
+				|| (parent == CONTAINER_NODE && _key == "children"))) {
+				container.type = CONTAINER_NODES;
+			}
+			else if (parent == CONTAINER_NODE || parent == CONTAINER_VALUE) {
+				container.type = CONTAINER_VALUE;
+				container.value = slot();
+				*container.value = object ? nlohmann::json::object() : nlohmann::json::array();
+			}
+
+			_containers.push_back(container);
+			return true;
+		}
+
+	public:
+		SceneSaxReader(fm::NodeTypeTable* typeTable) : _typeTable(typeTable), _failed(false) { }
+
+		~SceneSaxReader() {
+			// only nodes that weren't given to a graph are left
+			for (auto& pending : _pending) {
+				for (auto child : pending.children)
+					delete child;
+			}
+
+			for (auto root : _roots)
+				delete root;
+		}
+
+		/* Gives away the top level nodes, they're no longer deleted by the reader. */
+		std::vector<fm::SceneNode*> takeRoots() {
+			std::vector<fm::SceneNode*> roots;
+			roots.swap(_roots);
+			return roots;
+		}
+
+		bool failed() const {
+			return _failed;
+		}
+
+		// the sax interface
+		bool null() { return value(nullptr); }
+		bool boolean(bool v) { return value(v); }
+		bool number_integer(nlohmann::json::number_integer_t v) { return value(v); }
+		bool number_unsigned(nlohmann::json::number_unsigned_t v) { return value(v); }
+		bool number_float(nlohmann::json::number_float_t v, const nlohmann::json::string_t&) { return value(v); }
+		bool string(nlohmann::json::string_t& v) {
+			nlohmann::json* json = slot();
+			if (json != nullptr)
+				*json = std::move(v);
+
+			return true;
+		}
+
+		template<typename TBinary>
+		bool binary(TBinary&) { return value(nullptr); }
+
+		bool key(nlohmann::json::string_t& v) {
+			_key = v;
+			return true;
+		}
+
+		bool start_object(std::size_t) { return start(true); }
+		bool start_array(std::size_t) { return start(false); }
+
+		bool end_array() {
+			_containers.pop_back();
+			return true;
+		}
+
+		bool end_object() {
+			bool isNode = _containers.back().type == CONTAINER_NODE;
+			_containers.pop_back();
+
+			if (!isNode)
+				return true;
+
+			// its children were built already, so only the node's own values are left
+			fm::SceneNode* node = _typeTable->readNode(_pending.back().values);
+
+			// a node of a type that isn't registered fails the whole read, the destructor deletes what was built
+			if (node == nullptr) {
+				_failed = true;
+				return false;
+			}
+
+			for (auto child : _pending.back().children)
+				node->addChild(child);
+
+			_pending.pop_back();
+
+			// give it to the node that owns the children array it's in, or the graph
+			if (_pending.empty())
+				_roots.push_back(node);
+			else
+				_pending.back().children.push_back(node);
+
+			return true;
+		}
+
+		template<typename TException>
+		bool parse_error(std::size_t, const std::string&, const TException&) {
+			_failed = true;
+			return false;
+		}
+	};
+}
+
+fm::SceneNodeGraph* fm::io::readSceneGraphStream(std::istream& stream, NodeTypeTable* typeTable)
+{
+	SceneSaxReader reader(typeTable);
+	nlohmann::json::sax_parse(stream, &reader);
+
+	if (reader.failed())
+		return nullptr;
+
+	SceneNodeGraph* graph = new SceneNodeGraph();
+	graph->addNodes(reader.takeRoots());
+	return graph;
+}
+
+// Finds where each element of the root object's "nodes" array starts & ends, without parsing them.
+// Returns false if the json ends before the array does
+static bool findNodeRanges(const char* data, size_t size, std::vector<std::pair<size_t, size_t>>& ranges)
+{
+	int depth = 0;
+	bool inNodes = false;
+	size_t stringStart = 0, elementStart = 0;
+	std::string lastString;
+
+	for (size_t i = 0; i < size; ++i) {
+		char c = data[i];
+
+		if (c == '"') {
+			// skip to the end of the string, keeping the root's keys to find "nodes"
+			stringStart = ++i;
+			while (i < size && data[i] != '"')
+				i += data[i] == '\\' ? 2 : 1;
+
+			if (depth == 1 && i < size)
+				lastString.assign(data + stringStart, i - stringStart);
+		}
+		else if (c == '{' || c == '[') {
+			if (inNodes && depth == 2)
+				elementStart = i;
+
+			++depth;
+
+			// "nodes": [ in the root object
+			if (c == '[' && depth == 2 && lastString == "nodes")
+				inNodes = true;
+		}
+		else if (c == '}' || c == ']') {
+			--depth;
+
+			if (inNodes && depth == 2 && c == '}')
+				ranges.push_back(std::make_pair(elementStart, i + 1));
+			else if (inNodes && depth == 1)
+				return true;
+		}
+	}
+
+	// no "nodes" at all is an empty scene
+	return !inNodes && depth == 0;
+}
+
+fm::SceneNodeGraph* fm::io::readSceneGraphParallel(std::string file, NodeTypeTable* typeTable)
+{
+	// the binary format is read in a single quick pass
+	if (isBinaryScenePath(file))
+		return readSceneGraph(file, typeTable);
+
+	MappedFile mapped;
+	if (!mapped.open(file))
+		return nullptr;
+
+	// compressed json is decompressed whole (in parallel too), the ranges are found in it
+	const char* data = reinterpret_cast<const char*>(mapped.data());
+	size_t size = mapped.size();
+	std::vector<unsigned char> decompressed;
+
+	if (isCompressed(mapped.data(), mapped.size())) {
+		if (!decompressBytes(mapped.data(), mapped.size(), decompressed))
+			return nullptr;
+
+		data = reinterpret_cast<const char*>(decompressed.data());
+		size = decompressed.size();
+	}
+
+	std::vector<std::pair<size_t, size_t>> ranges;
+	if (!findNodeRanges(data, size, ranges))
+		return nullptr;
+
+	// each top level node (and its children) is parsed & built on its own, assets are loaded afterwards
+	std::vector<SceneNode*> nodes(ranges.size(), nullptr);
+	std::vector<DeferredLoads> loads(ranges.size());
+	std::atomic<bool> failed(false);
+
+	parallelFor(ranges.size(), [&](size_t i) {
+		// restored after, parallelFor may run this on a thread that's reading nodes of its own
+		DeferredLoads* previous = deferredLoads;
+		deferredLoads = &loads[i];
+
+		try {
+			nlohmann::json jNode = nlohmann::json::parse(data + ranges[i].first, data + ranges[i].second);
+			nodes[i] = readNode(jNode, typeTable);
+			if (nodes[i] == nullptr)
+				failed = true;
+		}
+		catch (const std::exception&) {
+			failed = true;
+		}
+
+		deferredLoads = previous;
+	});
+
+	if (failed) {
+		for (auto node : nodes)
+			delete node;
+
+		return nullptr;
+	}
+
+	// the models are loaded in parallel too (see loadObjModels), each once
+	std::set<std::string> modelPaths;
+	for (auto& load : loads) {
+		for (auto& model : load.models)
+			modelPaths.insert(model.second);
+	}
+
+	AssetManager::global->loadObjModels(std::vector<std::string>(modelPaths.begin(), modelPaths.end()));
+
+	// then given to the nodes, with the textures, in the order the serial reader would have loaded them
+	for (auto& load : loads) {
+		for (auto& model : load.models)
+			*model.first = AssetManager::global->getObjModel(model.second);
+
+		for (auto& texture : load.textures)
+			texture.first->data = AssetManager::global->getTextureData(texture.second);
+	}
+
+	// and the prefabs first read by the loader threads, see loadDeferredAssets
+	PrefabLibrary::global->loadAssets();
+	for (auto& load : loads) {
+		for (auto prefab : load.prefabs)
+			prefab->applyOverrides();
+	}
+
+	// in their original order, the graph keeps it within each category
+	SceneNodeGraph* graph = new SceneNodeGraph();
+	graph->addNodes(nodes);
+
+	Stats::global->set("parallel.subtrees", (double)nodes.size());
+	return graph;
+}
+
+fm::SceneNodeGraph* fm::io::readSceneGraph(const Bundle& bundle, NodeTypeTable* typeTable)
+{
+	const unsigned char* data;
+	size_t size;
+	if (!bundle.findScene(data, size))
+		return nullptr;
+
+	// a compressed scene (see BundleBuildOptions::compressScene) is decompressed first
+	std::vector<unsigned char> decompressed;
+	if (isCompressed(data, size)) {
+		if (!decompressBytes(data, size, decompressed))
+			return nullptr;
+
+		data = decompressed.data();
+		size = decompressed.size();
+	}
+
+	// the scene json is parsed straight out of the mapped bundle
+	nlohmann::json json = json::parse(std::string(reinterpret_cast<const char*>(data), size));
+	return readSceneGraph(json, typeTable);
+}
+
+fm::SceneNodeGraph* fm::io::readSceneGraphPreloaded(std::string file, NodeTypeTable* typeTable)
+{
+	Timer timer;
+	std::string manifest = preloadManifestPath(file);
+
+	// kick off everything the scene used last time, before the graph needs it
+	std::vector<AssetUsage> assets;
+	readPreloadManifest(manifest, assets);
+	AssetManager::global->preload(assets);
+	double warmup = timer.elapsedMs();
+
+	AssetManager::global->beginRecording();
+	SceneNodeGraph* graph = readSceneGraph(file, typeTable);
+	std::vector<AssetUsage> used = AssetManager::global->endRecording();
+	double critical = timer.elapsedMs();
+
+	// the times recorded for preloaded assets are from the warm-up, keep the manifest's serial load times instead
+	double serial = 0.0;
+	for (auto& asset : assets) {
+		serial += asset.milliseconds;
+
+		for (auto& usage : used) {
+			if (usage.filepath == asset.filepath && usage.model == asset.model)
+				usage.milliseconds = asset.milliseconds;
+		}
+	}
+
+	writePreloadManifest(manifest, used);
+
+	Stats::global->set("preload.assets", (double)assets.size());
+	Stats::global->set("preload.warmup_ms", warmup);
+	Stats::global->set("preload.critical_ms", critical);
+	Stats::global->set("preload.serial_ms", serial);
+	Stats::global->set("preload.hidden_ms", serial > warmup ? serial - warmup : 0.0);
+	return graph;
+}
+
+std::string fm::io::preloadManifestPath(const std::string& sceneFile)
+{
+	return sceneFile + ".manifest";
+}
+
+bool fm::io::writePreloadManifest(const std::string& file, const std::vector<AssetUsage>& assets)
+{
+	nlohmann::json j;
+	j["assets"] = nlohmann::json::array();
+
+	for (auto& asset : assets) {
+		nlohmann::json jAsset;
+		jAsset["path"] = asset.filepath;
+		jAsset["model"] = asset.model;
+		jAsset["bytes"] = asset.bytes;
+		jAsset["ms"] = asset.milliseconds;
+		j["assets"].push_back(jAsset);
+	}
+
+	std::string data = j.dump(4);
+	return writeFileAtomic(file, data.data(), data.size());
+}
+
+bool fm::io::readPreloadManifest(const std::string& file, std::vector<AssetUsage>& assets)
+{
+	std::vector<unsigned char> bytes;
+	if (!fileExists(file) || !readFileBytes(file, bytes))
+		return false;
+
+	try {
+		nlohmann::json j = nlohmann::json::parse(std::string(bytes.begin(), bytes.end()));
+		nlohmann::json jAssets = j["assets"];
+
+		for (auto i = jAssets.begin(); i != jAssets.end(); ++i) {
+			AssetUsage asset;
+			asset.filepath = i->value("path", std::string());
+			asset.model = i->value("model", false);
+			asset.bytes = i->value("bytes", 0ULL);
+			asset.milliseconds = i->value("ms", 0.0);
+
+			if (!asset.filepath.empty())
+				assets.push_back(asset);
+		}
+	}
+	catch (const std::exception&) {
+		assets.clear();
+		return false;
+	}
+
+	return true;
+}
+
+fm::SceneNodeGraph* fm::io::readSceneGraph(nlohmann::json& json, NodeTypeTable* typeTable)
 {
 	// create a scene graph
 	SceneNodeGraph* graph = new SceneNodeGraph();
 
-	// read the json file, get the nodes array
-	nlohmann::json json = readJson(file);
-	nlohmann::json jNodes = json["nodes"];
+	// get the nodes array
+	nlohmann::json& jNodes = json["nodes"];
 
-	// parse each node, add it to the scene graph
-	for (auto i = jNodes.begin(); i != jNodes.end(); ++i) {
-		auto jNode = *i;
-		//TODO null check against readNode()
-		graph->addNode(readNode(jNode, typeTable));
+	// parse each node, add them all to the scene graph
+	std::vector<SceneNode*> nodes;
+	for (auto& jNode : jNodes) {
+		SceneNode* node = readNode(jNode, typeTable);
+		if (node == nullptr) {
+			for (auto read : nodes)
+				delete read;
+
+			delete graph;
+			return nullptr;
+		}
+
+		nodes.push_back(node);
 	}
 
+	graph->addNodes(nodes);
 	return graph;
 }
 
-void fm::io::writeSceneGraph(std::string file, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable)
+bool fm::io::writeSceneGraph(std::string file, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, bool compact, bool compress)
+{
+	if (isBinaryScenePath(file)) {
+		std::vector<unsigned char> bytes;
+		writeSceneGraphBinary(bytes, sceneGraph, typeTable);
+
+		if (compress) {
+			std::vector<unsigned char> compressed;
+			compressBytes(bytes.data(), bytes.size(), compressed);
+			bytes.swap(compressed);
+		}
+
+		return writeFileAtomic(file, bytes.data(), bytes.size());
+	}
+
+	// stream into a temporary file, moved over the scene once it's complete
+	std::string temporaryPath = file + ".tmp";
+	bool written;
+
+	{
+		std::vector<char> buffer(1 << 20);
+		std::ofstream stream;
+		stream.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+		stream.open(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!stream.good())
+			return false;
+
+		if (compress) {
+			// the json is compressed a batch of blocks at a time as it's written
+			CompressedOutputBuffer buffer(stream);
+			std::ostream compressed(&buffer);
+			written = writeSceneGraphStream(compressed, sceneGraph, typeTable, compact);
+			written = buffer.finish() && written;
+		}
+		else {
+			written = writeSceneGraphStream(stream, sceneGraph, typeTable, compact);
+		}
+
+		stream.close();
+		written = written && !stream.fail();
+	}
+
+	if (!written) {
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+
+	return replaceFile(temporaryPath, file);
+}
+
+// Starts a new line at the given depth, nothing when compact
+static void writeJsonLine(std::ostream& stream, int depth, bool compact)
+{
+	if (compact)
+		return;
+
+	stream << '\n';
+	for (int i = 0; i < depth; ++i)
+		stream << "    ";
+}
+
+// Writes a node & its children as json at the given depth. Only the node's own values are ever json,
+// its children are written after them, into the same object
+static void writeNodeStream(std::ostream& stream, fm::SceneNode* node, fm::NodeTypeTable* typeTable, int depth, bool compact)
+{
+	nlohmann::json jNode = nlohmann::json::object();
+	typeTable->writeNode(jNode, node);
+	std::string text = jNode.dump(compact ? -1 : 4);
+
+	// indent the node's lines to its depth
+	if (!compact) {
+		std::string indent = "\n" + std::string(depth * 4, ' ');
+		for (size_t at = text.find('\n'); at != std::string::npos; at = text.find('\n', at + indent.size()))
+			text.replace(at, 1, indent);
+	}
+
+	// only the children the type table can write
+	std::vector<fm::SceneNode*> children;
+	for (auto child : node->childNodes) {
+		if (typeTable->typeId(child) != 0)
+			children.push_back(child);
+	}
+
+	if (children.empty()) {
+		stream << text;
+		return;
+	}
+
+	// reopen the object (it always has the node_id) to add the children
+	size_t end = text.find_last_not_of(" \n", text.find_last_of('}') - 1);
+	stream.write(text.data(), end + 1);
+	stream << ',';
+	writeJsonLine(stream, depth + 1, compact);
+	stream << (compact ? "\"children\":[" : "\"children\": [");
+
+	for (size_t i = 0; i < children.size(); ++i) {
+		if (i > 0)
+			stream << ',';
+
+		writeJsonLine(stream, depth + 2, compact);
+		writeNodeStream(stream, children[i], typeTable, depth + 2, compact);
+	}
+
+	writeJsonLine(stream, depth + 1, compact);
+	stream << ']';
+	writeJsonLine(stream, depth, compact);
+	stream << '}';
+}
+
+bool fm::io::writeSceneGraphStream(std::ostream& stream, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, bool compact)
 {
-	// base object, our graph
-	nlohmann::json jGraph = nlohmann::json::object();
-	// our array of nodes that we are about to write
-	nlohmann::json jNodes = nlohmann::json::array();
+	// { "nodes": [ ... ] }, written a node at a time
+	stream << '{';
+	writeJsonLine(stream, 1, compact);
+	stream << (compact ? "\"nodes\":[" : "\"nodes\": [");
 
+	bool first = true;
 	for (auto node : sceneGraph->getNodes()) {
-		// our node json object
-		nlohmann::json jNode = nlohmann::json::object();
-		// write the node into json
-		writeNode(jNode, node, typeTable);
-		// push back into the array
-		jNodes.push_back(jNode);
+		if (typeTable->typeId(node) == 0)
+			continue;
+
+		if (!first)
+			stream << ',';
+
+		writeJsonLine(stream, 2, compact);
+		writeNodeStream(stream, node, typeTable, 2, compact);
+		first = false;
+	}
+
+	if (!first)
+		writeJsonLine(stream, 1, compact);
+
+	stream << ']';
+	writeJsonLine(stream, 0, compact);
+	stream << '}';
+
+	if (!compact)
+		stream << std::endl;
+
+	return stream.good();
+}
+
+fm::io::Autosave::Autosave(const std::string& file, unsigned int slots, double intervalSeconds)
+	: _file(file), _slots(slots > 0 ? slots : 1), _intervalMs(intervalSeconds * 1000.0), _count(0), _saving(false) { }
+
+fm::io::Autosave::~Autosave()
+{
+	wait();
+}
+
+bool fm::io::Autosave::update(SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable)
+{
+	if (_timer.elapsedMs() < _intervalMs)
+		return false;
+
+	return save(sceneGraph, typeTable);
+}
+
+bool fm::io::Autosave::save(SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable)
+{
+	// never wait on the disk, the next update tries again
+	if (_saving)
+		return false;
+
+	// the last save is finished, so this doesn't block
+	if (_thread.joinable())
+		_thread.join();
+
+	_timer.reset();
+
+	// the snapshot is the only part on this thread, the buffer keeps its capacity between saves
+	Timer snapshotTimer;
+	_snapshot.clear();
+	writeSceneGraphBinary(_snapshot, sceneGraph, typeTable);
+	Stats::global->set("autosave.snapshot_ms", snapshotTimer.elapsedMs());
+	Stats::global->set("autosave.bytes", (double)_snapshot.size());
+
+	std::string path = slotPath(_count % _slots);
+	++_count;
+	Stats::global->set("autosave.count", (double)_count);
+
+	_saving = true;
+	_thread = std::thread([this, path]() {
+		Timer saveTimer;
+		if (!writeFileAtomic(path, _snapshot.data(), _snapshot.size()))
+			Stats::global->add("autosave.failed", 1.0);
+
+		Stats::global->set("autosave.save_ms", saveTimer.elapsedMs());
+		_saving = false;
+	});
+
+	return true;
+}
+
+void fm::io::Autosave::wait()
+{
+	if (_thread.joinable())
+		_thread.join();
+}
+
+bool fm::io::Autosave::saving() const
+{
+	return _saving;
+}
+
+unsigned int fm::io::Autosave::count() const
+{
+	return _count;
+}
+
+std::string fm::io::Autosave::slotPath(unsigned int slot) const
+{
+	return _file + ".autosave" + std::to_string(slot) + ".fmscene";
+}
+
+// PREFAB LIBRARY IMPLEMENTATION
+fm::io::PrefabLibrary* fm::io::PrefabLibrary::global = new PrefabLibrary();
+
+fm::io::PrefabLibrary::PrefabLibrary() : _typeTable(nullptr) { }
+
+fm::io::PrefabLibrary::~PrefabLibrary()
+{
+	for (auto& prefab : _prefabs)
+		delete prefab.second;
+
+	_prefabs.clear();
+}
+
+void fm::io::PrefabLibrary::setTypeTable(NodeTypeTable* typeTable)
+{
+	_typeTable = typeTable;
+}
+
+fm::NodeTypeTable* fm::io::PrefabLibrary::typeTable()
+{
+	return _typeTable;
+}
+
+fm::SceneNodeGraph* fm::io::PrefabLibrary::get(const std::string& path)
+{
+	// recursive, the prefab may have prefab nodes of its own
+	std::lock_guard<std::recursive_mutex> lock(_mutex);
+
+	auto found = _prefabs.find(path);
+	if (found != _prefabs.end())
+		return found->second;
+
+	// a prefab inside of itself would never finish reading
+	if (_typeTable == nullptr || path.empty() || !fileExists(path) || _reading.count(path) != 0)
+		return nullptr;
+
+	_reading.insert(path);
+	SceneNodeGraph* prefab = nullptr;
+
+	if (deferredLoads == nullptr)
+		prefab = readSceneGraph(path, _typeTable);
+	else {
+		// on a loader thread the assets are the shared prefab's own, not those of the cell (or subtree) being read,
+		// which could be evicted before they're loaded
+		DeferredLoads loads;
+		DeferredLoads* previous = deferredLoads;
+		deferredLoads = &loads;
+		prefab = readSceneGraph(path, _typeTable);
+		deferredLoads = previous;
+
+		_pending.textures.insert(_pending.textures.end(), loads.textures.begin(), loads.textures.end());
+		_pending.models.insert(_pending.models.end(), loads.models.begin(), loads.models.end());
+		_pending.prefabs.insert(_pending.prefabs.end(), loads.prefabs.begin(), loads.prefabs.end());
+	}
+
+	_reading.erase(path);
+
+	// a prefab that can't be read is remembered too, so it isn't read again for every instance
+	_prefabs[path] = prefab;
+	Stats::global->set("prefab.count", (double)_prefabs.size());
+	return prefab;
+}
+
+void fm::io::PrefabLibrary::loadAssets()
+{
+	DeferredAssets pending;
+	{
+		std::lock_guard<std::recursive_mutex> lock(_mutex);
+		std::swap(pending, _pending);
+	}
+
+	if (!pending.textures.empty() || !pending.models.empty() || !pending.prefabs.empty())
+		loadDeferredAssets(pending);
+}
+
+bool fm::io::PrefabLibrary::add(const std::string& path, SceneNodeGraph* prefab)
+{
+	std::lock_guard<std::recursive_mutex> lock(_mutex);
+	if (_prefabs.find(path) != _prefabs.end())
+		return false;
+
+	_prefabs[path] = prefab;
+	Stats::global->set("prefab.count", (double)_prefabs.size());
+	return true;
+}
+
+size_t fm::io::PrefabLibrary::count()
+{
+	std::lock_guard<std::recursive_mutex> lock(_mutex);
+	return _prefabs.size();
+}
+
+bool fm::io::isBinaryScenePath(const std::string& file)
+{
+	const std::string extension = ".fmscene";
+	if (file.size() < extension.size())
+		return false;
+
+	std::string end = file.substr(file.size() - extension.size());
+	std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+	return end == extension;
+}
+
+// The types written into a binary scene so far, see writeNodeBinary
+struct BinarySceneTypes {
+	// type id (see NodeTypeTable::typeId) -> the id in this scene, UNREGISTERED_TYPE for the types not seen yet
+	std::vector<unsigned int> ids;
+	std::vector<std::string> names;
+
+	// Gets the id of the node's type in this scene, giving it one the first time it's seen.
+	// Returns false if the type table can't write the node
+	bool find(fm::SceneNode* node, fm::NodeTypeTable* typeTable, unsigned int& id) {
+		unsigned int type = typeTable->typeId(node);
+		if (type == 0)
+			return false;
+
+		if (type >= ids.size())
+			ids.resize(typeTable->typeCount(), UNREGISTERED_TYPE);
+
+		if (ids[type] == UNREGISTERED_TYPE) {
+			ids[type] = (unsigned int)names.size();
+			names.push_back(typeTable->getIdOfType(type));
+		}
+
+		id = ids[type];
+		return true;
+	}
+};
+
+// Writes a node & its children: the type, the child count, the size of the node's values, the values, then the children.
+// Without 'children' the node is written as if it had none
+static void writeNodeBinary(fm::ByteWriter& w, std::vector<unsigned char>& bytes, fm::SceneNode* node, unsigned int type,
+	fm::NodeTypeTable* typeTable, BinarySceneTypes& types, bool children)
+{
+	w.writeValue(type);
+
+	// only the children the type table can write are counted
+	unsigned int childCount = 0, childType;
+	if (children) {
+		for (auto child : node->childNodes)
+			childCount += types.find(child, typeTable, childType) ? 1 : 0;
+	}
+
+	w.writeValue(childCount);
+
+	// the size is filled in once the values are written
+	size_t sizeOffset = bytes.size();
+	w.writeValue((unsigned int)0);
+	typeTable->writeNodeBinary(w, node);
+
+	unsigned int size = (unsigned int)(bytes.size() - sizeOffset - sizeof(unsigned int));
+	memcpy(bytes.data() + sizeOffset, &size, sizeof(size));
+
+	if (!children)
+		return;
+
+	for (auto child : node->childNodes) {
+		if (types.find(child, typeTable, childType))
+			writeNodeBinary(w, bytes, child, childType, typeTable, types, true);
+	}
+}
+
+void fm::io::writeSceneGraphBinary(std::vector<unsigned char>& bytes, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable)
+{
+	writeNodesBinary(bytes, sceneGraph->getNodes(), typeTable, true);
+}
+
+void fm::io::writeNodesBinary(std::vector<unsigned char>& bytes, const std::vector<SceneNode*>& nodes, NodeTypeTable* typeTable, bool children)
+{
+	// the nodes are written first, they decide which types are in the type list
+	std::vector<unsigned char> nodeBytes;
+	ByteWriter nodeWriter(nodeBytes);
+	BinarySceneTypes types;
+	unsigned int rootCount = 0, type;
+
+	for (auto node : nodes) {
+		if (!types.find(node, typeTable, type))
+			continue;
+
+		writeNodeBinary(nodeWriter, nodeBytes, node, type, typeTable, types, children);
+		++rootCount;
+	}
+
+	// magic, version, type count, root node count, the type ids, then the nodes
+	ByteWriter w(bytes);
+	w.writeValue(SCENE_MAGIC);
+	w.writeValue(SCENE_VERSION);
+	w.writeValue((unsigned int)types.names.size());
+	w.writeValue(rootCount);
+
+	for (auto& name : types.names)
+		w.writeString(name);
+
+	w.write(nodeBytes.data(), nodeBytes.size());
+}
+
+// Reads the type list of a binary scene as the indices of the types in the table, -1 for those it doesn't have
+static void readTypesBinary(fm::ByteReader& r, unsigned int typeCount, fm::NodeTypeTable* typeTable, std::vector<int>& types)
+{
+	for (unsigned int i = 0; i < typeCount && !r.failed(); ++i)
+		types.push_back(typeTable->findType(r.readString()));
+}
+
+// Reads a node & its children written by writeNodeBinary, nullptr if it's invalid.
+// 'types' is the scene's type list read by readTypesBinary
+static fm::SceneNode* readNodeBinary(fm::ByteReader& r, fm::NodeTypeTable* typeTable, const std::vector<int>& types)
+{
+	unsigned int type = r.readValue<unsigned int>();
+	unsigned int childCount = r.readValue<unsigned int>();
+	unsigned int size = r.readValue<unsigned int>();
+
+	if (r.failed() || type >= types.size() || types[type] < 0 || size > r.remaining())
+		return nullptr;
+
+	// the node must read exactly the values that were written for it
+	fm::ByteReader values(r.current(), size);
+	fm::SceneNode* node = typeTable->readNodeBinary((unsigned int)types[type], values);
+	r.skip(size);
+
+	if (node == nullptr || values.failed() || values.remaining() != 0) {
+		delete node;
+		return nullptr;
 	}
 
-	jGraph["nodes"] = jNodes;
-	writeJson(file, jGraph);
+	for (unsigned int i = 0; i < childCount; ++i) {
+		fm::SceneNode* child = readNodeBinary(r, typeTable, types);
+		if (child == nullptr) {
+			delete node;
+			return nullptr;
+		}
+
+		node->addChild(child);
+	}
+
+	return node;
+}
+
+fm::SceneNodeGraph* fm::io::readSceneGraphBinary(const unsigned char* data, size_t size, NodeTypeTable* typeTable)
+{
+	std::vector<SceneNode*> nodes;
+	if (!readNodesBinary(data, size, typeTable, nodes))
+		return nullptr;
+
+	SceneNodeGraph* graph = new SceneNodeGraph();
+	graph->addNodes(nodes);
+	return graph;
+}
+
+bool fm::io::readNodesBinary(const unsigned char* data, size_t size, NodeTypeTable* typeTable, std::vector<SceneNode*>& nodes)
+{
+	ByteReader r(data, size);
+	unsigned int magic = r.readValue<unsigned int>();
+	unsigned int version = r.readValue<unsigned int>();
+	unsigned int typeCount = r.readValue<unsigned int>();
+	unsigned int rootCount = r.readValue<unsigned int>();
+
+	if (r.failed() || magic != SCENE_MAGIC || version != SCENE_VERSION)
+		return false;
+
+	std::vector<int> types;
+	readTypesBinary(r, typeCount, typeTable, types);
+
+	std::vector<SceneNode*> read;
+	for (unsigned int i = 0; i < rootCount; ++i) {
+		SceneNode* node = readNodeBinary(r, typeTable, types);
+		if (node == nullptr) {
+			for (auto readRoot : read)
+				delete readRoot;
+
+			return false;
+		}
+
+		read.push_back(node);
+	}
+
+	nodes.insert(nodes.end(), read.begin(), read.end());
+	return true;
+}
+
+bool fm::io::readNodesBinaryDeferred(const unsigned char* data, size_t size, NodeTypeTable* typeTable,
+	std::vector<SceneNode*>& nodes, DeferredAssets& assets)
+{
+	DeferredLoads* previous = deferredLoads;
+	deferredLoads = &assets;
+	bool read = readNodesBinary(data, size, typeTable, nodes);
+	deferredLoads = previous;
+	return read;
+}
+
+void fm::io::loadDeferredAssets(DeferredAssets& assets)
+{
+	for (auto& model : assets.models)
+		*model.first = AssetManager::global->getObjModel(model.second);
+
+	for (auto& texture : assets.textures)
+		texture.first->data = AssetManager::global->getTextureData(texture.second);
+
+	// the prefabs first read by the loader threads, then the copies the instances made before they had their assets
+	PrefabLibrary::global->loadAssets();
+	for (auto prefab : assets.prefabs)
+		prefab->applyOverrides();
+
+	assets.models.clear();
+	assets.textures.clear();
+	assets.prefabs.clear();
+}
+
+void fm::io::loadDeferredModels(DeferredAssets& assets)
+{
+	// the nodes are given the models later, on the thread with the OpenGL context
+	for (auto& model : assets.models)
+		AssetManager::global->prepareObjModel(model.second);
+}
+
+bool fm::io::writeSceneGraphSnapshot(const std::string& file, const std::vector<unsigned char>& snapshot, NodeTypeTable* typeTable,
+	bool compress)
+{
+	if (isBinaryScenePath(file)) {
+		if (!compress)
+			return writeFileAtomic(file, snapshot.data(), snapshot.size());
+
+		std::vector<unsigned char> compressed;
+		compressBytes(snapshot.data(), snapshot.size(), compressed);
+		return writeFileAtomic(file, compressed.data(), compressed.size());
+	}
+
+	// the nodes only need the paths of their assets to be written, so none are loaded
+	DeferredLoads loads;
+	DeferredLoads* previous = deferredLoads;
+	deferredLoads = &loads;
+	SceneNodeGraph* graph = readSceneGraphBinary(snapshot.data(), snapshot.size(), typeTable);
+	deferredLoads = previous;
+
+	if (graph == nullptr)
+		return false;
+
+	// stand ins holding just the paths, freed once the graph is written
+	std::vector<std::unique_ptr<TextureData>> textures;
+	for (auto& texture : loads.textures) {
+		textures.emplace_back(new TextureData());
+		textures.back()->filepath = texture.second;
+		texture.first->data = textures.back().get();
+	}
+
+	std::vector<std::unique_ptr<ObjModel>> models;
+	for (auto& model : loads.models) {
+		models.emplace_back(new ObjModel());
+		models.back()->filepath = model.second;
+		*model.first = models.back().get();
+	}
+
+	bool written = writeSceneGraph(file, graph, typeTable, false, compress);
+	delete graph;
+	return written;
+}
+
+// LAZY SCENE IMPLEMENTATION
+
+static void multiplyMatrix(const float* a, const float* b, float* out)
+{
+	for (int column = 0; column < 4; ++column) {
+		for (int row = 0; row < 4; ++row) {
+			float sum = 0.0f;
+			for (int k = 0; k < 4; ++k)
+				sum += a[k * 4 + row] * b[column * 4 + k];
+			out[column * 4 + row] = sum;
+		}
+	}
+}
+
+// Grows a box by a unit shape placed with the matrix, as a sphere as wide as its largest scale
+static void growBounds(const float* m, float* boxMin, float* boxMax)
+{
+	float radius = 0.0f;
+	for (int column = 0; column < 3; ++column) {
+		const float* axis = m + column * 4;
+		radius = std::max(radius, sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]));
+	}
+
+	for (int k = 0; k < 3; ++k) {
+		boxMin[k] = std::min(boxMin[k], m[12 + k] - radius);
+		boxMax[k] = std::max(boxMax[k], m[12 + k] + radius);
+	}
+}
+
+// Skips a node & its children written by writeNodeBinary, growing the box by each of them (see LazyScene).
+// 'parent' is the matrix the node's transform is applied within. Returns false if it's invalid
+static bool indexNodeBinary(fm::ByteReader& r, const float* parent, float* boxMin, float* boxMax)
+{
+	r.readValue<unsigned int>();
+	unsigned int childCount = r.readValue<unsigned int>();
+	unsigned int size = r.readValue<unsigned int>();
+
+	if (r.failed() || size > r.remaining())
+		return false;
+
+	// the node's values start with its SceneNode values, the transform first
+	fm::ByteReader values(r.current(), size);
+	fm::Transform transform;
+	fm::io::readTransformBinary(values, transform);
+	r.skip(size);
+
+	float world[16];
+	if (values.failed()) {
+		memcpy(world, parent, sizeof(world));
+	}
+	else {
+		float local[16];
+		fm::transformMatrix(transform, local);
+		multiplyMatrix(parent, local, world);
+		growBounds(world, boxMin, boxMax);
+	}
+
+	for (unsigned int i = 0; i < childCount; ++i) {
+		if (!indexNodeBinary(r, world, boxMin, boxMax))
+			return false;
+	}
+
+	return true;
+}
+
+fm::io::LazyScene::LazyScene(const std::string& file, NodeTypeTable* typeTable, float loadRadius,
+	double unloadSeconds, unsigned int maxLoadsPerUpdate)
+	: _file(file), _typeTable(typeTable), _loadRadius(loadRadius), _unloadMs(unloadSeconds * 1000.0),
+	_maxLoads(maxLoadsPerUpdate > 0 ? maxLoadsPerUpdate : 1), _data(nullptr), _size(0), _loadedCount(0), _keepLoaded(false) { }
+
+fm::SceneNodeGraph* fm::io::LazyScene::open()
+{
+	Timer timer;
+	_types.clear();
+	_subtrees.clear();
+	_index.clear();
+	_loadedCount = 0;
+
+	if (!_mapped.open(_file))
+		return nullptr;
+
+	// a compressed scene can't be read in place, it's held decompressed instead
+	_unpacked.clear();
+	_data = _mapped.data();
+	_size = _mapped.size();
+
+	if (isCompressed(_data, _size)) {
+		bool decompressed = decompressBytes(_data, _size, _unpacked);
+		_mapped.close();
+		if (!decompressed)
+			return nullptr;
+
+		_data = _unpacked.data();
+		_size = _unpacked.size();
+	}
+
+	ByteReader r(_data, _size);
+	unsigned int magic = r.readValue<unsigned int>();
+	unsigned int version = r.readValue<unsigned int>();
+	unsigned int typeCount = r.readValue<unsigned int>();
+	unsigned int rootCount = r.readValue<unsigned int>();
+
+	if (r.failed() || magic != SCENE_MAGIC || version != SCENE_VERSION)
+		return nullptr;
+
+	readTypesBinary(r, typeCount, _typeTable, _types);
+
+	std::vector<SceneNode*> nodes;
+	_subtrees.resize(rootCount);
+	bool valid = !r.failed();
+
+	for (unsigned int i = 0; i < rootCount && valid; ++i) {
+		Subtree& subtree = _subtrees[i];
+		unsigned int type = r.readValue<unsigned int>();
+		subtree.childCount = r.readValue<unsigned int>();
+		unsigned int size = r.readValue<unsigned int>();
+
+		if (r.failed() || type >= _types.size() || _types[type] < 0 || size > r.remaining()) {
+			valid = false;
+			break;
+		}
+
+		// the stub is the node's own values, its assets are loaded with its children
+		DeferredLoads loads;
+		DeferredLoads* previous = deferredLoads;
+		deferredLoads = &loads;
+		ByteReader values(r.current(), size);
+		SceneNode* node = _typeTable->readNodeBinary((unsigned int)_types[type], values);
+		deferredLoads = previous;
+		r.skip(size);
+
+		if (node == nullptr || values.failed() || values.remaining() != 0) {
+			delete node;
+			valid = false;
+			break;
+		}
+
+		nodes.push_back(node);
+		subtree.node = node;
+		subtree.assets.textures.swap(loads.textures);
+		subtree.assets.models.swap(loads.models);
+		subtree.assets.prefabs.swap(loads.prefabs);
+		subtree.loaded = subtree.childCount == 0 && subtree.assets.textures.empty() && subtree.assets.models.empty()
+			&& subtree.assets.prefabs.empty();
+		subtree.dirty = false;
+		subtree.neededMs = 0.0;
+		subtree.childOffset = r.position();
+
+		// the children are only skipped over, for the bounds
+		float world[16];
+		float boxMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float boxMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		transformMatrix(node->transform, world);
+		growBounds(world, boxMin, boxMax);
+
+		for (unsigned int child = 0; child < subtree.childCount && valid; ++child)
+			valid = indexNodeBinary(r, world, boxMin, boxMax);
+
+		float extent[3];
+		for (int k = 0; k < 3; ++k) {
+			subtree.center[k] = (boxMin[k] + boxMax[k]) * 0.5f;
+			extent[k] = (boxMax[k] - boxMin[k]) * 0.5f;
+		}
+
+		subtree.radius = sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]);
+		_index[node] = i;
+
+		if (subtree.loaded)
+			++_loadedCount;
+	}
+
+	if (!valid) {
+		for (auto node : nodes)
+			delete node;
+
+		_subtrees.clear();
+		_index.clear();
+		_mapped.close();
+		_unpacked.clear();
+		return nullptr;
+	}
+
+	SceneNodeGraph* graph = new SceneNodeGraph();
+	graph->addNodes(nodes);
+
+	Stats::global->set("lazy.open_ms", timer.elapsedMs());
+	Stats::global->set("lazy.subtrees", (double)_subtrees.size());
+	Stats::global->set("lazy.loaded", (double)_loadedCount);
+	_timer.reset();
+	return graph;
+}
+
+bool fm::io::LazyScene::load(Subtree& subtree)
+{
+	if (subtree.loaded)
+		return true;
+
+	ByteReader r(_data + subtree.childOffset, _size - subtree.childOffset);
+	std::vector<SceneNode*> children;
+
+	for (unsigned int i = 0; i < subtree.childCount; ++i) {
+		SceneNode* child = readNodeBinary(r, _typeTable, _types);
+		if (child == nullptr) {
+			for (auto read : children)
+				delete read;
+
+			return false;
+		}
+
+		children.push_back(child);
+	}
+
+	for (auto child : children)
+		subtree.node->addChild(child);
+
+	// the stub's own assets, it keeps them once it has them
+	loadDeferredAssets(subtree.assets);
+	subtree.loaded = true;
+	++_loadedCount;
+
+	Stats::global->add("lazy.loads", 1.0);
+	return true;
+}
+
+void fm::io::LazyScene::unload(Subtree& subtree)
+{
+	// the children of a changed subtree are only in memory
+	if (!subtree.loaded || subtree.childCount == 0 || subtree.dirty)
+		return;
+
+	for (auto child : subtree.node->childNodes)
+		delete child;
+
+	subtree.node->childNodes.clear();
+	subtree.loaded = false;
+	--_loadedCount;
+
+	Stats::global->add("lazy.unloads", 1.0);
+}
+
+fm::io::LazyScene::Subtree* fm::io::LazyScene::find(SceneNode* node)
+{
+	while (node != nullptr && node->getParent() != nullptr)
+		node = node->getParent();
+
+	auto found = _index.find(node);
+	return found == _index.end() ? nullptr : &_subtrees[found->second];
+}
+
+void fm::io::LazyScene::update(const Vector3& cameraPosition, const CullCamera* view)
+{
+	Timer timer;
+	double now = _timer.elapsedMs();
+	std::vector<std::pair<float, Subtree*>> wanted;
+
+	for (auto& subtree : _subtrees) {
+		if (subtree.node == nullptr)
+			continue;
+
+		float dx = subtree.center[0] - cameraPosition.x;
+		float dy = subtree.center[1] - cameraPosition.y;
+		float dz = subtree.center[2] - cameraPosition.z;
+		float distance = sqrtf(dx * dx + dy * dy + dz * dz) - subtree.radius;
+		bool needed = distance <= _loadRadius;
+
+		// in view unless the bounds are wholly behind one of the planes
+		if (!needed && view != nullptr) {
+			needed = true;
+			for (int plane = 0; plane < 6 && needed; ++plane) {
+				const float* p = view->planes[plane];
+				needed = p[0] * subtree.center[0] + p[1] * subtree.center[1] + p[2] * subtree.center[2] + p[3] >= -subtree.radius;
+			}
+		}
+
+		if (needed) {
+			subtree.neededMs = now;
+			if (!subtree.loaded)
+				wanted.push_back(std::make_pair(distance, &subtree));
+		}
+		else if (subtree.loaded && !_keepLoaded && now - subtree.neededMs > _unloadMs) {
+			unload(subtree);
+		}
+	}
+
+	// the nearest first, a few at a time so one frame never loads the whole world
+	std::sort(wanted.begin(), wanted.end(), [](const std::pair<float, Subtree*>& a, const std::pair<float, Subtree*>& b) {
+		return a.first < b.first;
+	});
+
+	size_t loads = std::min(wanted.size(), (size_t)_maxLoads);
+	for (size_t i = 0; i < loads; ++i)
+		load(*wanted[i].second);
+
+	if (loads > 0)
+		Stats::global->set("lazy.load_ms", timer.elapsedMs());
+
+	Stats::global->set("lazy.loaded", (double)_loadedCount);
+	Stats::global->set("lazy.waiting", (double)(wanted.size() - loads));
+}
+
+void fm::io::LazyScene::need(SceneNode* node)
+{
+	Subtree* subtree = find(node);
+	if (subtree == nullptr)
+		return;
+
+	subtree->neededMs = _timer.elapsedMs();
+	load(*subtree);
+}
+
+void fm::io::LazyScene::loadAll()
+{
+	_keepLoaded = true;
+
+	for (auto& subtree : _subtrees) {
+		if (subtree.node != nullptr)
+			load(subtree);
+	}
+
+	Stats::global->set("lazy.loaded", (double)_loadedCount);
+}
+
+void fm::io::LazyScene::changed(SceneNode* node)
+{
+	Subtree* subtree = find(node);
+	if (subtree == nullptr)
+		return;
+
+	load(*subtree);
+	subtree->dirty = true;
+}
+
+unsigned int fm::io::LazyScene::stubChildCount(SceneNode* node)
+{
+	auto found = _index.find(node);
+	if (found == _index.end())
+		return 0;
+
+	Subtree& subtree = _subtrees[found->second];
+	return subtree.loaded ? 0 : subtree.childCount;
+}
+
+void fm::io::LazyScene::nodeRemoving(SceneNode* node)
+{
+	auto found = _index.find(node);
+	if (found == _index.end())
+		return;
+
+	Subtree& subtree = _subtrees[found->second];
+	if (subtree.loaded)
+		--_loadedCount;
+
+	subtree.node = nullptr;
+	subtree.loaded = false;
+	_index.erase(found);
+}
+
+size_t fm::io::LazyScene::subtreeCount() const
+{
+	return _index.size();
+}
+
+size_t fm::io::LazyScene::loadedCount() const
+{
+	return _loadedCount;
 }
 
 void fm::io::writeNode(nlohmann::json& json, SceneNode* node, NodeTypeTable* typeTable)
@@ -99,14 +1571,21 @@ void fm::io::writeNode(nlohmann::json& json, SceneNode* node, NodeTypeTable* typ
 fm::SceneNode* fm::io::readNode(nlohmann::json & json, NodeTypeTable * typeTable)
 {
 	SceneNode* node = typeTable->readNode(json);
+	if (node == nullptr)
+		return nullptr;
+
 	// try to get the json 'children' field, which is an array of child nodes
-	nlohmann::json jChildren = json["children"];
-	// if not null, attempt to parse them
-	if (!jChildren.is_null()) {
+	auto jChildren = json.find("children");
+	// if there is one, attempt to parse them
+	if (jChildren != json.end() && !jChildren->is_null()) {
 		// if we parse a child, add it as a node child so the tree stays in shape
-		for (auto& jChild : jChildren) {
+		for (auto& jChild : *jChildren) {
 			auto nChild = readNode(jChild, typeTable);
-			//TODO null check
+			if (nChild == nullptr) {
+				delete node;
+				return nullptr;
+			}
+
 			node->addChild(nChild);
 		}
 	}
@@ -189,14 +1668,32 @@ void fm::io::writeMaterial(json & j, Material & material)
 	j["difColor"] = difColorJson;
 	j["specColor"] = specColorJson; // could be null
 	j["shininess"] = shininessJson; // could be null
+
+	// the texture's filepath, so it's loaded again (and can be bundled)
+	json textureJson;
+	if (material.texture != nullptr && material.texture->data != nullptr)
+		textureJson = material.texture->data->filepath;
+
+	j["texture"] = textureJson; // could be null
+
+	// only written when it does something
+	UvTransform& uv = material.uvTransform;
+	if (!uv.isIdentity()) {
+		json uvJson = json::object();
+		uvJson["flip"] = uv.flip;
+		uvJson["offset"] = { uv.offsetU, uv.offsetV };
+		uvJson["scale"] = { uv.scaleU, uv.scaleV };
+		uvJson["rotation"] = uv.rotation;
+		j["uvTransform"] = uvJson;
+	}
 }
 
 void fm::io::readMaterial(json & j, Material & material)
 {
-	json ambColorJson = j["ambColor"];
-	json difColorJson = j["difColor"];
-	json specColorJson = j["specColor"];
-	json shininessJson = j["shininess"];
+	json& ambColorJson = j["ambColor"];
+	json& difColorJson = j["difColor"];
+	json& specColorJson = j["specColor"];
+	json& shininessJson = j["shininess"];
 
 	readColor(ambColorJson, material.ambientColor);
 	readColor(difColorJson, material.diffuseColor);
@@ -210,236 +1707,267 @@ void fm::io::readMaterial(json & j, Material & material)
 		material.shininessEnabled = true;
 		material.shininess = shininessJson;
 	}
-}
-
-// SCENE NODE TO JSON
-void fm::io::writeSceneNode(json & j, SceneNode & node)
-{
-	json jTransform;
-	writeTransform(jTransform, node.transform);
-	j["transform"] = jTransform;
-
-	j["name"] = node.name;
-	j["enabled"] = node.enabled;
-}
-
-void fm::io::readSceneNode(json & j, SceneNode & node)
-{
-	json& jTransform = j["transform"];
-	readTransform(jTransform, node.transform);
-
-	json& jName = j["name"];
-	json& jEnabled = j["enabled"];
-
-	if (!jName.is_null())
-		node.name = jName.get<std::string>();
-	if (!jEnabled.is_null())
-		node.enabled = jEnabled;
-}
-
-// SHAPE NODE TO JSON
-void fm::io::writeShapeNode(json & j, ShapeNode & shape)
-{
-	json jMaterial = json::object();
-	writeMaterial(jMaterial, shape.material);
-	j["material"] = jMaterial;
-}
 
-void fm::io::readShapeNode(json & j, ShapeNode & shape)
-{
-	readMaterial(j["material"], shape.material);
-}
+	auto textureJson = j.find("texture");
+	if (textureJson != j.end() && textureJson->is_string()) {
+		delete material.texture;
+		material.texture = readTexture(textureJson->get<std::string>());
+	}
 
-// CUBE NODE TO JSON
-void fm::io::writeCubeNode(json & j, CubeNode & cube)
-{
-	writeSceneNode(j, cube);
-	writeShapeNode(j, cube);
+	auto uvJson = j.find("uvTransform");
+	if (uvJson != j.end() && uvJson->is_object()) {
+		UvTransform& uv = material.uvTransform;
+		uv.flip = uvJson->value("flip", false);
+		uv.rotation = uvJson->value("rotation", 0.0f);
+
+		json offset = uvJson->value("offset", json::array({ 0.0f, 0.0f }));
+		json scale = uvJson->value("scale", json::array({ 1.0f, 1.0f }));
+		uv.offsetU = offset[0];
+		uv.offsetV = offset[1];
+		uv.scaleU = scale[0];
+		uv.scaleV = scale[1];
+	}
 }
 
-void fm::io::readCubeNode(json & j, CubeNode & cube)
+// MODELS TO JSON, the fields of the node types are declared in fullmetal-reflect.h
+void fm::io::writeObjModel(json & j, ObjModel* model)
 {
-	readSceneNode(j, cube);
-	readShapeNode(j, cube);
+	j["filepath"] = model->filepath;
 }
 
-// SPHERE NODE TO JSON
-void fm::io::writeSphereNode(json & j, SphereNode & sphere)
+void fm::io::readObjModel(json & j, ObjModel** model)
 {
-	writeSceneNode(j, sphere);
-	writeShapeNode(j, sphere);
-
-	j["stacks"] = sphere.getStacks();
-	j["slices"] = sphere.getSlices();
+	// get the filepath, load the obj model from it (the model is shared, so it's never changed here)
+	std::string filepath = j["filepath"];
+	readModel(model, filepath);
 }
 
-void fm::io::readSphereNode(json & j, SphereNode & sphere)
+// PREFAB NODE TO JSON, written by hand rather than reflected: its overrides are whole nodes written with the
+// type table & reading it resolves the shared prefab through the library, neither of which is a field
+void fm::io::writePrefabNode(json & j, PrefabNode & node)
 {
-	readSceneNode(j, sphere);
-	readShapeNode(j, sphere);
+	writeFields<SceneNode>(j, node);
+	j["prefab"] = node.prefab;
+
+	// each override is the path of the node in the prefab & the node's values, without its children
+	json jOverrides = json::array();
+	for (auto& override : node.overrides) {
+		json jOverride = json::object();
+		json jNode = json::object();
+		PrefabLibrary::global->typeTable()->writeNode(jNode, override.node);
+
+		jOverride["path"] = override.path;
+		jOverride["node"] = jNode;
+		jOverrides.push_back(jOverride);
+	}
 
-	int& stacks = sphere.getStacks();
-	int& slices = sphere.getSlices();
-	stacks = j["stacks"];
-	slices = j["slices"];
+	j["overrides"] = jOverrides;
 }
 
-// PLANE NODE TO JSON
-void fm::io::writePlaneNode(json & j, PlaneNode & plane)
+void fm::io::readPrefabNode(json & j, PrefabNode & node)
 {
-	writeSceneNode(j, plane);
-	writeShapeNode(j, plane);
+	readFields<SceneNode>(j, node);
+	node.prefab = j["prefab"].get<std::string>();
+
+	json& jOverrides = j["overrides"];
+	if (jOverrides.is_array()) {
+		for (auto& jOverride : jOverrides) {
+			SceneNode* values = PrefabLibrary::global->typeTable()->readNode(jOverride["node"]);
+			if (values != nullptr)
+				node.overrides.push_back({ jOverride["path"].get<std::vector<unsigned int>>(), values });
+		}
+	}
 
-	j["width"] = plane.width();
-	j["height"] = plane.height();
-	j["quadSize"] = plane.quadLength();
+	// the prefab is read once, then shared
+	readPrefab(node);
 }
 
-void fm::io::readPlaneNode(json & j, PlaneNode & plane)
+// TRANSFORM, VECTOR & COLOR TO BINARY
+void fm::io::writeTransformBinary(ByteWriter & w, Transform & transform)
 {
-	readSceneNode(j, plane);
-	readShapeNode(j, plane);
-	plane.buildQuads(j["quadSize"], j["width"], j["height"]);
+	writeVector3Binary(w, transform.position);
+	writeVector3Binary(w, transform.scale);
+	writeVector3Binary(w, transform.rotation);
+	w.writeValue(transform.angle);
 }
 
-// LIGHT NODE TO JSON
-void fm::io::writeLightNode(json & j, LightNode & light)
+void fm::io::readTransformBinary(ByteReader & r, Transform & transform)
 {
-	json jColor;
-	writeColor(jColor, light.color);
-	j["color"] = jColor;
+	readVector3Binary(r, transform.position);
+	readVector3Binary(r, transform.scale);
+	readVector3Binary(r, transform.rotation);
+	transform.angle = r.readValue<float>();
 }
 
-void fm::io::readLightNode(json & j, LightNode & light)
+void fm::io::writeVector3Binary(ByteWriter & w, Vector3 & vec)
 {
-	json& jColor = j["color"];
-	readColor(jColor, light.color);
+	w.writeValue((float)vec.x);
+	w.writeValue((float)vec.y);
+	w.writeValue((float)vec.z);
 }
 
-// AMBIENT LIGHT NODE TO JSON
-void fm::io::writeAmbientLightNode(json & j, AmbientLightNode & ambientLight)
+void fm::io::readVector3Binary(ByteReader & r, Vector3 & vec)
 {
-	writeSceneNode(j, ambientLight);
-	writeLightNode(j, ambientLight);
-
-	json jDiffuse;
-	writeColor(jDiffuse, ambientLight.diffuse);
-	j["diffuse"] = jDiffuse;
+	vec.x = r.readValue<float>();
+	vec.y = r.readValue<float>();
+	vec.z = r.readValue<float>();
 }
 
-void fm::io::readAmbientLightNode(json & j, AmbientLightNode & ambientLight)
+void fm::io::writeColorBinary(ByteWriter & w, Color & color)
 {
-	readSceneNode(j, ambientLight);
-	readLightNode(j, ambientLight);
-
-	readColor(j["diffuse"], ambientLight.diffuse);
+	w.writeValue((float)color.r);
+	w.writeValue((float)color.g);
+	w.writeValue((float)color.b);
+	w.writeValue((float)color.a);
 }
 
-// DIRECTIONAL LIGHT TO JSON
-void fm::io::writeDirectionalLightNode(json & j, DirectionalLightNode & directionalLight)
+void fm::io::readColorBinary(ByteReader & r, Color & color)
 {
-	writeSceneNode(j, directionalLight);
-	writeLightNode(j, directionalLight);
+	color.r = r.readValue<float>();
+	color.g = r.readValue<float>();
+	color.b = r.readValue<float>();
+	color.a = r.readValue<float>();
 }
 
-void fm::io::readDirectionalLightNode(json & j, DirectionalLightNode & directionalLight)
+// MATERIAL TO BINARY
+void fm::io::writeMaterialBinary(ByteWriter & w, Material & material)
 {
-	readSceneNode(j, directionalLight);
-	readLightNode(j, directionalLight);
+	// flags for the values that are optional, the same ones that can be null in the json
+	bool hasTexture = material.texture != nullptr && material.texture->data != nullptr;
+	UvTransform& uv = material.uvTransform;
+
+	unsigned char flags = 0;
+	flags |= material.specularEnabled ? MATERIAL_SPECULAR : 0;
+	flags |= material.shininessEnabled ? MATERIAL_SHININESS : 0;
+	flags |= hasTexture ? MATERIAL_TEXTURE : 0;
+	flags |= !uv.isIdentity() ? MATERIAL_UV_TRANSFORM : 0;
+	w.writeValue(flags);
+
+	writeColorBinary(w, material.ambientColor);
+	writeColorBinary(w, material.diffuseColor);
+
+	if (flags & MATERIAL_SPECULAR)
+		writeColorBinary(w, material.specularColor);
+
+	if (flags & MATERIAL_SHININESS)
+		w.writeValue(material.shininess);
+
+	if (flags & MATERIAL_TEXTURE)
+		w.writeString(material.texture->data->filepath);
+
+	if (flags & MATERIAL_UV_TRANSFORM) {
+		w.writeValue((unsigned char)(uv.flip ? 1 : 0));
+		w.writeValue(uv.offsetU);
+		w.writeValue(uv.offsetV);
+		w.writeValue(uv.scaleU);
+		w.writeValue(uv.scaleV);
+		w.writeValue(uv.rotation);
+	}
 }
 
-// SPOTLIGHT TO JSON
-void fm::io::writeSpotLightNode(json & j, SpotLightNode & spotLight)
+void fm::io::readMaterialBinary(ByteReader & r, Material & material)
 {
-	writeSceneNode(j, spotLight);
-	writeLightNode(j, spotLight);
+	unsigned char flags = r.readValue<unsigned char>();
 
-	j["cutoff"] = spotLight.cutoff;
-	j["exponent"] = spotLight.exponent;
+	readColorBinary(r, material.ambientColor);
+	readColorBinary(r, material.diffuseColor);
 
-	json jDirection;
-	writeVector3(jDirection, spotLight.direction);
-	j["direction"] = jDirection;
-
-	json jDiffuse;
-	writeColor(jDiffuse, spotLight.diffuse);
-	j["diffuse"] = jDiffuse;
-}
+	if (flags & MATERIAL_SPECULAR) {
+		material.specularEnabled = true;
+		readColorBinary(r, material.specularColor);
+	}
 
-void fm::io::readSpotLightNode(json & j, SpotLightNode & spotLight)
-{
-	readSceneNode(j, spotLight);
-	readLightNode(j, spotLight);
+	if (flags & MATERIAL_SHININESS) {
+		material.shininessEnabled = true;
+		material.shininess = r.readValue<float>();
+	}
 
-	spotLight.cutoff = j["cutoff"];
-	spotLight.exponent = j["exponent"];
+	if (flags & MATERIAL_TEXTURE) {
+		std::string filepath = r.readString();
+		if (!r.failed()) {
+			delete material.texture;
+			material.texture = readTexture(filepath);
+		}
+	}
 
-	writeVector3(j["direction"], spotLight.direction);
-	writeColor(j["diffuse"], spotLight.diffuse);
+	if (flags & MATERIAL_UV_TRANSFORM) {
+		UvTransform& uv = material.uvTransform;
+		uv.flip = r.readValue<unsigned char>() != 0;
+		uv.offsetU = r.readValue<float>();
+		uv.offsetV = r.readValue<float>();
+		uv.scaleU = r.readValue<float>();
+		uv.scaleV = r.readValue<float>();
+		uv.rotation = r.readValue<float>();
+	}
 }
 
-void fm::io::writeObjModel(json & j, ObjModel* model)
+// MODELS TO BINARY
+void fm::io::writeObjModelBinary(ByteWriter & w, ObjModel* model)
 {
-	j["filepath"] = model->filepath;
-	j["switchedUvs"] = model->switchedUvs;
+	// the model's filepath, empty for no model
+	w.writeString(model != nullptr ? model->filepath : std::string());
 }
 
-void fm::io::readObjModel(json & j, ObjModel** model)
+void fm::io::readObjModelBinary(ByteReader & r, ObjModel** model)
 {
-	// get the filepath, load the obj model from it
-	std::string filepath = j["filepath"];
-	bool switched = j["switchedUvs"];
-
-	ObjModel* m = AssetManager::global->getObjModel(filepath);
-	*model = m;
-
-	if (switched)
-		switchModelUvs(m);
+	std::string filepath = r.readString();
+	if (!filepath.empty() && !r.failed())
+		readModel(model, filepath);
 }
 
-void fm::io::writeMeshNode(json & j, MeshNode & meshNode)
+// PREFAB NODE TO BINARY
+void fm::io::writePrefabNodeBinary(ByteWriter & w, PrefabNode & node)
 {
-	writeSceneNode(j, meshNode);
-
-	json jMaterial = json::object();
-	writeMaterial(jMaterial, meshNode.material);
-	j["material"] = jMaterial;
-
-	json jModel;
-	if (meshNode.model != nullptr) {
-		jModel = json::object();
-		writeObjModel(jModel, meshNode.model);
+	writeFieldsBinary<SceneNode>(w, node);
+	w.writeString(node.prefab);
+
+	// the path of each override, then its node's values as a scene of one node
+	w.writeValue((unsigned int)node.overrides.size());
+	for (auto& override : node.overrides) {
+		w.writeValue((unsigned int)override.path.size());
+		for (auto index : override.path)
+			w.writeValue(index);
+
+		std::vector<unsigned char> values;
+		std::vector<SceneNode*> nodes(1, override.node);
+		writeNodesBinary(values, nodes, PrefabLibrary::global->typeTable(), false);
+
+		w.writeValue((unsigned int)values.size());
+		w.write(values.data(), values.size());
 	}
-
-	j["model"] = jModel;
 }
 
-void fm::io::readMeshNode(json & j, MeshNode & meshNode)
+void fm::io::readPrefabNodeBinary(ByteReader & r, PrefabNode & node)
 {
-	readSceneNode(j, meshNode);
-
-	readMaterial(j["material"], meshNode.material);
+	readFieldsBinary<SceneNode>(r, node);
+	node.prefab = r.readString();
+
+	unsigned int overrideCount = r.readValue<unsigned int>();
+	for (unsigned int i = 0; i < overrideCount && !r.failed(); ++i) {
+		unsigned int length = r.readValue<unsigned int>();
+		if (length > r.remaining() / sizeof(unsigned int))
+			break;
+
+		std::vector<unsigned int> path(length);
+		for (auto& index : path)
+			index = r.readValue<unsigned int>();
+
+		unsigned int size = r.readValue<unsigned int>();
+		if (r.failed() || size > r.remaining())
+			break;
+
+		std::vector<SceneNode*> nodes;
+		if (readNodesBinary(r.current(), size, PrefabLibrary::global->typeTable(), nodes) && nodes.size() == 1)
+			node.overrides.push_back({ path, nodes[0] });
+		else {
+			for (auto read : nodes)
+				delete read;
+		}
 
-	json& jModel = j["model"];
-	if (!jModel.is_null()) {
-		readObjModel(jModel, &meshNode.model);
+		r.skip(size);
 	}
-}
-
-void fm::io::writeCylinderNode(json & j, CylinderNode & node)
-{
-	writeSceneNode(j, node);
-	writeShapeNode(j, node);
-
-	j["segments"] = node.numSegments();
-}
-
-void fm::io::readCylinderNode(json & j, CylinderNode & node)
-{
-	readSceneNode(j, node);
-	readShapeNode(j, node);
 
-	node.build(j["segments"]);
+	readPrefab(node);
 }
 
 #endif // END
\ No newline at end of file
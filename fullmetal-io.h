@@ -4,12 +4,25 @@
 #ifdef FM_IO
 
 #include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <set>
+#include <mutex>
 #include "json.hpp"
+#include "fullmetal-bundle.h"
+#include "fullmetal-platform.h"
 using json = nlohmann::json;
 
 namespace fm {
 	class SceneNodeGraph;
 	class NodeTypeTable;
+	struct AssetUsage;
+	class ByteWriter;
+	class ByteReader;
 
 	class SceneNode;
 	class ShapeNode;
@@ -22,32 +35,365 @@ namespace fm {
 	class SpotLightNode;
 	class MeshNode;
 	class CylinderNode;
+	class PrefabNode;
 
 	class Transform;
 	class Vector3;
 	struct Color;
 
 	struct Material;
+	struct Texture;
 	struct ObjModel;
+	struct CullCamera;
 
 	namespace io { 
 		/*
+		 * Writes the json to the given file path, indented. With 'compress' it's compressed (see fm::compressBytes).
 		 */
-		void writeJson(std::string& file, nlohmann::json& j);
+		void writeJson(std::string& file, nlohmann::json& j, bool compress = false);
 
 		/*
+		 * Reads the json from the given file path, decompressing it if it was written compressed.
 		 */
 		nlohmann::json readJson(std::string& file);
 
 		/*
 		 * Reads the scene graph from the given file path.
+		 * Files ending in .fmscene are read in the binary scene format, anything else is streamed as json
+		 * (see readSceneGraphStream). Scenes written compressed are detected & decompressed as they're read.
+		 * Returns nullptr if the file is invalid.
 		 */
 		SceneNodeGraph* readSceneGraph(std::string file, NodeTypeTable* typeTable);
 
+		/*
+		 * Reads the scene graph from a stream of json, building the nodes as they are parsed (with the sax parser).
+		 * Only the values of the nodes being read are held, the whole document is never in memory.
+		 * Returns nullptr if the json is invalid.
+		 */
+		SceneNodeGraph* readSceneGraphStream(std::istream& stream, NodeTypeTable* typeTable);
+
+		/*
+		 * Reads the scene graph from the given file path, building the top level nodes (each with its children)
+		 * in parallel across the worker threads (see parallelFor). The textures & models the nodes use are loaded
+		 * afterwards on the calling thread, which must have the OpenGL context, with the models loaded in parallel.
+		 * The graph is the same as readSceneGraph's, in the same order. Binary scenes are read as normal,
+		 * compressed json is decompressed in parallel before it's read. Returns nullptr if the file is invalid.
+		 */
+		SceneNodeGraph* readSceneGraphParallel(std::string file, NodeTypeTable* typeTable);
+
+		/*
+		 * Reads the scene graph stored in a bundle (see buildBundle).
+		 * Mount the bundle first (see AssetManager::mountBundle), so the nodes load their assets from it.
+		 * Returns nullptr if the bundle has no scene.
+		 */
+		SceneNodeGraph* readSceneGraph(const Bundle& bundle, NodeTypeTable* typeTable);
+
+		/*
+		 * Reads the scene graph from already parsed json.
+		 * Returns nullptr if a node's type isn't registered with the type table.
+		 */
+		SceneNodeGraph* readSceneGraph(nlohmann::json& json, NodeTypeTable* typeTable);
+
+		/*
+		 * Reads the scene graph from the given file path, warming up the assets listed in its
+		 * preload manifest (see readPreloadManifest) in parallel before the graph is built.
+		 * The assets the scene used are recorded into a new manifest for the next load.
+		 * Sets the "preload.*" stats: critical_ms is the warm-up plus graph construction,
+		 * serial_ms what the manifest's assets took to load one by one & hidden_ms how much of that the warm-up saved.
+		 */
+		SceneNodeGraph* readSceneGraphPreloaded(std::string file, NodeTypeTable* typeTable);
+
+		/*
+		 * Gets the path of the preload manifest of a scene file, next to it.
+		 */
+		std::string preloadManifestPath(const std::string& sceneFile);
+
+		/*
+		 * Writes the assets a scene used (see AssetManager::endRecording) into a preload manifest.
+		 */
+		bool writePreloadManifest(const std::string& file, const std::vector<AssetUsage>& assets);
+
+		/*
+		 * Reads a preload manifest, returns false if there isn't one (or it's unreadable).
+		 */
+		bool readPreloadManifest(const std::string& file, std::vector<AssetUsage>& assets);
+
 		/*
 		 * Writes the scene graph to the given file path.
+		 * Files ending in .fmscene are written in the binary scene format, anything else is streamed as json
+		 * (see writeSceneGraphStream), indented unless 'compact'. With 'compress' either format is compressed
+		 * a block at a time across the worker threads (see fm::CompressedOutputBuffer), the readers detect it.
+		 * The file is written to a temporary file that is renamed over it once complete, so a failed save
+		 * leaves the old file as it was. Returns false if it could not be written.
+		 */
+		bool writeSceneGraph(std::string file, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, bool compact = false, bool compress = false);
+
+		/*
+		 * Writes the scene graph as json, a node at a time as the graph is walked,
+		 * so only the json of one node is ever in memory. 'compact' leaves out the indentation & new lines.
+		 * Nodes of types that aren't in the type table are skipped. Returns false if the stream failed.
+		 */
+		bool writeSceneGraphStream(std::ostream& stream, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, bool compact = false);
+
+		/*
+		 * True if the file is a binary scene, by its extension (.fmscene).
+		 */
+		bool isBinaryScenePath(const std::string& file);
+
+		/*
+		 * Reads a scene graph in the binary scene format.
+		 * The binary format holds the same nodes as the json, so the two convert both ways without losing anything.
+		 * Returns nullptr if the data isn't a valid binary scene, or has a node type the type table doesn't know.
+		 */
+		SceneNodeGraph* readSceneGraphBinary(const unsigned char* data, size_t size, NodeTypeTable* typeTable);
+
+		/*
+		 * Writes the scene graph in the binary scene format, appending to 'bytes'.
+		 * Nodes of types that aren't in the type table are skipped, like the json.
+		 */
+		void writeSceneGraphBinary(std::vector<unsigned char>& bytes, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable);
+
+		/*
+		 * Writes nodes & their children in the binary scene format, as the roots of a scene, appending to 'bytes'.
+		 * Without 'children' only the nodes' own values are written, as if they had none.
+		 */
+		void writeNodesBinary(std::vector<unsigned char>& bytes, const std::vector<SceneNode*>& nodes, NodeTypeTable* typeTable, bool children = true);
+
+		/*
+		 * Reads the root nodes of a binary scene (see writeNodesBinary), appending them to 'nodes'.
+		 * Returns false (and reads none) if the data is invalid.
+		 */
+		bool readNodesBinary(const unsigned char* data, size_t size, NodeTypeTable* typeTable, std::vector<SceneNode*>& nodes);
+
+		/*
+		 * The assets of nodes that were read on a loader thread, loaded afterwards on the thread with the OpenGL context.
+		 */
+		struct DeferredAssets {
+			std::vector<std::pair<Texture*, std::string>> textures;
+			std::vector<std::pair<ObjModel**, std::string>> models;
+
+			// the prefab instances read, their copies are made again once their prefabs have their assets
+			std::vector<PrefabNode*> prefabs;
+		};
+
+		/*
+		 * Reads the root nodes of a binary scene like readNodesBinary, without loading their textures or models,
+		 * which are added to 'assets' instead. Safe on any thread. Load the assets with loadDeferredAssets.
+		 */
+		bool readNodesBinaryDeferred(const unsigned char* data, size_t size, NodeTypeTable* typeTable,
+			std::vector<SceneNode*>& nodes, DeferredAssets& assets);
+
+		/*
+		 * Gives nodes read with readNodesBinaryDeferred their textures & models, through the AssetManager,
+		 * and the prefabs they use theirs (see PrefabLibrary::loadAssets). Call it on the thread with the OpenGL context.
+		 * Clears 'assets'.
+		 */
+		void loadDeferredAssets(DeferredAssets& assets);
+
+		/*
+		 * Loads the models of 'assets' ahead of loadDeferredAssets, which then finds them loaded and only
+		 * has to give them to the nodes. Safe on any thread, call it on the thread that read the nodes.
+		 */
+		void loadDeferredModels(DeferredAssets& assets);
+
+		/*
+		 * Writes a snapshot of a graph, taken with writeSceneGraphBinary, to the given file path in the format
+		 * its extension asks for, like writeSceneGraph. The nodes are built without loading their textures or models,
+		 * so it's safe on any thread. With 'compress' the file is compressed, see writeSceneGraph.
+		 * Returns false if the snapshot is invalid or the file could not be written.
 		 */
-		void writeSceneGraph(std::string file, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable);
+		bool writeSceneGraphSnapshot(const std::string& file, const std::vector<unsigned char>& snapshot, NodeTypeTable* typeTable,
+			bool compress = false);
+
+		/*
+		 * The prefabs used by the scenes, each read once from its scene file and shared by all of its instances
+		 * (see PrefabNode). Prefab nodes are read with the type table set here, createDefaultTypeTable sets it.
+		 */
+		class PrefabLibrary {
+		private:
+			NodeTypeTable* _typeTable;
+			std::map<std::string, SceneNodeGraph*> _prefabs;
+			std::set<std::string> _reading;
+			DeferredAssets _pending;
+			std::recursive_mutex _mutex;
+
+		public:
+			static PrefabLibrary* global;
+
+			PrefabLibrary();
+			~PrefabLibrary();
+
+			/* The type table the prefabs (and the overrides of their instances) are read with. */
+			void setTypeTable(NodeTypeTable* typeTable);
+			NodeTypeTable* typeTable();
+
+			/*
+			 * Gets the prefab stored in a scene file, reading it the first time. Safe on the loader threads,
+			 * a prefab first read on one gets its textures & models from loadAssets.
+			 * Returns nullptr if it can't be read, or if the prefab contains itself.
+			 */
+			SceneNodeGraph* get(const std::string& path);
+
+			/*
+			 * Loads the assets of the prefabs that were read on the loader threads since the last call.
+			 * Call it on the thread with the OpenGL context, loadDeferredAssets does.
+			 */
+			void loadAssets();
+
+			/*
+			 * Adds a prefab made in code under a path, owned by the library from then on.
+			 * Returns false (and deletes nothing) if there's already a prefab with that path.
+			 */
+			bool add(const std::string& path, SceneNodeGraph* prefab);
+
+			/* The number of distinct prefabs read so far. */
+			size_t count();
+		};
+
+		/*
+		 * Saves the scene graph every so often, without holding up the editor.
+		 * A save takes a snapshot of the graph in the binary scene format on the calling thread, which is quick,
+		 * then writes it out on a background thread into one of 'slots' files next to the scene, oldest first.
+		 * While a save is being written no new snapshot is taken, so the calling thread never waits on the disk.
+		 * Sets the "autosave.*" stats: snapshot_ms is the time the calling thread spent, save_ms the background write.
+		 */
+		class Autosave {
+		private:
+			std::string _file;
+			unsigned int _slots;
+			double _intervalMs;
+			Timer _timer;
+			unsigned int _count;
+			std::thread _thread;
+			std::atomic<bool> _saving;
+			std::vector<unsigned char> _snapshot;
+
+		public:
+			/* Autosaves 'file' every 'intervalSeconds', rotating through 'slots' files (see slotPath). */
+			Autosave(const std::string& file, unsigned int slots = 3, double intervalSeconds = 60.0);
+
+			/* Waits for the save being written, if any. */
+			~Autosave();
+
+			/*
+			 * Call once a frame, saves if the interval has passed since the last save.
+			 * Returns true if a save was started.
+			 */
+			bool update(SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable);
+
+			/*
+			 * Snapshots the graph now and starts writing it out.
+			 * Returns false (and does nothing) if the last save is still being written.
+			 */
+			bool save(SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable);
+
+			/* Waits for the save being written, if any. */
+			void wait();
+
+			/* True while a save is being written. */
+			bool saving() const;
+
+			/* The number of saves started. */
+			unsigned int count() const;
+
+			/*
+			 * Gets the path of a slot, "<file>.autosave<slot>.fmscene".
+			 * Read them back like any binary scene, with readSceneGraph.
+			 */
+			std::string slotPath(unsigned int slot) const;
+		};
+
+		/*
+		 * A binary scene whose top level subtrees are only read once they're needed, for worlds too big to keep resident.
+		 * Opening it indexes where each top level node starts in the file, and reads just those nodes (without their
+		 * children or assets) into the graph as stubs, each with the bounds of its whole subtree.
+		 * A subtree's children, then the assets of all its nodes, are loaded the first time it's needed: when its bounds
+		 * are in view, when the camera comes within 'loadRadius' of them, or when it's expanded in the editor (see need).
+		 * Subtrees that haven't been needed for 'unloadSeconds' are unloaded back into stubs, unless they've been changed
+		 * (see changed), so call loadAll() before writing the graph.
+		 * The bounds come from the transforms of the subtree's nodes, each taken as a unit shape, so node types must
+		 * write their SceneNode values first like the default nodes do. Sets the "lazy.*" stats.
+		 */
+		class LazyScene {
+		private:
+			// a top level node, where its children are in the file & the assets it loads with them
+			struct Subtree {
+				SceneNode* node;
+				size_t childOffset;
+				unsigned int childCount;
+				float center[3];
+				float radius;
+				bool loaded;
+				bool dirty;
+				double neededMs;
+				DeferredAssets assets;
+			};
+
+			std::string _file;
+			NodeTypeTable* _typeTable;
+			float _loadRadius;
+			double _unloadMs;
+			unsigned int _maxLoads;
+			Timer _timer;
+
+			// the scene stays mapped, the subtrees are read straight out of it (or out of '_unpacked' if it was compressed)
+			MappedFile _mapped;
+			std::vector<unsigned char> _unpacked;
+			const unsigned char* _data;
+			size_t _size;
+			std::vector<int> _types;
+			std::vector<Subtree> _subtrees;
+			std::map<SceneNode*, size_t> _index;
+			size_t _loadedCount;
+			bool _keepLoaded;
+
+			bool load(Subtree& subtree);
+			void unload(Subtree& subtree);
+			Subtree* find(SceneNode* node);
+
+		public:
+			/* The scene in the binary file, loading at most 'maxLoadsPerUpdate' subtrees each update. Call open() to read it. */
+			LazyScene(const std::string& file, NodeTypeTable* typeTable, float loadRadius = 50.0f,
+				double unloadSeconds = 30.0, unsigned int maxLoadsPerUpdate = 4);
+
+			/*
+			 * Maps the scene file and reads the stubs into a new graph, owned by the caller.
+			 * The lazy scene must outlive the graph's use. Returns nullptr if the file isn't a valid binary scene.
+			 */
+			SceneNodeGraph* open();
+
+			/*
+			 * Call once a frame. Loads the subtrees that are needed, the nearest first, and unloads the ones that
+			 * haven't been needed for a while. 'view' is the camera's frustum in world space (the model view just after
+			 * Camera::view() & the projection, see CullCamera::fromMatrices), without it only the radius is used.
+			 */
+			void update(const Vector3& cameraPosition, const CullCamera* view = nullptr);
+
+			/*
+			 * Marks the subtree of a node (any node in it) as needed now, loading it straight away if it isn't.
+			 * The editor calls this for the nodes that are expanded or selected, so they're never unloaded under it.
+			 */
+			void need(SceneNode* node);
+
+			/* Loads every subtree, and keeps them loaded. */
+			void loadAll();
+
+			/*
+			 * Marks the subtree of a node (any node in it) as changed, loading it if it isn't, so it's never unloaded
+			 * and the changes lost. The editor calls this when it adds, deletes or edits a node.
+			 */
+			void changed(SceneNode* node);
+
+			/* The number of children a stub will have once its subtree is loaded, 0 if the node isn't a stub. */
+			unsigned int stubChildCount(SceneNode* node);
+
+			/* Forgets a top level node that's about to be deleted from the graph, call this before deleting it. */
+			void nodeRemoving(SceneNode* node);
+
+			/* The number of top level subtrees, and how many of them are loaded. */
+			size_t subtreeCount() const;
+			size_t loadedCount() const;
+		};
 
 		/*
 		 * Writes a node into json, not knowing the nodes child type.
@@ -55,7 +401,8 @@ namespace fm {
 		void writeNode(nlohmann::json& json, SceneNode* node, NodeTypeTable* typeTable);
 
 		/* 
-		 * 
+		 * Reads a node & its children from json written by writeNode.
+		 * Returns nullptr if the type of the node (or of one of its children) isn't registered.
 		 */
 		SceneNode* readNode(nlohmann::json& json, NodeTypeTable* typeTable);
 
@@ -71,41 +418,30 @@ namespace fm {
 		void writeMaterial(json& j, Material& material);
 		void readMaterial(json& j, Material& material);
 
-		void writeSceneNode(json& j, SceneNode& node);
-		void readSceneNode(json& j, SceneNode& node);
-
-		void writeShapeNode(json& j, ShapeNode& shape);
-		void readShapeNode(json& j, ShapeNode& shape);
-
-		void writeCubeNode(json& j, CubeNode& cube);
-		void readCubeNode(json& j, CubeNode& cube);
-
-		void writeSphereNode(json& j, SphereNode& sphere);
-		void readSphereNode(json& j, SphereNode& sphere);
-
-		void writePlaneNode(json& j, PlaneNode& plane);
-		void readPlaneNode(json& j, PlaneNode& plane);
+		void writeObjModel(json& j, ObjModel* model);
+		void readObjModel(json& j, ObjModel** model);
 
-		void writeLightNode(json& j, LightNode& light);
-		void readLightNode(json& j, LightNode& light);
+		void writePrefabNode(json& j, PrefabNode& node);
+		void readPrefabNode(json& j, PrefabNode& node);
 
-		void writeAmbientLightNode(json& j, AmbientLightNode& ambientLight);
-		void readAmbientLightNode(json& j, AmbientLightNode& ambientLight);
+		// the binary scene format, the same values in the same order as the json, at fixed sizes
+		void writeTransformBinary(ByteWriter& w, Transform& transform);
+		void readTransformBinary(ByteReader& r, Transform& transform);
 
-		void writeDirectionalLightNode(json& j, DirectionalLightNode& directionalLight);
-		void readDirectionalLightNode(json& j, DirectionalLightNode& directionalLight);
+		void writeVector3Binary(ByteWriter& w, Vector3& vec);
+		void readVector3Binary(ByteReader& r, Vector3& vec);
 
-		void writeSpotLightNode(json& j, SpotLightNode& spotLight);
-		void readSpotLightNode(json& j, SpotLightNode& spotLight);
+		void writeColorBinary(ByteWriter& w, Color& color);
+		void readColorBinary(ByteReader& r, Color& color);
 
-		void writeObjModel(json& j, ObjModel* model);
-		void readObjModel(json& j, ObjModel** model);
+		void writeMaterialBinary(ByteWriter& w, Material& material);
+		void readMaterialBinary(ByteReader& r, Material& material);
 
-		void writeMeshNode(json& j, MeshNode& meshNode);
-		void readMeshNode(json& j, MeshNode& meshNode);
+		void writeObjModelBinary(ByteWriter& w, ObjModel* model);
+		void readObjModelBinary(ByteReader& r, ObjModel** model);
 
-		void writeCylinderNode(json& j, CylinderNode& node);
-		void readCylinderNode(json& j, CylinderNode& node);
+		void writePrefabNodeBinary(ByteWriter& w, PrefabNode& node);
+		void readPrefabNodeBinary(ByteReader& r, PrefabNode& node);
 	}
 }
 
@@ -0,0 +1,604 @@
+#include "fullmetal-journal.h"
+
+#ifdef FM_IO
+#include "fullmetal.h"
+#include "fullmetal-io.h"
+#include "fullmetal-types.h"
+#include "fullmetal-platform.h"
+#include "fullmetal-compress.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <random>
+
+// JOURNAL FORMAT CONSTANTS
+namespace {
+	const unsigned int JOURNAL_MAGIC = 0x4c4a4d46; // "FMJL"
+	const unsigned int JOURNAL_VERSION = 1;
+
+	// magic, version, id, the hash of the scene file it follows, the id of the journal it follows
+	const size_t JOURNAL_HEADER_SIZE = 32;
+	const size_t JOURNAL_BASE_HASH_OFFSET = 16;
+
+	// the base hash of a journal whose scene file isn't written yet, or doesn't exist
+	const unsigned long long NO_BASE = 0;
+
+	struct JournalHeader {
+		unsigned long long id;
+		unsigned long long baseHash;
+		unsigned long long parentId;
+	};
+
+	// A journal read from a file, up to the last whole record
+	struct JournalFile {
+		JournalHeader header;
+		std::vector<unsigned char> bytes;
+
+		// where each record's op & values are, and how big they are
+		std::vector<std::pair<size_t, size_t>> records;
+		size_t validEnd;
+	};
+}
+
+static void writeJournalHeader(std::vector<unsigned char>& bytes, const JournalHeader& header)
+{
+	fm::ByteWriter w(bytes);
+	w.writeValue(JOURNAL_MAGIC);
+	w.writeValue(JOURNAL_VERSION);
+	w.writeValue(header.id);
+	w.writeValue(header.baseHash);
+	w.writeValue(header.parentId);
+}
+
+// Reads a journal, stopping at the first record that's torn or doesn't match its hash.
+// Returns false if there's no journal or it isn't one
+static bool readJournalFile(const std::string& path, JournalFile& journal)
+{
+	if (!fm::fileExists(path) || !fm::readFileBytes(path, journal.bytes))
+		return false;
+
+	fm::ByteReader r(journal.bytes.data(), journal.bytes.size());
+	unsigned int magic = r.readValue<unsigned int>();
+	unsigned int version = r.readValue<unsigned int>();
+	journal.header.id = r.readValue<unsigned long long>();
+	journal.header.baseHash = r.readValue<unsigned long long>();
+	journal.header.parentId = r.readValue<unsigned long long>();
+
+	if (r.failed() || magic != JOURNAL_MAGIC || version != JOURNAL_VERSION)
+		return false;
+
+	// each record is its size, its op & values, then the hash of the op & values
+	journal.validEnd = r.position();
+	while (r.remaining() > 0) {
+		unsigned int size = r.readValue<unsigned int>();
+		if (r.failed() || size == 0 || (size_t)size + sizeof(unsigned long long) > r.remaining())
+			break;
+
+		size_t offset = r.position();
+		r.skip(size);
+		unsigned long long hash = r.readValue<unsigned long long>();
+		if (r.failed() || hash != fm::hashBytes(journal.bytes.data() + offset, size))
+			break;
+
+		journal.records.push_back(std::make_pair(offset, (size_t)size));
+		journal.validEnd = r.position();
+	}
+
+	return true;
+}
+
+// The hash of a scene file, NO_BASE if there isn't one
+static unsigned long long baseHashOf(const std::string& file)
+{
+	unsigned long long hash;
+	return fm::fileExists(file) && fm::hashFile(file, hash) ? hash : NO_BASE;
+}
+
+static unsigned long long newJournalId()
+{
+	std::random_device device;
+	unsigned long long id = ((unsigned long long)device() << 32) | device();
+	return id != 0 ? id : 1;
+}
+
+// Writes a path, its length then the indices
+static void writePath(fm::ByteWriter& w, const std::vector<unsigned int>& path)
+{
+	w.writeValue((unsigned int)path.size());
+	for (auto index : path)
+		w.writeValue(index);
+}
+
+static bool readPath(fm::ByteReader& r, std::vector<unsigned int>& path)
+{
+	unsigned int length = r.readValue<unsigned int>();
+	if (r.failed() || length == 0 || length > r.remaining() / sizeof(unsigned int))
+		return false;
+
+	path.resize(length);
+	for (auto& index : path)
+		index = r.readValue<unsigned int>();
+
+	return !r.failed();
+}
+
+// Finds the parent of the node at a path, nullptr for a top level node. Returns false if the parent doesn't exist
+static bool findParent(fm::SceneNodeGraph* graph, const std::vector<unsigned int>& path, fm::SceneNode*& parent)
+{
+	parent = nullptr;
+	for (size_t i = 0; i + 1 < path.size(); ++i) {
+		std::vector<fm::SceneNode*>& nodes = parent == nullptr ? graph->getNodes() : parent->childNodes;
+		if (path[i] >= nodes.size())
+			return false;
+
+		parent = nodes[path[i]];
+	}
+
+	return true;
+}
+
+// Takes the node at a path out of the graph, nullptr if there's no node there
+static fm::SceneNode* detachNode(fm::SceneNodeGraph* graph, const std::vector<unsigned int>& path)
+{
+	fm::SceneNode* parent;
+	if (!findParent(graph, path, parent))
+		return nullptr;
+
+	std::vector<fm::SceneNode*>& nodes = parent == nullptr ? graph->getNodes() : parent->childNodes;
+	if (path.back() >= nodes.size())
+		return nullptr;
+
+	fm::SceneNode* node = nodes[path.back()];
+	if (parent == nullptr)
+		nodes.erase(nodes.begin() + path.back());
+	else
+		parent->removeChild(node);
+
+	return node;
+}
+
+// Puts a node into the graph at a path. The path is where the node was after the edit,
+// so top level nodes go straight to their index, they were already sorted. Returns false if the parent doesn't exist
+static bool attachNode(fm::SceneNodeGraph* graph, const std::vector<unsigned int>& path, fm::SceneNode* node)
+{
+	fm::SceneNode* parent;
+	if (!findParent(graph, path, parent))
+		return false;
+
+	std::vector<fm::SceneNode*>& nodes = parent == nullptr ? graph->getNodes() : parent->childNodes;
+	if (path.back() > nodes.size())
+		return false;
+
+	if (parent == nullptr)
+		nodes.insert(nodes.begin() + path.back(), node);
+	else
+		parent->insertChild(node, path.back());
+
+	return true;
+}
+
+// Reads the single node written into a record, nullptr if it's invalid
+static fm::SceneNode* readRecordNode(fm::ByteReader& r, fm::NodeTypeTable* typeTable)
+{
+	std::vector<fm::SceneNode*> nodes;
+	if (!fm::io::readNodesBinary(r.current(), r.remaining(), typeTable, nodes))
+		return nullptr;
+
+	if (nodes.size() != 1) {
+		for (auto node : nodes)
+			delete node;
+
+		return nullptr;
+	}
+
+	return nodes[0];
+}
+
+// Applies a record to the graph, returns false if it doesn't fit the graph
+static bool applyRecord(fm::SceneNodeGraph* graph, fm::NodeTypeTable* typeTable, const unsigned char* data, size_t size)
+{
+	fm::ByteReader r(data, size);
+	unsigned char op = r.readValue<unsigned char>();
+
+	std::vector<unsigned int> path;
+	if (!readPath(r, path))
+		return false;
+
+	switch (op) {
+	case fm::io::JOURNAL_ADD: {
+		fm::SceneNode* node = readRecordNode(r, typeTable);
+		if (node == nullptr)
+			return false;
+
+		if (!attachNode(graph, path, node)) {
+			delete node;
+			return false;
+		}
+
+		return true;
+	}
+	case fm::io::JOURNAL_REMOVE: {
+		fm::SceneNode* node = detachNode(graph, path);
+		delete node;
+		return node != nullptr;
+	}
+	case fm::io::JOURNAL_MOVE: {
+		std::vector<unsigned int> to;
+		if (!readPath(r, to))
+			return false;
+
+		fm::SceneNode* node = detachNode(graph, path);
+		if (node == nullptr)
+			return false;
+
+		if (!attachNode(graph, to, node)) {
+			delete node;
+			return false;
+		}
+
+		return true;
+	}
+	case fm::io::JOURNAL_SET: {
+		// the node is read again with its new values, and takes the children of the old one
+		fm::SceneNode* node = readRecordNode(r, typeTable);
+		if (node == nullptr)
+			return false;
+
+		fm::SceneNode* old = detachNode(graph, path);
+		if (old == nullptr) {
+			delete node;
+			return false;
+		}
+
+		node->takeChildren(old);
+		delete old;
+		return attachNode(graph, path, node);
+	}
+	}
+
+	return false;
+}
+
+// Starts a record of an edit to a node, its op then its path. Returns false if the node isn't in the graph
+static bool beginRecord(std::vector<unsigned char>& record, fm::io::JournalOp op, fm::SceneNodeGraph* graph, fm::SceneNode* node)
+{
+	std::vector<unsigned int> path;
+	if (!fm::io::Journal::nodePath(graph, node, path))
+		return false;
+
+	record.clear();
+	fm::ByteWriter w(record);
+	w.writeValue((unsigned char)op);
+	writePath(w, path);
+	return true;
+}
+
+// JOURNAL IMPLEMENTATION
+fm::io::Journal::Journal(const std::string& file, NodeTypeTable* typeTable)
+	: _file(file), _typeTable(typeTable), _id(0), _records(0), _inspected(nullptr),
+	_compacting(false), _compacted(false), _nextId(0), _foldedRecords(0) { }
+
+fm::io::Journal::~Journal()
+{
+	wait();
+}
+
+fm::SceneNodeGraph* fm::io::Journal::load()
+{
+	wait();
+	_stream.close();
+	_inspected = nullptr;
+	_records = 0;
+
+	Timer timer;
+	SceneNodeGraph* graph = fileExists(_file) ? readSceneGraph(_file, _typeTable) : new SceneNodeGraph();
+	if (graph == nullptr)
+		return nullptr;
+
+	// the journal of this save, then the next journal if a compaction didn't finish
+	// (it follows the new save once that's written, or this journal until then)
+	unsigned long long baseHash = baseHashOf(_file);
+	JournalFile journal, next;
+	bool hasJournal = readJournalFile(journalPath(), journal) && journal.header.baseHash == baseHash;
+	bool hasNext = readJournalFile(nextPath(), next);
+
+	if (hasNext && next.header.baseHash == baseHash)
+		hasJournal = false;
+	else if (hasNext)
+		hasNext = hasJournal && next.header.parentId == journal.header.id;
+
+	std::vector<JournalFile*> journals;
+	if (hasJournal)
+		journals.push_back(&journal);
+	if (hasNext)
+		journals.push_back(&next);
+
+	// replay until a record doesn't fit, keeping the records that did
+	JournalHeader header = { newJournalId(), baseHash, 0 };
+	std::vector<unsigned char> kept;
+	writeJournalHeader(kept, header);
+	bool replayed = true;
+
+	for (auto replaying : journals) {
+		for (auto& record : replaying->records) {
+			const unsigned char* data = replaying->bytes.data() + record.first;
+			if (!(replayed = applyRecord(graph, _typeTable, data, record.second)))
+				break;
+
+			kept.insert(kept.end(), data - sizeof(unsigned int), data + record.second + sizeof(unsigned long long));
+			++_records;
+		}
+
+		if (!replayed)
+			break;
+	}
+
+	// the journal is kept as it is if all of it was replayed, otherwise it's replaced by what was
+	bool whole = hasJournal && !hasNext && replayed && journal.validEnd == journal.bytes.size();
+	if (whole)
+		_id = journal.header.id;
+	else {
+		_id = header.id;
+		writeFileAtomic(journalPath(), kept.data(), kept.size());
+	}
+
+	std::remove(nextPath().c_str());
+	openJournal(journalPath());
+
+	Stats::global->set("journal.replayed", (double)_records);
+	Stats::global->set("journal.replay_ms", timer.elapsedMs());
+	if (!replayed)
+		Stats::global->add("journal.dropped", 1.0);
+
+	return graph;
+}
+
+void fm::io::Journal::nodeAdded(SceneNodeGraph* graph, SceneNode* node)
+{
+	if (!beginRecord(_record, JOURNAL_ADD, graph, node))
+		return;
+
+	std::vector<SceneNode*> nodes(1, node);
+	writeNodesBinary(_record, nodes, _typeTable, true);
+	append();
+}
+
+void fm::io::Journal::nodeRemoving(SceneNodeGraph* graph, SceneNode* node)
+{
+	// the inspected node may be this one, or one of its children
+	_inspected = nullptr;
+
+	if (beginRecord(_record, JOURNAL_REMOVE, graph, node))
+		append();
+}
+
+void fm::io::Journal::nodeMoved(SceneNodeGraph* graph, SceneNode* node, const std::vector<unsigned int>& from)
+{
+	std::vector<unsigned int> to;
+	if (from.empty() || !nodePath(graph, node, to))
+		return;
+
+	_record.clear();
+	ByteWriter w(_record);
+	w.writeValue((unsigned char)JOURNAL_MOVE);
+	writePath(w, from);
+	writePath(w, to);
+	append();
+}
+
+void fm::io::Journal::nodeChanged(SceneNodeGraph* graph, SceneNode* node)
+{
+	if (!beginRecord(_record, JOURNAL_SET, graph, node))
+		return;
+
+	std::vector<SceneNode*> nodes(1, node);
+	writeNodesBinary(_record, nodes, _typeTable, false);
+	append();
+
+	if (node == _inspected) {
+		_inspectedValues.clear();
+		writeNodesBinary(_inspectedValues, nodes, _typeTable, false);
+	}
+}
+
+void fm::io::Journal::inspect(SceneNodeGraph* graph, SceneNode* node)
+{
+	if (node == nullptr) {
+		_inspected = nullptr;
+		return;
+	}
+
+	// only the node's own values, its children are edited when they're inspected
+	std::vector<SceneNode*> nodes(1, node);
+	_values.clear();
+	writeNodesBinary(_values, nodes, _typeTable, false);
+
+	if (node != _inspected) {
+		_inspected = node;
+		_inspectedValues.swap(_values);
+		return;
+	}
+
+	if (_values == _inspectedValues)
+		return;
+
+	_inspectedValues.swap(_values);
+	if (beginRecord(_record, JOURNAL_SET, graph, node)) {
+		// the values were just written as a scene, they're the rest of the record
+		_record.insert(_record.end(), _inspectedValues.begin(), _inspectedValues.end());
+		append();
+	}
+}
+
+bool fm::io::Journal::compact(SceneNodeGraph* graph)
+{
+	if (_compacting)
+		return false;
+
+	// a compaction that finished since the last update
+	update();
+
+	Timer timer;
+	_snapshot.clear();
+	writeSceneGraphBinary(_snapshot, graph, _typeTable);
+
+	// edits made from now on follow the snapshot, so they go into the next journal
+	JournalHeader header = { newJournalId(), NO_BASE, _id };
+	std::vector<unsigned char> bytes;
+	writeJournalHeader(bytes, header);
+	if (!writeFileBytes(nextPath(), bytes.data(), bytes.size()))
+		return false;
+
+	_stream.close();
+	openJournal(nextPath());
+	_nextId = header.id;
+	_foldedRecords = _records;
+	Stats::global->set("journal.compact_snapshot_ms", timer.elapsedMs());
+
+	_compacting = true;
+	_thread = std::thread([this]() {
+		Timer compactTimer;
+		std::string file = _file;
+		std::string temporaryPath = file + ".compact" + (isBinaryScenePath(file) ? ".fmscene" : "");
+		unsigned long long hash;
+
+		// a scene that was saved compressed stays compressed
+		bool compress = isCompressedFile(file);
+		bool saved = writeSceneGraphSnapshot(temporaryPath, _snapshot, _typeTable, compress) && hashFile(temporaryPath, hash);
+
+		// the next journal follows the new save from before it replaces the scene file,
+		// so whichever of the two is there when loading, the right journals are replayed
+		if (saved) {
+			std::fstream stream(nextPath().c_str(), std::ios::binary | std::ios::in | std::ios::out);
+			stream.seekp(JOURNAL_BASE_HASH_OFFSET);
+			stream.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+			stream.close();
+			saved = !stream.fail() && replaceFile(temporaryPath, file);
+		}
+
+		if (!saved) {
+			std::remove(temporaryPath.c_str());
+			Stats::global->add("journal.compact_failed", 1.0);
+		}
+
+		Stats::global->set("journal.compact_ms", compactTimer.elapsedMs());
+		_compacted = saved;
+		_compacting = false;
+	});
+
+	return true;
+}
+
+void fm::io::Journal::update()
+{
+	if (_compacting || !_thread.joinable())
+		return;
+
+	_thread.join();
+	finishCompaction();
+}
+
+void fm::io::Journal::wait()
+{
+	if (!_thread.joinable())
+		return;
+
+	_thread.join();
+	finishCompaction();
+}
+
+void fm::io::Journal::finishCompaction()
+{
+	_stream.close();
+
+	if (_compacted) {
+		// the next journal is the journal of the new save
+		replaceFile(nextPath(), journalPath());
+		_id = _nextId;
+		_records -= _foldedRecords;
+	}
+	else {
+		// the save failed, so the edits in the next journal go back onto the end of this one
+		JournalFile next;
+		if (readJournalFile(nextPath(), next)) {
+			std::ofstream stream(journalPath().c_str(), std::ios::binary | std::ios::app);
+			stream.write(reinterpret_cast<const char*>(next.bytes.data() + JOURNAL_HEADER_SIZE), next.validEnd - JOURNAL_HEADER_SIZE);
+		}
+
+		std::remove(nextPath().c_str());
+	}
+
+	openJournal(journalPath());
+	Stats::global->set("journal.records", (double)_records);
+}
+
+bool fm::io::Journal::append()
+{
+	if (!_stream.is_open())
+		return false;
+
+	// the record is written & flushed straight away, the size of the edit is all it costs
+	Timer timer;
+	unsigned int size = (unsigned int)_record.size();
+	unsigned long long hash = hashBytes(_record.data(), _record.size());
+
+	_stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	_stream.write(reinterpret_cast<const char*>(_record.data()), _record.size());
+	_stream.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+	_stream.flush();
+	++_records;
+
+	Stats::global->set("journal.records", (double)_records);
+	Stats::global->set("journal.append_ms", timer.elapsedMs());
+	Stats::global->set("journal.append_bytes", (double)(size + sizeof(size) + sizeof(hash)));
+	return _stream.good();
+}
+
+bool fm::io::Journal::openJournal(const std::string& path)
+{
+	_stream.clear();
+	_stream.open(path.c_str(), std::ios::binary | std::ios::app);
+	return _stream.good();
+}
+
+bool fm::io::Journal::compacting() const
+{
+	return _compacting;
+}
+
+unsigned int fm::io::Journal::recordCount() const
+{
+	return _records;
+}
+
+std::string fm::io::Journal::journalPath() const
+{
+	return _file + ".journal";
+}
+
+std::string fm::io::Journal::nextPath() const
+{
+	return _file + ".journal.next";
+}
+
+bool fm::io::Journal::nodePath(SceneNodeGraph* graph, SceneNode* node, std::vector<unsigned int>& path)
+{
+	path.clear();
+
+	// walk up to the top level, finding each node in its parent
+	for (SceneNode* current = node; current != nullptr; current = current->getParent()) {
+		SceneNode* parent = current->getParent();
+		std::vector<SceneNode*>& nodes = parent == nullptr ? graph->getNodes() : parent->childNodes;
+
+		auto found = std::find(nodes.begin(), nodes.end(), current);
+		if (found == nodes.end())
+			return false;
+
+		path.push_back((unsigned int)(found - nodes.begin()));
+	}
+
+	std::reverse(path.begin(), path.end());
+	return !path.empty();
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * The scene journal, an append-only file of the edits made to a scene since it was last saved in full.
+ * Each edit (a node added, removed, moved or changed) is a small record addressed by the node's path in the graph,
+ * so saving an edit only costs that edit. Loading reads the last full save and replays the journal over it,
+ * and compaction folds the journal back into a full save in the background.
+ */
+
+#pragma once
+#include "fullmetal-config.h"
+
+#ifdef FM_IO
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+
+namespace fm {
+	class SceneNodeGraph;
+	class SceneNode;
+	class NodeTypeTable;
+
+	namespace io {
+		/*
+		 * What a journal record does.
+		 */
+		enum JournalOp {
+			JOURNAL_ADD = 1,
+			JOURNAL_REMOVE = 2,
+			JOURNAL_MOVE = 3,
+			JOURNAL_SET = 4
+		};
+
+		/*
+		 * The journal of a scene file, "<file>.journal".
+		 * Nodes are addressed by their path, the index of the top level node then the index of each child down to it,
+		 * so every node in the graph must be of a type in the type table (like the rest of the IO).
+		 * Sets the "journal.*" stats.
+		 */
+		class Journal {
+		private:
+			std::string _file;
+			NodeTypeTable* _typeTable;
+
+			// the journal being appended to, and its id
+			std::ofstream _stream;
+			unsigned long long _id;
+			unsigned int _records;
+			std::vector<unsigned char> _record;
+
+			// the node being inspected, and its values when they were last recorded
+			SceneNode* _inspected;
+			std::vector<unsigned char> _inspectedValues;
+			std::vector<unsigned char> _values;
+
+			// the compaction running in the background, if any
+			std::thread _thread;
+			std::atomic<bool> _compacting;
+			std::atomic<bool> _compacted;
+			std::vector<unsigned char> _snapshot;
+			unsigned long long _nextId;
+			unsigned int _foldedRecords;
+
+			bool append();
+			bool openJournal(const std::string& path);
+			void finishCompaction();
+			std::string nextPath() const;
+
+		public:
+			/* The journal of 'file', read & written with the given type table. Call load() before recording. */
+			Journal(const std::string& file, NodeTypeTable* typeTable);
+
+			/* Finishes any compaction that's running. */
+			~Journal();
+
+			/*
+			 * Reads the scene file (an empty graph if there isn't one yet) and replays the journal over it.
+			 * Records from a journal that doesn't match the scene file (it was saved without the journal) are dropped,
+			 * as is a torn record at the end. Returns nullptr if the scene file is invalid.
+			 */
+			SceneNodeGraph* load();
+
+			/* Records a node (and its children) that was just added to the graph or to a parent. */
+			void nodeAdded(SceneNodeGraph* graph, SceneNode* node);
+
+			/* Records a node that is about to be removed, call this before removing it. */
+			void nodeRemoving(SceneNodeGraph* graph, SceneNode* node);
+
+			/* Records a node that was just moved, 'from' is its path before the move (see nodePath). */
+			void nodeMoved(SceneNodeGraph* graph, SceneNode* node, const std::vector<unsigned int>& from);
+
+			/* Records the values of a node that were just changed, its children are left as they are. */
+			void nodeChanged(SceneNodeGraph* graph, SceneNode* node);
+
+			/*
+			 * Call every frame with the node being edited in the inspector (or nullptr), after it's introspected.
+			 * Its values are recorded whenever they differ from the last time, only that node is compared.
+			 */
+			void inspect(SceneNodeGraph* graph, SceneNode* node);
+
+			/*
+			 * Folds the journal into a new full save of the scene file.
+			 * The graph is snapshot now, it's written in the background while new edits go into the next journal.
+			 * Returns false (and does nothing) if a compaction is already running.
+			 */
+			bool compact(SceneNodeGraph* graph);
+
+			/* Call once a frame, switches to the next journal once a compaction has finished. */
+			void update();
+
+			/* Waits for a running compaction to finish. */
+			void wait();
+
+			/* True while a compaction is running. */
+			bool compacting() const;
+
+			/* The number of records since the last full save was snapshot. */
+			unsigned int recordCount() const;
+
+			/* The path of the journal, "<file>.journal". */
+			std::string journalPath() const;
+
+			/*
+			 * Gets the path of a node in the graph, the top level index then the child indices.
+			 * Returns false if the node isn't in the graph.
+			 */
+			static bool nodePath(SceneNodeGraph* graph, SceneNode* node, std::vector<unsigned int>& path);
+		};
+	}
+}
+
+#endif
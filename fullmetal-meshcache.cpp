@@ -0,0 +1,322 @@
+#include "fullmetal-meshcache.h"
+#include "fullmetal-3d.h"
+#include "fullmetal-platform.h"
+
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+// MESH FORMAT CONSTANTS
+namespace {
+	const unsigned int MESH_MAGIC = 0x424d4d46; // "FMMB"
+	const unsigned int MESH_VERSION = 1;
+
+	// chunk tags
+	const unsigned int CHUNK_VERTICES = 0x58545256; // "VRTX"
+	const unsigned int CHUNK_INDICES = 0x58444e49; // "INDX"
+	const unsigned int CHUNK_LODS = 0x53444f4c; // "LODS"
+	const unsigned int CHUNK_MESHLETS = 0x54454c4d; // "MLET"
+	const unsigned int CHUNK_BOUNDS = 0x53444e42; // "BNDS"
+
+	// chunks start on this alignment, so arrays can be used in place from a mapped file
+	const size_t CHUNK_ALIGNMENT = 16;
+}
+
+// Writes a chunk header, then the payload written by 'writePayload'
+template<typename TWrite>
+static void writeChunk(fm::ByteWriter& writer, std::vector<unsigned char>& bytes, unsigned int tag, TWrite writePayload)
+{
+	writer.writeValue(tag);
+	writer.writeValue((unsigned int)0);
+
+	// the size is patched in once the payload is written
+	size_t sizeOffset = bytes.size();
+	writer.writeValue((unsigned long long)0);
+
+	size_t start = bytes.size();
+	writePayload();
+
+	unsigned long long size = bytes.size() - start;
+	memcpy(&bytes[sizeOffset], &size, sizeof(size));
+	writer.align(CHUNK_ALIGNMENT);
+}
+
+void fm::writeMeshBinary(ObjModel * model, std::vector<unsigned char>& bytes)
+{
+	assert(model != nullptr && model->buffer != nullptr);
+	MeshBuffer& buffer = *model->buffer;
+	ByteWriter writer(bytes);
+
+	writer.writeValue(MESH_MAGIC);
+	writer.writeValue(MESH_VERSION);
+	writer.writeValue((unsigned long long)0);
+
+	writeChunk(writer, bytes, CHUNK_VERTICES, [&]() {
+		writer.write(buffer.vertices.data(), buffer.vertices.size() * sizeof(MeshVertex));
+	});
+
+	writeChunk(writer, bytes, CHUNK_INDICES, [&]() {
+		writer.write(buffer.indices.data(), buffer.indices.size() * sizeof(unsigned int));
+	});
+
+	writeChunk(writer, bytes, CHUNK_BOUNDS, [&]() {
+		writer.writeValue(model->bounds);
+	});
+
+	if (!model->lods.empty()) {
+		writeChunk(writer, bytes, CHUNK_LODS, [&]() {
+			writer.writeValue((unsigned int)model->lods.size());
+
+			for (auto& lod : model->lods) {
+				writer.writeValue(lod.ratio);
+				writer.writeValue(lod.error);
+				writer.writeValue((unsigned int)lod.indices.size());
+				writer.write(lod.indices.data(), lod.indices.size() * sizeof(unsigned int));
+			}
+		});
+	}
+
+	if (!model->meshlets.empty()) {
+		writeChunk(writer, bytes, CHUNK_MESHLETS, [&]() {
+			writer.write(model->meshlets.data(), model->meshlets.size() * sizeof(Meshlet));
+		});
+	}
+}
+
+fm::ObjModel * fm::readMeshBinary(const unsigned char * data, size_t size)
+{
+	ByteReader reader(data, size);
+
+	if (reader.readValue<unsigned int>() != MESH_MAGIC || reader.readValue<unsigned int>() != MESH_VERSION)
+		return nullptr;
+	reader.skip(sizeof(unsigned long long));
+
+	ObjModel* model = new ObjModel();
+	model->buffer = new MeshBuffer();
+	MeshBuffer& buffer = *model->buffer;
+	bool complete = true;
+	bool hasBounds = false;
+
+	while (!reader.failed() && reader.remaining() > 0) {
+		unsigned int tag = reader.readValue<unsigned int>();
+		reader.skip(sizeof(unsigned int));
+		unsigned long long chunkSize = reader.readValue<unsigned long long>();
+
+		if (reader.failed() || chunkSize > reader.remaining()) {
+			complete = false;
+			break;
+		}
+
+		ByteReader chunk(reader.current(), (size_t)chunkSize);
+
+		if (tag == CHUNK_VERTICES) {
+			buffer.vertices.resize((size_t)chunkSize / sizeof(MeshVertex));
+			chunk.read(buffer.vertices.data(), buffer.vertices.size() * sizeof(MeshVertex));
+		}
+		else if (tag == CHUNK_INDICES) {
+			buffer.indices.resize((size_t)chunkSize / sizeof(unsigned int));
+			chunk.read(buffer.indices.data(), buffer.indices.size() * sizeof(unsigned int));
+		}
+		else if (tag == CHUNK_LODS) {
+			unsigned int lodCount = chunk.readValue<unsigned int>();
+
+			for (unsigned int i = 0; i < lodCount && !chunk.failed(); ++i) {
+				MeshLod lod;
+				lod.ratio = chunk.readValue<float>();
+				lod.error = chunk.readValue<float>();
+
+				unsigned int indexCount = chunk.readValue<unsigned int>();
+				if (indexCount > chunk.remaining() / sizeof(unsigned int)) {
+					complete = false;
+					break;
+				}
+
+				lod.indices.resize(indexCount);
+				chunk.read(lod.indices.data(), indexCount * sizeof(unsigned int));
+				model->lods.push_back(std::move(lod));
+			}
+		}
+
+		else if (tag == CHUNK_BOUNDS) {
+			model->bounds = chunk.readValue<MeshBounds>();
+			hasBounds = !chunk.failed();
+		}
+		else if (tag == CHUNK_MESHLETS) {
+			model->meshlets.resize((size_t)chunkSize / sizeof(Meshlet));
+			chunk.read(model->meshlets.data(), model->meshlets.size() * sizeof(Meshlet));
+		}
+
+		// unknown chunks are skipped, they're from a newer writer
+		reader.skip((size_t)chunkSize);
+		reader.align(CHUNK_ALIGNMENT);
+	}
+
+	// make sure every index points at a vertex, so a corrupt file can't crash the renderer
+	bool valid = complete && !buffer.vertices.empty();
+	for (auto index : buffer.indices)
+		valid = valid && index < buffer.vertices.size();
+
+	for (auto& lod : model->lods) {
+		for (auto index : lod.indices)
+			valid = valid && index < buffer.vertices.size();
+	}
+
+	for (auto& meshlet : model->meshlets)
+		valid = valid && meshlet.indexOffset + (size_t)meshlet.indexCount <= buffer.indices.size();
+
+	if (!valid) {
+		delete model;
+		return nullptr;
+	}
+
+	model->meshletCullData.build(model->meshlets);
+
+	// older entries don't have bounds
+	if (!hasBounds)
+		model->bounds = computeBounds(buffer.vertices[0].position, buffer.vertices.size(), sizeof(MeshVertex));
+
+	return model;
+}
+
+// MESH CACHE IMPLEMENTATION
+fm::MeshCache::MeshCache(const std::string& directory) : _directory(directory) { }
+
+std::string fm::MeshCache::entryPath(const std::string& sourcePath, unsigned long long contentHash)
+{
+	unsigned long long pathHash = hashBytes(sourcePath.data(), sourcePath.size());
+	return _directory + "/" + hashToString(pathHash) + "-" + hashToString(contentHash) + ".fmm";
+}
+
+bool fm::MeshCache::find(const std::string& sourcePath, std::string& cachedPath)
+{
+	// hash the contents so a changed source model misses the cache
+	unsigned long long contentHash;
+	if (!hashFile(sourcePath, contentHash))
+		return false;
+
+	std::string path = entryPath(sourcePath, contentHash);
+	if (!fileExists(path))
+		return false;
+
+	cachedPath = path;
+	return true;
+}
+
+fm::ObjModel * fm::MeshCache::load(const std::string& sourcePath)
+{
+	std::string cachedPath;
+	if (!find(sourcePath, cachedPath))
+		return nullptr;
+
+	// read in place from the mapped entry, so a big (streamed) model isn't held twice while it's read
+	MappedFile mapped;
+	if (!mapped.open(cachedPath))
+		return nullptr;
+
+	ObjModel* model = readMeshBinary(mapped.data(), mapped.size());
+	if (model != nullptr)
+		model->filepath = sourcePath;
+
+	return model;
+}
+
+bool fm::MeshCache::store(const std::string& sourcePath, ObjModel * model)
+{
+	unsigned long long contentHash;
+	if (!hashFile(sourcePath, contentHash))
+		return false;
+
+	std::vector<unsigned char> bytes;
+	writeMeshBinary(model, bytes);
+
+	std::string path = entryPath(sourcePath, contentHash);
+	return writeFileAtomic(path, bytes.data(), bytes.size());
+}
+
+// Copies a file into 'output' as a chunk, a window at a time
+static bool copyFileChunk(std::ofstream& output, unsigned int tag, const std::string& fp, size_t windowBytes)
+{
+	unsigned long long size = fm::fileSize(fp);
+	unsigned int reserved = 0;
+	output.write(reinterpret_cast<const char*>(&tag), sizeof(tag));
+	output.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+	output.write(reinterpret_cast<const char*>(&size), sizeof(size));
+
+	std::ifstream input(fp.c_str(), std::ios::binary);
+	std::vector<char> window(windowBytes);
+	unsigned long long copied = 0;
+
+	while (input) {
+		input.read(window.data(), window.size());
+		output.write(window.data(), input.gcount());
+		copied += input.gcount();
+	}
+
+	// the header & chunk headers are 16 bytes, so padding the payload keeps the next chunk aligned
+	static const char padding[CHUNK_ALIGNMENT] = { 0 };
+	output.write(padding, (CHUNK_ALIGNMENT - copied % CHUNK_ALIGNMENT) % CHUNK_ALIGNMENT);
+	return copied == size && output.good();
+}
+
+bool fm::MeshCache::buildStreaming(const std::string& sourcePath, const ObjStreamOptions& options, ObjStreamReport* report)
+{
+	unsigned long long contentHash;
+	if (!hashFile(sourcePath, contentHash))
+		return false;
+
+	std::string path = entryPath(sourcePath, contentHash);
+	if (fileExists(path))
+		return true;
+
+	// the streamed vertices & indices land in temporary files next to the entry
+	size_t threadId = std::hash<std::thread::id>()(std::this_thread::get_id());
+	std::string prefix = path + ".stream" + hashToString(threadId);
+
+	ObjStreamReport streamReport;
+	ObjModelLoader loader;
+	bool built = loader.stream(sourcePath, prefix, options, streamReport);
+
+	if (built) {
+		std::string temporaryPath = prefix + ".fmm";
+
+		{
+			std::ofstream output(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+
+			std::vector<unsigned char> bytes;
+			ByteWriter writer(bytes);
+			writer.writeValue(MESH_MAGIC);
+			writer.writeValue(MESH_VERSION);
+			writer.writeValue((unsigned long long)0);
+			output.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+
+			built = copyFileChunk(output, CHUNK_VERTICES, prefix + ".vertices", options.windowBytes)
+				&& copyFileChunk(output, CHUNK_INDICES, prefix + ".indices", options.windowBytes);
+
+			bytes.clear();
+			writeChunk(writer, bytes, CHUNK_BOUNDS, [&]() {
+				writer.writeValue(streamReport.bounds);
+			});
+			output.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+			built = built && output.good();
+		}
+
+		built = built && replaceFile(temporaryPath, path);
+		std::remove(temporaryPath.c_str());
+	}
+
+	std::remove((prefix + ".vertices").c_str());
+	std::remove((prefix + ".indices").c_str());
+
+	if (report != nullptr)
+		*report = streamReport;
+
+	return built;
+}
+
+const std::string& fm::MeshCache::directory()
+{
+	return _directory;
+}
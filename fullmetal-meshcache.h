@@ -0,0 +1,80 @@
+/*
+ * The binary mesh format and the on disk mesh cache.
+ * A processed model (the welded buffer, its lods and meshlets) is stored in the binary format,
+ * so loading it again skips parsing the obj, welding, simplifying and clustering.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace fm {
+	struct ObjModel;
+	struct ObjStreamOptions;
+	struct ObjStreamReport;
+
+	/*
+	 * Writes a processed model (see processObjModel) into the binary mesh format.
+	 * The model must still have its MeshBuffer, so call this before compactObjModel.
+	 * The format is a header followed by tagged chunks, readers skip chunks they don't know.
+	 */
+	void writeMeshBinary(ObjModel* model, std::vector<unsigned char>& bytes);
+
+	/*
+	 * Reads a model written by writeMeshBinary.
+	 * Returns nullptr if the bytes aren't a valid mesh.
+	 */
+	ObjModel* readMeshBinary(const unsigned char* data, size_t size);
+
+	/*
+	 * A directory of processed models in the binary mesh format.
+	 * Entries are keyed like the TextureCache, by a hash of the source filepath and of its contents.
+	 */
+	class MeshCache {
+	private:
+		std::string _directory;
+
+	public:
+		/*
+		 * Creates a cache that reads and writes .fmm files inside of 'directory'.
+		 * The directory must already exist.
+		 */
+		MeshCache(const std::string& directory);
+
+		/*
+		 * Gets the path of the cache entry for a source model and its content hash.
+		 */
+		std::string entryPath(const std::string& sourcePath, unsigned long long contentHash);
+
+		/*
+		 * Looks up the cache entry for a source model.
+		 * Returns true and assigns 'cachedPath' if a valid entry exists.
+		 */
+		bool find(const std::string& sourcePath, std::string& cachedPath);
+
+		/*
+		 * Loads the cached version of a source model. The entry is mapped and read in place,
+		 * so only the model's own copy of the mesh is held. Returns nullptr if there is no entry, or it could not be read.
+		 */
+		ObjModel* load(const std::string& sourcePath);
+
+		/*
+		 * Writes the cache entry of a processed model, replacing any existing entry.
+		 * Returns false if it could not be written.
+		 */
+		bool store(const std::string& sourcePath, ObjModel* model);
+
+		/*
+		 * Builds the cache entry of an obj too large to load in memory, by streaming it (see ObjModelLoader::stream).
+		 * The entry has the welded vertices, indices and bounds, but no lods or meshlets.
+		 * Returns true straight away if the entry already exists, and false if it could not be built.
+		 */
+		bool buildStreaming(const std::string& sourcePath, const ObjStreamOptions& options, ObjStreamReport* report = nullptr);
+
+		/*
+		 * The directory the cache entries live in.
+		 */
+		const std::string& directory();
+	};
+}
@@ -0,0 +1,406 @@
+#include "fullmetal-platform.h"
+
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// TIMER IMPLEMENTATION
+fm::Timer::Timer() : _start(std::chrono::high_resolution_clock::now()) { }
+
+void fm::Timer::reset()
+{
+	_start = std::chrono::high_resolution_clock::now();
+}
+
+double fm::Timer::elapsedMs()
+{
+	auto now = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(now - _start).count();
+}
+
+// PARALLELISM
+unsigned int fm::workerThreadCount()
+{
+	// hardware_concurrency can return 0 if it's unknown
+	unsigned int count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : count;
+}
+
+void fm::parallelFor(size_t count, const std::function<void(size_t)>& func)
+{
+	if (count == 0) return;
+
+	size_t threadCount = workerThreadCount();
+	if (threadCount > count)
+		threadCount = count;
+
+	// not worth spinning up threads, run inline
+	if (threadCount <= 1) {
+		for (size_t i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	// each worker pulls the next index until we run out, this balances
+	// the load when some items (big textures, big meshes) take much longer
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			func(i);
+	};
+
+	// the calling thread does work as well, so spawn one less
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < threadCount; ++t)
+		threads.push_back(std::thread(worker));
+
+	worker();
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// HASHING
+unsigned long long fm::hashBytes(const void* data, size_t size, unsigned long long seed)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	unsigned long long hash = seed;
+
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+std::string fm::hashToString(unsigned long long hash)
+{
+	char buffer[17];
+	snprintf(buffer, sizeof(buffer), "%016llx", hash);
+	return std::string(buffer);
+}
+
+// FILE HELPERS
+bool fm::readFileBytes(const std::string& fp, std::vector<unsigned char>& bytes)
+{
+	std::ifstream stream(fp.c_str(), std::ios::binary | std::ios::ate);
+	if (!stream.good())
+		return false;
+
+	// we opened at the end, so the position is the size of the file
+	std::streamsize size = stream.tellg();
+	stream.seekg(0, std::ios::beg);
+
+	bytes.resize((size_t)size);
+	if (size > 0)
+		stream.read(reinterpret_cast<char*>(bytes.data()), size);
+
+	return stream.good() || stream.eof();
+}
+
+bool fm::writeFileBytes(const std::string& fp, const void* data, size_t size)
+{
+	std::ofstream stream(fp.c_str(), std::ios::binary | std::ios::trunc);
+	if (!stream.good())
+		return false;
+
+	stream.write(static_cast<const char*>(data), size);
+	return stream.good();
+}
+
+bool fm::writeFileAtomic(const std::string& fp, const void* data, size_t size)
+{
+	// the thread id keeps threads writing the same file from sharing a temporary
+	unsigned long long threadId = std::hash<std::thread::id>()(std::this_thread::get_id());
+	std::string tempPath = fp + ".tmp" + hashToString(threadId);
+	if (!writeFileBytes(tempPath, data, size))
+		return false;
+
+	return replaceFile(tempPath, fp);
+}
+
+bool fm::replaceFile(const std::string& from, const std::string& to)
+{
+	// both replace 'to' in one step, so it's always either the old or the new file
+#ifdef _WIN32
+	bool moved = MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	bool moved = std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+
+	if (!moved) {
+		std::remove(from.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool fm::hashFile(const std::string& fp, unsigned long long& hash)
+{
+	std::ifstream stream(fp.c_str(), std::ios::binary);
+	if (!stream.good())
+		return false;
+
+	std::vector<char> block(1 << 20);
+	hash = hashBytes(nullptr, 0);
+
+	while (stream) {
+		stream.read(block.data(), block.size());
+		hash = hashBytes(block.data(), (size_t)stream.gcount(), hash);
+	}
+
+	return stream.eof();
+}
+
+unsigned long long fm::fileSize(const std::string& fp)
+{
+	std::ifstream stream(fp.c_str(), std::ios::binary | std::ios::ate);
+	if (!stream.good())
+		return 0;
+
+	return (unsigned long long)stream.tellg();
+}
+
+bool fm::fileExists(const std::string& fp)
+{
+	std::ifstream stream(fp.c_str(), std::ios::binary);
+	return stream.good();
+}
+
+// MAPPED FILE IMPLEMENTATION
+fm::MappedFile::MappedFile() : _data(nullptr), _size(0), _file(nullptr), _mapping(nullptr) { }
+
+fm::MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool fm::MappedFile::open(const std::string& fp)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fp.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_size = (size_t)size.QuadPart;
+	_data = static_cast<const unsigned char*>(view);
+#else
+	int file = ::open(fp.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0) {
+		::close(file);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+	// the mapping keeps its own reference to the file
+	::close(file);
+	if (view == MAP_FAILED)
+		return false;
+
+	_size = (size_t)info.st_size;
+	_data = static_cast<const unsigned char*>(view);
+#endif
+
+	return true;
+}
+
+void fm::MappedFile::close()
+{
+	if (_data == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+#else
+	munmap(const_cast<unsigned char*>(_data), _size);
+#endif
+
+	_data = nullptr;
+	_size = 0;
+	_file = nullptr;
+	_mapping = nullptr;
+}
+
+const unsigned char* fm::MappedFile::data() const
+{
+	return _data;
+}
+
+size_t fm::MappedFile::size() const
+{
+	return _size;
+}
+
+// BYTE WRITER IMPLEMENTATION
+fm::ByteWriter::ByteWriter(std::vector<unsigned char>& bytes) : _bytes(bytes) { }
+
+void fm::ByteWriter::write(const void* data, size_t size)
+{
+	const unsigned char* begin = static_cast<const unsigned char*>(data);
+	_bytes.insert(_bytes.end(), begin, begin + size);
+}
+
+void fm::ByteWriter::writeString(const std::string& value)
+{
+	writeValue((unsigned int)value.size());
+	write(value.data(), value.size());
+}
+
+void fm::ByteWriter::align(size_t alignment)
+{
+	while (_bytes.size() % alignment != 0)
+		_bytes.push_back(0);
+}
+
+size_t fm::ByteWriter::size()
+{
+	return _bytes.size();
+}
+
+// BYTE READER IMPLEMENTATION
+fm::ByteReader::ByteReader(const unsigned char* data, size_t size) 
+	: _data(data), _size(size), _position(0), _failed(false) { }
+
+bool fm::ByteReader::read(void* out, size_t size)
+{
+	if (_failed || size > _size - _position) {
+		_failed = true;
+		return false;
+	}
+
+	memcpy(out, _data + _position, size);
+	_position += size;
+	return true;
+}
+
+std::string fm::ByteReader::readString()
+{
+	unsigned int length = readValue<unsigned int>();
+	if (_failed || length > _size - _position) {
+		_failed = true;
+		return std::string();
+	}
+
+	std::string value(reinterpret_cast<const char*>(_data + _position), length);
+	_position += length;
+	return value;
+}
+
+bool fm::ByteReader::skip(size_t size)
+{
+	if (_failed || size > _size - _position) {
+		_failed = true;
+		return false;
+	}
+
+	_position += size;
+	return true;
+}
+
+bool fm::ByteReader::align(size_t alignment)
+{
+	size_t padding = (alignment - _position % alignment) % alignment;
+	return skip(padding);
+}
+
+const unsigned char* fm::ByteReader::current()
+{
+	return _data + _position;
+}
+
+size_t fm::ByteReader::position()
+{
+	return _position;
+}
+
+size_t fm::ByteReader::remaining()
+{
+	return _size - _position;
+}
+
+bool fm::ByteReader::failed()
+{
+	return _failed;
+}
+
+// STATS IMPLEMENTATION
+fm::Stats::Stats() : _values() { }
+
+// Single instance of Stats
+fm::Stats* fm::Stats::global = new Stats();
+
+void fm::Stats::set(const std::string& name, double value)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_values[name] = value;
+}
+
+void fm::Stats::add(const std::string& name, double value)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_values[name] += value;
+}
+
+double fm::Stats::get(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _values.find(name);
+	return it == _values.end() ? 0.0 : it->second;
+}
+
+std::map<std::string, double> fm::Stats::values()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _values;
+}
+
+void fm::Stats::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_values.clear();
+}
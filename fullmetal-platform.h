@@ -0,0 +1,235 @@
+/*
+ * Platform utilities shared by the loaders: timing,
+ * simple parallelism, hashing, file helpers and stats.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+namespace fm {
+	/*
+	 * Wall clock timer, starts timing on construction.
+	 */
+	class Timer {
+	private:
+		std::chrono::high_resolution_clock::time_point _start;
+
+	public:
+		Timer();
+
+		/* Restarts the timer. */
+		void reset();
+
+		/* Milliseconds since construction or the last reset(). */
+		double elapsedMs();
+	};
+
+	/*
+	 * Gets the number of threads used by parallelFor, at least 1.
+	 */
+	unsigned int workerThreadCount();
+
+	/*
+	 * Calls func(i) for every i in [0, count), spread across the worker threads.
+	 * Blocks until every call has returned. Indexes are handed out dynamically,
+	 * so func must not depend on the order in which they are run.
+	 */
+	void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+	/*
+	 * 64 bit FNV-1a hash of a block of bytes.
+	 * Pass a previous result as the seed to hash multiple blocks.
+	 */
+	unsigned long long hashBytes(const void* data, size_t size,
+		unsigned long long seed = 14695981039346656037ULL);
+
+	/*
+	 * Formats a 64 bit hash as a 16 character hex string.
+	 */
+	std::string hashToString(unsigned long long hash);
+
+	/*
+	 * Reads an entire file into the given buffer.
+	 * Returns false if the file could not be opened.
+	 */
+	bool readFileBytes(const std::string& fp, std::vector<unsigned char>& bytes);
+
+	/*
+	 * Writes a buffer into a file, replacing the file if it exists.
+	 * Returns false if the file could not be written.
+	 */
+	bool writeFileBytes(const std::string& fp, const void* data, size_t size);
+
+	/*
+	 * Same as writeFileBytes, but writes to a temporary file and renames it over 'fp',
+	 * so a crash (or another thread) never leaves a half written file behind.
+	 */
+	bool writeFileAtomic(const std::string& fp, const void* data, size_t size);
+
+	/*
+	 * Moves 'from' over 'to', replacing 'to' if it exists.
+	 * The replace is atomic, readers of 'to' see the old file or the new one, never a mix (or no file).
+	 * Returns false (and removes 'from') if it could not be moved.
+	 */
+	bool replaceFile(const std::string& from, const std::string& to);
+
+	/*
+	 * Hashes the contents of a file with hashBytes, a block at a time so large files aren't loaded.
+	 * Returns false if the file could not be read.
+	 */
+	bool hashFile(const std::string& fp, unsigned long long& hash);
+
+	/*
+	 * Gets the size of a file in bytes, 0 if it can't be opened.
+	 */
+	unsigned long long fileSize(const std::string& fp);
+
+	/*
+	 * Checks if a file exists and can be opened for reading.
+	 */
+	bool fileExists(const std::string& fp);
+
+	/*
+	 * A read only memory mapping of a whole file, so loaders can use its contents in place.
+	 * The mapping is released by close() or the destructor.
+	 */
+	class MappedFile {
+	private:
+		const unsigned char* _data;
+		size_t _size;
+		void* _file;
+		void* _mapping;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+	public:
+		MappedFile();
+		~MappedFile();
+
+		/*
+		 * Maps the file, closing any file mapped before.
+		 * Returns false if it could not be opened, or is empty.
+		 */
+		bool open(const std::string& fp);
+
+		/* Unmaps the file, data() is invalid after this. */
+		void close();
+
+		const unsigned char* data() const;
+		size_t size() const;
+	};
+
+	/*
+	 * Appends values to a byte buffer, used to write the binary formats.
+	 * Values are written in the byte order of the machine (little endian on everything we target).
+	 */
+	class ByteWriter {
+	private:
+		std::vector<unsigned char>& _bytes;
+
+	public:
+		/* Appends to the end of 'bytes'. */
+		ByteWriter(std::vector<unsigned char>& bytes);
+
+		/* Appends a block of bytes. */
+		void write(const void* data, size_t size);
+
+		/* Appends a plain value. */
+		template<typename T>
+		void writeValue(const T& value) {
+			write(&value, sizeof(T));
+		}
+
+		/* Appends a 32 bit length followed by the characters. */
+		void writeString(const std::string& value);
+
+		/* Appends zeros until the size is a multiple of 'alignment'. */
+		void align(size_t alignment);
+
+		/* The size of the buffer being written to. */
+		size_t size();
+	};
+
+	/*
+	 * Reads values written by a ByteWriter from a block of bytes it does not own.
+	 * Reading past the end fails instead of overrunning, every later read then fails too.
+	 */
+	class ByteReader {
+	private:
+		const unsigned char* _data;
+		size_t _size;
+		size_t _position;
+		bool _failed;
+
+	public:
+		ByteReader(const unsigned char* data, size_t size);
+
+		/* Copies the next 'size' bytes into 'out'. Returns false if there aren't enough. */
+		bool read(void* out, size_t size);
+
+		/* Reads a plain value, zero if there aren't enough bytes. */
+		template<typename T>
+		T readValue() {
+			T value = T();
+			read(&value, sizeof(T));
+			return value;
+		}
+
+		/* Reads a string written with ByteWriter::writeString. */
+		std::string readString();
+
+		/* Skips 'size' bytes. Returns false if there aren't enough. */
+		bool skip(size_t size);
+
+		/* Skips to the next multiple of 'alignment'. */
+		bool align(size_t alignment);
+
+		/* Pointer to the next unread byte. */
+		const unsigned char* current();
+
+		size_t position();
+		size_t remaining();
+
+		/* True if any read has run past the end. */
+		bool failed();
+	};
+
+	/*
+	 * Named values (timings, counts, ratios) reported by the loaders and benchmarks.
+	 * Safe to write to from worker threads. Drawn by fm::gui::drawStats().
+	 */
+	class Stats {
+	private:
+		std::mutex _mutex;
+		std::map<std::string, double> _values;
+
+		// forces access through instance
+		Stats();
+
+	public:
+		/* Global instance of the stats. */
+		static Stats* global;
+
+		/* Sets a named value. */
+		void set(const std::string& name, double value);
+
+		/* Adds to a named value, creating it at 0 if it does not exist. */
+		void add(const std::string& name, double value);
+
+		/* Gets a named value, 0 if it has not been set. */
+		double get(const std::string& name);
+
+		/* Copies every named value, sorted by name. */
+		std::map<std::string, double> values();
+
+		/* Removes all the named values. */
+		void clear();
+	};
+}
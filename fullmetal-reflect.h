@@ -0,0 +1,495 @@
+/*
+ * Compile time reflection of the fields of the node types.
+ * A node type declares its fields once, in order, by specialising NodeFields:
+ *
+ *	template<> struct NodeFields<SphereNode> : NodeFieldsBase {
+ *		template<class TVisitor>
+ *		static void visit(SphereNode& node, TVisitor& v) {
+ *			NodeFields<ShapeNode>::visit(node, v);
+ *			v.group("Sphere");
+ *			v.field("stacks", node.getStacks(), 1, 100);
+ *		}
+ *	};
+ *
+ * The json & binary readers and writers and the inspector are generated from the fields at compile time.
+ * Each visitor is a template, so every field is read or written by a call the compiler can inline,
+ * without a std::function or a dynamic_cast. Register the type with NodeTypeTable::registerReflectedNode<TNode>(id).
+ * A field's name is its json key and the order of the fields is their binary order, so neither can change
+ * once scenes have been saved.
+ */
+
+#pragma once
+#include "fullmetal-config.h"
+
+#include <string>
+#include <vector>
+#include <typeinfo>
+#include "fullmetal.h"
+#include "fullmetal-types.h"
+#include "fullmetal-platform.h"
+
+#ifdef FM_IO
+#include "fullmetal-io.h"
+#endif
+
+namespace fm {
+	/*
+	 * The fields of a node type, see the top of this file. Specialised for each reflected type.
+	 */
+	template<class TNode>
+	struct NodeFields;
+
+	/*
+	 * The base of the NodeFields specialisations.
+	 */
+	struct NodeFieldsBase {
+		/* Called after the fields were read or edited, for types that build something from them. */
+		template<class TNode>
+		static void changed(TNode& /*node*/) { }
+
+		/* Called after the fields were read from json, for types whose older scenes saved a value differently. */
+		template<class TNode>
+		static void readOlderJson(nlohmann::json& /*j*/, TNode& /*node*/) { }
+	};
+
+	template<>
+	struct NodeFields<SceneNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(SceneNode& node, TVisitor& v) {
+			v.group("Node");
+			v.field("transform", node.transform);
+			v.field("name", node.name);
+			v.field("enabled", node.enabled);
+		}
+	};
+
+	template<>
+	struct NodeFields<ShapeNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(ShapeNode& node, TVisitor& v) {
+			NodeFields<SceneNode>::visit(node, v);
+			v.group("Shape");
+			v.field("material", node.material);
+		}
+	};
+
+	template<>
+	struct NodeFields<LightNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(LightNode& node, TVisitor& v) {
+			NodeFields<SceneNode>::visit(node, v);
+			v.group("Light");
+			v.field("color", node.color);
+		}
+	};
+
+	template<>
+	struct NodeFields<CubeNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(CubeNode& node, TVisitor& v) {
+			NodeFields<ShapeNode>::visit(node, v);
+		}
+	};
+
+	template<>
+	struct NodeFields<SphereNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(SphereNode& node, TVisitor& v) {
+			NodeFields<ShapeNode>::visit(node, v);
+			v.group("Sphere");
+			v.field("stacks", node.getStacks(), 1, 100);
+			v.field("slices", node.getSlices(), 1, 100);
+		}
+	};
+
+	template<>
+	struct NodeFields<PlaneNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(PlaneNode& node, TVisitor& v) {
+			NodeFields<ShapeNode>::visit(node, v);
+			v.group("Plane");
+			v.field("width", node._width, 1, 4096);
+			v.field("height", node._height, 1, 4096);
+			v.field("quadSize", node._quadSize, 1, 4096);
+		}
+
+		static void changed(PlaneNode& node) {
+			node.buildQuads(node._quadSize, node._width, node._height);
+		}
+	};
+
+	template<>
+	struct NodeFields<CylinderNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(CylinderNode& node, TVisitor& v) {
+			NodeFields<ShapeNode>::visit(node, v);
+			v.group("Cylinder");
+			v.field("segments", node._numSegments, 20, 120);
+		}
+
+		static void changed(CylinderNode& node) {
+			node.build(node._numSegments);
+		}
+	};
+
+	template<>
+	struct NodeFields<MeshNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(MeshNode& node, TVisitor& v) {
+			NodeFields<SceneNode>::visit(node, v);
+			v.group("Mesh");
+			v.field("material", node.material);
+			v.field("model", node.model);
+		}
+
+		static void readOlderJson(nlohmann::json& j, MeshNode& node) {
+			// older scenes flipped the (shared) model's uvs, that's the material's job now
+			auto model = j.find("model");
+			if (model == j.end() || !model->is_object())
+				return;
+
+			auto switched = model->find("switchedUvs");
+			if (switched != model->end() && switched->is_boolean() && switched->get<bool>())
+				node.material.uvTransform.flip = true;
+		}
+	};
+
+	template<>
+	struct NodeFields<AmbientLightNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(AmbientLightNode& node, TVisitor& v) {
+			NodeFields<LightNode>::visit(node, v);
+			v.field("diffuse", node.diffuse);
+		}
+	};
+
+	template<>
+	struct NodeFields<DirectionalLightNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(DirectionalLightNode& node, TVisitor& v) {
+			NodeFields<LightNode>::visit(node, v);
+		}
+	};
+
+	template<>
+	struct NodeFields<SpotLightNode> : NodeFieldsBase {
+		template<class TVisitor>
+		static void visit(SpotLightNode& node, TVisitor& v) {
+			NodeFields<LightNode>::visit(node, v);
+			v.group("Spot Light");
+			v.field("cutoff", node.cutoff);
+			v.field("exponent", node.exponent);
+			v.field("direction", node.direction);
+			v.field("diffuse", node.diffuse);
+		}
+	};
+
+#ifdef FM_IO
+	namespace io {
+		// the json values of the fields
+		inline void writeFieldValue(json& j, bool& value) { j = value; }
+		inline void writeFieldValue(json& j, int& value) { j = value; }
+		inline void writeFieldValue(json& j, float& value) { j = value; }
+		inline void writeFieldValue(json& j, std::string& value) { j = value; }
+		inline void writeFieldValue(json& j, Vector3& value) { writeVector3(j, value); }
+		inline void writeFieldValue(json& j, Color& value) { writeColor(j, value); }
+		inline void writeFieldValue(json& j, Transform& value) { writeTransform(j, value); }
+		inline void writeFieldValue(json& j, Material& value) { j = json::object(); writeMaterial(j, value); }
+		inline void writeFieldValue(json& j, ObjModel*& value) {
+			// a model is saved as its filepath, null for none
+			j = nullptr;
+			if (value != nullptr) {
+				j = json::object();
+				writeObjModel(j, value);
+			}
+		}
+
+		inline void readFieldValue(json& j, bool& value) { value = j.get<bool>(); }
+		inline void readFieldValue(json& j, int& value) { value = j.get<int>(); }
+		inline void readFieldValue(json& j, float& value) { value = j.get<float>(); }
+		inline void readFieldValue(json& j, std::string& value) { value = j.get<std::string>(); }
+		inline void readFieldValue(json& j, Vector3& value) { readVector3(j, value); }
+		inline void readFieldValue(json& j, Color& value) { readColor(j, value); }
+		inline void readFieldValue(json& j, Transform& value) { readTransform(j, value); }
+		inline void readFieldValue(json& j, Material& value) { readMaterial(j, value); }
+		inline void readFieldValue(json& j, ObjModel*& value) { readObjModel(j, &value); }
+
+		// the binary values of the fields, bools are a byte
+		inline void writeFieldBinary(ByteWriter& w, bool& value) { w.writeValue((unsigned char)(value ? 1 : 0)); }
+		inline void writeFieldBinary(ByteWriter& w, int& value) { w.writeValue(value); }
+		inline void writeFieldBinary(ByteWriter& w, float& value) { w.writeValue(value); }
+		inline void writeFieldBinary(ByteWriter& w, std::string& value) { w.writeString(value); }
+		inline void writeFieldBinary(ByteWriter& w, Vector3& value) { writeVector3Binary(w, value); }
+		inline void writeFieldBinary(ByteWriter& w, Color& value) { writeColorBinary(w, value); }
+		inline void writeFieldBinary(ByteWriter& w, Transform& value) { writeTransformBinary(w, value); }
+		inline void writeFieldBinary(ByteWriter& w, Material& value) { writeMaterialBinary(w, value); }
+		inline void writeFieldBinary(ByteWriter& w, ObjModel*& value) { writeObjModelBinary(w, value); }
+
+		inline void readFieldBinary(ByteReader& r, bool& value) { value = r.readValue<unsigned char>() != 0; }
+		inline void readFieldBinary(ByteReader& r, int& value) { value = r.readValue<int>(); }
+		inline void readFieldBinary(ByteReader& r, float& value) { value = r.readValue<float>(); }
+		inline void readFieldBinary(ByteReader& r, std::string& value) { value = r.readString(); }
+		inline void readFieldBinary(ByteReader& r, Vector3& value) { readVector3Binary(r, value); }
+		inline void readFieldBinary(ByteReader& r, Color& value) { readColorBinary(r, value); }
+		inline void readFieldBinary(ByteReader& r, Transform& value) { readTransformBinary(r, value); }
+		inline void readFieldBinary(ByteReader& r, Material& value) { readMaterialBinary(r, value); }
+		inline void readFieldBinary(ByteReader& r, ObjModel*& value) { readObjModelBinary(r, &value); }
+
+		/*
+		 * Writes each field into the json object under its name.
+		 */
+		class JsonFieldWriter {
+		private:
+			json& _j;
+
+		public:
+			JsonFieldWriter(json& j) : _j(j) { }
+
+			void group(const char* /*name*/) { }
+
+			template<class T>
+			void field(const char* name, T& value) {
+				writeFieldValue(_j[name], value);
+			}
+
+			void field(const char* name, int& value, int /*min*/, int /*max*/) {
+				field(name, value);
+			}
+		};
+
+		/*
+		 * Reads each field from the json object, a field that's missing (or null) keeps the node's default.
+		 */
+		class JsonFieldReader {
+		private:
+			json& _j;
+
+		public:
+			JsonFieldReader(json& j) : _j(j) { }
+
+			void group(const char* /*name*/) { }
+
+			template<class T>
+			void field(const char* name, T& value) {
+				auto found = _j.find(name);
+				if (found != _j.end() && !found->is_null())
+					readFieldValue(*found, value);
+			}
+
+			void field(const char* name, int& value, int /*min*/, int /*max*/) {
+				field(name, value);
+			}
+		};
+
+		/*
+		 * Writes each field in order.
+		 */
+		class BinaryFieldWriter {
+		private:
+			ByteWriter& _w;
+
+		public:
+			BinaryFieldWriter(ByteWriter& w) : _w(w) { }
+
+			void group(const char* /*name*/) { }
+
+			template<class T>
+			void field(const char* /*name*/, T& value) {
+				writeFieldBinary(_w, value);
+			}
+
+			void field(const char* name, int& value, int /*min*/, int /*max*/) {
+				field(name, value);
+			}
+		};
+
+		/*
+		 * Reads each field in order.
+		 */
+		class BinaryFieldReader {
+		private:
+			ByteReader& _r;
+
+		public:
+			BinaryFieldReader(ByteReader& r) : _r(r) { }
+
+			void group(const char* /*name*/) { }
+
+			template<class T>
+			void field(const char* /*name*/, T& value) {
+				readFieldBinary(_r, value);
+			}
+
+			void field(const char* name, int& value, int /*min*/, int /*max*/) {
+				field(name, value);
+			}
+		};
+
+		/*
+		 * Writes the fields of the node into the json object, under their names.
+		 */
+		template<class TNode>
+		void writeFields(json& j, TNode& node) {
+			JsonFieldWriter writer(j);
+			NodeFields<TNode>::visit(node, writer);
+		}
+
+		/*
+		 * Reads the fields of the node from the json object.
+		 */
+		template<class TNode>
+		void readFields(json& j, TNode& node) {
+			JsonFieldReader reader(j);
+			NodeFields<TNode>::visit(node, reader);
+			NodeFields<TNode>::readOlderJson(j, node);
+			NodeFields<TNode>::changed(node);
+		}
+
+		/*
+		 * Writes the fields of the node in the binary scene format.
+		 */
+		template<class TNode>
+		void writeFieldsBinary(ByteWriter& w, TNode& node) {
+			BinaryFieldWriter writer(w);
+			NodeFields<TNode>::visit(node, writer);
+		}
+
+		/*
+		 * Reads the fields of the node from the binary scene format.
+		 */
+		template<class TNode>
+		void readFieldsBinary(ByteReader& r, TNode& node) {
+			BinaryFieldReader reader(r);
+			NodeFields<TNode>::visit(node, reader);
+			NodeFields<TNode>::changed(node);
+		}
+	}
+#endif
+
+#ifdef FM_EDITOR
+	namespace gui {
+		// the inspector's widgets for the fields, labelled from the name ("quadSize" is "Quad Size").
+		// Each returns true if it changed the value (the compound values can't tell, so they return false)
+		bool introspectField(const char* name, bool& value);
+		bool introspectField(const char* name, int& value);
+		bool introspectField(const char* name, int& value, int min, int max);
+		bool introspectField(const char* name, float& value);
+		bool introspectField(const char* name, std::string& value);
+		bool introspectField(const char* name, Vector3& value);
+		bool introspectField(const char* name, Color& value);
+		bool introspectField(const char* name, Transform& value);
+		bool introspectField(const char* name, Material& value);
+		bool introspectField(const char* name, ObjModel*& value);
+
+		// a heading over the fields that follow, indenting them until the next one (or the end)
+		void beginFieldGroup(const char* name, bool& indented);
+		void endFieldGroup(bool& indented);
+
+		/*
+		 * Draws a widget for each field, under the headings of the groups.
+		 */
+		class FieldIntrospector {
+		private:
+			bool _indented;
+			bool _changed;
+
+		public:
+			FieldIntrospector() : _indented(false), _changed(false) { }
+
+			void group(const char* name) {
+				beginFieldGroup(name, _indented);
+			}
+
+			template<class T>
+			void field(const char* name, T& value) {
+				if (introspectField(name, value))
+					_changed = true;
+			}
+
+			void field(const char* name, int& value, int min, int max) {
+				if (introspectField(name, value, min, max))
+					_changed = true;
+			}
+
+			/* Closes the last group, returns true if a field was changed. */
+			bool end() {
+				endFieldGroup(_indented);
+				return _changed;
+			}
+		};
+
+		/*
+		 * Draws the fields of the node for editing in the inspector.
+		 */
+		template<class TNode>
+		void introspectFields(TNode& node) {
+			FieldIntrospector introspector;
+			NodeFields<TNode>::visit(node, introspector);
+
+			if (introspector.end())
+				NodeFields<TNode>::changed(node);
+		}
+	}
+#endif
+
+	/*
+	 * The link of a reflected type, its functions are generated from NodeFields<TNode>.
+	 * It's found by the node's exact type, so the node is cast statically.
+	 */
+	template<class TNode>
+	class NodeTypeTable::ReflectedNodeTypeLink : public NodeTypeTable::INodeTypeLink {
+	public:
+		virtual SceneNode* create_node() override {
+			return new TNode();
+		}
+
+		virtual SceneNode* read(nlohmann::json& json) override {
+#ifdef FM_IO
+			// read straight into the new node
+			TNode* node = new TNode();
+			io::readFields(json, *node);
+			return node;
+#else
+			assert(false);
+			return nullptr;
+#endif
+		}
+
+		virtual void write(nlohmann::json& json, SceneNode* node) override {
+			assert(typeid(*node) == typeid(TNode));
+#ifdef FM_IO
+			io::writeFields(json, *static_cast<TNode*>(node));
+#endif
+		}
+
+		virtual SceneNode* readBinary(ByteReader& reader) override {
+#ifdef FM_IO
+			TNode* node = new TNode();
+			io::readFieldsBinary(reader, *node);
+			return node;
+#else
+			assert(false);
+			return nullptr;
+#endif
+		}
+
+		virtual void writeBinary(ByteWriter& writer, SceneNode* node) override {
+			assert(typeid(*node) == typeid(TNode));
+#ifdef FM_IO
+			io::writeFieldsBinary(writer, *static_cast<TNode*>(node));
+#endif
+		}
+
+		virtual void introspect(SceneNode* node) override {
+			assert(typeid(*node) == typeid(TNode));
+#ifdef FM_EDITOR
+			gui::introspectFields(*static_cast<TNode*>(node));
+#endif
+		}
+	};
+
+	template<class TNode>
+	void NodeTypeTable::registerReflectedNode(std::string name) {
+		addLink(name, std::type_index(typeid(TNode)), new ReflectedNodeTypeLink<TNode>());
+	}
+}
@@ -0,0 +1,429 @@
+#include "fullmetal-streaming.h"
+
+#ifdef FM_IO
+
+#include "fullmetal.h"
+#include "fullmetal-types.h"
+#include "fullmetal-bundle.h"
+
+#include <map>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+// WORLD FORMAT CONSTANTS
+namespace {
+	const unsigned int WORLD_MAGIC = 0x44574d46; // "FMWD"
+	const unsigned int WORLD_VERSION = 1;
+
+	// magic, version, cell size & cell count, then the cell table
+	const size_t WORLD_HEADER_SIZE = 16;
+
+	// x, z, offset, size, node count & reserved
+	const size_t WORLD_CELL_SIZE = 32;
+}
+
+// WORLD WRITING IMPLEMENTATION
+fm::io::WorldCell::WorldCell() : x(0), z(0), offset(0), size(0), nodeCount(0) { }
+
+bool fm::io::writeWorld(const std::string& file, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, float cellSize)
+{
+	std::vector<unsigned char> bytes;
+	writeWorld(bytes, sceneGraph, typeTable, cellSize);
+	return writeFileAtomic(file, bytes.data(), bytes.size());
+}
+
+void fm::io::writeWorld(std::vector<unsigned char>& bytes, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, float cellSize)
+{
+	assert(cellSize > 0.0f);
+
+	// the top level nodes by the cell their position is in, where applyTransform puts their origin
+	std::map<std::pair<int, int>, std::vector<SceneNode*>> cells;
+	for (auto node : sceneGraph->getNodes()) {
+		float matrix[16];
+		transformMatrix(node->transform, matrix);
+
+		int x = (int)floorf(matrix[12] / cellSize);
+		int z = (int)floorf(matrix[14] / cellSize);
+		cells[std::make_pair(x, z)].push_back(node);
+	}
+
+	// each cell is a binary scene of its own, after the header & the cell table
+	std::vector<unsigned char> chunks;
+	std::vector<WorldCell> table;
+	unsigned long long start = WORLD_HEADER_SIZE + WORLD_CELL_SIZE * cells.size();
+
+	for (auto& cell : cells) {
+		WorldCell stored;
+		stored.x = cell.first.first;
+		stored.z = cell.first.second;
+		stored.offset = start + chunks.size();
+
+		writeNodesBinary(chunks, cell.second, typeTable, true);
+		stored.size = start + chunks.size() - stored.offset;
+
+		for (auto node : cell.second)
+			stored.nodeCount += 1 + node->childCount();
+
+		table.push_back(stored);
+	}
+
+	ByteWriter w(bytes);
+	w.writeValue(WORLD_MAGIC);
+	w.writeValue(WORLD_VERSION);
+	w.writeValue(cellSize);
+	w.writeValue((unsigned int)table.size());
+
+	for (auto& stored : table) {
+		w.writeValue(stored.x);
+		w.writeValue(stored.z);
+		w.writeValue(stored.offset);
+		w.writeValue(stored.size);
+		w.writeValue(stored.nodeCount);
+		w.writeValue((unsigned int)0);
+	}
+
+	w.write(chunks.data(), chunks.size());
+}
+
+// WORLD STREAMER IMPLEMENTATION
+fm::io::WorldStreamer::WorldStreamer(NodeTypeTable* typeTable, float loadRadius, float unloadRadius, unsigned int maxLoads,
+	unsigned long long residentBudget, double frameBudgetMs)
+	: _typeTable(typeTable), _loadRadius(loadRadius), _unloadRadius(std::max(loadRadius, unloadRadius)),
+	_maxLoads(maxLoads > 0 ? maxLoads : 1), _residentBudget(residentBudget), _frameBudgetMs(frameBudgetMs),
+	_data(nullptr), _size(0), _cellSize(0.0f), _stopping(false), _loading(0), _residentBytes(0), _maxUpdateMs(0.0) { }
+
+fm::io::WorldStreamer::~WorldStreamer()
+{
+	stopLoaders();
+
+	// the resident cells belong to the graph now, anything read but not added is deleted
+	for (auto& cell : _cells) {
+		if (cell.state == CELL_RESIDENT)
+			continue;
+
+		for (auto node : cell.nodes)
+			delete node;
+	}
+}
+
+bool fm::io::WorldStreamer::open(const std::string& file)
+{
+	if (!_cells.empty() || !_mapped.open(file))
+		return false;
+
+	if (!readCells(_mapped.data(), _mapped.size())) {
+		_mapped.close();
+		return false;
+	}
+
+	startLoaders();
+	return true;
+}
+
+bool fm::io::WorldStreamer::open(const Bundle& bundle)
+{
+	const unsigned char* data;
+	size_t size;
+	if (!_cells.empty() || !bundle.findWorld(data, size) || !readCells(data, size))
+		return false;
+
+	startLoaders();
+	return true;
+}
+
+bool fm::io::WorldStreamer::readCells(const unsigned char* data, size_t size)
+{
+	ByteReader r(data, size);
+	unsigned int magic = r.readValue<unsigned int>();
+	unsigned int version = r.readValue<unsigned int>();
+	float cellSize = r.readValue<float>();
+	unsigned int cellCount = r.readValue<unsigned int>();
+
+	if (r.failed() || magic != WORLD_MAGIC || version != WORLD_VERSION || !(cellSize > 0.0f))
+		return false;
+
+	// the cell table must fit in the data before it's allocated
+	if (cellCount > r.remaining() / WORLD_CELL_SIZE)
+		return false;
+
+	std::vector<Cell> cells(cellCount);
+	for (auto& cell : cells) {
+		cell.stored.x = r.readValue<int>();
+		cell.stored.z = r.readValue<int>();
+		cell.stored.offset = r.readValue<unsigned long long>();
+		cell.stored.size = r.readValue<unsigned long long>();
+		cell.stored.nodeCount = r.readValue<unsigned int>();
+		r.skip(sizeof(unsigned int));
+		cell.state = CELL_UNLOADED;
+		cell.failed = false;
+
+		// every cell must be inside of the world
+		if (r.failed() || cell.stored.offset > size || cell.stored.size > size - cell.stored.offset)
+			return false;
+	}
+
+	_data = data;
+	_size = size;
+	_cellSize = cellSize;
+	_cells.swap(cells);
+
+	Stats::global->set("stream.cells", (double)_cells.size());
+	return true;
+}
+
+void fm::io::WorldStreamer::startLoaders()
+{
+	_stopping = false;
+	for (unsigned int i = 0; i < _maxLoads; ++i)
+		_loaders.emplace_back(&WorldStreamer::loaderThread, this);
+}
+
+void fm::io::WorldStreamer::stopLoaders()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+
+	_wake.notify_all();
+	for (auto& loader : _loaders)
+		loader.join();
+
+	_loaders.clear();
+
+	// what the loaders finished is deleted with the cells that weren't added
+	std::lock_guard<std::mutex> lock(_mutex);
+	_queue.clear();
+	_finished.clear();
+}
+
+void fm::io::WorldStreamer::loaderThread()
+{
+	for (;;) {
+		size_t index;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+			if (_stopping)
+				return;
+
+			index = _queue.front();
+			_queue.pop_front();
+		}
+
+		// the cells never move once the world is open, and the updating thread leaves a loading cell alone
+		Cell& cell = _cells[index];
+		std::vector<SceneNode*> nodes;
+		DeferredAssets assets;
+
+		Timer timer;
+		bool read = readNodesBinaryDeferred(_data + cell.stored.offset, (size_t)cell.stored.size, _typeTable, nodes, assets);
+		Stats::global->set("stream.read_ms", timer.elapsedMs());
+
+		// the models are parsed here too, the updating thread only uploads the textures
+		if (read) {
+			timer.reset();
+			loadDeferredModels(assets);
+			Stats::global->set("stream.models_ms", timer.elapsedMs());
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			cell.nodes.swap(nodes);
+			cell.assets.textures.swap(assets.textures);
+			cell.assets.models.swap(assets.models);
+			cell.assets.prefabs.swap(assets.prefabs);
+			cell.failed = !read;
+			_finished.push_back(index);
+		}
+
+		_wake.notify_all();
+	}
+}
+
+float fm::io::WorldStreamer::cellDistance(const Cell& cell, float x, float z) const
+{
+	// to the nearest point of the cell's square, 0 inside of it
+	float minX = (float)cell.stored.x * _cellSize, minZ = (float)cell.stored.z * _cellSize;
+	float dx = std::max(std::max(minX - x, x - (minX + _cellSize)), 0.0f);
+	float dz = std::max(std::max(minZ - z, z - (minZ + _cellSize)), 0.0f);
+	return sqrtf(dx * dx + dz * dz);
+}
+
+void fm::io::WorldStreamer::evict(Cell& cell, std::vector<SceneNode*>& removing)
+{
+	if (cell.state == CELL_RESIDENT)
+		_residentBytes -= cell.stored.size;
+
+	removing.insert(removing.end(), cell.nodes.begin(), cell.nodes.end());
+	cell.nodes.clear();
+	cell.assets.textures.clear();
+	cell.assets.models.clear();
+	cell.assets.prefabs.clear();
+	cell.state = CELL_UNLOADED;
+
+	Stats::global->add("stream.evictions", 1.0);
+}
+
+void fm::io::WorldStreamer::update(SceneNodeGraph* sceneGraph, const Vector3& cameraPosition)
+{
+	Timer timer;
+	float x = cameraPosition.x, z = cameraPosition.z;
+
+	std::vector<size_t> finished;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		finished.swap(_finished);
+	}
+
+	for (auto index : finished) {
+		Cell& cell = _cells[index];
+		cell.state = CELL_READY;
+		--_loading;
+
+		if (cell.failed) {
+			for (auto node : cell.nodes)
+				delete node;
+
+			cell.nodes.clear();
+			cell.state = CELL_UNLOADED;
+			Stats::global->add("stream.failed", 1.0);
+		}
+	}
+
+	// the bytes of every cell that's resident, read or being read, against the budget
+	unsigned long long committed = 0;
+	std::vector<SceneNode*> removing;
+	std::vector<std::pair<float, size_t>> ready, wanted, held;
+
+	for (size_t i = 0; i < _cells.size(); ++i) {
+		Cell& cell = _cells[i];
+		float distance = cellDistance(cell, x, z);
+
+		if ((cell.state == CELL_RESIDENT || cell.state == CELL_READY) && distance > _unloadRadius)
+			evict(cell, removing);
+
+		if (cell.state == CELL_READY)
+			ready.push_back(std::make_pair(distance, i));
+		else if (cell.state == CELL_UNLOADED && distance <= _loadRadius)
+			wanted.push_back(std::make_pair(distance, i));
+
+		if (cell.state == CELL_RESIDENT || cell.state == CELL_READY)
+			held.push_back(std::make_pair(distance, i));
+
+		if (cell.state != CELL_UNLOADED)
+			committed += cell.stored.size;
+	}
+
+	std::sort(ready.begin(), ready.end());
+	std::sort(wanted.begin(), wanted.end());
+	std::sort(held.begin(), held.end());
+
+	// start the nearest wanted cells, evicting the furthest held cells to stay within the memory budget
+	size_t started = 0;
+	for (auto& entry : wanted) {
+		if (_loading >= _maxLoads)
+			break;
+
+		Cell& cell = _cells[entry.second];
+		while (committed + cell.stored.size > _residentBudget && !held.empty() && held.back().first > entry.first) {
+			Cell& furthest = _cells[held.back().second];
+			if (furthest.state != CELL_UNLOADED) {
+				committed -= furthest.stored.size;
+				evict(furthest, removing);
+			}
+
+			held.pop_back();
+		}
+
+		if (committed + cell.stored.size > _residentBudget)
+			break;
+
+		cell.state = CELL_LOADING;
+		committed += cell.stored.size;
+		++_loading;
+		++started;
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(entry.second);
+	}
+
+	if (started > 0) {
+		_wake.notify_all();
+		Stats::global->add("stream.loads", (double)started);
+	}
+
+	// add what's been read, nearest first, until the frame's budget is spent
+	std::vector<SceneNode*> adding;
+	for (auto& entry : ready) {
+		if (timer.elapsedMs() >= _frameBudgetMs)
+			break;
+
+		// cells evicted to make room for nearer ones aren't added
+		Cell& cell = _cells[entry.second];
+		if (cell.state != CELL_READY)
+			continue;
+
+		loadDeferredAssets(cell.assets);
+		adding.insert(adding.end(), cell.nodes.begin(), cell.nodes.end());
+		cell.state = CELL_RESIDENT;
+		_residentBytes += cell.stored.size;
+	}
+
+	// the graph is changed once for all of the cells
+	if (!removing.empty()) {
+		sceneGraph->removeNodes(removing);
+		for (auto node : removing)
+			delete node;
+	}
+
+	if (!adding.empty())
+		sceneGraph->addNodes(adding);
+
+	double updateMs = timer.elapsedMs();
+	_maxUpdateMs = std::max(_maxUpdateMs, updateMs);
+
+	Stats::global->set("stream.update_ms", updateMs);
+	Stats::global->set("stream.max_update_ms", _maxUpdateMs);
+	Stats::global->set("stream.resident", (double)residentCount());
+	Stats::global->set("stream.loading", (double)_loading);
+	Stats::global->set("stream.resident_bytes", (double)_residentBytes);
+}
+
+void fm::io::WorldStreamer::wait()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_wake.wait(lock, [this]() { return _finished.size() >= _loading; });
+}
+
+float fm::io::WorldStreamer::cellSize() const
+{
+	return _cellSize;
+}
+
+size_t fm::io::WorldStreamer::cellCount() const
+{
+	return _cells.size();
+}
+
+size_t fm::io::WorldStreamer::residentCount() const
+{
+	size_t count = 0;
+	for (auto& cell : _cells)
+		count += cell.state == CELL_RESIDENT ? 1 : 0;
+
+	return count;
+}
+
+unsigned int fm::io::WorldStreamer::loadingCount() const
+{
+	return _loading;
+}
+
+unsigned long long fm::io::WorldStreamer::residentBytes() const
+{
+	return _residentBytes;
+}
+
+#endif
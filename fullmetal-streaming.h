@@ -0,0 +1,160 @@
+/*
+ * World streaming, for open worlds far bigger than what can be resident at once.
+ * A world is a scene split into a grid of square cells on the ground (x & z), each cell stored as its own chunk
+ * (a binary scene) in a world file or a bundle. The WorldStreamer loads the cells around the camera on background
+ * threads, nearest first, and evicts the ones that are far away, within budgets for the loads in flight,
+ * the memory the resident cells take and the time each frame spends adding cells to the graph.
+ */
+
+#pragma once
+#include "fullmetal-config.h"
+
+#ifdef FM_IO
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "fullmetal-platform.h"
+#include "fullmetal-io.h"
+
+namespace fm {
+	class SceneNodeGraph;
+	class SceneNode;
+	class NodeTypeTable;
+	class Vector3;
+	class Bundle;
+
+	namespace io {
+		/*
+		 * Writes the graph as a world file, each top level node (with its children) put into the cell of
+		 * 'cellSize' its position falls in. The file is written to a temporary file that is renamed over it
+		 * once complete, like writeSceneGraph. Returns false if it could not be written.
+		 */
+		bool writeWorld(const std::string& file, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, float cellSize);
+
+		/*
+		 * Writes the graph as a world, appending to 'bytes'. See writeWorld.
+		 */
+		void writeWorld(std::vector<unsigned char>& bytes, SceneNodeGraph* sceneGraph, NodeTypeTable* typeTable, float cellSize);
+
+		/*
+		 * Where a cell of a world is, on the grid & in the world's data.
+		 */
+		struct WorldCell {
+			WorldCell();
+
+			/* The cell's place on the grid, it covers x * cellSize to (x + 1) * cellSize (the same for z). */
+			int x, z;
+
+			/* Where the cell's binary scene is, from the start of the world. */
+			unsigned long long offset;
+			unsigned long long size;
+
+			/* The number of nodes in the cell, children included. */
+			unsigned int nodeCount;
+		};
+
+		/*
+		 * Streams the cells of a world into a graph around the camera.
+		 * Cells within 'loadRadius' of the camera are read on 'maxLoads' background threads, nearest first,
+		 * and added to the graph once read. Cells further than 'unloadRadius' are removed from the graph & deleted.
+		 * At most 'residentBudget' bytes of cells (by their size in the world) are resident or loading,
+		 * the furthest resident cell is evicted to make room for a nearer one.
+		 * Update never waits on a load. The cells' models are loaded on the background threads with their nodes,
+		 * their textures (which need the OpenGL context) as the cells are added, within 'frameBudgetMs' a frame
+		 * (a cell is never split, so one with slow textures can still go over).
+		 * The nodes of the resident cells belong to the streamer, don't delete them from the graph.
+		 * Sets the "stream.*" stats, update_ms & max_update_ms are the time the frame spent in update.
+		 */
+		class WorldStreamer {
+		private:
+			// what a cell is doing, only changed on the updating thread
+			enum CellState {
+				CELL_UNLOADED,
+				CELL_LOADING,
+				CELL_READY,
+				CELL_RESIDENT
+			};
+
+			struct Cell {
+				WorldCell stored;
+				CellState state;
+
+				// the nodes once they're read, and their assets until they're added to the graph
+				std::vector<SceneNode*> nodes;
+				DeferredAssets assets;
+				bool failed;
+			};
+
+			NodeTypeTable* _typeTable;
+			float _loadRadius, _unloadRadius;
+			unsigned int _maxLoads;
+			unsigned long long _residentBudget;
+			double _frameBudgetMs;
+
+			// the world, mapped from a file or found in a bundle
+			MappedFile _mapped;
+			const unsigned char* _data;
+			size_t _size;
+			float _cellSize;
+			std::vector<Cell> _cells;
+
+			// the cells being read, handed to the loader threads & back
+			std::vector<std::thread> _loaders;
+			std::mutex _mutex;
+			std::condition_variable _wake;
+			std::deque<size_t> _queue;
+			std::vector<size_t> _finished;
+			bool _stopping;
+
+			unsigned int _loading;
+			unsigned long long _residentBytes;
+			double _maxUpdateMs;
+
+			bool readCells(const unsigned char* data, size_t size);
+			void startLoaders();
+			void stopLoaders();
+			void loaderThread();
+			float cellDistance(const Cell& cell, float x, float z) const;
+			void evict(Cell& cell, std::vector<SceneNode*>& removing);
+
+		public:
+			WorldStreamer(NodeTypeTable* typeTable, float loadRadius = 100.0f, float unloadRadius = 150.0f, unsigned int maxLoads = 2,
+				unsigned long long residentBudget = 256ull << 20, double frameBudgetMs = 2.0);
+
+			/* Stops the loader threads. Resident cells stay in the graph, cells still loading are deleted. */
+			~WorldStreamer();
+
+			/* Maps a world file (see writeWorld). Returns false if it isn't a valid world. */
+			bool open(const std::string& file);
+
+			/* Streams the world stored in a bundle, which must stay open. Returns false if it has no valid world. */
+			bool open(const Bundle& bundle);
+
+			/*
+			 * Call once a frame on the thread with the OpenGL context, with Camera::getPosition().
+			 * Adds the cells that have been read into the graph, evicts the far ones and starts the next loads.
+			 */
+			void update(SceneNodeGraph* sceneGraph, const Vector3& cameraPosition);
+
+			/* Waits for the loads in flight to be read, they're added by the next update. */
+			void wait();
+
+			/* The size of the cells of the world. */
+			float cellSize() const;
+
+			/* The number of cells in the world, resident & being read. */
+			size_t cellCount() const;
+			size_t residentCount() const;
+			unsigned int loadingCount() const;
+
+			/* The bytes of the resident cells, by their size in the world. */
+			unsigned long long residentBytes() const;
+		};
+	}
+}
+
+#endif
@@ -0,0 +1,465 @@
+#include "fullmetal-textures.h"
+#include "fullmetal-platform.h"
+
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include "../SOIL.h"
+
+// DDS CONSTANTS
+namespace {
+	const unsigned int DDS_MAGIC = 0x20534444; // "DDS "
+	const unsigned int DDSD_CAPS = 0x1;
+	const unsigned int DDSD_HEIGHT = 0x2;
+	const unsigned int DDSD_WIDTH = 0x4;
+	const unsigned int DDSD_PIXELFORMAT = 0x1000;
+	const unsigned int DDSD_MIPMAPCOUNT = 0x20000;
+	const unsigned int DDSD_LINEARSIZE = 0x80000;
+	const unsigned int DDPF_FOURCC = 0x4;
+	const unsigned int DDSCAPS_COMPLEX = 0x8;
+	const unsigned int DDSCAPS_TEXTURE = 0x1000;
+	const unsigned int DDSCAPS_MIPMAP = 0x400000;
+	const unsigned int FOURCC_DXT1 = 0x31545844; // "DXT1"
+	const unsigned int FOURCC_DXT5 = 0x35545844; // "DXT5"
+
+	int nextPowerOfTwo(int value)
+	{
+		int pot = 1;
+		while (pot < value)
+			pot *= 2;
+		return pot;
+	}
+
+	// Bilinear resize of an RGBA image, used to get to power of two sizes like SOIL does.
+	void resizeImage(const unsigned char* src, int sw, int sh, std::vector<unsigned char>& dst, int dw, int dh)
+	{
+		dst.resize((size_t)dw * dh * 4);
+
+		for (int y = 0; y < dh; ++y) {
+			float fy = ((y + 0.5f) * sh / dh) - 0.5f;
+			if (fy < 0) fy = 0;
+			int y0 = (int)fy;
+			int y1 = (y0 + 1 < sh) ? y0 + 1 : y0;
+			float ty = fy - y0;
+
+			for (int x = 0; x < dw; ++x) {
+				float fx = ((x + 0.5f) * sw / dw) - 0.5f;
+				if (fx < 0) fx = 0;
+				int x0 = (int)fx;
+				int x1 = (x0 + 1 < sw) ? x0 + 1 : x0;
+				float tx = fx - x0;
+
+				for (int c = 0; c < 4; ++c) {
+					float a = src[(y0 * sw + x0) * 4 + c];
+					float b = src[(y0 * sw + x1) * 4 + c];
+					float d = src[(y1 * sw + x0) * 4 + c];
+					float e = src[(y1 * sw + x1) * 4 + c];
+					float top = a + (b - a) * tx;
+					float bottom = d + (e - d) * tx;
+					dst[((size_t)y * dw + x) * 4 + c] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+				}
+			}
+		}
+	}
+
+	// Box filters an RGBA image down to the next mip level.
+	void downsampleImage(const std::vector<unsigned char>& src, int sw, int sh, std::vector<unsigned char>& dst, int dw, int dh)
+	{
+		dst.resize((size_t)dw * dh * 4);
+
+		for (int y = 0; y < dh; ++y) {
+			int y0 = (y * 2 < sh) ? y * 2 : sh - 1;
+			int y1 = (y * 2 + 1 < sh) ? y * 2 + 1 : y0;
+
+			for (int x = 0; x < dw; ++x) {
+				int x0 = (x * 2 < sw) ? x * 2 : sw - 1;
+				int x1 = (x * 2 + 1 < sw) ? x * 2 + 1 : x0;
+
+				for (int c = 0; c < 4; ++c) {
+					int sum = src[((size_t)y0 * sw + x0) * 4 + c] + src[((size_t)y0 * sw + x1) * 4 + c]
+						+ src[((size_t)y1 * sw + x0) * 4 + c] + src[((size_t)y1 * sw + x1) * 4 + c];
+					dst[((size_t)y * dw + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	unsigned short packColor565(int r, int g, int b)
+	{
+		return (unsigned short)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+	}
+
+	void unpackColor565(unsigned short color, int* rgb)
+	{
+		int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	// Encodes the color part of a DXT block from 16 RGBA pixels, using the inset bounding box.
+	void encodeColorBlock(const unsigned char* pixels, unsigned char* out)
+	{
+		int minC[3] = { 255, 255, 255 }, maxC[3] = { 0, 0, 0 };
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 3; ++c) {
+				int v = pixels[i * 4 + c];
+				if (v < minC[c]) minC[c] = v;
+				if (v > maxC[c]) maxC[c] = v;
+			}
+		}
+
+		// inset the box slightly, it reduces the error of the end points
+		for (int c = 0; c < 3; ++c) {
+			int inset = (maxC[c] - minC[c]) / 16;
+			minC[c] += inset;
+			maxC[c] -= inset;
+		}
+
+		unsigned short c0 = packColor565(maxC[0], maxC[1], maxC[2]);
+		unsigned short c1 = packColor565(minC[0], minC[1], minC[2]);
+		if (c0 < c1) {
+			unsigned short t = c0; c0 = c1; c1 = t;
+		}
+
+		unsigned int indices = 0;
+
+		// c0 > c1 selects the four color mode, equal end points just use index 0
+		if (c0 != c1) {
+			int palette[4][3];
+			unpackColor565(c0, palette[0]);
+			unpackColor565(c1, palette[1]);
+			for (int c = 0; c < 3; ++c) {
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; ++i) {
+				int best = 0, bestDist = 0x7fffffff;
+				for (int p = 0; p < 4; ++p) {
+					int dr = pixels[i * 4] - palette[p][0];
+					int dg = pixels[i * 4 + 1] - palette[p][1];
+					int db = pixels[i * 4 + 2] - palette[p][2];
+					int dist = dr * dr + dg * dg + db * db;
+					if (dist < bestDist) {
+						bestDist = dist;
+						best = p;
+					}
+				}
+				indices |= (unsigned int)best << (i * 2);
+			}
+		}
+
+		out[0] = c0 & 0xff; out[1] = c0 >> 8;
+		out[2] = c1 & 0xff; out[3] = c1 >> 8;
+		for (int i = 0; i < 4; ++i)
+			out[4 + i] = (indices >> (i * 8)) & 0xff;
+	}
+
+	// Encodes the alpha part of a DXT5 block from 16 RGBA pixels.
+	void encodeAlphaBlock(const unsigned char* pixels, unsigned char* out)
+	{
+		int minA = 255, maxA = 0;
+		for (int i = 0; i < 16; ++i) {
+			int a = pixels[i * 4 + 3];
+			if (a < minA) minA = a;
+			if (a > maxA) maxA = a;
+		}
+
+		unsigned long long indices = 0;
+
+		// a0 > a1 selects the eight alpha mode
+		if (maxA != minA) {
+			int palette[8];
+			palette[0] = maxA;
+			palette[1] = minA;
+			for (int p = 1; p < 7; ++p)
+				palette[p + 1] = ((7 - p) * maxA + p * minA) / 7;
+
+			for (int i = 0; i < 16; ++i) {
+				int best = 0, bestDist = 256;
+				for (int p = 0; p < 8; ++p) {
+					int dist = abs(pixels[i * 4 + 3] - palette[p]);
+					if (dist < bestDist) {
+						bestDist = dist;
+						best = p;
+					}
+				}
+				indices |= (unsigned long long)best << (i * 3);
+			}
+		}
+
+		out[0] = (unsigned char)maxA;
+		out[1] = (unsigned char)minA;
+		for (int i = 0; i < 6; ++i)
+			out[2 + i] = (indices >> (i * 8)) & 0xff;
+	}
+
+	// Compresses one mip level, appending the blocks to 'out'.
+	void compressLevel(const std::vector<unsigned char>& rgba, int w, int h, bool hasAlpha, std::vector<unsigned char>& out)
+	{
+		unsigned char block[64];
+		unsigned char encoded[16];
+
+		for (int by = 0; by < h; by += 4) {
+			for (int bx = 0; bx < w; bx += 4) {
+				// gather the 4x4 block, replicating edge pixels for levels smaller than 4
+				for (int y = 0; y < 4; ++y) {
+					int sy = (by + y < h) ? by + y : h - 1;
+					for (int x = 0; x < 4; ++x) {
+						int sx = (bx + x < w) ? bx + x : w - 1;
+						memcpy(&block[(y * 4 + x) * 4], &rgba[((size_t)sy * w + sx) * 4], 4);
+					}
+				}
+
+				if (hasAlpha) {
+					encodeAlphaBlock(block, encoded);
+					encodeColorBlock(block, encoded + 8);
+					out.insert(out.end(), encoded, encoded + 16);
+				}
+				else {
+					encodeColorBlock(block, encoded);
+					out.insert(out.end(), encoded, encoded + 8);
+				}
+			}
+		}
+	}
+
+	void pushUInt(std::vector<unsigned char>& out, unsigned int value)
+	{
+		for (int i = 0; i < 4; ++i)
+			out.push_back((value >> (i * 8)) & 0xff);
+	}
+}
+
+void fm::compressPixelsToDDS(const unsigned char* rgba, int width, int height, bool hasAlpha, std::vector<unsigned char>& dds)
+{
+	assert(width > 0 && height > 0);
+
+	// mipmaps need power of two sizes, same as SOIL_FLAG_MIPMAPS
+	int w = nextPowerOfTwo(width);
+	int h = nextPowerOfTwo(height);
+
+	std::vector<unsigned char> level;
+	if (w != width || h != height)
+		resizeImage(rgba, width, height, level, w, h);
+	else
+		level.assign(rgba, rgba + (size_t)width * height * 4);
+
+	// count the levels down to 1x1
+	int levelCount = 1;
+	for (int lw = w, lh = h; lw > 1 || lh > 1; ++levelCount) {
+		lw = lw > 1 ? lw / 2 : 1;
+		lh = lh > 1 ? lh / 2 : 1;
+	}
+
+	int blockSize = hasAlpha ? 16 : 8;
+	unsigned int topLevelSize = ((w + 3) / 4) * ((h + 3) / 4) * blockSize;
+
+	// write the DDS header, 4 byte magic + 124 byte header
+	dds.clear();
+	dds.reserve(128 + topLevelSize * 2);
+	pushUInt(dds, DDS_MAGIC);
+	pushUInt(dds, 124);
+	pushUInt(dds, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE);
+	pushUInt(dds, h);
+	pushUInt(dds, w);
+	pushUInt(dds, topLevelSize);
+	pushUInt(dds, 0); // depth
+	pushUInt(dds, levelCount);
+	for (int i = 0; i < 11; ++i)
+		pushUInt(dds, 0); // reserved
+
+	// pixel format
+	pushUInt(dds, 32);
+	pushUInt(dds, DDPF_FOURCC);
+	pushUInt(dds, hasAlpha ? FOURCC_DXT5 : FOURCC_DXT1);
+	for (int i = 0; i < 5; ++i)
+		pushUInt(dds, 0); // bit count & masks
+
+	// caps
+	pushUInt(dds, DDSCAPS_COMPLEX | DDSCAPS_TEXTURE | DDSCAPS_MIPMAP);
+	for (int i = 0; i < 4; ++i)
+		pushUInt(dds, 0); // caps2, caps3, caps4, reserved
+
+	// now every level, largest first
+	std::vector<unsigned char> next;
+	for (int i = 0; i < levelCount; ++i) {
+		compressLevel(level, w, h, hasAlpha, dds);
+
+		if (i + 1 < levelCount) {
+			int nw = w > 1 ? w / 2 : 1;
+			int nh = h > 1 ? h / 2 : 1;
+			downsampleImage(level, w, h, next, nw, nh);
+			level.swap(next);
+			w = nw;
+			h = nh;
+		}
+	}
+}
+
+bool fm::compressTextureToDDS(const std::string& sourcePath, std::vector<unsigned char>& dds)
+{
+	int width, height, channels;
+	unsigned char* pixels = SOIL_load_image(sourcePath.c_str(), &width, &height, &channels, SOIL_LOAD_RGBA);
+	if (pixels == nullptr)
+		return false;
+
+	// scale colors into the NTSC safe range, matches SOIL_FLAG_NTSC_SAFE_RGB
+	size_t count = (size_t)width * height;
+	for (size_t i = 0; i < count; ++i) {
+		for (int c = 0; c < 3; ++c)
+			pixels[i * 4 + c] = (unsigned char)(16 + (pixels[i * 4 + c] * 219 + 127) / 255);
+	}
+
+	// SOIL uses DXT5 for images with an alpha channel, DXT1 for the rest
+	bool hasAlpha = channels == 2 || channels == 4;
+	compressPixelsToDDS(pixels, width, height, hasAlpha, dds);
+
+	SOIL_free_image_data(pixels);
+	return true;
+}
+
+// TEXTURE CACHE IMPLEMENTATION
+fm::TextureCache::TextureCache(const std::string& directory) : _directory(directory) { }
+
+std::string fm::TextureCache::entryPath(const std::string& sourcePath, unsigned long long contentHash)
+{
+	unsigned long long pathHash = hashBytes(sourcePath.data(), sourcePath.size());
+	return _directory + "/" + hashToString(pathHash) + "-" + hashToString(contentHash) + ".dds";
+}
+
+bool fm::TextureCache::find(const std::string& sourcePath, std::string& cachedPath)
+{
+	// hash the contents so a changed source image misses the cache
+	unsigned long long contentHash;
+	if (!hashFile(sourcePath, contentHash))
+		return false;
+
+	std::string path = entryPath(sourcePath, contentHash);
+	if (!fileExists(path))
+		return false;
+
+	cachedPath = path;
+	return true;
+}
+
+bool fm::TextureCache::build(const std::string& sourcePath, std::string& cachedPath)
+{
+	unsigned long long contentHash;
+	if (!hashFile(sourcePath, contentHash))
+		return false;
+
+	std::string path = entryPath(sourcePath, contentHash);
+
+	// already built, nothing to do
+	if (fileExists(path)) {
+		cachedPath = path;
+		return true;
+	}
+
+	std::vector<unsigned char> dds;
+	if (!compressTextureToDDS(sourcePath, dds))
+		return false;
+
+	if (!writeFileAtomic(path, dds.data(), dds.size()))
+		return false;
+
+	cachedPath = path;
+	return true;
+}
+
+int fm::TextureCache::buildAll(const std::vector<std::string>& sourcePaths)
+{
+	std::atomic<int> failures(0);
+
+	parallelFor(sourcePaths.size(), [&](size_t i) {
+		std::string cachedPath;
+		if (!build(sourcePaths[i], cachedPath))
+			++failures;
+	});
+
+	return failures;
+}
+
+const std::string& fm::TextureCache::directory()
+{
+	return _directory;
+}
+
+// ATLAS PACKING IMPLEMENTATION
+fm::AtlasEntry::AtlasEntry() : width(0), height(0), page(-1), x(0), y(0) { }
+
+// Sorts tallest first, ties broken by width then path so the order is total
+static bool sortAtlasEntry(const fm::AtlasEntry* a, const fm::AtlasEntry* b)
+{
+	if (a->height != b->height) return a->height > b->height;
+	if (a->width != b->width) return a->width > b->width;
+	return a->path < b->path;
+}
+
+int fm::packAtlas(std::vector<AtlasEntry>& entries, int pageSize, int padding)
+{
+	std::vector<AtlasEntry*> sorted;
+	for (auto& entry : entries)
+		sorted.push_back(&entry);
+
+	std::sort(sorted.begin(), sorted.end(), sortAtlasEntry);
+
+	int page = 0, shelfX = 0, shelfY = 0, shelfHeight = 0;
+	bool pageUsed = false;
+
+	for (auto entry : sorted) {
+		int w = entry->width + padding * 2;
+		int h = entry->height + padding * 2;
+
+		// will never fit, leave it as its own texture
+		if (w > pageSize || h > pageSize) {
+			entry->page = -1;
+			continue;
+		}
+
+		// start a new shelf when we run out of width
+		if (shelfX + w > pageSize) {
+			shelfX = 0;
+			shelfY += shelfHeight;
+			shelfHeight = 0;
+		}
+
+		// start a new page when we run out of height
+		if (shelfY + h > pageSize) {
+			++page;
+			shelfX = 0;
+			shelfY = 0;
+			shelfHeight = 0;
+		}
+
+		entry->page = page;
+		entry->x = shelfX + padding;
+		entry->y = shelfY + padding;
+		pageUsed = true;
+
+		shelfX += w;
+		if (h > shelfHeight)
+			shelfHeight = h;
+	}
+
+	return pageUsed ? page + 1 : 0;
+}
+
+void fm::copyIntoAtlas(std::vector<unsigned char>& page, int pageSize, const unsigned char* rgba, 
+	int width, int height, int x, int y, int padding)
+{
+	// includes the padding, every padded pixel takes the nearest edge pixel
+	for (int py = -padding; py < height + padding; ++py) {
+		int sy = py < 0 ? 0 : (py >= height ? height - 1 : py);
+		for (int px = -padding; px < width + padding; ++px) {
+			int sx = px < 0 ? 0 : (px >= width ? width - 1 : px);
+			memcpy(&page[((size_t)(y + py) * pageSize + (x + px)) * 4], &rgba[((size_t)sy * width + sx) * 4], 4);
+		}
+	}
+}
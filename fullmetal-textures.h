@@ -0,0 +1,105 @@
+/*
+ * Utilities for preparing textures ahead of time.
+ * Includes the precompressed (DXT/DDS) texture cache.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace fm {
+	/*
+	 * Decodes an image, resizes it to a power of two, builds the full
+	 * mip chain and compresses every level to DXT1 (no alpha) or DXT5 (alpha).
+	 * The result is written into 'dds' as a DDS file that can be uploaded directly.
+	 * This does not touch OpenGL, so it is safe to call from worker threads.
+	 * Returns false if the image could not be decoded.
+	 */
+	bool compressTextureToDDS(const std::string& sourcePath, std::vector<unsigned char>& dds);
+
+	/*
+	 * Same as compressTextureToDDS, but takes already decoded RGBA pixels.
+	 * Set 'hasAlpha' to false to produce DXT1, true to produce DXT5.
+	 */
+	void compressPixelsToDDS(const unsigned char* rgba, int width, int height,
+		bool hasAlpha, std::vector<unsigned char>& dds);
+
+	/*
+	 * A directory of precompressed textures.
+	 * Entries are keyed by a hash of the source filepath and a hash of the source file contents,
+	 * so editing a source image invalidates its entry without any manual cleanup.
+	 */
+	class TextureCache {
+	private:
+		std::string _directory;
+
+	public:
+		/*
+		 * Creates a cache that reads and writes .dds files inside of 'directory'.
+		 * The directory must already exist.
+		 */
+		TextureCache(const std::string& directory);
+
+		/*
+		 * Gets the path of the cache entry for a source image and its content hash.
+		 */
+		std::string entryPath(const std::string& sourcePath, unsigned long long contentHash);
+
+		/*
+		 * Looks up the cache entry for a source image.
+		 * Returns true and assigns 'cachedPath' if a valid entry exists.
+		 */
+		bool find(const std::string& sourcePath, std::string& cachedPath);
+
+		/*
+		 * Builds the cache entry for a source image if it doesn't exist.
+		 * Returns true and assigns 'cachedPath' on success.
+		 */
+		bool build(const std::string& sourcePath, std::string& cachedPath);
+
+		/*
+		 * Builds the cache entries for all of the given images in parallel.
+		 * Returns the number of entries that could not be built.
+		 */
+		int buildAll(const std::vector<std::string>& sourcePaths);
+
+		/*
+		 * The directory the cache entries live in.
+		 */
+		const std::string& directory();
+	};
+
+	/*
+	 * An image that is packed into a texture atlas page.
+	 * 'path', 'width' and 'height' are inputs, 'page', 'x' and 'y' are assigned by packAtlas().
+	 */
+	struct AtlasEntry {
+		AtlasEntry();
+
+		std::string path;
+		int width;
+		int height;
+
+		/* The page the image was packed into, -1 if it didn't fit on a page. */
+		int page;
+		int x;
+		int y;
+	};
+
+	/*
+	 * Packs the entries into square pages of 'pageSize' pixels using shelves,
+	 * leaving 'padding' pixels around every image for filtering.
+	 * The layout only depends on the set of entries, not the order they are given in,
+	 * so it can be computed offline or at load and always comes out the same.
+	 * Returns the number of pages used.
+	 */
+	int packAtlas(std::vector<AtlasEntry>& entries, int pageSize, int padding);
+
+	/*
+	 * Copies an RGBA image into an RGBA atlas page at (x, y),
+	 * filling 'padding' pixels around it with the image edges.
+	 */
+	void copyIntoAtlas(std::vector<unsigned char>& page, int pageSize, const unsigned char* rgba,
+		int width, int height, int x, int y, int padding);
+}
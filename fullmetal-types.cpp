@@ -3,13 +3,174 @@
 #include "fullmetal.h"
 #include "fullmetal-io.h"
 #include "fullmetal-introspectors.h"
+#include "fullmetal-reflect.h"
+
+#include <algorithm>
+#include <mutex>
+
+// type -> type id, shared by every table so a type has the same id in each. Ids start at 1, 0 is no type.
+// (tables may be made before main, so it's made on first use)
+static std::unordered_map<std::type_index, unsigned int>& typeIds()
+{
+	static std::unordered_map<std::type_index, unsigned int> ids;
+	return ids;
+}
+
+static std::mutex& typeIdsMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+// Gets the type id of the type, giving it the next one if it hasn't got one
+static unsigned int registerTypeId(std::type_index index)
+{
+	std::lock_guard<std::mutex> lock(typeIdsMutex());
+	auto& ids = typeIds();
+	auto found = ids.find(index);
+	if (found != ids.end())
+		return found->second;
+
+	unsigned int id = (unsigned int)ids.size() + 1;
+	ids[index] = id;
+	return id;
+}
+
+// Gets the type id of the type, 0 if no table has registered it
+static unsigned int findTypeId(std::type_index index)
+{
+	std::lock_guard<std::mutex> lock(typeIdsMutex());
+	auto& ids = typeIds();
+	auto found = ids.find(index);
+	return found == ids.end() ? 0 : found->second;
+}
+
+void fm::NodeTypeTable::addLink(const std::string & name, std::type_index index, INodeTypeLink * link)
+{
+	// Assert that we don't already have a node registered with this name
+	assert(_typesById.find(name) == _typesById.end());
+
+	unsigned int type = registerTypeId(index);
+	if (type >= _links.size())
+		_links.resize(type + 1, nullptr);
+
+	// a type can only be registered once per table
+	assert(_links[type] == nullptr);
+
+	link->parse_id = name;
+	_typesById[name] = type;
+	_links[type] = link;
+}
+
+bool fm::NodeTypeTable::writeNode(nlohmann::json & j, SceneNode * node)
+{
+	unsigned int type = typeId(node);
+	if (type == 0)
+		return false;
+
+	//TODO, some sort of check to ensure the write worked..
+	auto nodeLink = _links[type];
+	nodeLink->write(j, node);
+
+	// write the parse id so we know what object to parse on readNode()
+	j["node_id"] = nodeLink->parse_id;
+
+	return true;
+}
+
+void fm::NodeTypeTable::introspect(SceneNode * node)
+{
+	unsigned int type = typeId(node);
+	if (type == 0)
+		return;
+
+	// introspect the node..
+	_links[type]->introspect(node);
+}
+
+fm::SceneNode * fm::NodeTypeTable::readNode(nlohmann::json & j)
+{
+	// try get the parse id from the jObj
+	auto jParseId = j.find("node_id");
+	if (jParseId == j.end() || !jParseId->is_string())
+		return nullptr;
+
+	auto found = _typesById.find(jParseId->get_ref<const std::string&>());
+	if (found == _typesById.end())
+		return nullptr;
+
+	// read the json to create the node..
+	SceneNode* node = _links[found->second]->read(j);
+	node->_typeId = found->second;
+	return node;
+}
+
+unsigned int fm::NodeTypeTable::typeId(SceneNode * node)
+{
+	// looked up once, then kept on the node
+	if (node->_typeId == 0)
+		node->_typeId = findTypeId(std::type_index(typeid(*node)));
+
+	unsigned int type = node->_typeId;
+	return type < _links.size() && _links[type] != nullptr ? type : 0;
+}
+
+unsigned int fm::NodeTypeTable::typeCount()
+{
+	return (unsigned int)_links.size();
+}
+
+std::string fm::NodeTypeTable::getIdOfType(unsigned int type)
+{
+	return type < _links.size() && _links[type] != nullptr ? _links[type]->parse_id : std::string();
+}
+
+void fm::NodeTypeTable::countTypes(const std::vector<SceneNode*>& nodes, std::vector<unsigned int>& counts, bool children)
+{
+	counts.assign(_links.size() > 0 ? _links.size() : 1, 0);
+
+	// a stack rather than recursion, graphs can be deep
+	std::vector<SceneNode*> stack(nodes.begin(), nodes.end());
+	while (!stack.empty()) {
+		SceneNode* node = stack.back();
+		stack.pop_back();
+		++counts[typeId(node)];
+
+		if (children)
+			stack.insert(stack.end(), node->childNodes.begin(), node->childNodes.end());
+	}
+}
+
+// Adds the node (then its children, with 'children') to the group of its type
+static void groupNode(fm::NodeTypeTable* table, fm::SceneNode* node, std::vector<std::vector<fm::SceneNode*>>& groups, bool children)
+{
+	groups[table->typeId(node)].push_back(node);
+
+	if (!children)
+		return;
+
+	for (auto child : node->childNodes)
+		groupNode(table, child, groups, true);
+}
+
+void fm::NodeTypeTable::groupByType(const std::vector<SceneNode*>& nodes, std::vector<std::vector<SceneNode*>>& groups, bool children)
+{
+	groups.assign(_links.size() > 0 ? _links.size() : 1, std::vector<SceneNode*>());
+
+	for (auto node : nodes)
+		groupNode(this, node, groups, children);
+}
 
 std::vector<std::string> fm::NodeTypeTable::getIds()
 {
 	std::vector<std::string> ids;
-	for (auto link : _linksById)
-		ids.push_back(link.first);
+	for (auto link : _links) {
+		if (link != nullptr)
+			ids.push_back(link->parse_id);
+	}
 
+	// sorted, the order the gui lists them in
+	std::sort(ids.begin(), ids.end());
 	return ids;
 }
 
@@ -18,63 +179,91 @@ fm::SceneNode * fm::NodeTypeTable::createNodeFromId(std::string id)
 	// get the link from the match, ensure it's not null
 	// otherwise we have a dodgy id, which shouldn't ever
 	// happen during the programs runtime
-	auto link = _linksById[id];
-	assert(link != nullptr);
+	int type = findType(id);
+	assert(type >= 0);
 
 	// create the node from the link
-	return link->create_node();
+	SceneNode* node = _links[type]->create_node();
+	node->_typeId = (unsigned int)type;
+	return node;
+}
+
+std::string fm::NodeTypeTable::getId(SceneNode * node)
+{
+	return getIdOfType(typeId(node));
+}
+
+bool fm::NodeTypeTable::writeNodeBinary(ByteWriter & writer, SceneNode * node)
+{
+	unsigned int type = typeId(node);
+	if (type == 0)
+		return false;
+
+	_links[type]->writeBinary(writer, node);
+	return true;
+}
+
+fm::SceneNode * fm::NodeTypeTable::readNodeBinary(const std::string & id, ByteReader & reader)
+{
+	// an id from a file, it may not be registered
+	int type = findType(id);
+	if (type < 0)
+		return nullptr;
+
+	return readNodeBinary((unsigned int)type, reader);
+}
+
+fm::SceneNode * fm::NodeTypeTable::readNodeBinary(unsigned int type, ByteReader & reader)
+{
+	if (type >= _links.size() || _links[type] == nullptr)
+		return nullptr;
+
+	SceneNode* node = _links[type]->readBinary(reader);
+	node->_typeId = type;
+	return node;
+}
+
+int fm::NodeTypeTable::findType(const std::string & id)
+{
+	auto found = _typesById.find(id);
+	return found == _typesById.end() ? -1 : (int)found->second;
 }
 
 fm::NodeTypeTable* fm::createDefaultTypeTable()
 {
 	fm::NodeTypeTable* nodeTable = new fm::NodeTypeTable();
 
-	// register shape nodes..
-	auto& cube = nodeTable->registerNode<fm::CubeNode>("CubeNode");
-	auto& sphere = nodeTable->registerNode<fm::SphereNode>("SphereNode");
-	auto& plane = nodeTable->registerNode<fm::PlaneNode>("PlaneNode");
-	auto& cylinder = nodeTable->registerNode<fm::CylinderNode>("CylinderNode");
+	// register shape nodes, their io & introspection come from their fields (see fullmetal-reflect.h)..
+	nodeTable->registerReflectedNode<fm::CubeNode>("CubeNode");
+	nodeTable->registerReflectedNode<fm::SphereNode>("SphereNode");
+	nodeTable->registerReflectedNode<fm::PlaneNode>("PlaneNode");
+	nodeTable->registerReflectedNode<fm::CylinderNode>("CylinderNode");
 
 	// register light nodes..
-	auto& ambient_light = nodeTable->registerNode<fm::AmbientLightNode>("AmbientLightNode");
-	auto& directional_light = nodeTable->registerNode<fm::DirectionalLightNode>("DirectionalLightNode");
-	auto& spot_light = nodeTable->registerNode<fm::SpotLightNode>("SpotLightNode");
+	nodeTable->registerReflectedNode<fm::AmbientLightNode>("AmbientLightNode");
+	nodeTable->registerReflectedNode<fm::DirectionalLightNode>("DirectionalLightNode");
+	nodeTable->registerReflectedNode<fm::SpotLightNode>("SpotLightNode");
 
 	// 3d model nodes
-	auto& mesh_node = nodeTable->registerNode<fm::MeshNode>("MeshNode");
+	nodeTable->registerReflectedNode<fm::MeshNode>("MeshNode");
+
+	// instances of prefabs, their io & introspection are written by hand (see fm::io::writePrefabNode)
+	auto& prefab_node = nodeTable->registerNode<fm::PrefabNode>("PrefabNode");
 
 #ifdef FM_IO
 	// if we're using IO, register the parse functions for reading/writing the nodes.
-	cube.set_parse_functions(fm::io::readCubeNode, fm::io::writeCubeNode);
-	sphere.set_parse_functions(fm::io::readSphereNode, fm::io::writeSphereNode);
-	plane.set_parse_functions(fm::io::readPlaneNode, fm::io::writePlaneNode);
-
-	ambient_light.set_parse_functions(fm::io::readAmbientLightNode, 
-		fm::io::writeAmbientLightNode);
+	prefab_node.set_parse_functions(fm::io::readPrefabNode, fm::io::writePrefabNode);
 
-	directional_light.set_parse_functions(fm::io::readDirectionalLightNode, 
-		fm::io::writeDirectionalLightNode);
+	// and for the binary scene format
+	prefab_node.set_binary_functions(fm::io::readPrefabNodeBinary, fm::io::writePrefabNodeBinary);
 
-	spot_light.set_parse_functions(fm::io::readSpotLightNode, fm::io::writeSpotLightNode);
-
-	mesh_node.set_parse_functions(fm::io::readMeshNode, fm::io::writeMeshNode);
-
-	cylinder.set_parse_functions(fm::io::readCylinderNode, fm::io::writeCylinderNode);
+	// prefabs & the overrides of their instances are read with this table
+	fm::io::PrefabLibrary::global->setTypeTable(nodeTable);
 #endif
 
 #ifdef FM_EDITOR
 	// if we're using the GUI, register the introspection functions for reading/writing
-	cube.set_introspection_function(fm::gui::introspectCubeNode);
-	sphere.set_introspection_function(fm::gui::introspectSphereNode);
-	plane.set_introspection_function(fm::gui::introspectPlaneNode);
-
-	ambient_light.set_introspection_function(fm::gui::introspectAmbientLightNode);
-	directional_light.set_introspection_function(fm::gui::introspectDirectionalLightNode);
-	spot_light.set_introspection_function(fm::gui::introspectSpotLightNode);
-
-	mesh_node.set_introspection_function(fm::gui::introspectMeshNode);
-
-	cylinder.set_introspection_function(fm::gui::introspectCylinderNode);
+	prefab_node.set_introspection_function(fm::gui::introspectPrefabNode);
 #endif
 
 	return nodeTable;
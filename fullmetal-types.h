@@ -7,6 +7,7 @@
 #include "fullmetal-config.h"
 
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <cassert>
 #include <string>
@@ -17,6 +18,8 @@
 namespace fm {
 	class SceneNode;
 	class NodeTypeTable;
+	class ByteWriter;
+	class ByteReader;
 
 	/*
 	 * Creates a node type table
@@ -28,6 +31,8 @@ namespace fm {
 		// typedef of a function that takes json/tnode params
 		typedef std::function<void(nlohmann::json&, TNode& node)> ParseFunction;
 		typedef std::function<void(TNode*)> IntrospectFunction;
+		typedef std::function<void(ByteReader&, TNode& node)> BinaryReadFunction;
+		typedef std::function<void(ByteWriter&, TNode& node)> BinaryWriteFunction;
 
 		/* 
 		 * Function that takes json & tnode params.
@@ -46,11 +51,26 @@ namespace fm {
 		 */
 		IntrospectFunction introspectFunction;
 
+		/*
+		 * Reads the node from the binary scene format.
+		 */
+		BinaryReadFunction binaryReadFunction;
+
+		/*
+		 * Writes the node into the binary scene format.
+		 */
+		BinaryWriteFunction binaryWriteFunction;
+
 		void set_parse_functions(ParseFunction readFunc, ParseFunction writeFunc) {
 			readFunction = readFunc;
 			writeFunction = writeFunc;
 		}
 
+		void set_binary_functions(BinaryReadFunction readFunc, BinaryWriteFunction writeFunc) {
+			binaryReadFunction = readFunc;
+			binaryWriteFunction = writeFunc;
+		}
+
 		void set_introspection_function(IntrospectFunction introFunc) {
 			introspectFunction = introFunc;
 		}
@@ -67,9 +87,13 @@ namespace fm {
 		public:
 			std::string parse_id;
 
+			virtual ~INodeTypeLink() { }
+
 			virtual SceneNode* create_node() = 0;
 			virtual SceneNode* read(nlohmann::json& json) = 0;
 			virtual void write(nlohmann::json& json, SceneNode* node) = 0;
+			virtual SceneNode* readBinary(ByteReader& reader) = 0;
+			virtual void writeBinary(ByteWriter& writer, SceneNode* node) = 0;
 			virtual void introspect(SceneNode* node) = 0;
 		};
 
@@ -87,11 +111,10 @@ namespace fm {
 				// ensure we have a read function for this node
 				assert(nodeFunctions.readFunction);
 
-				// read the node from JSON 
-				TNode node;
-				nodeFunctions.readFunction(json, node);
-
-				TNode* node_ptr = new TNode(node);
+				// read the node from JSON, straight into the new node.
+				// (a copy would share the material's texture with a node that deletes it)
+				TNode* node_ptr = new TNode();
+				nodeFunctions.readFunction(json, *node_ptr);
 				return node_ptr;
 			}
 
@@ -99,30 +122,51 @@ namespace fm {
 				// ensure we have a write function for this node
 				assert(nodeFunctions.writeFunction);
 
-				// write the node to JSON
-				auto castedNode = dynamic_cast<TNode*>(node);
-				assert(castedNode != nullptr);
-				nodeFunctions.writeFunction(json, *castedNode);
+				// write the node to JSON, the link is found by the node's exact type so the cast is static
+				assert(typeid(*node) == typeid(TNode));
+				nodeFunctions.writeFunction(json, *static_cast<TNode*>(node));
+			}
+
+			virtual SceneNode* readBinary(ByteReader& reader) override {
+				// ensure we have a binary read function for this node
+				assert(nodeFunctions.binaryReadFunction);
+
+				// read straight into the new node
+				TNode* node_ptr = new TNode();
+				nodeFunctions.binaryReadFunction(reader, *node_ptr);
+				return node_ptr;
+			}
+
+			virtual void writeBinary(ByteWriter& writer, SceneNode* node) override {
+				// ensure we have a binary write function for this node
+				assert(nodeFunctions.binaryWriteFunction);
+
+				assert(typeid(*node) == typeid(TNode));
+				nodeFunctions.binaryWriteFunction(writer, *static_cast<TNode*>(node));
 			}
 
 			virtual void introspect(SceneNode * node) override
 			{
-				// write the node to JSON
-				auto castedNode = dynamic_cast<TNode*>(node);
-				assert(castedNode != nullptr);
-				nodeFunctions.introspectFunction(castedNode);
+				assert(typeid(*node) == typeid(TNode));
+				nodeFunctions.introspectFunction(static_cast<TNode*>(node));
 			}
 		};
 
-		// string -> INodeTypeLink ptr
-		std::map<std::string, INodeTypeLink*> _linksById;
-		// type -> INodeTypeLink ptr
-		std::map<std::type_index, INodeTypeLink*> _linksByType;
+		// INodeTypeLink ptrs indexed by type id (see typeId), nullptr for the ids of types this table doesn't have
+		std::vector<INodeTypeLink*> _links;
+		// string -> type id, hashed rather than compared down a tree
+		std::unordered_map<std::string, unsigned int> _typesById;
+
+		// the link of a type whose functions are generated from its fields, defined in fullmetal-reflect.h
+		template<class TNode>
+		class ReflectedNodeTypeLink;
+
+		void addLink(const std::string& name, std::type_index index, INodeTypeLink* link);
 
 	public:
 		~NodeTypeTable() {
-			for (auto link : _linksById)
-				delete link.second;
+			for (auto link : _links)
+				delete link;
 		}
 
 		/*
@@ -134,66 +178,94 @@ namespace fm {
 		 */
 		template<class TNode>
 		NodeFunctions<TNode>& registerNode(std::string name) {
-			// Assert that we don't already have a node registered with this name
-			assert(_linksById[name] == nullptr);
-
 			// get the type index from our TNode type
 			std::type_index index = std::type_index(typeid(TNode));
 
 			// create a node type link with our TNode type
 			auto nodeLink = new NodeTypeLink<TNode>{};
-			nodeLink->parse_id = name;
-			_linksById[name] = nodeLink;
-			_linksByType[index] = nodeLink;
+			addLink(name, index, nodeLink);
 
 			return nodeLink->nodeFunctions;
 		}
 
+		/*
+		 * Registers a type whose fields are declared with fm::NodeFields<TNode>, include fullmetal-reflect.h to call it.
+		 * Its json & binary functions and its introspection are generated from its fields, so there's nothing to set.
+		 */
+		template<class TNode>
+		void registerReflectedNode(std::string name);
+
 		/*
 		 * Attempts to write the node into json.
 		 * Returns false if not possible, true if complete.
 		 */
-		bool writeNode(nlohmann::json& j, SceneNode* node) {
-			// get the index from the node type
-			std::type_index index = std::type_index(typeid(*node));
-			// now try to get the node type link from the index
-			auto nodeLink = _linksByType[index];
-			if (nodeLink == nullptr) 
-				return false;
-			
-			//TODO, some sort of check to ensure the write worked..
-			nodeLink->write(j, node);
-
-			// write the parse id so we know what object to parse on readNode()
-			j["node_id"] = nodeLink->parse_id;
-
-			return true;
-		}
+		bool writeNode(nlohmann::json& j, SceneNode* node);
 
-		void introspect(SceneNode* node) {
-			std::type_index index = std::type_index(typeid(*node));
-			// now try to get the node type link from the index
-			auto nodeLink = _linksByType[index];
-			if (nodeLink == nullptr) return;
-			
-			// introspect the node..
-			nodeLink->introspect(node);
-		}
+		void introspect(SceneNode* node);
 
 		/* 
+		 * Reads a node from json written by writeNode, the node is constructed once & read straight into.
+		 * Returns nullptr if the json has no node_id, or its id isn't registered.
+		 */
+		SceneNode* readNode(nlohmann::json& j);
+
+		/*
+		 * Gets the dense id of the node's type (see SceneNode::typeId), 0 if the type isn't registered with this table.
+		 * Every type gets an id when it's first registered, in any table, so the id of a type is the same in each.
+		 * It's looked up the first time a node is seen & kept on the node, after that this is an array lookup.
 		 */
-		SceneNode* readNode(nlohmann::json& j) {
-			// try get the parse id from the jObj
-			nlohmann::json jParseId = j["node_id"];
-			assert(!jParseId.is_null());
+		unsigned int typeId(SceneNode* node);
 
-			std::string parse_id = jParseId;
-			auto nodeLink = _linksById[parse_id];
-			assert(nodeLink != nullptr);
+		/*
+		 * One more than the largest type id registered with this table, the size of an array indexed by type id.
+		 */
+		unsigned int typeCount();
 
-			// read the json to create the node..
-			return nodeLink->read(j);
-		}
+		/*
+		 * Gets the string id the type with the type id was registered with, an empty string if it isn't registered.
+		 */
+		std::string getIdOfType(unsigned int type);
+
+		/*
+		 * Counts the nodes of each type (and their children's, with 'children'), 'counts' is indexed by type id.
+		 * The nodes of types that aren't registered are counted at 0.
+		 */
+		void countTypes(const std::vector<SceneNode*>& nodes, std::vector<unsigned int>& counts, bool children = true);
+
+		/*
+		 * Groups the nodes by their type (with their children's, with 'children'), 'groups' is indexed by type id.
+		 * Each group keeps the order the nodes were in. The nodes of types that aren't registered are grouped at 0.
+		 */
+		void groupByType(const std::vector<SceneNode*>& nodes, std::vector<std::vector<SceneNode*>>& groups, bool children = true);
+
+		/*
+		 * Gets the string id the type of the node was registered with.
+		 * Returns an empty string if the type isn't registered.
+		 */
+		std::string getId(SceneNode* node);
+
+		/*
+		 * Writes the node into the binary scene format, without its type or children (see fm::io::writeSceneGraph).
+		 * Returns false if the type isn't registered.
+		 */
+		bool writeNodeBinary(ByteWriter& writer, SceneNode* node);
+
+		/*
+		 * Reads a node of the type registered with 'id' from the binary scene format.
+		 * Returns nullptr if the id isn't registered.
+		 */
+		SceneNode* readNodeBinary(const std::string& id, ByteReader& reader);
+
+		/*
+		 * Reads a node of the type with the type id (see findType) from the binary scene format.
+		 * Readers look the ids of a scene up once, rather than once per node.
+		 */
+		SceneNode* readNodeBinary(unsigned int type, ByteReader& reader);
+
+		/*
+		 * Gets the type id of the type registered with 'id' (see typeId), or -1 if the id isn't registered.
+		 */
+		int findType(const std::string& id);
 
 		/*
 		 * Gets a vector of the string ids registered to nodes in the type table.
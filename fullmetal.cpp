@@ -1,10 +1,17 @@
 #include "fullmetal.h"
 #include "fullmetal-3d.h"
+#include "fullmetal-textures.h"
+#include "fullmetal-meshcache.h"
+#include "fullmetal-gltf.h"
+#include "fullmetal-bundle.h"
+#include "fullmetal-platform.h"
 #include "glut.h"
 
 #include <math.h>
 #include <cassert>
 #include <algorithm>
+#include <atomic>
+#include <set>
 
 // Includes for OpenGL go here
 #include <gl/GL.h>
@@ -66,17 +73,93 @@ void fm::applyTransform(Transform& transform)
 	glScalef(transform.scale.x, transform.scale.y, transform.scale.z);
 }
 
+void fm::transformMatrix(Transform& transform, float* m)
+{
+	float x = transform.rotation.x, y = transform.rotation.y, z = transform.rotation.z;
+	float length = sqrtf(x * x + y * y + z * z);
+	float radians = transform.angle * 3.14159265f / 180.0f;
+	float c = cosf(radians), s = sinf(radians), t = 1.0f - c;
+
+	// no axis is no rotation
+	if (length > 0.0f) {
+		x /= length;
+		y /= length;
+		z /= length;
+	}
+	else {
+		c = 1.0f;
+		s = t = 0.0f;
+	}
+
+	float rotation[9] = {
+		x * x * t + c, y * x * t + z * s, x * z * t - y * s,
+		x * y * t - z * s, y * y * t + c, y * z * t + x * s,
+		x * z * t + y * s, y * z * t - x * s, z * z * t + c
+	};
+
+	float scale[3] = { transform.scale.x, transform.scale.y, transform.scale.z };
+	float position[3] = { transform.position.x, transform.position.y, transform.position.z };
+
+	for (int column = 0; column < 3; ++column) {
+		for (int row = 0; row < 3; ++row)
+			m[column * 4 + row] = rotation[column * 3 + row] * scale[column];
+
+		m[column * 4 + 3] = 0.0f;
+	}
+
+	for (int row = 0; row < 3; ++row)
+		m[12 + row] = rotation[row] * position[0] + rotation[3 + row] * position[1] + rotation[6 + row] * position[2];
+
+	m[15] = 1.0f;
+}
+
+// The texture id that applyTexture() last bound, 0 if unknown
+static int boundTextureId = 0;
+
 bool fm::applyTexture(Material & material)
 {
 	// Check if we're using a texture, if so, bind it!
 	Texture* texture = material.texture;
 
 	if (texture != nullptr && texture->data != nullptr) {
-		// Linear filtering
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		TextureData* data = texture->data;
+
+		// Only bind if it's a different texture, textures packed 
+		// into the same atlas page share an id and never rebind
+		if (data->glTextureId != boundTextureId) {
+			// Bind the texture using the loaded texture id
+			glBindTexture(GL_TEXTURE_2D, data->glTextureId);
+
+			// Linear filtering
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+			boundTextureId = data->glTextureId;
+		}
+
+		// Map the uvs into the atlas region, if packed
+		glMatrixMode(GL_TEXTURE);
+		glLoadIdentity();
+
+		if (data->packed) {
+			glTranslatef(data->regionX, data->regionY, 0.0f);
+			glScalef(data->regionWidth, data->regionHeight, 1.0f);
+		}
 
-		// Bind the texture using the loaded texture id
-		glBindTexture(GL_TEXTURE_2D, material.texture->data->glTextureId);
+		// Then the uv transform of the material, inside of the atlas region
+		UvTransform& uv = material.uvTransform;
+		if (!uv.isIdentity()) {
+			glTranslatef(uv.offsetU + 0.5f, uv.offsetV + 0.5f, 0.0f);
+			glRotatef(uv.rotation, 0.0f, 0.0f, 1.0f);
+			glTranslatef(-0.5f, -0.5f, 0.0f);
+			glScalef(uv.scaleU, uv.scaleV, 1.0f);
+
+			if (uv.flip) {
+				glTranslatef(1.0f, 1.0f, 0.0f);
+				glScalef(-1.0f, -1.0f, 1.0f);
+			}
+		}
+
+		glMatrixMode(GL_MODELVIEW);
 
 		// Indicate that we're using the texture
 		return true;
@@ -85,6 +168,43 @@ bool fm::applyTexture(Material & material)
 	return false;
 }
 
+void fm::resetTextureBinding()
+{
+	boundTextureId = 0;
+}
+
+void fm::drawMeshBuffer(const MeshBuffer & buffer, bool textured)
+{
+	drawMeshVertices(buffer.vertices, buffer.indices.data(), buffer.indices.size(), textured);
+}
+
+void fm::drawMeshVertices(const std::vector<MeshVertex>& meshVertices, const unsigned int * indices, 
+	size_t indexCount, bool textured)
+{
+	if (indexCount == 0)
+		return;
+
+	// the arrays are interleaved, so every attribute uses the size of a vertex as the stride
+	const MeshVertex* vertices = meshVertices.data();
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, sizeof(MeshVertex), vertices->position);
+	glNormalPointer(GL_FLOAT, sizeof(MeshVertex), vertices->normal);
+
+	if (textured) {
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(MeshVertex), vertices->uv);
+	}
+
+	glDrawElements(GL_TRIANGLES, (GLsizei)indexCount, GL_UNSIGNED_INT, indices);
+
+	if (textured)
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
 void fm::normUvVert(float nx, float ny, float nz, float uvx, float uvy, float vx, float vy, float vz)
 {
 	glNormal3f(nx, ny, nz);
@@ -111,29 +231,29 @@ bool fm::removeNodeFromVector(SceneNode * node, std::vector<SceneNode*>& _nodes)
 	return false;
 }
 
-void fm::cloneNode(SceneNodeGraph * graph, SceneNode * node)
+fm::SceneNode* fm::cloneNode(SceneNodeGraph * graph, SceneNode * node)
 {
 	auto parent = node->getParent();
+	auto clone = node->clone();
 
 	// if no parent, add node to graph
 	if (parent == nullptr) {
-		graph->addNode(node->clone());
+		graph->addNode(clone);
 	}
 	else { // if parent, add to that parent
-		parent->addChild(node);
+		parent->addChild(clone);
 	}
+
+	return clone;
 }
 
 int fm::createDynamicLightId()
 {
-	// Global id, begins at 0
-	static int global_id = GL_LIGHT0;
+	// Global id, begins at 0. Lights may be created on the loader threads (see readSceneGraphParallel)
+	static std::atomic<int> global_id(GL_LIGHT0);
 
-	// local ref to our id
-	int id = global_id;
-
-	// increment global id
-	++global_id;
+	// take our id & increment the global id
+	int id = global_id++;
 	
 	// We need to figure out how to handle this later, but for now
 	// just don't permit creation of more than 8 lights.
@@ -394,7 +514,8 @@ float fm::Input::scrollAmount()
 }
 
 // TEXTURE DATA IMPLEMENTATION
-fm::TextureData::TextureData() : glTextureId(0) { }
+fm::TextureData::TextureData() : glTextureId(0), packed(false), 
+	regionX(0.0f), regionY(0.0f), regionWidth(1.0f), regionHeight(1.0f) { }
 
 // IMPLEMENTATION OF TEXTURE
 fm::Texture::Texture() : data(nullptr) { }
@@ -405,7 +526,10 @@ fm::Texture::Texture(const std::string& fp) : Texture()
 }
 
 // ASSET MANAGER IMPLEMENTATION
-fm::AssetManager::AssetManager() : _loadedModelData(), _loadedTxData() { }
+fm::AssetUsage::AssetUsage() : filepath(), model(false), bytes(0), milliseconds(0.0) { }
+
+fm::AssetManager::AssetManager() : _loadedModelData(), _loadedTxData(), _textureCache(nullptr), _meshCache(nullptr), _bundle(nullptr), _loadTimes(), _usage(), _recording(false), 
+	_lodRatios(), _buildMeshlets(false), _compactModels(false), _streamingThreshold(0), _streamingBudget(64 << 20) { }
 
 // Single instance of AssetManager
 fm::AssetManager* fm::AssetManager::global = new AssetManager();
@@ -431,38 +555,516 @@ fm::TextureData * fm::AssetManager::getTextureData(const std::string & fp)
 	TextureData* txrData = _loadedTxData[fp];
 
 	// if we don't, load a texture, put it into the map
-	if (txrData == nullptr) {
-		txrData = new TextureData();
+	if (txrData == nullptr)
+		txrData = loadTextureData(fp, nullptr);
+
+	recordUsage(fp, false);
+	return txrData;
+}
+
+fm::TextureData * fm::AssetManager::loadTextureData(const std::string & fp, const std::vector<unsigned char>* source)
+{
+	TextureData* txrData = new TextureData();
+
+	// Assign filepath
+	txrData->filepath = fp;
 
-		// Assign filepath
-		txrData->filepath = fp;
+	// Load the texture
+	Timer timer;
+	txrData->glTextureId = loadTexture(fp, source);
+	_loadTimes[fp] = timer.elapsedMs();
 
-		// Load the texture
-		txrData->glTextureId = SOIL_load_OGL_texture(fp.c_str(),
+	// Put the texture into the map cache
+	_loadedTxData[fp] = txrData;
+
+	// Ensure texture loaded & was given a proper id
+	assert(txrData->glTextureId != 0);
+	return txrData;
+}
+
+unsigned int fm::AssetManager::loadTexture(const std::string & fp, const std::vector<unsigned char>* source)
+{
+	// bundled textures are already compressed, upload them straight from the mapped bundle
+	const unsigned char* data;
+	size_t size;
+	if (_bundle != nullptr && _bundle->find(fp, BUNDLE_TEXTURE, data, size)) {
+		Stats::global->add("bundle.texture_hits", 1);
+		return SOIL_load_OGL_texture_from_memory(data, (int)size,
+			SOIL_LOAD_AUTO,
+			SOIL_CREATE_NEW_ID,
+			SOIL_FLAG_DDS_LOAD_DIRECT);
+	}
+
+	// if we have a cache, upload the precompressed mip chain directly.
+	// build() returns the existing entry, or compresses the texture into the cache
+	if (_textureCache != nullptr) {
+		std::string cachedPath;
+		if (_textureCache->build(fp, cachedPath)) {
+			return SOIL_load_OGL_texture(cachedPath.c_str(),
+				SOIL_LOAD_AUTO,
+				SOIL_CREATE_NEW_ID,
+				SOIL_FLAG_DDS_LOAD_DIRECT);
+		}
+	}
+
+	// no cache (or the cache failed), decode, build mipmaps & compress at runtime
+	if (source != nullptr) {
+		return SOIL_load_OGL_texture_from_memory(source->data(), (int)source->size(),
 			SOIL_LOAD_AUTO,
 			SOIL_CREATE_NEW_ID,
 			SOIL_FLAG_MIPMAPS | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT);
+	}
+
+	return SOIL_load_OGL_texture(fp.c_str(),
+		SOIL_LOAD_AUTO,
+		SOIL_CREATE_NEW_ID,
+		SOIL_FLAG_MIPMAPS | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT);
+}
 
-		// Put the texture into the map cache
-		_loadedTxData[fp] = txrData;
+void fm::AssetManager::setTextureCache(TextureCache * cache)
+{
+	_textureCache = cache;
+}
+
+void fm::AssetManager::setMeshCache(MeshCache * cache)
+{
+	_meshCache = cache;
+}
+
+void fm::AssetManager::setLodRatios(const std::vector<float>& ratios)
+{
+	_lodRatios = ratios;
+}
+
+void fm::AssetManager::setBuildMeshlets(bool build)
+{
+	_buildMeshlets = build;
+}
+
+void fm::AssetManager::setCompactModels(bool compact)
+{
+	_compactModels = compact;
+}
+
+void fm::AssetManager::mountBundle(const Bundle * bundle)
+{
+	_bundle = bundle;
+}
 
-		// Ensure texture loaded & was given a proper id
-		assert(txrData->glTextureId != 0);
+void fm::AssetManager::setObjStreaming(unsigned long long thresholdBytes, size_t memoryBudget)
+{
+	_streamingThreshold = thresholdBytes;
+	_streamingBudget = memoryBudget;
+}
+
+int fm::AssetManager::packTextures(const std::vector<std::string>& filepaths, int pageSize)
+{
+	// each texture gets 2 pixels of its own edge around it, so linear filtering
+	// and the first mip levels don't bleed in the neighbouring textures
+	const int padding = 2;
+
+	// only pack each texture once, even if it's listed twice
+	std::vector<std::string> paths;
+	for (auto& fp : filepaths) {
+		if (std::find(paths.begin(), paths.end(), fp) == paths.end())
+			paths.push_back(fp);
 	}
-	
-	return txrData;
+
+	// decode all the images in parallel, this is the slow part
+	std::vector<unsigned char*> pixels(paths.size(), nullptr);
+	std::vector<AtlasEntry> entries(paths.size());
+
+	parallelFor(paths.size(), [&](size_t i) {
+		int channels;
+		entries[i].path = paths[i];
+		pixels[i] = SOIL_load_image(paths[i].c_str(), &entries[i].width, &entries[i].height, &channels, SOIL_LOAD_RGBA);
+	});
+
+	// skip images that could not be loaded, then lay out the rest
+	std::vector<AtlasEntry> loaded;
+	std::vector<unsigned char*> loadedPixels;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (pixels[i] != nullptr) {
+			loaded.push_back(entries[i]);
+			loadedPixels.push_back(pixels[i]);
+		}
+	}
+
+	int pageCount = packAtlas(loaded, pageSize, padding);
+	int packedCount = 0;
+
+	// the pages of textures that were packed before, deleted once no texture is on them
+	std::set<int> oldPages;
+
+	for (int page = 0; page < pageCount; ++page) {
+		// copy every image on this page into the page
+		std::vector<unsigned char> pagePixels((size_t)pageSize * pageSize * 4, 0);
+		for (size_t i = 0; i < loaded.size(); ++i) {
+			if (loaded[i].page == page) {
+				copyIntoAtlas(pagePixels, pageSize, loadedPixels[i], loaded[i].width, loaded[i].height,
+					loaded[i].x, loaded[i].y, padding);
+			}
+		}
+
+		unsigned int pageId = SOIL_create_OGL_texture(pagePixels.data(), pageSize, pageSize, 4,
+			SOIL_CREATE_NEW_ID, SOIL_FLAG_MIPMAPS | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT);
+		assert(pageId != 0);
+
+		// point the texture data of every image on this page at the page
+		for (auto& entry : loaded) {
+			if (entry.page != page) continue;
+
+			TextureData* txrData = _loadedTxData[entry.path];
+			if (txrData == nullptr) {
+				txrData = new TextureData();
+				txrData->filepath = entry.path;
+				_loadedTxData[entry.path] = txrData;
+			}
+			else if (txrData->packed) {
+				oldPages.insert(txrData->glTextureId);
+			}
+			else if (txrData->glTextureId != 0) {
+				// it was loaded on its own, that texture isn't needed anymore
+				GLuint oldId = txrData->glTextureId;
+				glDeleteTextures(1, &oldId);
+			}
+
+			txrData->glTextureId = pageId;
+			txrData->packed = true;
+			txrData->regionX = (float)entry.x / pageSize;
+			txrData->regionY = (float)entry.y / pageSize;
+			txrData->regionWidth = (float)entry.width / pageSize;
+			txrData->regionHeight = (float)entry.height / pageSize;
+			++packedCount;
+		}
+	}
+
+	for (auto image : pixels) {
+		if (image != nullptr)
+			SOIL_free_image_data(image);
+	}
+
+	// an old page is still needed if a texture that wasn't packed again is on it
+	for (auto& loadedTexture : _loadedTxData) {
+		if (loadedTexture.second != nullptr && loadedTexture.second->packed)
+			oldPages.erase(loadedTexture.second->glTextureId);
+	}
+
+	for (auto page : oldPages) {
+		GLuint oldId = page;
+		glDeleteTextures(1, &oldId);
+	}
+
+	// ids may have been deleted & reused
+	resetTextureBinding();
+
+	return packedCount;
 }
 
 fm::ObjModel * fm::AssetManager::getObjModel(const std::string & fp)
 {
 	// check if we have this model loaded
-	ObjModel* model = _loadedModelData[fp];
+	ObjModel* model = findModel(fp);
 
 	if (model == nullptr) {
 		// load the model, cache it
-		model = loadObjModel(fp);
+		Timer timer;
+		model = keepModel(fp, loadModel(fp));
+		_loadTimes[fp] = timer.elapsedMs();
+	}
+
+	recordUsage(fp, true);
+	return model;
+}
+
+fm::ObjModel * fm::AssetManager::prepareObjModel(const std::string & fp)
+{
+	ObjModel* model = findModel(fp);
+
+	// loaded outside of the lock, so the threads load different models at once
+	if (model == nullptr)
+		model = keepModel(fp, loadModel(fp));
+
+	return model;
+}
+
+fm::ObjModel * fm::AssetManager::findModel(const std::string & fp)
+{
+	std::lock_guard<std::mutex> lock(_modelMutex);
+	auto found = _loadedModelData.find(fp);
+	return found == _loadedModelData.end() ? nullptr : found->second;
+}
+
+fm::ObjModel * fm::AssetManager::keepModel(const std::string & fp, ObjModel * model)
+{
+	std::lock_guard<std::mutex> lock(_modelMutex);
+	ObjModel*& kept = _loadedModelData[fp];
+
+	if (kept == nullptr)
+		kept = model;
+	else if (kept != model)
+		delete model;
+
+	return kept;
+}
+
+void fm::AssetManager::loadObjModels(const std::vector<std::string>& filepaths)
+{
+	// only load each model once, even if it's listed twice
+	std::vector<std::string> missing;
+	for (auto& fp : filepaths) {
+		if (findModel(fp) == nullptr && std::find(missing.begin(), missing.end(), fp) == missing.end())
+			missing.push_back(fp);
+	}
+
+	std::vector<ObjModel*> models(missing.size(), nullptr);
+	std::vector<double> times(missing.size(), 0.0);
+	parallelFor(missing.size(), [&](size_t i) {
+		Timer timer;
+		models[i] = loadModel(missing[i]);
+		times[i] = timer.elapsedMs();
+	});
+
+	for (size_t i = 0; i < missing.size(); ++i) {
+		keepModel(missing[i], models[i]);
+		_loadTimes[missing[i]] = times[i];
+	}
+}
+
+void fm::AssetManager::beginRecording()
+{
+	_usage.clear();
+	_recording = true;
+}
+
+std::vector<fm::AssetUsage> fm::AssetManager::endRecording()
+{
+	_recording = false;
+
+	std::vector<AssetUsage> usage;
+	usage.swap(_usage);
+	return usage;
+}
+
+void fm::AssetManager::recordUsage(const std::string & fp, bool model)
+{
+	if (!_recording)
+		return;
+
+	// only the first use of each asset
+	for (auto& used : _usage) {
+		if (used.model == model && used.filepath == fp)
+			return;
+	}
+
+	AssetUsage usage;
+	usage.filepath = fp;
+	usage.model = model;
+	usage.bytes = fileSize(fp);
+	usage.milliseconds = _loadTimes[fp];
+	_usage.push_back(usage);
+}
+
+void fm::AssetManager::preload(const std::vector<AssetUsage>& assets)
+{
+	// start the largest first, so the slowest loads aren't the last to start
+	std::vector<AssetUsage> sorted = assets;
+	std::stable_sort(sorted.begin(), sorted.end(), [](const AssetUsage& a, const AssetUsage& b) {
+		return a.bytes > b.bytes;
+	});
+
+	std::vector<std::string> models, textures;
+	for (auto& asset : sorted) {
+		if (asset.model && findModel(asset.filepath) == nullptr 
+			&& std::find(models.begin(), models.end(), asset.filepath) == models.end())
+			models.push_back(asset.filepath);
+		else if (!asset.model && _loadedTxData[asset.filepath] == nullptr 
+			&& std::find(textures.begin(), textures.end(), asset.filepath) == textures.end())
+			textures.push_back(asset.filepath);
+	}
+
+	// models load completely, textures are compressed into the cache (or read) ready to be uploaded.
+	// both are spread across the same workers, so a few large models don't hold up the textures
+	std::vector<ObjModel*> loadedModels(models.size(), nullptr);
+	std::vector<std::vector<unsigned char>> sources(textures.size());
+	std::vector<double> times(models.size() + textures.size(), 0.0);
+
+	parallelFor(models.size() + textures.size(), [&](size_t i) {
+		Timer timer;
+
+		if (i < models.size()) {
+			loadedModels[i] = loadModel(models[i]);
+		}
+		else {
+			const std::string& fp = textures[i - models.size()];
+			const unsigned char* data;
+			size_t size;
+			std::string cachedPath;
+
+			// bundled textures are read in place when uploaded
+			if (_bundle == nullptr || !_bundle->find(fp, BUNDLE_TEXTURE, data, size)) {
+				if (_textureCache == nullptr || !_textureCache->build(fp, cachedPath))
+					readFileBytes(fp, sources[i - models.size()]);
+			}
+		}
+
+		times[i] = timer.elapsedMs();
+	});
+
+	for (size_t i = 0; i < models.size(); ++i) {
+		keepModel(models[i], loadedModels[i]);
+		_loadTimes[models[i]] = times[i];
+	}
+
+	// uploads need the OpenGL context, so they happen here
+	for (size_t i = 0; i < textures.size(); ++i) {
+		loadTextureData(textures[i], sources[i].empty() ? nullptr : &sources[i]);
+		_loadTimes[textures[i]] += times[models.size() + i];
+	}
+
+	Stats::global->set("preload.models", (double)models.size());
+	Stats::global->set("preload.textures", (double)textures.size());
+}
+
+// Checks if a model has the lods that would be generated for 'ratios'
+static bool modelHasLods(fm::ObjModel* model, const std::vector<float>& ratios)
+{
+	std::vector<float> expected;
+	for (float ratio : ratios) {
+		if (ratio > 0.0f && ratio < 1.0f)
+			expected.push_back(ratio);
+	}
+
+	std::sort(expected.begin(), expected.end(), std::greater<float>());
+	if (expected.size() != model->lods.size())
+		return false;
 
-		_loadedModelData[fp] = model;
+	for (size_t i = 0; i < expected.size(); ++i) {
+		if (expected[i] != model->lods[i].ratio)
+			return false;
+	}
+
+	return true;
+}
+
+// Checks if a model is a .glb, which needs the IO (json) to be turned on
+static bool isModelGlb(const std::string& fp)
+{
+#ifdef FM_IO
+	return fm::isGlbPath(fp);
+#else
+	return false;
+#endif
+}
+
+fm::ObjModel * fm::AssetManager::loadModel(const std::string & fp)
+{
+	ObjModel* model = nullptr;
+
+	// bundled models are already processed, and read in place from the mapped bundle
+	const unsigned char* data;
+	size_t size;
+	if (_bundle != nullptr && _bundle->find(fp, BUNDLE_MESH, data, size)) {
+		model = readMeshBinary(data, size);
+
+		if (model != nullptr) {
+			Stats::global->add("bundle.mesh_hits", 1);
+			model->filepath = fp;
+
+			// the bundle was built with other settings, update this copy (the bundle is read only)
+			if (!modelHasLods(model, _lodRatios))
+				generateLods(model, _lodRatios);
+
+			if (_buildMeshlets && model->meshlets.empty())
+				buildMeshlets(model);
+		}
+	}
+
+	// very large objs are streamed into the cache, then loaded from it like any other entry
+	if (model == nullptr && _meshCache != nullptr && _streamingThreshold > 0 && !isModelGlb(fp) && fileSize(fp) >= _streamingThreshold) {
+		ObjStreamOptions options;
+		options.memoryBudget = _streamingBudget;
+		ObjStreamReport report;
+
+		if (_meshCache->buildStreaming(fp, options, &report) && report.bytesRead > 0) {
+			Stats::global->add("objstream.files", 1);
+			Stats::global->set("objstream.peak_mb", report.peakMemory / (1024.0 * 1024.0));
+			Stats::global->set("objstream.mb_per_s", report.megabytesPerSecond);
+			Stats::global->add("objstream.ms", report.milliseconds);
+		}
+		else if (report.longLine > 0) {
+			// the obj has a line too long to stream, it's loaded whole below
+			Stats::global->set("objstream.long_line", (double)report.longLine);
+		}
+	}
+
+	// cached models are already processed
+	if (model == nullptr && _meshCache != nullptr) {
+		model = _meshCache->load(fp);
+
+		if (model != nullptr) {
+			Stats::global->add("mesh.cache_hits", 1);
+
+			// the entry was made with other settings, update it
+			bool changed = false;
+			if (!modelHasLods(model, _lodRatios)) {
+				generateLods(model, _lodRatios);
+				changed = true;
+			}
+
+			if (_buildMeshlets && model->meshlets.empty()) {
+				buildMeshlets(model);
+				changed = true;
+			}
+
+			if (changed)
+				_meshCache->store(fp, model);
+		}
+	}
+
+	if (model == nullptr) {
+		if (isModelGlb(fp)) {
+			// glb models are already indexed, they go straight into a MeshBuffer
+			Timer timer;
+			model = loadGlbModel(fp);
+			if (model == nullptr)
+				return nullptr;
+
+			Stats::global->add("mesh.glb_ms", timer.elapsedMs());
+		}
+		else {
+			model = loadObjModel(fp);
+
+			// weld & reorder it for the vertex cache
+			MeshProcessReport report = processObjModel(model);
+			Stats::global->set("mesh.corners", (double)report.cornerCount);
+			Stats::global->set("mesh.vertices", (double)report.vertexCount);
+			Stats::global->set("mesh.acmr_before", report.acmrBefore);
+			Stats::global->set("mesh.acmr_after", report.acmrAfter);
+			Stats::global->add("mesh.process_ms", report.milliseconds);
+		}
+
+		if (!_lodRatios.empty()) {
+			Timer timer;
+			generateLods(model, _lodRatios);
+			Stats::global->add("mesh.lod_ms", timer.elapsedMs());
+		}
+
+		if (_buildMeshlets)
+			buildMeshlets(model);
+
+		if (_meshCache != nullptr) {
+			Stats::global->add("mesh.cache_misses", 1);
+			_meshCache->store(fp, model);
+		}
+	}
+
+	// quantise it if we want to save memory
+	if (_compactModels) {
+		CompactError error = compactObjModel(model);
+		Stats::global->set("compact.position_error", error.position);
+		Stats::global->set("compact.normal_error_deg", error.normalDegrees);
+		Stats::global->set("compact.uv_error", error.uv);
 	}
 
 	return model;
@@ -738,7 +1340,7 @@ fm::Color::Color() : Color(1, 1, 1, 1) { }
 
 // MATERIAL IMPLEMENTATION
 fm::Material::Material() : diffuseColor(), ambientColor(), specularColor(), 
-	doubleSided(false), specularEnabled(false), shininess(16), texture(nullptr) { }
+	doubleSided(false), specularEnabled(false), shininessEnabled(false), shininess(16), texture(nullptr), uvTransform() { }
 
 fm::Material::~Material()
 {
@@ -748,6 +1350,45 @@ fm::Material::~Material()
 	}
 }
 
+fm::Material::Material(const Material & material) : Material()
+{
+	*this = material;
+}
+
+fm::Material& fm::Material::operator=(const Material & material)
+{
+	if (this == &material)
+		return *this;
+
+	diffuseColor = material.diffuseColor;
+	ambientColor = material.ambientColor;
+	specularColor = material.specularColor;
+	doubleSided = material.doubleSided;
+	specularEnabled = material.specularEnabled;
+	shininessEnabled = material.shininessEnabled;
+	shininess = material.shininess;
+	uvTransform = material.uvTransform;
+
+	// the texture is deleted with the material, so each copy has its own (the data is the asset manager's)
+	delete texture;
+	texture = nullptr;
+
+	if (material.texture != nullptr) {
+		texture = new Texture();
+		texture->data = material.texture->data;
+	}
+
+	return *this;
+}
+
+// UV TRANSFORM IMPLEMENTATION
+fm::UvTransform::UvTransform() : flip(false), offsetU(0.0f), offsetV(0.0f), scaleU(1.0f), scaleV(1.0f), rotation(0.0f) { }
+
+bool fm::UvTransform::isIdentity() const
+{
+	return !flip && offsetU == 0.0f && offsetV == 0.0f && scaleU == 1.0f && scaleV == 1.0f && rotation == 0.0f;
+}
+
 // TRI IMPLEMENTATION
 fm::Tri::Tri() { }
 
@@ -771,13 +1412,23 @@ fm::SceneNode* fm::SceneNodeGraph::addNode(SceneNode * node)
 {
 	_nodes.push_back(node);
 
-	std::sort(_nodes.begin(), _nodes.end(), sortNodeByCategory);
+	std::stable_sort(_nodes.begin(), _nodes.end(), sortNodeByCategory);
 
 	return node;
 }
 
+void fm::SceneNodeGraph::addNodes(const std::vector<SceneNode*>& nodes)
+{
+	_nodes.insert(_nodes.end(), nodes.begin(), nodes.end());
+
+	std::stable_sort(_nodes.begin(), _nodes.end(), sortNodeByCategory);
+}
+
 void fm::SceneNodeGraph::render()
 {
+	// the gui & other code binds textures too, so start the frame fresh
+	resetTextureBinding();
+
 	// render all the known nodes
 	for (auto node : _nodes) {
 		if (!node->enabled) continue;
@@ -809,30 +1460,39 @@ void fm::SceneNodeGraph::removeNode(SceneNode * node)
 	}
 }
 
+void fm::SceneNodeGraph::removeNodes(const std::vector<SceneNode*>& nodes)
+{
+	// one pass over the graph, rather than one per node
+	std::set<SceneNode*> removing(nodes.begin(), nodes.end());
+	_nodes.erase(std::remove_if(_nodes.begin(), _nodes.end(), [&](SceneNode* node) { return removing.count(node) > 0; }), _nodes.end());
+}
+
 // SCENE NODE IMPLEMENTATION
 fm::SceneNode::SceneNode()
 {
-	static unsigned int globalUID = 0;
-	++globalUID;
-	_uid = globalUID;
+	// nodes may be created on the loader threads (see readSceneGraphParallel)
+	static std::atomic<unsigned int> globalUID(0);
+	_uid = ++globalUID;
 
 	name = "Scene Node";
 	_parent = nullptr;
+	_typeId = 0;
 	enabled = true;
 	nodeCategory = DEFAULT_NODE_CATEGORY;
 }
 
 fm::SceneNode::SceneNode(SceneNode * node) : SceneNode()
 {
+	// the copy has no parent until it's added to one
 	name = node->name;
-	_parent = node->_parent;
 	enabled = node->enabled;
+	transform = node->transform;
 	nodeCategory = node->nodeCategory;
 
 	// copy child nodes as well, if there are any
 	if (!node->childNodes.empty()) {
 		for (auto copyNode : node->childNodes) {
-			this->childNodes.push_back(copyNode->clone());
+			addChild(copyNode->clone());
 		}
 	}
 }
@@ -871,8 +1531,28 @@ fm::SceneNode* fm::SceneNode::removeChild(SceneNode * child)
 	if (!removeNodeFromVector(child, childNodes)) {
 		return nullptr;
 	}
-	else
+	else {
+		// so it can be added to another parent
+		child->_parent = nullptr;
 		return child;
+	}
+}
+
+void fm::SceneNode::insertChild(SceneNode * child, size_t index)
+{
+	assert(child->_parent == nullptr && index <= childNodes.size());
+	child->_parent = this;
+	childNodes.insert(childNodes.begin() + index, child);
+}
+
+void fm::SceneNode::takeChildren(SceneNode * from)
+{
+	for (auto child : from->childNodes) {
+		child->_parent = this;
+		childNodes.push_back(child);
+	}
+
+	from->childNodes.clear();
 }
 
 int fm::SceneNode::category()
@@ -890,6 +1570,11 @@ int fm::SceneNode::getUniqueId()
 	return _uid;
 }
 
+unsigned int fm::SceneNode::typeId()
+{
+	return _typeId;
+}
+
 int fm::SceneNode::childCount()
 {
 	int size = childNodes.size();
@@ -1322,6 +2007,8 @@ fm::MeshNode::MeshNode(const std::string& modelPath) : MeshNode()
 	model = AssetManager::global->getObjModel(modelPath);
 }
 
+float fm::MeshNode::lodErrorThreshold = 0.001f;
+
 fm::MeshNode::MeshNode(MeshNode * node) : SceneNode(node)
 {
 	material = node->material;
@@ -1340,8 +2027,101 @@ void fm::MeshNode::render()
 		Texture* texture = material.texture;
 		bool usingTexture = applyTexture(material);
 
+		// pick a lod from how far the model is from the camera
+		const MeshLod* lod = nullptr;
+		if (!model->lods.empty()) {
+			GLfloat modelView[16];
+			glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+
+			// the origin of the model in eye space, and how much the transform scales it
+			float distance = sqrtf(modelView[12] * modelView[12] + modelView[13] * modelView[13] + modelView[14] * modelView[14]);
+			float scale = sqrtf(modelView[0] * modelView[0] + modelView[1] * modelView[1] + modelView[2] * modelView[2]);
+
+			if (scale > 0.0f) {
+				int level = model->selectLod(lodErrorThreshold * distance / scale);
+				if (level >= 0)
+					lod = &model->lods[level];
+			}
+		}
+
+		// the full detail model is culled a meshlet at a time
+		bool culling = lod == nullptr && !model->meshlets.empty();
+
+		if (culling) {
+			GLfloat modelView[16], projection[16];
+			glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+			glGetFloatv(GL_PROJECTION_MATRIX, projection);
+
+			CullCamera camera = CullCamera::fromMatrices(modelView, projection);
+			// on this thread, starting the workers every frame costs more than the culling
+			cullMeshlets(model->meshletCullData, model->meshlets.size(), camera, _visible, false);
+		}
+
+		// processed models are drawn in one call, or one per run of visible meshlets
+		if (model->buffer != nullptr) {
+			if (lod != nullptr) {
+				drawMeshVertices(model->buffer->vertices, lod->indices.data(), lod->indices.size(), usingTexture);
+			}
+			else if (culling) {
+				const unsigned int* indices = model->buffer->indices.data();
+				size_t meshletCount = model->meshlets.size();
+
+				for (size_t i = 0; i < meshletCount; ++i) {
+					if (!_visible[i])
+						continue;
+
+					// meshlets are stored in order, so neighbours can be drawn together
+					size_t last = i;
+					while (last + 1 < meshletCount && _visible[last + 1])
+						++last;
+
+					size_t offset = model->meshlets[i].indexOffset;
+					size_t count = model->meshlets[last].indexOffset + model->meshlets[last].indexCount - offset;
+					drawMeshVertices(model->buffer->vertices, indices + offset, count, usingTexture);
+					i = last;
+				}
+			}
+			else {
+				drawMeshBuffer(*model->buffer, usingTexture);
+			}
+
+			SceneNode::render();
+			glPopMatrix();
+			return;
+		}
+
 		glBegin(GL_TRIANGLES);
 
+		if (model->compact != nullptr) {
+			// compact models are indexed, decode each vertex as it is sent
+			CompactMesh* compact = model->compact;
+			MeshVertex vertex;
+
+			// one range for the whole model, or one for each meshlet when culling
+			size_t rangeCount = culling ? model->meshlets.size() : 1;
+			for (size_t range = 0; range < rangeCount; ++range) {
+				size_t begin = 0;
+				size_t end = lod != nullptr ? lod->indices.size() : compact->indexCount();
+
+				if (culling) {
+					if (!_visible[range])
+						continue;
+
+					begin = model->meshlets[range].indexOffset;
+					end = begin + model->meshlets[range].indexCount;
+				}
+
+				for (size_t i = begin; i < end; ++i) {
+					compact->decodeVertex(lod != nullptr ? lod->indices[i] : compact->index(i), vertex);
+
+					glNormal3fv(vertex.normal);
+					if (usingTexture)
+						glTexCoord2fv(vertex.uv);
+					glVertex3fv(vertex.position);
+				}
+			}
+		}
+
 		// for every face of the model..
 		for (auto& face : model->polyFaces) {
 			// get the indexes to the vertex/tex/normal
@@ -1383,14 +2163,17 @@ fm::CylinderNode::CylinderNode() : ShapeNode(Color(1, 1, 1, 1))
 {
 	name = "Cylinder Node";
 
-	// build the cylinder vertex data
+	// the vertex data is built when it's first rendered, a node that's read is only built once
 	build(20);
 }
 
 fm::CylinderNode::CylinderNode(CylinderNode * node) : ShapeNode(node)
 {
 	// copy vertices
-	this->_vertices = node->_vertices;
+	_numSegments = node->_numSegments;
+	_vertices = node->_vertices;
+	_normals = node->_normals;
+	_uvs = node->_uvs;
 }
 
 int fm::CylinderNode::numSegments()
@@ -1408,6 +2191,16 @@ void fm::CylinderNode::build(int segments)
 	_normals.clear();
 
 	_numSegments = segments;
+}
+
+void fm::CylinderNode::buildVertices()
+{
+	int segments = _numSegments;
+
+	// four vertices a quad
+	_vertices.reserve(segments * segments * 12);
+	_normals.reserve(segments * segments * 12);
+	_uvs.reserve(segments * segments * 8);
 
 	float theta = 0.0f;
 	float delta = 0.0f;
@@ -1500,6 +2293,9 @@ void fm::CylinderNode::pushVertUv(float x, float y, float z, float u, float v)
 
 void fm::CylinderNode::render()
 {
+	if (_vertices.empty())
+		buildVertices();
+
 	glPushMatrix();
 	applyTransform(transform);
 	applyMaterial(material);
@@ -1535,3 +2331,133 @@ fm::SceneNode * fm::CylinderNode::clone()
 	return new CylinderNode(this);
 }
 
+
+// IMPLEMENTATION OF PREFAB NODE
+fm::PrefabNode::PrefabNode() : _source(nullptr)
+{
+	name = "Prefab Node";
+}
+
+fm::PrefabNode::PrefabNode(PrefabNode * node) : SceneNode(node), _source(nullptr)
+{
+	prefab = node->prefab;
+
+	for (auto& override : node->overrides)
+		overrides.push_back({ override.path, override.node->clone() });
+
+	setSource(node->_source);
+}
+
+fm::PrefabNode::~PrefabNode()
+{
+	deleteCopy();
+
+	for (auto& override : overrides)
+		delete override.node;
+
+	overrides.clear();
+}
+
+void fm::PrefabNode::render()
+{
+	glPushMatrix();
+	applyTransform(transform);
+
+	// the prefab's nodes are rendered inside of the instance
+	for (auto node : nodes()) {
+		if (!node->enabled) continue;
+		node->render();
+	}
+
+	SceneNode::render();
+
+	glPopMatrix();
+}
+
+fm::SceneNode * fm::PrefabNode::clone()
+{
+	return new PrefabNode(this);
+}
+
+void fm::PrefabNode::setSource(SceneNodeGraph * source)
+{
+	_source = source;
+	applyOverrides();
+}
+
+fm::SceneNodeGraph * fm::PrefabNode::source()
+{
+	return _source;
+}
+
+void fm::PrefabNode::addOverride(const std::vector<unsigned int>& path, SceneNode * node)
+{
+	overrides.push_back({ path, node });
+	applyOverrides();
+}
+
+void fm::PrefabNode::applyOverrides()
+{
+	deleteCopy();
+
+	// without overrides the prefab's own nodes are used
+	if (_source == nullptr || overrides.empty())
+		return;
+
+	for (auto node : _source->getNodes())
+		_copy.push_back(node->clone());
+
+	for (auto& override : overrides) {
+		if (override.path.empty())
+			continue;
+
+		// find the overridden node in the copy
+		SceneNode* parent = nullptr;
+		std::vector<SceneNode*>* siblings = &_copy;
+		for (size_t i = 0; i + 1 < override.path.size() && siblings != nullptr; ++i) {
+			if (override.path[i] >= siblings->size()) {
+				siblings = nullptr;
+				break;
+			}
+
+			parent = (*siblings)[override.path[i]];
+			siblings = &parent->childNodes;
+		}
+
+		unsigned int index = override.path.back();
+		if (siblings == nullptr || index >= siblings->size())
+			continue;
+
+		// a copy of the override's values takes the place (and the children) of the node
+		SceneNode* target = (*siblings)[index];
+		SceneNode* replacement = override.node->clone();
+		replacement->takeChildren(target);
+
+		if (parent == nullptr)
+			_copy[index] = replacement;
+		else {
+			parent->removeChild(target);
+			parent->insertChild(replacement, index);
+		}
+
+		delete target;
+	}
+}
+
+std::vector<fm::SceneNode*>& fm::PrefabNode::nodes()
+{
+	static std::vector<SceneNode*> none;
+
+	if (!_copy.empty())
+		return _copy;
+
+	return _source != nullptr ? _source->getNodes() : none;
+}
+
+void fm::PrefabNode::deleteCopy()
+{
+	for (auto node : _copy)
+		delete node;
+
+	_copy.clear();
+}
@@ -26,6 +26,7 @@
 #include <string>
 #include <map>
 #include <stack>
+#include <mutex>
 
 namespace fm {
 
@@ -43,7 +44,12 @@ namespace fm {
 	struct Texture;
 	struct Material;
 	struct ObjModel;
+	struct MeshBuffer;
+	struct MeshVertex;
 	class AssetManager;
+	class TextureCache;
+	class MeshCache;
+	class Bundle;
 
 	void clamp(int& value, int min, int max);
 	void clamp(float& value, float min, float max);
@@ -63,12 +69,35 @@ namespace fm {
 	 */
 	void applyTransform(Transform& transform);
 
+	/*
+	 * Gets the matrix applyTransform() applies (rotate, translate then scale), column major like OpenGL's.
+	 */
+	void transformMatrix(Transform& transform, float* matrix);
+
 	/*
 	 * Shortcut to apply a texture through a material.
 	 * Returns true/false depending if the texture was applied.
 	 */
 	bool applyTexture(Material& material);
 
+	/*
+	 * Forgets the texture that applyTexture() last bound, so the next call binds again.
+	 * Call this if anything other than applyTexture() has bound a texture.
+	 */
+	void resetTextureBinding();
+
+	/*
+	 * Draws the indexed triangles of a MeshBuffer with client side vertex arrays.
+	 * The uvs are only sent if 'textured' is true.
+	 */
+	void drawMeshBuffer(const MeshBuffer& buffer, bool textured);
+
+	/*
+	 * Same as drawMeshBuffer, but with a separate set of indices, e.g. a lod's.
+	 */
+	void drawMeshVertices(const std::vector<MeshVertex>& vertices, const unsigned int* indices, 
+		size_t indexCount, bool textured);
+
 	/*
 	 * Calls glNormal3f, glTexcoord2f and glVertex3f in order.
 	 */
@@ -85,9 +114,10 @@ namespace fm {
 	bool removeNodeFromVector(SceneNode* node, std::vector<SceneNode*>& nodes);
 
 	/*
-	 * Handles the cloning of a node.
+	 * Handles the cloning of a node, the clone is added next to it (to the graph or its parent).
+	 * Returns the clone.
 	 */
-	void cloneNode(SceneNodeGraph* graph, SceneNode* node);
+	SceneNode* cloneNode(SceneNodeGraph* graph, SceneNode* node);
 
 	/*
 	 * Gets a dynamic value between GL_LIGHT0 and GL_LIGHT7
@@ -398,6 +428,18 @@ namespace fm {
 		 * This is used for the editor and io more than anything else.
 		 */
 		std::string filepath;
+
+		/*
+		 * If true, the texture was packed into an atlas page by AssetManager::packTextures(). 
+		 * glTextureId is then the id of the page, which is shared with other textures.
+		 */
+		bool packed;
+
+		/*
+		 * The region of the atlas page that holds this texture, in uv space.
+		 * applyTexture() maps the 0-1 uvs of a node into this region with the texture matrix.
+		 */
+		float regionX, regionY, regionWidth, regionHeight;
 	};
 
 	/*
@@ -425,6 +467,24 @@ namespace fm {
 		TextureData* data;
 	};
 
+	/*
+	 * A model or texture that was used while the AssetManager was recording, see AssetManager::beginRecording.
+	 */
+	struct AssetUsage {
+		AssetUsage();
+
+		std::string filepath;
+
+		/* True for a model, false for a texture. */
+		bool model;
+
+		/* The size of the source file. */
+		unsigned long long bytes;
+
+		/* How long it took to load, 0 if it was already loaded before this session. */
+		double milliseconds;
+	};
+
 	/*
 	 * The owner of assets in the game scene.
 	 * This is the centralized area where assets will be created and deleted. 
@@ -437,6 +497,38 @@ namespace fm {
 	private:
 		std::map<const std::string, TextureData*> _loadedTxData;
 		std::map<const std::string, ObjModel*> _loadedModelData;
+		std::mutex _modelMutex;
+		TextureCache* _textureCache;
+		MeshCache* _meshCache;
+		const Bundle* _bundle;
+		std::map<const std::string, double> _loadTimes;
+		std::vector<AssetUsage> _usage;
+		bool _recording;
+		std::vector<float> _lodRatios;
+		bool _buildMeshlets;
+		bool _compactModels;
+		unsigned long long _streamingThreshold;
+		size_t _streamingBudget;
+
+		// loads a texture into OpenGL, through the bundle or texture cache if there is one.
+		// 'source' is the already read file, or nullptr to read it here
+		unsigned int loadTexture(const std::string& fp, const std::vector<unsigned char>* source);
+
+		// loads a texture that isn't loaded yet & keeps it
+		TextureData* loadTextureData(const std::string& fp, const std::vector<unsigned char>* source);
+
+		// adds an asset to the usage list, if recording
+		void recordUsage(const std::string& fp, bool model);
+
+		// loads & prepares a model, through the mesh cache if there is one. Safe to call from worker threads
+		ObjModel* loadModel(const std::string& fp);
+
+		// the loaded model, nullptr if it isn't loaded yet. Safe to call from worker threads
+		ObjModel* findModel(const std::string& fp);
+
+		// keeps a model that was just loaded, unless another thread kept one first, then it's deleted
+		// and that one is returned. Safe to call from worker threads
+		ObjModel* keepModel(const std::string& fp, ObjModel* model);
 
 		// forces access through instance
 		AssetManager();
@@ -451,6 +543,119 @@ namespace fm {
 		
 		/* Gets the cached version of the ObjModel or loads a new one. */
 		ObjModel* getObjModel(const std::string& fp);
+
+		/*
+		 * Loads the model if it isn't loaded yet, so getObjModel finds it loaded. Safe on any thread,
+		 * so models can be loaded on the loader threads. The use isn't recorded (see beginRecording).
+		 * Returns the model, nullptr if it couldn't be loaded.
+		 */
+		ObjModel* prepareObjModel(const std::string& fp);
+
+		/*
+		 * Loads all of the given models that aren't loaded yet, spread across the worker threads.
+		 * Parsing, processing and simplifying are done in parallel, so this is much faster than
+		 * calling getObjModel for each one.
+		 */
+		void loadObjModels(const std::vector<std::string>& filepaths);
+
+		/* 
+		 * Sets the precompressed texture cache used when loading textures, nullptr to disable it.
+		 * Textures missing from the cache are compressed into it on first load.
+		 * The asset manager does not own the cache.
+		 */
+		void setTextureCache(TextureCache* cache);
+
+		/*
+		 * Packs the given textures into shared atlas pages of 'pageSize' pixels, so nodes
+		 * using different textures can be drawn without rebinding (and batched).
+		 * Textures that are already loaded are moved into the atlas, their TextureData stays valid.
+		 * The layout is deterministic, see fm::packAtlas. Only pack textures that are drawn 
+		 * with uvs inside 0-1, repeating uvs would sample the neighbouring textures.
+		 * Returns the number of textures that were packed.
+		 */
+		int packTextures(const std::vector<std::string>& filepaths, int pageSize = 2048);
+
+		/*
+		 * Sets the binary mesh cache used when loading models, nullptr to disable it.
+		 * Models missing from the cache are processed and written into it on first load.
+		 * The asset manager does not own the cache.
+		 */
+		void setMeshCache(MeshCache* cache);
+
+		/*
+		 * Sets the triangle ratios of the lods generated for models loaded from now on,
+		 * e.g. { 0.5f, 0.25f, 0.1f }. Empty (the default) generates no lods.
+		 */
+		void setLodRatios(const std::vector<float>& ratios);
+
+		/*
+		 * If true, models loaded from now on are split into meshlets, so MeshNode
+		 * can skip the parts of large models that are off screen or facing away. Off by default.
+		 */
+		void setBuildMeshlets(bool build);
+
+		/*
+		 * If true, models loaded from now on are quantised with compactObjModel(),
+		 * which roughly halves their memory. Off by default.
+		 */
+		void setCompactModels(bool compact);
+
+		/*
+		 * Objs of at least 'thresholdBytes' are streamed into the mesh cache (see MeshCache::buildStreaming),
+		 * using no more than about 'memoryBudget' bytes, instead of being loaded whole. Needs a mesh cache.
+		 * The entry is then read in place from the cache (see MeshCache::load), so the mesh is only held once.
+		 * Streamed models are welded but not reordered for the vertex cache. 0 (the default) turns it off.
+		 */
+		void setObjStreaming(unsigned long long thresholdBytes, size_t memoryBudget = 64 << 20);
+
+		/*
+		 * Mounts a scene bundle (see buildBundle), nullptr to unmount it.
+		 * Models & textures in the bundle are read from it in place, anything else is loaded as normal.
+		 * The bundle must stay open while its assets are being loaded. The asset manager does not own it.
+		 */
+		void mountBundle(const Bundle* bundle);
+
+		/*
+		 * Starts recording the models & textures that are used (see getObjModel & getTextureData),
+		 * clearing anything recorded before. Used to build a scene's preload manifest.
+		 */
+		void beginRecording();
+
+		/*
+		 * Stops recording, returns every asset used since beginRecording, in the order they were first used.
+		 */
+		std::vector<AssetUsage> endRecording();
+
+		/*
+		 * Loads the given assets ahead of time, so getObjModel & getTextureData find them already loaded.
+		 * Models are loaded in parallel (see loadObjModels). Textures are compressed into the texture
+		 * cache (or read) in parallel, then uploaded on this thread since that needs the OpenGL context.
+		 * Larger assets are started first, so the slowest ones don't start last.
+		 */
+		void preload(const std::vector<AssetUsage>& assets);
+	};
+
+	/*
+	 * Maps the uvs of a mesh before sampling its texture, applied through the texture matrix
+	 * so the mesh data itself is never changed. The uvs are flipped first, then scaled,
+	 * rotated around the middle of the texture (0.5, 0.5) and offset.
+	 */
+	struct UvTransform {
+		UvTransform();
+
+		/* Flips both uv axes (u = 1 - u, v = 1 - v), for models exported with the other uv origin. */
+		bool flip;
+
+		float offsetU;
+		float offsetV;
+		float scaleU;
+		float scaleV;
+
+		/* Rotation in degrees. */
+		float rotation;
+
+		/* True if applying it would change nothing. */
+		bool isIdentity() const;
 	};
 
 	/*
@@ -460,6 +665,10 @@ namespace fm {
 		Material();
 		~Material();
 
+		/* Copies get their own texture, of the same (shared) texture data. */
+		Material(const Material& material);
+		Material& operator=(const Material& material);
+
 		/*
 		 * 
 		 */
@@ -499,6 +708,12 @@ namespace fm {
 		 * If true, enables the shininess openGL property with the shiness material value.
 		 */
 		bool shininessEnabled;
+
+		/*
+		 * How the uvs are mapped onto the texture, see UvTransform.
+		 * Packed textures (see AssetManager::packTextures) only work with uvs that stay inside 0-1.
+		 */
+		UvTransform uvTransform;
 	};
 
 	/*
@@ -528,6 +743,11 @@ namespace fm {
 		 */
 		SceneNode* addNode(SceneNode* node);
 
+		/*
+		 * Adds many nodes to the graph at once, sorting the graph once instead of after every node.
+		 */
+		void addNodes(const std::vector<SceneNode*>& nodes);
+
 		/*
 		 * Calls .Render() on all the scene nodes.
 		 */
@@ -548,6 +768,11 @@ namespace fm {
 		 * Removes a node from the top-level of the scene graph.
 		 */
 		void removeNode(SceneNode* node);
+
+		/*
+		 * Removes many nodes from the top-level of the scene graph at once, without deleting them.
+		 */
+		void removeNodes(const std::vector<SceneNode*>& nodes);
 	};
 
 	/*
@@ -558,6 +783,10 @@ namespace fm {
 		unsigned int _uid;
 		SceneNode* _parent;
 
+		// the dense id of the node's type, 0 until a type table has seen it (see NodeTypeTable::typeId)
+		unsigned int _typeId;
+		friend class NodeTypeTable;
+
 	protected:
 		int nodeCategory;
 
@@ -565,7 +794,7 @@ namespace fm {
 		SceneNode();
 		SceneNode(SceneNode* node);
 
-		~SceneNode();
+		virtual ~SceneNode();
 
 		/*
 		 * Name of the scene node.
@@ -612,6 +841,13 @@ namespace fm {
 		 */
 		int getUniqueId();
 
+		/*
+		 * Gets the dense id of the node's type, the same in every type table.
+		 * Set when a type table creates or reads the node, otherwise the first time a table looks its type up.
+		 * 0 until then, use NodeTypeTable::typeId to be sure of it.
+		 */
+		unsigned int typeId();
+
 		/*
 		 * Returns a count of this nodes children and all of their nodes children.
 		 */
@@ -628,6 +864,16 @@ namespace fm {
 		 */
 		SceneNode* removeChild(SceneNode* child);
 
+		/*
+		 * Adds a child to the scene node at the given index of the child nodes.
+		 */
+		void insertChild(SceneNode* child, size_t index);
+
+		/*
+		 * Moves all of another node's children to the end of this node's children, in order.
+		 */
+		void takeChildren(SceneNode* from);
+
 		/*
 		 * What node this category is in.
 		 * Determines render order in the scene.
@@ -711,6 +957,10 @@ namespace fm {
 		void buildQuads(int size, int width, int height);
 
 	private:
+		// its fields are reflected (see fullmetal-reflect.h)
+		template<class TNode>
+		friend struct NodeFields;
+
 		int _quadSize;
 		int _width;
 		int _height;
@@ -786,7 +1036,17 @@ namespace fm {
 	 * Draws the mesh of a loadable object.
 	 */
 	class MeshNode : public SceneNode {
+	private:
+		// which meshlets passed the last render's culling, kept so it isn't reallocated every frame
+		std::vector<unsigned char> _visible;
+
 	public:
+		/*
+		 * How far a lod's surface may be from the full detail model, as a fraction
+		 * of the distance to the camera. Higher values switch to the lods sooner.
+		 */
+		static float lodErrorThreshold;
+
 		ObjModel* model;
 		Material material;
 
@@ -808,19 +1068,92 @@ namespace fm {
 		std::vector<float> _uvs;
 
 		void pushVertUv(float x, float y, float z, float u, float v);
+		void buildVertices();
 	
 		int _numSegments;
 
+		// its fields are reflected (see fullmetal-reflect.h)
+		template<class TNode>
+		friend struct NodeFields;
+
 	public:
 		CylinderNode();
 		CylinderNode(CylinderNode* node);
 
 		int numSegments();
+
+		/* Sets the number of segments, the vertex data is (re)built the next time the node is rendered. */
 		void build(int segments);
 
 		void render() override;
 		SceneNode* clone() override;
 	};
+
+	/*
+	 * The values that replace those of a node inside of a prefab, for one instance.
+	 */
+	struct PrefabOverride {
+		/* The path of the node in the prefab, the index of the root then the index of each child down to it. */
+		std::vector<unsigned int> path;
+
+		/* The node holding the values, its children aren't used. Owned by the instance. */
+		SceneNode* node;
+	};
+
+	/*
+	 * An instance of a prefab, a subtree stored once in its own scene file (see fm::io::PrefabLibrary).
+	 * The prefab's nodes are shared by every instance and rendered inside of the instance's transform.
+	 * An instance with overrides has its own copy of the prefab with the overridden nodes replaced,
+	 * so memory grows with the distinct prefabs (and overridden instances), not with every instance.
+	 */
+	class PrefabNode : public SceneNode {
+	private:
+		SceneNodeGraph* _source;
+		std::vector<SceneNode*> _copy;
+
+		void deleteCopy();
+
+	public:
+		PrefabNode();
+		PrefabNode(PrefabNode* node);
+		~PrefabNode();
+
+		/*
+		 * The path of the prefab's scene file.
+		 */
+		std::string prefab;
+
+		/*
+		 * The overrides of this instance, see addOverride.
+		 */
+		std::vector<PrefabOverride> overrides;
+
+		void render() override;
+		SceneNode* clone() override;
+
+		/*
+		 * Sets the prefab this is an instance of, applying the overrides.
+		 * The prefab isn't owned by the instance.
+		 */
+		void setSource(SceneNodeGraph* source);
+
+		/* The prefab, nullptr if it hasn't been set (or wasn't found). */
+		SceneNodeGraph* source();
+
+		/*
+		 * Overrides the values of the node at 'path' in the prefab with those of 'node', which the instance takes.
+		 */
+		void addOverride(const std::vector<unsigned int>& path, SceneNode* node);
+
+		/*
+		 * Rebuilds the instance's copy of the prefab from the overrides, call after changing them.
+		 * Overrides whose path isn't in the prefab are skipped.
+		 */
+		void applyOverrides();
+
+		/* The nodes rendered for this instance, the prefab's or the instance's own copy. */
+		std::vector<SceneNode*>& nodes();
+	};
 }
 
 #endif
\ No newline at end of file